@@ -1,16 +1,35 @@
 #include <irrlicht.h>
 #include "q3factory.h"
 #include "sound.h"
+#include "levelshots.h"
+#include "worker.h"
+#include "mappedzip.h"
+#include "prefetch.h"
+#include "profile.h"
+#include "entitytable.h"
+#include "random.h"
+#include "q3collision.h"
+#include "q3bsp.h"
+#include "bvh.h"
+#include "character.h"
+#include "enemy.h"
+#include "navmesh.h"
+#include "visibility.h"
+#include "mapnode.h"
+#include "occlusion.h"
+#include "itembatch.h"
+#include "renderqueue.h"
+#include "compactmesh.h"
+#include "lightatlas.h"
+#include "spritebatch.h"
+#include "traversal.h"
 
 /*
 	Game Data is used to hold Data which is needed to drive the game
 */
 int time,eventtime=0,once=0,health=100;
-bool mapload=false,drawn=false;
-int enemyx=-90,enemyy=-15,enemyz=-140;
+bool mapload=false;
 vector3df player;
-scene::IAnimatedMeshSceneNode* modelNode ;
-/*vector3df( -90, -15, -140)*/
 vector3df update()
 {return player;}
 struct GameData
@@ -37,7 +56,7 @@ struct GameData
 
 	path StartupDir;
 	stringw CurrentMapName;
-	array<path> CurrentArchiveList;
+	core::array<path> CurrentArchiveList;
 
 	vector3df PlayerPosition;
 	vector3df PlayerRotation;
@@ -114,7 +133,7 @@ void GameData::setDefault ()
 struct Q3Player : public IAnimationEndCallBack
 {
 	Q3Player ()
-	: Device(0), MapParent(0), Mesh(0),  StartPositionCurrent(0)
+	: Device(0), MapParent(0), Mesh(0), Entities(0), Enemies(0), Character(0), StartPositionCurrent(0)
 	{
 		animation[0] = 0;
 		memset(Anim, 0, sizeof(TimeFire)*4);
@@ -124,8 +143,11 @@ struct Q3Player : public IAnimationEndCallBack
 
 	void create (	IrrlichtDevice *device,
 					IQ3LevelMesh* mesh,
+					const CEntityTable *entities,
 					ISceneNode *mapNode,
-					IMetaTriangleSelector *meta
+					IMetaTriangleSelector *meta,
+					const CCharacterController *controller,
+					const CEnemyManager *enemies
 				);
 	void shutdown ();
 	void setAnim ( const c8 *name );
@@ -137,6 +159,9 @@ struct Q3Player : public IAnimationEndCallBack
 	IrrlichtDevice *Device;
 	ISceneNode* MapParent;
 	IQ3LevelMesh* Mesh;
+	const CEntityTable *Entities;
+	const CEnemyManager *Enemies;
+	CCharacterAnimator *Character;		// 0 if the irrlicht animator collides
 	
 	s32 StartPositionCurrent;
 	TimeFire Anim[4];
@@ -162,12 +187,16 @@ void Q3Player::shutdown ()
 
 	MapParent = 0;
 	Mesh = 0;
+	Entities = 0;
+	Enemies = 0;
+	Character = 0;
 }
 
 
 /* create a new player
 */
-void Q3Player::create ( IrrlichtDevice *device, IQ3LevelMesh* mesh, ISceneNode *mapNode, IMetaTriangleSelector *meta )
+void Q3Player::create ( IrrlichtDevice *device, IQ3LevelMesh* mesh, const CEntityTable *entities, ISceneNode *mapNode, IMetaTriangleSelector *meta,
+						const CCharacterController *controller, const CEnemyManager *enemies )
 {
 	setTimeFire ( Anim + 0, 200, FIRED );
 	setTimeFire ( Anim + 1, 5000 );
@@ -177,6 +206,8 @@ void Q3Player::create ( IrrlichtDevice *device, IQ3LevelMesh* mesh, ISceneNode *
 	// load FPS weapon to Camera
 	Device = device;
 	Mesh = mesh;
+	Entities = entities;
+	Enemies = enemies;
 	MapParent = mapNode;
 
 	ISceneManager *smgr = device->getSceneManager ();
@@ -267,13 +298,25 @@ void Q3Player::create ( IrrlichtDevice *device, IQ3LevelMesh* mesh, ISceneNode *
 
 
 	//create a collision auto response animator
-	ISceneNodeAnimator* anim =
-		smgr->createCollisionResponseAnimator( meta, camera,
+	ISceneNodeAnimator* anim = 0;
+	if ( controller )
+	{
+		// quake3 gravity, 800 units/s^2
+		CCharacterController walk ( *controller );
+		walk.setGravity ( vector3df ( 0.f, -800.f, 0.f ) );
+		Character = new CCharacterAnimator ( walk, camera, vector3df(30,45,30), vector3df(0,40,0) );
+		Character->setWorld ( meta );
+		anim = Character;
+	}
+	else
+	{
+		anim = smgr->createCollisionResponseAnimator( meta, camera,
 			vector3df(30,45,30),
 			getGravity ( "earth" ),
 			vector3df(0,40,0),
 			0.0005f
 		);
+	}
 	camera->addAnimator( anim );
 	anim->drop();
 	if ( meta )
@@ -287,19 +330,21 @@ void Q3Player::create ( IrrlichtDevice *device, IQ3LevelMesh* mesh, ISceneNode *
 
 /*
 	so we need a good starting Position in the level.
-	we can ask the Quake3 Loader for all entities with class_name "info_player_deathmatch"
+	the spawn point furthest from the enemy is taken
 */
 void Q3Player::respawn ()
 {
-	if (!Device)
+	if (!Device || !Entities)
 		return;
 	ICameraSceneNode* camera = Device->getSceneManager()->getActiveCamera();
 
-	
+	core::array < vector3df > enemy;
+	if ( Enemies )
+		Enemies->getPositions ( enemy );
 
 	if ( StartPositionCurrent >= Q3StartPosition (
-			Mesh, camera,StartPositionCurrent++,
-			cam ()->getEllipsoidTranslation() )
+			*Entities, camera,StartPositionCurrent++,
+			cam ()->getEllipsoidTranslation(), enemy.const_pointer (), enemy.size () )
 		)
 	{
 		StartPositionCurrent = 0;
@@ -397,12 +442,13 @@ public:
 	void Animate();
 	void Render();
 
-	void AddArchive ( const path& archiveName );
+	void AddArchive ( const path& archiveName, bool updateGUI = true );
+	void UpdateArchiveGUI ();
 	void LoadMap ( const stringw& mapName, s32 collision );
 	void CreatePlayers();
 	void AddSky( u32 dome, const c8 *texture );
 	Q3Player *GetPlayer ( u32 index ) { return &Player[index]; }
-	void Enemy();
+	void SpawnEnemies ( u32 count );
 	void CreateGUI();
 	void SetGUIActive( s32 command);
 
@@ -433,53 +479,69 @@ private:
 		vector3df pos;
 		vector3df outVector;
 	};
-	array<SParticleImpact> Impacts;
+	core::array<SParticleImpact> Impacts;
 	void useItem( Q3Player * player);
 	void createParticleImpacts( u32 now );
 
+	// bullets and impact smoke
+	CSpriteBatchSceneNode *Sprites;
+
+	// parent of the item, shader, fog and bullet parents, walked on the workers
+	CParallelSceneNode *Traversal;
+
 	void createTextures ();
+	void updateLevelShots ();
 	void addSceneTreeItem( ISceneNode * parent, IGUITreeViewNode* nodeParent);
 
 	GUI gui;
+	CLevelShotCache *LevelShots;
+	CEntityTable Entities;
+	SCollisionMap Collision;
+	CCollisionBVH World;
+	CCharacterController Controller;
+	CNavMesh Nav;
+	CNavQuery NavQuery;
+	CQ3Visibility Visibility;
+	CQ3MapSceneNode *MapNode;
+	CLightmapAtlas Atlas;
+	COcclusionCuller Occlusion;
+	CRenderQueueSceneNode *Queue;
+	CEnemyManager Enemies;
+	u32 EnemyTime;
+	u32 StatsTime;
 	void dropMap ();
 };
-void CQuake3EventHandler:: Enemy()
+/*
+	spawns enemies in front of the player, a crowd goes to the spawn points
+*/
+void CQuake3EventHandler::SpawnEnemies ( u32 count )
 {
+	ICameraSceneNode *camera = Game->Device->getSceneManager()->getActiveCamera();
+	if ( 0 == camera )
+		return;
 
-	if (drawn == false)
-	{
-	ISceneManager* smgr1 = Game->Device->getSceneManager();
-	ISceneNode* camera = smgr1->getActiveCamera();
-	IVideoDriver * driver1 = Game->Device->getVideoDriver();
-	scene::IAnimatedMesh* mesh1 = smgr1->getMesh("dwarf.x");
-	modelNode = smgr1->addAnimatedMeshSceneNode(mesh1);
-	vector3df start = camera->getPosition();
-	player=start;
-	
-	enemyx=start.X;
-	enemyy=start.Y;
-	enemyz=start.Z;
-	enemyx-=(time)%60;
-	enemyy-=(time)%60;
-	enemyz-=(time)%60;
-	
-	if (modelNode)
+	vector3df ahead = camera->getTarget () - camera->getPosition ();
+	ahead.Y = 0.f;
+	ahead.setLength ( 200.f );
+	const vector3df feet ( 0.f, -80.f, 0.f );
+	player = camera->getPosition ();
+
+	CRandom &r = getRandom ( RANDOM_AI );
+	for ( u32 i = 0; i != count; ++i )
 	{
-		modelNode->setPosition( vector3df(enemyx,enemyy,enemyz) );
-		modelNode->setMaterialTexture(0, driver1->getTexture("dwarf.jpg"));
-		modelNode->setMaterialFlag(video::EMF_LIGHTING, true);
-		modelNode->setMD2Animation(scene::EMAT_CROUCH_WALK);
+		vector3df pos = camera->getPosition () + ahead + feet;
+		if ( count > 1 && Collision.Spawn.size () )
+			pos = Collision.Spawn [ r.rand ( Collision.Spawn.size () ) ].Origin;
+		pos += vector3df ( r.frand ( -64.f, 64.f ), 0.f, r.frand ( -64.f, 64.f ) );
+		Enemies.spawn ( pos, r.frand ( 0.f, 360.f ) );
 	}
-	drawn=true;
-	}
-	else 	{modelNode->setPosition( vector3df(enemyx,enemyy,enemyz) );}
 }
 
 /* Constructor
 */
 CQuake3EventHandler::CQuake3EventHandler( GameData *game )
 : Game(game), Mesh(0), MapParent(0), ShaderParent(0), ItemParent(0), UnresolvedParent(0),
-	BulletParent(0), FogParent(0), SkyNode(0), Meta(0)
+	BulletParent(0), FogParent(0), SkyNode(0), Meta(0), Sprites(0), Traversal(0), LevelShots(0), MapNode(0), Queue(0), EnemyTime(0), StatsTime(0)
 {
 	buf[0]=0;
 	font_health = game->Device->getGUIEnvironment()->getFont("Fonts\\destructo_font.xml"); // Installing Custom font
@@ -489,12 +551,20 @@ CQuake3EventHandler::CQuake3EventHandler( GameData *game )
 		game->Device->getVideoDriver()->setTextureCreationFlag(ETCF_ALWAYS_16_BIT, true);
 	}
 
+	// map archives are memory mapped instead of read through the builtin zip reader
+	IArchiveLoader *zipLoader = new CArchiveLoaderMappedZip ( game->Device->getFileSystem() );
+	game->Device->getFileSystem()->addArchiveLoader ( zipLoader );
+	zipLoader->drop ();
+
 	// Quake3 Shader controls Z-Writing
 	game->Device->getSceneManager()->getParameters()->setAttribute(scene::ALLOW_ZWRITE_ON_TRANSPARENT, true);
 
 	// create internal textures
 	createTextures ();
 
+	// map browser thumbnails, cached next to the executable
+	LevelShots = new CLevelShotCache ( game->Device, game->StartupDir + "levelshots.cache" );
+
 	sound_init ( game->Device );
 
 	Game->Device->setEventReceiver ( this );
@@ -507,6 +577,12 @@ CQuake3EventHandler::~CQuake3EventHandler ()
 	Player[0].shutdown ();
 	sound_shutdown ();
 
+	delete LevelShots;
+	prefetch_shutdown ();
+	worker_shutdown ();
+
+	// the enemy nodes are removed while the scene manager is still there
+	Enemies.clear ();
 
 	Game->Device->drop();
 }
@@ -598,22 +674,22 @@ void CQuake3EventHandler::CreateGUI()
 	gui.MapList = env->addListBox ( rect<s32>( 5,dim.Height - 400, dim.Width - 5,dim.Height - 40  ), gui.Window, -1, true  );
 	gui.MapList->setToolTipText ( L"Double-Click the Map to start the level" );
 
+	// mount all archives first, the lists are built once afterwards
 	ifstream file1("maps\\maps.txt");
 	std::string get;
-	while(!file1.eof())
+	while(file1>>get)
 	{
-		
-		file1>>get;
 		get="maps\\"+get;
-		AddArchive ( get.c_str() );
+		AddArchive ( get.c_str(), false );
 	}
+	UpdateArchiveGUI ();
 }
 
 
 /*
 	Add an Archive to the FileSystems and updates the GUI
 */
-void CQuake3EventHandler::AddArchive ( const path& archiveName )
+void CQuake3EventHandler::AddArchive ( const path& archiveName, bool updateGUI )
 {
 	IFileSystem *fs = Game->Device->getFileSystem();
 	u32 i;
@@ -634,7 +710,34 @@ void CQuake3EventHandler::AddArchive ( const path& archiveName )
 		{
 			fs->addFileArchive(archiveName, true, false);
 		}
+		LevelShots->addArchive ( archiveName );
+	}
+
+	if ( updateGUI )
+		UpdateArchiveGUI ();
+}
+
+
+// the list box creates its scrollbar with id -1, it is found by type
+static IGUIScrollBar * getListScrollBar ( IGUIListBox *list )
+{
+	const core::list < IGUIElement* > &children = list->getChildren ();
+	for ( core::list < IGUIElement* >::ConstIterator it = children.begin (); it != children.end (); ++it )
+	{
+		if ( (*it)->getType () == EGUIET_SCROLL_BAR )
+			return (IGUIScrollBar*) *it;
 	}
+	return 0;
+}
+
+/*
+	rebuild the archive and map list. levelshots are only
+	registered here, updateLevelShots loads the visible ones
+*/
+void CQuake3EventHandler::UpdateArchiveGUI ()
+{
+	IFileSystem *fs = Game->Device->getFileSystem();
+	u32 i;
 
 	// store the current archives in game data
 	// show the attached Archive in proper order
@@ -689,9 +792,9 @@ void CQuake3EventHandler::AddArchive ( const path& archiveName )
 		SGUISpriteFrame frame;
 		core::rect<s32> r;
 
-		bank->getSprites().clear();
-		bank->getPositions().clear ();
+		bank->clear ();
 		gui.MapList->setSpriteBank ( bank );
+		LevelShots->clear ();
 
 		u32 g = 0;
 		core::stringw s;
@@ -707,44 +810,10 @@ void CQuake3EventHandler::AddArchive ( const path& archiveName )
 			s = fileList->getFullFileName(i);
 			if ( s.find ( ".bsp" ) >= 0 )
 			{
-				// get level screenshot. reformat texture to 128x128
-				path c ( s );
-				deletePathFromFilename ( c );
-				cutFilenameExtension ( c, c );
-				c = path ( "levelshots/" ) + c;
-
-				dimension2du dim ( 128, 128 );
-				IVideoDriver * driver = Game->Device->getVideoDriver();
-				IImage* image = 0;
-				ITexture *tex = 0;
-				path filename;
-
-				filename = c + ".jpg";
-				if ( fs->existFile ( filename ) )
-					image = driver->createImageFromFile( filename );
-				if ( 0 == image )
-				{
-					filename = c + ".tga";
-					if ( fs->existFile ( filename ) )
-						image = driver->createImageFromFile( filename );
-				}
-
-				if ( image )
-				{
-					IImage* filter = driver->createImage ( video::ECF_R8G8B8, dim );
-					image->copyToScalingBoxFilter ( filter, 0 );
-					image->drop ();
-					image = filter;
-				}
-
-				if ( image )
-				{
-					tex = driver->addTexture ( filename, image );
-					image->drop ();
-				}
-
-
-				bank->setTexture ( g, tex );
+				// thumbnail is decoded lazily once the row gets visible
+				dimension2du dim ( LEVELSHOT_SIZE, LEVELSHOT_SIZE );
+				LevelShots->addMap ( s );
+				bank->addTexture ( 0 );
 
 				r.LowerRightCorner.X = dim.Width;
 				r.LowerRightCorner.Y = dim.Height;
@@ -766,7 +835,7 @@ void CQuake3EventHandler::AddArchive ( const path& archiveName )
 		fileList->drop ();
 
 		gui.MapList->setSelected ( -1 );
-		IGUIScrollBar * bar = (IGUIScrollBar*)gui.MapList->getElementFromId( 0 );
+		IGUIScrollBar * bar = getListScrollBar ( gui.MapList );
 		if ( bar )
 			bar->setPos ( 0 );
 
@@ -792,9 +861,18 @@ void CQuake3EventHandler::dropMap ()
 	dropElement ( UnresolvedParent );
 	dropElement ( FogParent );
 	dropElement ( BulletParent );
+	dropElement ( Traversal );
 
 
 	Impacts.clear();
+	Sprites = 0;	// a child of BulletParent
+	Entities.clear ();
+	Enemies.clear ();
+	NavQuery.setMesh ( 0 );
+	Nav.clear ();
+	Controller.setWorld ( 0 );
+	World.clear ();
+	Collision.clear ();
 
 	if ( Meta )
 	{
@@ -803,6 +881,11 @@ void CQuake3EventHandler::dropMap ()
 
 	dropElement ( MapParent );
 	dropElement ( SkyNode );
+	dropElement ( Queue );
+	MapNode = 0;
+	Visibility.clear ();
+	Occlusion.clear ();
+	Atlas.clear ();
 
 	// clean out meshes, because textures are invalid
 	// TODO: better texture handling;-)
@@ -830,8 +913,19 @@ void CQuake3EventHandler::LoadMap ( const stringw &mapName, s32 collision )
 	smgr->getMesh( file );
 	file->drop ();
 
+	// inflate bsp, scripts and textures on the workers ahead of the loader
+	CArchivePrefetcher *prefetch = getArchivePrefetcher ();
+	prefetch->prefetchMap ( fs, mapName );
+
 	// load the actual map
 	Mesh = (IQ3LevelMesh*) smgr->getMesh(mapName);
+
+	SPrefetchStats stats = prefetch->getStats ();
+	snprintf ( buf, 256, "prefetch: %u queued, %u hits, %u misses, %u crc errors, %u cap stalls, peak %u KB",
+		stats.Queued, stats.Hits, stats.Misses, stats.CrcErrors, stats.CapStalls, stats.PeakStaged >> 10 );
+	Game->Device->getLogger()->log ( buf, ELL_INFORMATION );
+	prefetch->clear ();
+
 	if ( 0 == Mesh )
 		return;
 
@@ -846,18 +940,103 @@ void CQuake3EventHandler::LoadMap ( const stringw &mapName, s32 collision )
 
 	Game->CurrentMapName = mapName;
 
+	// the lightmaps onto a few pages, before anything copies the geometry
+	IVideoDriver *driver = Game->Device->getVideoDriver ();
+	if ( Atlas.pack ( geometry, core::min_ ( 2048u, driver->getMaxTextureSize ().Width ) ) &&
+		Atlas.createPages ( driver, mapName ) )
+	{
+		Atlas.apply ( (SMesh*) geometry );
+
+		const SLightmapAtlasStats &atlas = Atlas.getStats ();
+		snprintf ( buf, 256, "lightmap atlas: %u lightmaps on %u pages of %u, %u%% used, %u buffers merged into %u, %u texture switches for the whole map against %u, %.2f ms",
+			atlas.Lightmaps, atlas.Pages, atlas.PageSize, atlas.Occupancy, atlas.BuffersBefore, atlas.BuffersAfter,
+			atlas.SwitchesAfter, atlas.SwitchesBefore, atlas.Micro / 1000.f );
+		Game->Device->getLogger()->log ( buf, ELL_INFORMATION );
+	}
+
+	// parse the entity strings once, spawn and item code index the tables
+	Entities.build ( Mesh->getEntityList () );
+
 	//create a collision list
 	Meta = 0;
 
+	// the bsp once for the brushes and the pvs
+	CQ3Bsp bsp;
+	const bool bspLoaded = bsp.load ( fs, mapName );
+
 	ITriangleSelector * selector = 0;
 	if (collision)
+	{
 		Meta = smgr->createMetaTriangleSelector();
 
+		// the player walks on the brushes, the selector stays for the weapon traces
+		if ( bspLoaded && buildCollisionMap ( bsp, Collision ) )
+		{
+			World.build ( Collision );
+			Controller.setWorld ( &World );
+
+			// walkable cells for the enemy routes, rebuilt when the map changes
+			path navFile ( mapName );
+			deletePathFromFilename ( navFile );
+			cutFilenameExtension ( navFile, navFile );
+			navFile = Game->StartupDir + "navmesh.cache/" + navFile + ".nav";
+
+			const u64 key = CNavMesh::getKey ( Collision );
+			const u32 start = Game->Device->getTimer()->getRealTime();
+			const bool cached = Nav.load ( navFile, key );
+			if ( !cached )
+			{
+				Nav.build ( Collision );
+				Nav.save ( navFile, key );
+			}
+			NavQuery.setMesh ( &Nav );
+
+			snprintf ( buf, 256, "navmesh: %s in %u ms, %u nodes, %u links, %u KB",
+				cached ? "loaded" : "built", Game->Device->getTimer()->getRealTime() - start,
+				Nav.getNodeCount (), Nav.getLinkCount (), Nav.getMemoryFootprint () >> 10 );
+			Game->Device->getLogger()->log ( buf, ELL_INFORMATION );
+		}
+	}
+
 	//IMeshBuffer *b0 = geometry->getMeshBuffer(0);
 	//s32 minimalNodes = b0 ? core::s32_max ( 2048, b0->getVertexCount() / 32 ) : 2048;
 	s32 minimalNodes = 2048;
 
-	MapParent = smgr->addOctreeSceneNode(geometry, 0, -1, minimalNodes);
+	// the pvs culls the map surfaces, maps compiled without a tree fall back to the octree
+	if ( bspLoaded && Visibility.build ( bsp ) )
+	{
+		MapNode = new CQ3MapSceneNode ( geometry, bsp, &Visibility, smgr->getRootSceneNode(), smgr );
+		MapNode->drop ();
+		MapParent = MapNode;
+
+		// map surfaces and items draw sorted by state from one queue
+		Queue = new CRenderQueueSceneNode ( smgr->getRootSceneNode(), smgr );
+		Queue->drop ();
+		MapNode->setRenderQueue ( Queue );
+
+		const SMapCullStats &cull = MapNode->getStats ();
+		snprintf ( buf, 256, "visibility: %u leafs, %u clusters, %u portals, %u of %u triangles in a surface",
+			Visibility.getLeafCount (), Visibility.getClusterCount (), Visibility.getPortalCount (),
+			cull.Matched, cull.Triangles );
+		Game->Device->getLogger()->log ( buf, ELL_INFORMATION );
+
+		// the cpu reads the map through the quantized copy, only while the occluders are picked
+		CCompactMesh compact;
+		compact.build ( geometry );
+		snprintf ( buf, 256, "compact geometry: %u vertices, %u bytes per vertex against %u, %u KB against %u KB",
+			compact.getVertexCount (), (u32) sizeof ( SCompactVertex ), (u32) sizeof ( S3DVertex2TCoords ),
+			compact.getMemoryFootprint () >> 10, compact.getSourceFootprint () >> 10 );
+		Game->Device->getLogger()->log ( buf, ELL_INFORMATION );
+
+		// the big walls and floors hide what the pvs lets through
+		MapNode->setOcclusion ( &Occlusion );
+		snprintf ( buf, 256, "occlusion: %u occluder triangles", Occlusion.setOccluders ( compact ) );
+		Game->Device->getLogger()->log ( buf, ELL_INFORMATION );
+	}
+	else
+	{
+		MapParent = smgr->addOctreeSceneNode(geometry, 0, -1, minimalNodes);
+	}
 	MapParent->setName ( mapName );
 	if ( Meta )
 	{
@@ -867,22 +1046,30 @@ void CQuake3EventHandler::LoadMap ( const stringw &mapName, s32 collision )
 		selector->drop ();
 	}
 
+	// the subtrees below are animated and culled on the workers, after the map node set the pvs
+	Traversal = new CParallelSceneNode ( smgr->getRootSceneNode(), smgr );
+	Traversal->drop ();
+
 	// logical parent for the items
-	ItemParent = smgr->addEmptySceneNode();
+	ItemParent = smgr->addEmptySceneNode( Traversal );
 
 
-	ShaderParent = smgr->addEmptySceneNode();
+	ShaderParent = smgr->addEmptySceneNode( Traversal );
 	
 
-	UnresolvedParent = smgr->addEmptySceneNode();
+	UnresolvedParent = smgr->addEmptySceneNode( Traversal );
 	
 
-	FogParent = smgr->addEmptySceneNode();
+	FogParent = smgr->addEmptySceneNode( Traversal );
 	
 
 	// logical parent for the bullets
-	BulletParent = smgr->addEmptySceneNode();
-	
+	BulletParent = smgr->addEmptySceneNode( Traversal );
+
+	// one node draws all bullets and smoke, hidden behind the map like the items
+	Sprites = new CSpriteBatchSceneNode ( BulletParent, smgr );
+	Sprites->drop ();
+	Sprites->setOcclusion ( MapNode ? &Occlusion : 0 );
 
 	/*
 		now construct SceneNodes for each Shader
@@ -894,10 +1081,28 @@ void CQuake3EventHandler::LoadMap ( const stringw &mapName, s32 collision )
 	Q3ShaderFactory ( Game->loadParam, Game->Device, Mesh, E_Q3_MESH_FOG,FogParent, 0, false );
 	Q3ShaderFactory ( Game->loadParam, Game->Device, Mesh, E_Q3_MESH_UNRESOLVED,UnresolvedParent, Meta, true );
 
+	// shader and fog nodes behind the pvs are hidden with the map surfaces
+	if ( MapNode )
+	{
+		MapNode->addCulledNodes ( ShaderParent );
+		MapNode->addCulledNodes ( UnresolvedParent );
+		MapNode->addCulledNodes ( FogParent );
+	}
+
 	/*
 		Now construct Models from Entity List
 	*/
-	Q3ModelFactory ( Game->loadParam, Game->Device, Mesh, ItemParent, false );
+	CItemBatchSceneNode *items = Q3ModelFactory ( Game->loadParam, Game->Device, Mesh, Entities, ItemParent, false );
+	if ( items && MapNode )
+	{
+		items->setOcclusion ( &Occlusion );
+		items->setRenderQueue ( Queue );
+	}
+
+	// one dwarf mesh for all enemies, F4 spawns them
+	Enemies.init ( smgr, World.getTriangleCount () ? &Controller : 0 );
+	Enemies.setNavigation ( Nav.getNodeCount () ? &NavQuery : 0 );
+	Enemies.setOcclusion ( MapNode ? &Occlusion : 0 );
 }
 
 /*
@@ -958,8 +1163,9 @@ void CQuake3EventHandler::addSceneTreeItem( ISceneNode * parent, IGUITreeViewNod
 // Adds life!
 void CQuake3EventHandler::CreatePlayers()
 {
-	Player[0].create ( Game->Device, Mesh, MapParent, Meta );
-	//Player[1].create ( Game->Device, Mesh, MapParent, Meta );
+	const CCharacterController *controller = World.getTriangleCount () ? &Controller : 0;
+	Player[0].create ( Game->Device, Mesh, &Entities, MapParent, Meta, controller, &Enemies );
+	//Player[1].create ( Game->Device, Mesh, &Entities, MapParent, Meta, controller, &Enemies );
 }
 
 
@@ -1148,10 +1354,8 @@ bool CQuake3EventHandler::OnEvent(const SEvent& eve)
 			Player[0].respawn ();
 		}
 		if (eve.KeyInput.Key == KEY_F4)
-		{   Enemy();
-			enemyx+=5;
-			enemyy+=5;
-			enemyz+=5;
+		{
+			SpawnEnemies ( eve.KeyInput.Shift ? 50 : 1 );
 		}
 		
 	}
@@ -1163,7 +1367,12 @@ bool CQuake3EventHandler::OnEvent(const SEvent& eve)
 		ISceneNodeAnimatorCollisionResponse *anim = Player[0].cam ();
 		if ( anim && 0 == Game->flyTroughState )
 		{
-			if ( false == eve.KeyInput.PressedDown )
+			if ( Player[0].Character )
+			{
+				// stands up once there is room
+				Player[0].Character->crouch ( eve.KeyInput.PressedDown );
+			}
+			else if ( false == eve.KeyInput.PressedDown )
 			{
 				// stand up
 				anim->setEllipsoidRadius (  vector3df(30,45,30) );
@@ -1230,49 +1439,42 @@ void CQuake3EventHandler::useItem( Q3Player * player)
 		imp.outVector = out;
 		imp.pos = end;
 	}
-	// create fire ball
-	ISceneNode* node = 0;
-	node = smgr->addBillboardSceneNode( BulletParent,dimension2d<f32>(10,10), start);
-	node->setMaterialFlag(EMF_LIGHTING, false);
-	node->setMaterialTexture(0, Game->Device->getVideoDriver()->getTexture("shalow1.bmp"));
-	node->setMaterialFlag(video::EMF_ZWRITE_ENABLE, false);
-	node->setMaterialType(EMT_TRANSPARENT_ADD_COLOR);
-	
+
+	// an enemy in front of the wall takes the hit
+	f32 at;
+	u32 enemy;
+	if ( Enemies.raycast ( line3df ( start, end ), at, enemy ) )
+	{
+		end = start + ( end - start ) * at;
+		Enemies.damage ( enemy, 50 );
+		imp.when = 0;
+	}
+
 	f32 length = (f32)(end - start).getLength();
 	const f32 speed = 5.8f;
 	u32 time = (u32)(length / speed);
 
-	ISceneNodeAnimator* anim = 0;
-
-	// set flight line
-
-	anim = smgr->createFlyStraightAnimator(start, end, time);
-	node->addAnimator(anim);
-	anim->drop();
-
-	snprintf ( buf, 64, "bullet: %s on %.1f,%1.f,%1.f",
-				imp.when ? "hit" : "nohit", end.X, end.Y, end.Z );
-	node->setName ( buf );
-
-
-	anim = smgr->createDeleteAnimator(time);
-	node->addAnimator(anim);
-	anim->drop();
+	// create fire ball, flying straight to the hit
+	const u32 now = Game->Device->getTimer()->getTime();
+	if ( Sprites )
+		Sprites->addSprite ( Game->Device->getVideoDriver()->getTexture("shalow1.bmp"), EMT_TRANSPARENT_ADD_COLOR,
+			10.f, start, end, now, time );
 
 	if (imp.when)
 	{
-		imp.when = Game->Device->getTimer()->getTime() +
-			(time + (s32) ( ( 1.f + Noiser::get() ) * 250.f ));
+		imp.when = now +
+			(time + (s32) getRandom ( RANDOM_WEAPON ).frand ( 0.f, 500.f ));
 		Impacts.push_back(imp);
 	}
 
 }
 
+// smoke particles drift about 50 units off the wall, plus the emitter box and particle size
+static const f32 SMOKE_REACH = 96.f;
+
 // rendered when bullets hit something
 void CQuake3EventHandler::createParticleImpacts( u32 now )
 {
-	ISceneManager* sm = Game->Device->getSceneManager();
-	
 	struct smokeLayer
 	{
 		const c8 * texture;
@@ -1295,54 +1497,35 @@ void CQuake3EventHandler::createParticleImpacts( u32 now )
 
 	u32 i;
 	u32 g;
-	s32 factor = 1;
 
 	for ( i=0; i < Impacts.size(); ++i)
 	{
 		if (now < Impacts[i].when)
 			continue;
 
-		// create smoke particle system
-		IParticleSystemSceneNode* pas = 0;
-
-		for ( g = 0; g != 2; ++g )
+		// create smoke emitters, removed by the sprite batch after their life time
+		for ( g = 0; g != 2 && Sprites; ++g )
 		{
-			pas = sm->addParticleSystemSceneNode(false, BulletParent, -1, Impacts[i].pos);
-
-			snprintf ( buf, 64, "bullet impact smoke at %.1f,%.1f,%1.f",
-				Impacts[i].pos.X,Impacts[i].pos.Y,Impacts[i].pos.Z);
-			pas->setName ( buf );
-
 			// create a flat smoke
-			vector3df direction = Impacts[i].outVector;
-			direction *= smoke[g].scale;
-			IParticleEmitter* em = pas->createBoxEmitter(
-				aabbox3d<f32>(-4.f,0.f,-4.f,20.f,smoke[g].minparticleSize,20.f),
-				direction,smoke[g].minParticle, smoke[g].maxParticle,
-				video::SColor(0,0,0,0),video::SColor(0,128,128,128),
-				250,4000, 60);
-
-			em->setMinStartSize (dimension2d<f32>( smoke[g].minparticleSize, smoke[g].minparticleSize));
-			em->setMaxStartSize (dimension2d<f32>( smoke[g].maxparticleSize, smoke[g].maxparticleSize));
-
-			pas->setEmitter(em);
-			em->drop();
+			SSpriteEmitterDesc desc;
+			desc.Texture = Game->Device->getVideoDriver()->getTexture( smoke[g].texture );
+			desc.Blend = video::EMT_TRANSPARENT_ADD_COLOR;
+			desc.Box = aabbox3d<f32>(-4.f,0.f,-4.f,20.f,smoke[g].minparticleSize,20.f);
+			desc.Direction = Impacts[i].outVector * smoke[g].scale;
+			desc.MinPerSecond = smoke[g].minParticle;
+			desc.MaxPerSecond = smoke[g].maxParticle;
+			desc.MinColor = video::SColor(0,0,0,0);
+			desc.MaxColor = video::SColor(0,128,128,128);
+			desc.MinLife = 250;
+			desc.MaxLife = 4000;
+			desc.MaxAngle = 60.f;
+			desc.MinSize = smoke[g].minparticleSize;
+			desc.MaxSize = smoke[g].maxparticleSize;
 
 			// particles get invisible
-			IParticleAffector* paf = pas->createFadeOutParticleAffector(
-				video::SColor ( 0, 0, 0, 0 ), smoke[g].fadeout);
-			pas->addAffector(paf);
-			paf->drop();
-
-			// particle system life time
-			ISceneNodeAnimator* anim = sm->createDeleteAnimator( smoke[g].lifetime);
-			pas->addAnimator(anim);
-			anim->drop();
-
-			pas->setMaterialFlag(video::EMF_LIGHTING, false);
-			pas->setMaterialFlag(video::EMF_ZWRITE_ENABLE, false);
-			pas->setMaterialType(video::EMT_TRANSPARENT_ADD_COLOR );
-			pas->setMaterialTexture(0, Game->Device->getVideoDriver()->getTexture( smoke[g].texture ));
+			desc.FadeOut = smoke[g].fadeout;
+
+			Sprites->addEmitter ( desc, Impacts[i].pos, SMOKE_REACH, now, smoke[g].lifetime );
 		}
 
 
@@ -1375,6 +1558,9 @@ void CQuake3EventHandler::Animate()
 {
 	u32 now = Game->Device->getTimer()->getTime();
 
+	// jobs that have to touch irrlicht
+	getJobSystem ()->runMainJobs ();
+
 	Q3Player * player = Player + 0;
 	// Query Scene Manager attributes
 	if ( player->Anim[0].flags & FIRED )
@@ -1388,11 +1574,94 @@ void CQuake3EventHandler::Animate()
 			L"Destructo Beam Start");
 		Game->Device->setWindowCaption( msg );
 	}
+	else
+	if ( now - StatsTime >= 1000 )
+	{
+		// draw calls and primitives of the last frame, jobs of the last second
+		SFrameStats stats;
+		getFrameStats ( Game->Device, stats );
+		SJobStats jobs;
+		getJobSystem ()->getStats ( jobs );
+		StatsTime = now;
+
+		// map triangles behind the pvs and outside the view
+		u32 pvsCulled = 0, viewCulled = 0;
+		if ( MapNode )
+		{
+			pvsCulled = MapNode->getStats ().PVSCulled;
+			viewCulled = MapNode->getStats ().FrustumCulled;
+		}
+
+		// boxes hidden by the occluders per frame against the time raster and tests took
+		SOcclusionStats occlusion;
+		Occlusion.getStats ( occlusion );
+		const u32 frames = core::max_ ( occlusion.Frames, 1u );
+
+		// state changes of the sorted map and item draws, against their submit order
+		SRenderQueueStats queue;
+		memset ( &queue, 0, sizeof ( queue ) );
+		if ( Queue )
+			queue = Queue->getStats ();
+
+		// nodes culled on the workers never register
+		SParallelStats traversal;
+		memset ( &traversal, 0, sizeof ( traversal ) );
+		if ( Traversal )
+			traversal = Traversal->getStats ();
+
+		wchar_t msg[512];
+		swprintf ( msg, 512, L"Destructo Beam  fps: %d  nodes: %u ( %u culled, %u on workers in %.2f ms )  draws: %u  tris: %u ( pvs %u, view %u culled )  occluded: %u in %.2f ms  switches: %u material, %u texture ( %u unsorted )  sprites: %u in %u draws  jobs: %u ( %u stolen, %u%% busy )",
+			Game->Device->getVideoDriver()->getFPS(), stats.Registered, stats.Culled + traversal.Culled,
+			traversal.Leaves, ( traversal.AnimateMicro + traversal.CullMicro ) * 0.001f, stats.DrawCalls, stats.Primitives,
+			pvsCulled, viewCulled,
+			occlusion.Occluded / frames, ( occlusion.RasterMicro + occlusion.TestMicro ) * 0.001f / frames,
+			queue.MaterialSwitches, queue.TextureSwitches, queue.SubmitOrderSwitches,
+			Sprites ? Sprites->getDrawnCount () : 0, Sprites ? Sprites->getDrawCalls () : 0,
+			jobs.Jobs, jobs.Steals, (u32) ( jobs.Busy * 100 / core::max_ ( jobs.Wall * jobs.Threads, (u64) 1 ) ) );
+		Game->Device->setWindowCaption( msg );
+	}
 
-	
 
 	createParticleImpacts ( now );
 
+	// enemies chase the camera, hits lower the health display
+	ICameraSceneNode *camera = Game->Device->getSceneManager()->getActiveCamera();
+	NavQuery.update ();
+	if ( camera && Enemies.getCount () )
+	{
+		health -= Enemies.update ( camera->getPosition (), ( now - EnemyTime ) * 0.001f );
+		if ( health <= 0 )
+		{
+			health = 100;
+			player->respawn ();
+		}
+	}
+	EnemyTime = now;
+
+	if ( Game->guiActive )
+		updateLevelShots ();
+}
+
+
+/*
+	request thumbnails for the rows the map list shows and
+	upload the ones the workers have finished
+*/
+void CQuake3EventHandler::updateLevelShots ()
+{
+	if ( 0 == gui.MapList || 0 == LevelShots->getSlotCount () )
+		return;
+
+	// the list box scrollbar position is in pixel
+	const s32 itemHeight = LEVELSHOT_SIZE + 4;
+	IGUIScrollBar * bar = getListScrollBar ( gui.MapList );
+	s32 first = bar ? bar->getPos () / itemHeight : 0;
+	s32 rows = gui.MapList->getAbsolutePosition().getHeight() / itemHeight + 2;
+
+	for ( s32 i = first; i < first + rows && i < (s32) LevelShots->getSlotCount (); ++i )
+		LevelShots->request ( i );
+
+	LevelShots->update ( Game->Device->getGUIEnvironment()->getSpriteBank("sprite_q3map") );
 }
 
 
@@ -1458,8 +1727,6 @@ void runGame ( GameData *game )
 		game->Device->getGUIEnvironment()->addImage(driver->getTexture("health\\20.png"),core::position2d<s32>(80,519));
 		if (health==10)
 		game->Device->getGUIEnvironment()->addImage(driver->getTexture("health\\10.png"),core::position2d<s32>(80,519));
-//		Enemy->setPosition(vector3df( enemyx, enemyy, enemyz));
-	//	eventHandler->Enemy();
 		}
 		time = game->Device->getTimer()->getTime();
 	eventHandler->Animate ();
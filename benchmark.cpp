@@ -0,0 +1,2214 @@
+/*!
+	Benchmarks.
+	started with "-bench" on the command line, results go to the console
+*/
+
+#include "benchmark.h"
+#include "profile.h"
+#include "mappedzip.h"
+#include "prefetch.h"
+#include "q3factory.h"
+#include "q3collision.h"
+#include "itembatch.h"
+#include "entitytable.h"
+#include "vartable.h"
+#include "shaderscript.h"
+#include "waveform.h"
+#include "random.h"
+#include "worker.h"
+#include "jobs.h"
+#include "bvh.h"
+#include "character.h"
+#include "spatialhash.h"
+#include "enemy.h"
+#include "navmesh.h"
+#include "boxcull.h"
+#include "q3bsp.h"
+#include "visibility.h"
+#include "mapnode.h"
+#include "occlusion.h"
+#include "renderqueue.h"
+#include "compactmesh.h"
+#include "lightatlas.h"
+#include "spritebatch.h"
+#include "traversal.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <atomic>
+
+#if defined(_MSC_VER) && defined(_DEBUG)
+	#include <crtdbg.h>
+#endif
+
+using namespace core;
+using namespace scene;
+using namespace video;
+using namespace io;
+using namespace quake3;
+
+static funcptr_createDeviceEx CreateDevice = 0;
+
+/*
+	the tables count their own allocations through CCountingAllocator on
+	every build. the stock SVarGroup allocates inside the irrlicht headers,
+	only the allocation hook of the debug crt sees that, installed by
+	runBenchmarks
+*/
+#if defined(_MSC_VER) && defined(_DEBUG)
+	#define ALLOCATION_HOOK
+
+static std::atomic < u32 > HeapAllocations ( 0 );
+
+static int countHeapAllocation ( int type, void *, size_t, int, long, const unsigned char *, int )
+{
+	if ( type == _HOOK_ALLOC )
+		HeapAllocations += 1;
+	return 1;
+}
+#endif
+
+static IrrlichtDevice * createNullDevice ()
+{
+	SIrrlichtCreationParameters p;
+	p.DriverType = EDT_NULL;
+	p.LoggingLevel = ELL_ERROR;
+	return CreateDevice ( p );
+}
+
+static f32 ms ( u64 micro )
+{
+	return micro / 1000.f;
+}
+
+// archives listed in maps/maps.txt
+static void getMapArchives ( core::array < path > &list )
+{
+	FILE *f = fopen ( "maps/maps.txt", "r" );
+	if ( 0 == f )
+		return;
+
+	c8 name[256];
+	while ( fscanf ( f, "%255s", name ) == 1 )
+		list.push_back ( path ( "maps/" ) + name );
+	fclose ( f );
+}
+
+// first .bsp inside the mounted archives
+static path findMap ( IFileSystem *fs )
+{
+	path map;
+	for ( u32 a = 0; a != fs->getFileArchiveCount () && map.size () == 0; ++a )
+	{
+		const IFileList *list = fs->getFileArchive ( a )->getFileList ();
+		for ( u32 i = 0; i != list->getFileCount (); ++i )
+		{
+			if ( hasFileExtension ( list->getFullFileName ( i ), "bsp" ) )
+			{
+				map = list->getFullFileName ( i );
+				break;
+			}
+		}
+	}
+	return map;
+}
+
+// load a map the way CQuake3EventHandler::LoadMap does
+static IQ3LevelMesh * loadMap ( IrrlichtDevice *device, const path &map, Q3LevelLoadParameter &loadParam )
+{
+	ISceneManager *smgr = device->getSceneManager ();
+	IReadFile* file = device->getFileSystem ()->createMemoryReadFile ( &loadParam,
+				sizeof ( loadParam ), L"levelparameter.cfg", false );
+	smgr->getMesh ( file );
+	file->drop ();
+
+	return (IQ3LevelMesh*) smgr->getMesh ( map );
+}
+
+
+//! files opened from an archive and the bytes copied out of them
+struct SReadCount
+{
+	u32 FilesOpened;
+	u32 BytesRead;
+};
+
+//! passes reads through and counts them
+class CCountingReadFile : public IReadFile
+{
+public:
+	CCountingReadFile ( IReadFile *file, SReadCount &count ) : File ( file ), Count ( count ) {}
+	virtual ~CCountingReadFile () { File->drop (); }
+
+	virtual s32 read ( void *buffer, u32 sizeToRead )
+	{
+		const s32 n = File->read ( buffer, sizeToRead );
+		if ( n > 0 )
+			Count.BytesRead += n;
+		return n;
+	}
+	virtual bool seek ( long finalPos, bool relativeMovement = false ) { return File->seek ( finalPos, relativeMovement ); }
+	virtual long getSize () const { return File->getSize (); }
+	virtual long getPos () const { return File->getPos (); }
+	virtual const io::path& getFileName () const { return File->getFileName (); }
+
+private:
+	IReadFile *File;
+	SReadCount &Count;
+};
+
+//! the files of an archive, opened through a counting read file
+class CCountingArchive : public IFileArchive
+{
+public:
+	CCountingArchive ( IFileArchive *archive, SReadCount &count ) : Archive ( archive ), Count ( count ) {}
+	virtual ~CCountingArchive () { Archive->drop (); }
+
+	virtual IReadFile* createAndOpenFile ( const io::path &filename ) { return wrap ( Archive->createAndOpenFile ( filename ) ); }
+	virtual IReadFile* createAndOpenFile ( u32 index ) { return wrap ( Archive->createAndOpenFile ( index ) ); }
+	virtual const IFileList* getFileList () const { return Archive->getFileList (); }
+	virtual E_FILE_ARCHIVE_TYPE getType () const { return Archive->getType (); }
+
+private:
+	IReadFile * wrap ( IReadFile *file )
+	{
+		if ( 0 == file )
+			return 0;
+		Count.FilesOpened += 1;
+		return new CCountingReadFile ( file, Count );
+	}
+
+	IFileArchive *Archive;
+	SReadCount &Count;
+};
+
+// mount like addFileArchive, the last loader added is asked first
+static bool addCountingArchive ( IFileSystem *fs, const path &filename, SReadCount &count )
+{
+	for ( s32 i = (s32) fs->getArchiveLoaderCount () - 1; i >= 0; --i )
+	{
+		IArchiveLoader *loader = fs->getArchiveLoader ( i );
+		if ( !loader->isALoadableFileFormat ( filename ) )
+			continue;
+
+		IFileArchive *archive = loader->createArchive ( filename, true, false );
+		if ( 0 == archive )
+			continue;
+
+		IFileArchive *counting = new CCountingArchive ( archive, count );
+		fs->addFileArchive ( counting );
+		counting->drop ();
+		return true;
+	}
+	return false;
+}
+
+/*
+	mount and map load time of the builtin zip reader against the mapped
+	reader. both count the bytes the map load copies out of the archive
+	files, the mapped reader also what it views, inflates and stages
+*/
+static void benchArchive ( const core::array < path > &archives )
+{
+	printf ( "\n-- archive: mount and map load\n" );
+
+	static const c8 * passName[] = { "builtin ", "mapped  ", "prefetch" };
+
+	for ( u32 pass = 0; pass != 3; ++pass )
+	{
+		IrrlichtDevice *device = createNullDevice ();
+		if ( 0 == device )
+			return;
+
+		IFileSystem *fs = device->getFileSystem ();
+		if ( pass )
+		{
+			IArchiveLoader *loader = new CArchiveLoaderMappedZip ( fs );
+			fs->addArchiveLoader ( loader );
+			loader->drop ();
+		}
+
+		SArchiveStats &stats = getArchiveStats ();
+		memset ( &stats, 0, sizeof ( stats ) );
+
+		// the prefetcher needs the mapped archives themselves
+		SReadCount count;
+		u64 mount = 0;
+		{
+			SScopeTimer t ( mount );
+			for ( u32 i = 0; i != archives.size (); ++i )
+			{
+				if ( pass < 2 )
+					addCountingArchive ( fs, archives[i], count );
+				else
+					fs->addFileArchive ( archives[i], true, false );
+			}
+		}
+		memset ( &count, 0, sizeof ( count ) );
+
+		const path map = findMap ( fs );
+		Q3LevelLoadParameter loadParam;
+		u64 load = 0;
+		{
+			SScopeTimer t ( load );
+			if ( 2 == pass )
+				getArchivePrefetcher ()->prefetchMap ( fs, map );
+			loadMap ( device, map, loadParam );
+		}
+
+		printf ( "%s: %u archives mounted in %.2f ms, %s loaded in %.2f ms\n",
+			passName[pass], archives.size (), ms ( mount ), map.c_str (), ms ( load ) );
+
+		if ( pass < 2 )
+			printf ( "%s: %u files opened, %u bytes read out of them\n", passName[pass], count.FilesOpened, count.BytesRead );
+
+		if ( 1 == pass )
+		{
+			printf ( "mapped  : %u files opened, %u bytes viewed, %u bytes inflated, %u bytes staged\n",
+				stats.FilesOpened, stats.BytesViewed, stats.BytesInflated, stats.BytesStaged );
+		}
+		else
+		if ( 2 == pass )
+		{
+			SPrefetchStats p = getArchivePrefetcher ()->getStats ();
+			printf ( "prefetch: %u queued, %u inflated, %u hits, %u misses, %u cap stalls, peak %u KB staged\n",
+				p.Queued, p.Inflated, p.Hits, p.Misses, p.CapStalls, p.PeakStaged >> 10 );
+			prefetch_shutdown ();
+		}
+
+		device->closeDevice ();
+		device->drop ();
+	}
+}
+
+
+// vertex and index bytes of a mesh
+static u32 getMeshBytes ( IMesh *mesh )
+{
+	u32 bytes = 0;
+	for ( u32 i = 0; mesh && i != mesh->getMeshBufferCount (); ++i )
+	{
+		const IMeshBuffer *b = mesh->getMeshBuffer ( i );
+		bytes += b->getVertexCount () * getVertexPitchFromType ( b->getVertexType () );
+		bytes += b->getIndexCount () * ( b->getIndexType () == EIT_16BIT ? 2 : 4 );
+	}
+	return bytes;
+}
+
+/*
+	full client load ( level mesh, shader and model factories ) against the
+	collision only load a server or a bot uses
+*/
+static void benchCollision ( const core::array < path > &archives )
+{
+	printf ( "\n-- collision only load\n" );
+
+	IrrlichtDevice *device = createNullDevice ();
+	if ( 0 == device )
+		return;
+
+	IFileSystem *fs = device->getFileSystem ();
+	IArchiveLoader *loader = new CArchiveLoaderMappedZip ( fs );
+	fs->addArchiveLoader ( loader );
+	loader->drop ();
+
+	for ( u32 i = 0; i != archives.size (); ++i )
+		fs->addFileArchive ( archives[i], true, false );
+
+	const path map = findMap ( fs );
+
+	Q3LevelLoadParameter loadParam;
+	u64 full = 0;
+	IQ3LevelMesh *mesh;
+	{
+		SScopeTimer t ( full );
+		mesh = loadMap ( device, map, loadParam );
+		if ( mesh )
+		{
+			ISceneNode *root = device->getSceneManager ()->getRootSceneNode ();
+			Q3ShaderFactory ( loadParam, device, mesh, E_Q3_MESH_ITEMS, root, 0, false );
+			Q3ShaderFactory ( loadParam, device, mesh, E_Q3_MESH_FOG, root, 0, false );
+			Q3ShaderFactory ( loadParam, device, mesh, E_Q3_MESH_UNRESOLVED, root, 0, false );
+			CEntityTable entities;
+			entities.build ( mesh->getEntityList () );
+			Q3ModelFactory ( loadParam, device, mesh, entities, root, false );
+		}
+	}
+
+	if ( 0 == mesh )
+	{
+		printf ( "%s: failed to load\n", map.c_str () );
+		device->closeDevice ();
+		device->drop ();
+		return;
+	}
+
+	u32 meshBytes = 0;
+	for ( u32 i = 0; i != E_Q3_MESH_SIZE; ++i )
+		meshBytes += getMeshBytes ( mesh->getMesh ( i ) );
+
+	// the null driver keeps no pixels, count what got decoded
+	IVideoDriver *driver = device->getVideoDriver ();
+	u32 imageBytes = 0;
+	for ( u32 i = 0; i != driver->getTextureCount (); ++i )
+	{
+		ITexture *tex = driver->getTextureByIndex ( i );
+		const dimension2du &d = tex->getOriginalSize ();
+		imageBytes += d.Width * d.Height * IImage::getBitsPerPixelFromFormat ( tex->getColorFormat () ) / 8;
+	}
+
+	printf ( "full     : %s in %.2f ms, %u KB meshes, %u KB images ( %u textures )\n",
+		map.c_str (), ms ( full ), meshBytes >> 10, imageBytes >> 10, driver->getTextureCount () );
+
+	SCollisionMap collision;
+	u64 coll = 0;
+	{
+		SScopeTimer t ( coll );
+		loadCollisionMap ( fs, map, collision );
+	}
+
+	printf ( "collision: %s in %.2f ms, %u KB, %u triangles, %u brushes, %u spawns, %u triggers\n",
+		map.c_str (), ms ( coll ), collision.getMemoryFootprint () >> 10, collision.getTriangleCount (),
+		collision.Brush.size (), collision.Spawn.size (), collision.Trigger.size () );
+
+	device->closeDevice ();
+	device->drop ();
+}
+
+
+/*
+	character controller over the collision bvh against irrlicht's
+	collision response on an octree selector. the same walkers from
+	the spawn points, one second at 60 frames
+*/
+static void benchCharacters ( const core::array < path > &archives )
+{
+	printf ( "\n-- character controller\n" );
+
+	IrrlichtDevice *device = createNullDevice ();
+	if ( 0 == device )
+		return;
+
+	IFileSystem *fs = device->getFileSystem ();
+	ISceneManager *smgr = device->getSceneManager ();
+	IArchiveLoader *loader = new CArchiveLoaderMappedZip ( fs );
+	fs->addArchiveLoader ( loader );
+	loader->drop ();
+
+	for ( u32 i = 0; i != archives.size (); ++i )
+		fs->addFileArchive ( archives[i], true, false );
+
+	const path map = findMap ( fs );
+	Q3LevelLoadParameter loadParam;
+	IQ3LevelMesh *mesh = loadMap ( device, map, loadParam );
+	SCollisionMap collision;
+	if ( 0 == mesh || !loadCollisionMap ( fs, map, collision ) )
+	{
+		device->closeDevice ();
+		device->drop ();
+		return;
+	}
+
+	CCollisionBVH world;
+	u64 build = 0;
+	{
+		SScopeTimer t ( build );
+		world.build ( collision );
+	}
+	printf ( "bvh      : %u triangles, %u nodes, %u KB in %.2f ms\n",
+		world.getTriangleCount (), world.getNodeCount (), world.getMemoryFootprint () >> 10, ms ( build ) );
+
+	IMesh *geometry = mesh->getMesh ( E_Q3_MESH_GEOMETRY );
+	ISceneNode *node = smgr->addOctreeSceneNode ( geometry, 0, -1, 2048 );
+	ITriangleSelector *selector = smgr->createOctreeTriangleSelector ( geometry, node, 2048 );
+
+	const u32 count = 256;
+	const u32 frames = 60;
+	const f32 dt = 1.f / 60.f;
+	const vector3df gravity ( 0.f, -800.f, 0.f );
+
+	CCharacterController controller ( &world );
+	controller.setGravity ( gravity );
+
+	core::array < SCharacter > character;
+	core::array < vector3df > heading;
+	character.set_used ( count );
+	heading.set_used ( count );
+
+	CRandom r ( 0x69666966, RANDOM_AI );
+	for ( u32 i = 0; i != count; ++i )
+	{
+		const vector3df start = collision.Spawn.size () ?
+			collision.Spawn [ i % collision.Spawn.size () ].Origin + vector3df ( 0.f, 40.f, 0.f ) :
+			collision.Box.getCenter ();
+		controller.init ( character[i], start );
+		const f32 a = r.frand ( 0.f, 2.f * core::PI );
+		heading[i].set ( sinf ( a ) * 320.f * dt, 0.f, cosf ( a ) * 320.f * dt );
+	}
+	core::array < SCharacter > irr = character;
+
+	u64 bvhTime = 0;
+	{
+		SScopeTimer t ( bvhTime );
+		for ( u32 f = 0; f != frames; ++f )
+		{
+			for ( u32 i = 0; i != count; ++i )
+				character[i].Wish = heading[i];
+			controller.move ( character.pointer (), count, dt );
+		}
+	}
+
+	u32 ground = 0;
+	for ( u32 i = 0; i != count; ++i )
+		ground += character[i].OnGround ? 1 : 0;
+
+	// what the collision response animator does per frame
+	u64 irrTime = 0;
+	{
+		SScopeTimer t ( irrTime );
+		ISceneCollisionManager *cm = smgr->getSceneCollisionManager ();
+		for ( u32 f = 0; f != frames; ++f )
+		{
+			for ( u32 i = 0; i != count; ++i )
+			{
+				SCharacter &c = irr[i];
+				c.Velocity += gravity * dt;
+
+				triangle3df tri;
+				vector3df hit;
+				bool falling = false;
+				ISceneNode *hitNode = 0;
+				const vector3df pos = cm->getCollisionResultPosition ( selector, c.Position - c.Translation,
+					c.Radius, heading[i], tri, hit, falling, hitNode, 0.0005f, c.Velocity * dt );
+				if ( !falling )
+					c.Velocity.set ( 0.f, 0.f, 0.f );
+				c.Position = pos + c.Translation;
+			}
+		}
+	}
+
+	const u32 moves = count * frames;
+	printf ( "bvh      : %u characters x %u frames in %.2f ms, %.1f moves/ms, %u on ground\n",
+		count, frames, ms ( bvhTime ), moves / core::max_ ( ms ( bvhTime ), 0.001f ), ground );
+	printf ( "animator : %u characters x %u frames in %.2f ms, %.1f moves/ms\n",
+		count, frames, ms ( irrTime ), moves / core::max_ ( ms ( irrTime ), 0.001f ) );
+
+	selector->drop ();
+	device->closeDevice ();
+	device->drop ();
+}
+
+
+/*
+	enemy manager from 1 to 500 dwarfs chasing a point on the map.
+	think and move on the workers against syncing and drawing the nodes.
+	the cached poses against irrlicht skinning every node in drawAll
+*/
+static void benchEnemies ( const core::array < path > &archives )
+{
+	printf ( "\n-- enemies\n" );
+
+	IrrlichtDevice *device = createNullDevice ();
+	if ( 0 == device )
+		return;
+
+	IFileSystem *fs = device->getFileSystem ();
+	ISceneManager *smgr = device->getSceneManager ();
+	IVideoDriver *driver = device->getVideoDriver ();
+	IArchiveLoader *loader = new CArchiveLoaderMappedZip ( fs );
+	fs->addArchiveLoader ( loader );
+	loader->drop ();
+
+	for ( u32 i = 0; i != archives.size (); ++i )
+		fs->addFileArchive ( archives[i], true, false );
+
+	const path map = findMap ( fs );
+	SCollisionMap collision;
+	if ( !loadCollisionMap ( fs, map, collision ) || collision.Spawn.empty () )
+	{
+		device->closeDevice ();
+		device->drop ();
+		return;
+	}
+
+	CCollisionBVH world;
+	world.build ( collision );
+	CCharacterController controller ( &world );
+
+	ICameraSceneNode *camera = smgr->addCameraSceneNode ();
+	camera->setFarValue ( 20000.f );
+
+	// poses of different frames have to get different joint matrices
+	IAnimatedMesh *dwarf = smgr->getMesh ( "dwarf.x" );
+	if ( dwarf && dwarf->getMeshType () == EAMT_SKINNED )
+	{
+		CSkinCache skin;
+		if ( skin.init ( (ISkinnedMesh*) dwarf ) )
+		{
+			const f32 middle = (f32) ( dwarf->getFrameCount () / 2 );
+			const u32 a = skin.getKey ( 0.f );
+			const u32 b = skin.getKey ( middle );
+			skin.request ( a );
+			skin.request ( b );
+			skin.skin ();
+
+			const f32 *pa = skin.getPalette ( a );
+			const f32 *pb = skin.getPalette ( b );
+			const bool differ = pa && pb && memcmp ( pa, pb, skin.getJointCount () * 12 * sizeof ( f32 ) ) != 0;
+			printf ( "palettes of frame 0 and %.0f: %s\n", middle, differ ? "differ" : "IDENTICAL, POSES NOT ANIMATED" );
+		}
+	}
+
+	const u32 frames = 60;
+	const f32 dt = 1.f / 60.f;
+	const u32 counts[] = { 1, 10, 100, 250, 500 };
+
+	for ( u32 c = 0; c != sizeof ( counts ) / sizeof ( counts[0] ); ++c )
+	{
+		CEnemyManager enemies;
+		if ( !enemies.init ( smgr, &controller ) )
+		{
+			printf ( "dwarf.x not found\n" );
+			break;
+		}
+
+		CRandom r ( 0x69666966, RANDOM_AI );
+		for ( u32 i = 0; i != counts[c]; ++i )
+		{
+			const SCollisionEntity &spawn = collision.Spawn [ i % collision.Spawn.size () ];
+			enemies.spawn ( spawn.Origin + vector3df ( r.frand ( -64.f, 64.f ), 0.f, r.frand ( -64.f, 64.f ) ) );
+		}
+
+		// the target stands at the first spawn point, watched from above
+		const vector3df target = collision.Spawn[0].Origin + vector3df ( 0.f, 40.f, 0.f );
+		camera->setPosition ( target + vector3df ( 0.f, 400.f, -400.f ) );
+		camera->setTarget ( target );
+
+		u64 updateTime = 0;
+		u64 drawTime = 0;
+		s32 dealt = 0;
+		u32 skinned = 0;
+		u32 shared = 0;
+		for ( u32 f = 0; f != frames; ++f )
+		{
+			{
+				SScopeTimer t ( updateTime );
+				dealt += enemies.update ( target, dt );
+			}
+			skinned += enemies.getSkin ().getSkinnedCount ();
+			shared += enemies.getSkin ().getHitCount ();
+			{
+				SScopeTimer t ( drawTime );
+				driver->beginScene ( true, true, SColor ( 0, 0, 0, 0 ) );
+				smgr->drawAll ();
+				driver->endScene ();
+			}
+		}
+
+		u32 chasing = 0;
+		for ( u32 i = 0; i != enemies.getCount (); ++i )
+			chasing += enemies.getState ( i ) == ENEMY_CHASE || enemies.getState ( i ) == ENEMY_ATTACK ? 1 : 0;
+
+		printf ( "%3u enemies: update %.3f ms/frame, draw %.3f ms/frame, %u chasing, %d damage\n",
+			counts[c], ms ( updateTime ) / frames, ms ( drawTime ) / frames, chasing, dealt );
+		printf ( "             %u poses skinned, %u reused, %u cached in %u KB\n",
+			skinned, shared, enemies.getSkin ().getPoseCount (), enemies.getSkin ().getMemoryFootprint () >> 10 );
+	}
+
+	// the same crowd as animated nodes, each skins the shared mesh when drawn.
+	// last, it leaves dwarf.x out of the bind pose
+	if ( dwarf )
+	{
+		const u32 count = counts [ sizeof ( counts ) / sizeof ( counts[0] ) - 1 ];
+		ISceneNode *parent = smgr->addEmptySceneNode ();
+		array < IAnimatedMeshSceneNode* > nodes;
+		CRandom r ( 0x69666966, RANDOM_AI );
+		for ( u32 i = 0; i != count; ++i )
+		{
+			const SCollisionEntity &spawn = collision.Spawn [ i % collision.Spawn.size () ];
+			IAnimatedMeshSceneNode *node = smgr->addAnimatedMeshSceneNode ( dwarf, parent,
+				-1, spawn.Origin + vector3df ( r.frand ( -64.f, 64.f ), 0.f, r.frand ( -64.f, 64.f ) ) );
+			node->setAnimationSpeed ( 0.f );
+			nodes.push_back ( node );
+		}
+
+		u64 drawTime = 0;
+		for ( u32 f = 0; f != frames; ++f )
+		{
+			SScopeTimer t ( drawTime );
+			for ( u32 i = 0; i != nodes.size (); ++i )
+				nodes[i]->setCurrentFrame ( fmodf ( ( f + i ) * 25.f * dt, (f32) dwarf->getFrameCount () ) );
+			driver->beginScene ( true, true, SColor ( 0, 0, 0, 0 ) );
+			smgr->drawAll ();
+			driver->endScene ();
+		}
+		parent->remove ();
+
+		printf ( "%3u animated nodes: draw %.3f ms/frame\n", count, ms ( drawTime ) / frames );
+	}
+
+	device->closeDevice ();
+	device->drop ();
+}
+
+
+/*
+	navmesh of the collision map: build against the disk cache, then
+	a* between random floors, serial and on the workers
+*/
+static void benchNavMesh ( const core::array < path > &archives )
+{
+	printf ( "\n-- navmesh\n" );
+
+	IrrlichtDevice *device = createNullDevice ();
+	if ( 0 == device )
+		return;
+
+	IFileSystem *fs = device->getFileSystem ();
+	IArchiveLoader *loader = new CArchiveLoaderMappedZip ( fs );
+	fs->addArchiveLoader ( loader );
+	loader->drop ();
+
+	for ( u32 i = 0; i != archives.size (); ++i )
+		fs->addFileArchive ( archives[i], true, false );
+
+	const path map = findMap ( fs );
+	SCollisionMap collision;
+	if ( !loadCollisionMap ( fs, map, collision ) )
+	{
+		device->closeDevice ();
+		device->drop ();
+		return;
+	}
+
+	CNavMesh nav;
+	u64 buildTime = 0;
+	{
+		SScopeTimer t ( buildTime );
+		nav.build ( collision );
+	}
+
+	const path cacheFile ( "navmesh.bench" );
+	const u64 key = CNavMesh::getKey ( collision );
+	nav.save ( cacheFile, key );
+
+	CNavMesh cached;
+	u64 loadTime = 0;
+	bool loaded;
+	{
+		SScopeTimer t ( loadTime );
+		loaded = cached.load ( cacheFile, key );
+	}
+	remove ( cacheFile.c_str () );
+
+	printf ( "build: %.2f ms, %u nodes, %u links, %u KB, cache load %.2f ms%s\n",
+		ms ( buildTime ), nav.getNodeCount (), nav.getLinkCount (), nav.getMemoryFootprint () >> 10,
+		ms ( loadTime ), loaded && cached.getNodeCount () == nav.getNodeCount () ? "" : " ( failed )" );
+
+	if ( nav.getNodeCount () < 2 )
+	{
+		device->closeDevice ();
+		device->drop ();
+		return;
+	}
+
+	const u32 queries = 1000;
+	core::array < vector3df > from;
+	core::array < vector3df > to;
+	CRandom r ( 0x69666966, RANDOM_AI );
+	for ( u32 i = 0; i != queries; ++i )
+	{
+		from.push_back ( nav.getNodePosition ( r.rand ( nav.getNodeCount () ) ) );
+		to.push_back ( nav.getNodePosition ( r.rand ( nav.getNodeCount () ) ) );
+	}
+
+	SNavSearch search;
+	core::array < vector3df > route;
+	u32 found = 0;
+	u32 corners = 0;
+	u64 serial = 0;
+	{
+		SScopeTimer t ( serial );
+		for ( u32 i = 0; i != queries; ++i )
+		{
+			if ( nav.findPath ( from[i], to[i], route, search ) )
+			{
+				found += 1;
+				corners += route.size ();
+			}
+		}
+	}
+
+	CNavQuery query;
+	query.setMesh ( &nav );
+	u64 async = 0;
+	{
+		SScopeTimer t ( async );
+		for ( u32 i = 0; i != queries; ++i )
+			query.request ( from[i], to[i] );
+		query.wait ();
+	}
+	query.update ();
+
+	printf ( "serial : %u queries in %.2f ms, %.0f queries/s, %u found, %.1f corners\n",
+		queries, ms ( serial ), queries * 1000.f / core::max_ ( ms ( serial ), 0.001f ),
+		found, found ? (f32) corners / found : 0.f );
+	printf ( "workers: %u queries in %.2f ms, %.0f queries/s on %u threads\n",
+		queries, ms ( async ), queries * 1000.f / core::max_ ( ms ( async ), 0.001f ),
+		getWorkerPool ()->getThreadCount () );
+
+	device->closeDevice ();
+	device->drop ();
+}
+
+
+/*
+	map triangles and shader nodes the pvs and the frustum remove, one
+	view from every spawn point along its angle. then the shader nodes
+	the occluders hide, against the cost of rasterizing and testing
+*/
+static void benchVisibility ( const core::array < path > &archives )
+{
+	printf ( "\n-- pvs and occlusion culling\n" );
+
+	IrrlichtDevice *device = createNullDevice ();
+	if ( 0 == device )
+		return;
+
+	IFileSystem *fs = device->getFileSystem ();
+	ISceneManager *smgr = device->getSceneManager ();
+	IArchiveLoader *loader = new CArchiveLoaderMappedZip ( fs );
+	fs->addArchiveLoader ( loader );
+	loader->drop ();
+
+	for ( u32 i = 0; i != archives.size (); ++i )
+		fs->addFileArchive ( archives[i], true, false );
+
+	const path map = findMap ( fs );
+	Q3LevelLoadParameter loadParam;
+	IQ3LevelMesh *mesh = loadMap ( device, map, loadParam );
+	CQ3Bsp bsp;
+	SCollisionMap collision;
+	if ( 0 == mesh || !bsp.load ( fs, map ) || !buildCollisionMap ( bsp, collision ) || collision.Spawn.empty () )
+	{
+		device->closeDevice ();
+		device->drop ();
+		return;
+	}
+
+	CQ3Visibility vis;
+	CQ3MapSceneNode *node = 0;
+	u64 build = 0;
+	{
+		SScopeTimer t ( build );
+		if ( vis.build ( bsp ) )
+			node = new CQ3MapSceneNode ( mesh->getMesh ( E_Q3_MESH_GEOMETRY ), bsp, &vis, smgr->getRootSceneNode (), smgr );
+	}
+	if ( 0 == node )
+	{
+		printf ( "no bsp tree\n" );
+		device->closeDevice ();
+		device->drop ();
+		return;
+	}
+
+	ISceneNode *shaderParent = smgr->addEmptySceneNode ();
+	Q3ShaderFactory ( loadParam, device, mesh, E_Q3_MESH_ITEMS, shaderParent, 0, false );
+	Q3ShaderFactory ( loadParam, device, mesh, E_Q3_MESH_FOG, shaderParent, 0, false );
+	node->addCulledNodes ( shaderParent );
+
+	const SMapCullStats &stats = node->getStats ();
+	printf ( "build: %.2f ms, %u leafs, %u clusters, %u portals, %u of %u triangles in a surface\n",
+		ms ( build ), vis.getLeafCount (), vis.getClusterCount (), vis.getPortalCount (), stats.Matched, stats.Triangles );
+
+	matrix4 projection;
+	projection.buildProjectionMatrixPerspectiveFovLH ( core::PI / 2.5f, 4.f / 3.f, 1.f, 20000.f );
+
+	u64 drawn = 0, pvsCulled = 0, viewCulled = 0, hidden = 0, outside = 0, leafs = 0;
+	u64 time = 0;
+	for ( u32 i = 0; i != collision.Spawn.size (); ++i )
+	{
+		const SCollisionEntity &spawn = collision.Spawn[i];
+		const vector3df eye = spawn.Origin + vector3df ( 0.f, 40.f, 0.f );
+		const f32 angle = spawn.Angle * core::DEGTORAD;
+		const vector3df target = eye + vector3df ( cosf ( angle ), 0.f, sinf ( angle ) ) * 100.f;
+
+		matrix4 view;
+		view.buildCameraLookAtMatrixLH ( eye, target, vector3df ( 0.f, 1.f, 0.f ) );
+		const SViewFrustum frustum ( projection * view );
+
+		{
+			SScopeTimer t ( time );
+			node->cull ( eye, &frustum );
+		}
+
+		drawn += stats.Drawn;
+		pvsCulled += stats.PVSCulled;
+		viewCulled += stats.FrustumCulled;
+		hidden += stats.NodesHidden;
+		outside += stats.NodesOutside;
+		leafs += vis.getVisibleLeafCount ();
+	}
+
+	const u32 n = collision.Spawn.size ();
+	printf ( "%u views: %.1f us per cull, %u visible leafs, triangles %u drawn, %u pvs culled, %u view culled of %u\n",
+		n, time / (f32) n, (u32) ( leafs / n ), (u32) ( drawn / n ), (u32) ( pvsCulled / n ), (u32) ( viewCulled / n ),
+		stats.Triangles );
+	printf ( "shader nodes: %u hidden, %u outside the view of %u\n", (u32) ( hidden / n ), (u32) ( outside / n ), stats.Nodes );
+
+	// the same views again, the nodes left are tested against the occluders
+	CCompactMesh compact;
+	compact.build ( mesh->getMesh ( E_Q3_MESH_GEOMETRY ) );
+	COcclusionCuller occlusion;
+	u64 select = 0;
+	{
+		SScopeTimer t ( select );
+		occlusion.setOccluders ( compact );
+	}
+	node->setOcclusion ( &occlusion );
+
+	u64 occluded = 0;
+	outside = 0;
+	for ( u32 i = 0; i != collision.Spawn.size (); ++i )
+	{
+		const SCollisionEntity &spawn = collision.Spawn[i];
+		const vector3df eye = spawn.Origin + vector3df ( 0.f, 40.f, 0.f );
+		const f32 angle = spawn.Angle * core::DEGTORAD;
+		const vector3df target = eye + vector3df ( cosf ( angle ), 0.f, sinf ( angle ) ) * 100.f;
+
+		matrix4 view;
+		view.buildCameraLookAtMatrixLH ( eye, target, vector3df ( 0.f, 1.f, 0.f ) );
+		const SViewFrustum frustum ( projection * view );
+
+		occlusion.render ( projection * view );
+		node->cull ( eye, &frustum );
+		occluded += stats.NodesOccluded;
+		outside += stats.NodesOutside;
+	}
+
+	SOcclusionStats o;
+	occlusion.getStats ( o );
+	printf ( "occlusion: %u occluders selected in %.2f ms, %u rasterized per view in %.1f us, %u tests in %.1f us\n",
+		o.Occluders, ms ( select ), o.Rasterized / n, o.RasterMicro / (f32) n, o.Tests / n, o.TestMicro / (f32) n );
+	printf ( "shader node draws saved: %u occluded of %u in the view\n",
+		(u32) ( occluded / n ), stats.Nodes - (u32) ( hidden / n ) - (u32) ( outside / n ) );
+
+	node->drop ();
+	device->closeDevice ();
+	device->drop ();
+}
+
+
+/*
+	the map geometry as S3DVertex2TCoords against the quantized copy: the
+	memory, the error, and walking every triangle reading positions or
+	whole vertices like the cpu code does
+*/
+static void benchCompactMesh ( const core::array < path > &archives )
+{
+	printf ( "\n-- compact map geometry\n" );
+
+	IrrlichtDevice *device = createNullDevice ();
+	if ( 0 == device )
+		return;
+
+	IFileSystem *fs = device->getFileSystem ();
+	IArchiveLoader *loader = new CArchiveLoaderMappedZip ( fs );
+	fs->addArchiveLoader ( loader );
+	loader->drop ();
+
+	for ( u32 i = 0; i != archives.size (); ++i )
+		fs->addFileArchive ( archives[i], true, false );
+
+	Q3LevelLoadParameter loadParam;
+	IQ3LevelMesh *mesh = loadMap ( device, findMap ( fs ), loadParam );
+	IMesh *geometry = mesh ? mesh->getMesh ( E_Q3_MESH_GEOMETRY ) : 0;
+	if ( 0 == geometry )
+	{
+		device->closeDevice ();
+		device->drop ();
+		return;
+	}
+
+	CCompactMesh compact;
+	u64 build = 0;
+	{
+		SScopeTimer t ( build );
+		compact.build ( geometry );
+	}
+
+	// the same buffers are taken in the same order
+	f32 posError = 0.f, normalError = 0.f, lightmapError = 0.f;
+	u32 b = 0;
+	for ( u32 m = 0; m != geometry->getMeshBufferCount (); ++m )
+	{
+		IMeshBuffer *mb = geometry->getMeshBuffer ( m );
+		if ( mb->getVertexType () != EVT_2TCOORDS || mb->getIndexType () != EIT_16BIT || 0 == mb->getVertexCount () )
+			continue;
+
+		const SCompactBuffer &buffer = compact.getBuffer ( b++ );
+		const S3DVertex2TCoords *v = (const S3DVertex2TCoords*) mb->getVertices ();
+		const SCompactVertex *c = compact.getVertices ( buffer );
+		for ( u32 i = 0; i != buffer.VertexCount; ++i )
+		{
+			S3DVertex2TCoords d;
+			CCompactMesh::decode ( buffer, c[i], d );
+			posError = core::max_ ( posError, d.Pos.getDistanceFrom ( v[i].Pos ) );
+			if ( v[i].Normal.getLengthSQ () > 0.5f )
+				normalError = core::max_ ( normalError, acosf ( core::clamp ( d.Normal.dotProduct ( vector3df ( v[i].Normal ).normalize () ), -1.f, 1.f ) ) );
+			lightmapError = core::max_ ( lightmapError, ( d.TCoords2 - v[i].TCoords2 ).getLength () );
+		}
+	}
+
+	printf ( "%u vertices in %u buffers built in %.2f ms: %u bytes per vertex against %u, %u KB against %u KB\n",
+		compact.getVertexCount (), compact.getBufferCount (), ms ( build ),
+		(u32) sizeof ( SCompactVertex ), (u32) sizeof ( S3DVertex2TCoords ),
+		compact.getMemoryFootprint () >> 10, compact.getSourceFootprint () >> 10 );
+	printf ( "max error: position %.4f units, normal %.2f degrees, lightmap %.6f\n",
+		posError, normalError * core::RADTODEG, lightmapError );
+
+	const u32 passes = 20;
+	u64 floatPos = 0, compactPos = 0, floatFull = 0, compactFull = 0;
+	vector3df sum ( 0.f );
+	u32 color = 0;
+	u32 corners = 0;
+
+	for ( u32 pass = 0; pass != passes; ++pass )
+	{
+		{
+			SScopeTimer t ( floatPos );
+			for ( u32 m = 0; m != geometry->getMeshBufferCount (); ++m )
+			{
+				IMeshBuffer *mb = geometry->getMeshBuffer ( m );
+				if ( mb->getVertexType () != EVT_2TCOORDS || mb->getIndexType () != EIT_16BIT )
+					continue;
+				const S3DVertex2TCoords *v = (const S3DVertex2TCoords*) mb->getVertices ();
+				const u16 *index = mb->getIndices ();
+				for ( u32 i = 0; i != mb->getIndexCount (); ++i )
+					sum += v[index[i]].Pos;
+			}
+		}
+		{
+			SScopeTimer t ( compactPos );
+			for ( u32 k = 0; k != compact.getBufferCount (); ++k )
+			{
+				const SCompactBuffer &buffer = compact.getBuffer ( k );
+				const SCompactVertex *v = compact.getVertices ( buffer );
+				const u16 *index = compact.getIndices ( buffer );
+				for ( u32 i = 0; i != buffer.IndexCount; ++i )
+					sum += CCompactMesh::getPosition ( buffer, v[index[i]] );
+				corners += pass ? 0 : buffer.IndexCount;
+			}
+		}
+		{
+			SScopeTimer t ( floatFull );
+			for ( u32 m = 0; m != geometry->getMeshBufferCount (); ++m )
+			{
+				IMeshBuffer *mb = geometry->getMeshBuffer ( m );
+				if ( mb->getVertexType () != EVT_2TCOORDS || mb->getIndexType () != EIT_16BIT )
+					continue;
+				const S3DVertex2TCoords *v = (const S3DVertex2TCoords*) mb->getVertices ();
+				for ( u32 i = 0; i != mb->getVertexCount (); ++i )
+				{
+					const S3DVertex2TCoords d = v[i];
+					sum += d.Normal;
+					sum.X += d.TCoords.X + d.TCoords2.X;
+					color ^= d.Color.color;
+				}
+			}
+		}
+		{
+			SScopeTimer t ( compactFull );
+			for ( u32 k = 0; k != compact.getBufferCount (); ++k )
+			{
+				const SCompactBuffer &buffer = compact.getBuffer ( k );
+				const SCompactVertex *v = compact.getVertices ( buffer );
+				for ( u32 i = 0; i != buffer.VertexCount; ++i )
+				{
+					S3DVertex2TCoords d;
+					CCompactMesh::decode ( buffer, v[i], d );
+					sum += d.Normal;
+					sum.X += d.TCoords.X + d.TCoords2.X;
+					color ^= d.Color.color;
+				}
+			}
+		}
+	}
+
+	const f32 verts = (f32) compact.getVertexCount () * passes;
+	const f32 reads = (f32) corners * passes;
+	printf ( "triangle positions: float %.1f M/s, compact %.1f M/s\n",
+		reads / core::max_ ( (f32) floatPos, 1.f ), reads / core::max_ ( (f32) compactPos, 1.f ) );
+	printf ( "whole vertices    : float %.1f M/s, compact decoded %.1f M/s ( %.0f %x )\n",
+		verts / core::max_ ( (f32) floatFull, 1.f ), verts / core::max_ ( (f32) compactFull, 1.f ), sum.X + sum.Y + sum.Z, color );
+
+	device->closeDevice ();
+	device->drop ();
+}
+
+
+/*
+	the skyline packer on mixed rectangles, then the lightmaps of the map.
+	the null driver can't lock textures, its pages stay empty
+*/
+static void benchLightmapAtlas ( const core::array < path > &archives )
+{
+	printf ( "\n-- lightmap atlas\n" );
+
+	CRandom r ( 0x69666966 );
+	CSkylinePacker packer;
+	packer.init ( 2048, 2048 );
+	u32 packed = 0, x, y;
+	u64 packTime = 0;
+	{
+		SScopeTimer t ( packTime );
+		for ( u32 i = 0; i != 4096; ++i )
+			packed += packer.pack ( 16 + r.rand ( 240 ), 16 + r.rand ( 240 ), x, y ) ? 1 : 0;
+	}
+	printf ( "skyline: %u of 4096 rectangles 16..256 on 2048x2048, %.1f%% covered in %.2f ms\n",
+		packed, packer.getOccupancy () * 100.f, ms ( packTime ) );
+
+	IrrlichtDevice *device = createNullDevice ();
+	if ( 0 == device )
+		return;
+
+	IFileSystem *fs = device->getFileSystem ();
+	IArchiveLoader *loader = new CArchiveLoaderMappedZip ( fs );
+	fs->addArchiveLoader ( loader );
+	loader->drop ();
+
+	for ( u32 i = 0; i != archives.size (); ++i )
+		fs->addFileArchive ( archives[i], true, false );
+
+	Q3LevelLoadParameter loadParam;
+	IQ3LevelMesh *mesh = loadMap ( device, findMap ( fs ), loadParam );
+	IMesh *geometry = mesh ? mesh->getMesh ( E_Q3_MESH_GEOMETRY ) : 0;
+	if ( 0 == geometry )
+	{
+		device->closeDevice ();
+		device->drop ();
+		return;
+	}
+
+	u32 vertices = 0, indices = 0;
+	for ( u32 b = 0; b != geometry->getMeshBufferCount (); ++b )
+	{
+		vertices += geometry->getMeshBuffer ( b )->getVertexCount ();
+		indices += geometry->getMeshBuffer ( b )->getIndexCount ();
+	}
+
+	IVideoDriver *driver = device->getVideoDriver ();
+	CLightmapAtlas atlas;
+	if ( atlas.pack ( geometry, 2048 ) )
+	{
+		atlas.createPages ( driver, "bench" );
+		atlas.apply ( (SMesh*) geometry );
+	}
+
+	// merging keeps every vertex and index, the lightmap coordinates stay on the pages
+	u32 verticesAfter = 0, indicesAfter = 0, outside = 0;
+	for ( u32 b = 0; b != geometry->getMeshBufferCount (); ++b )
+	{
+		IMeshBuffer *mb = geometry->getMeshBuffer ( b );
+		verticesAfter += mb->getVertexCount ();
+		indicesAfter += mb->getIndexCount ();
+		if ( mb->getVertexType () != EVT_2TCOORDS )
+			continue;
+		const S3DVertex2TCoords *v = (const S3DVertex2TCoords*) mb->getVertices ();
+		for ( u32 i = 0; i != mb->getVertexCount (); ++i )
+			outside += v[i].TCoords2.X < 0.f || v[i].TCoords2.X > 1.f || v[i].TCoords2.Y < 0.f || v[i].TCoords2.Y > 1.f ? 1 : 0;
+	}
+
+	const SLightmapAtlasStats &stats = atlas.getStats ();
+	printf ( "%u lightmaps on %u pages of %u, %u%% used, %u unreadable, %.2f ms\n",
+		stats.Lightmaps, stats.Pages, stats.PageSize, stats.Occupancy, stats.Unreadable, ms ( stats.Micro ) );
+	printf ( "buffers %u -> %u, texture switches drawing all %u -> %u\n",
+		stats.BuffersBefore, stats.BuffersAfter, stats.SwitchesBefore, stats.SwitchesAfter );
+	printf ( "vertices %u -> %u, indices %u -> %u, %u lightmap coordinates off the page: %s\n",
+		vertices, verticesAfter, indices, indicesAfter, outside,
+		vertices == verticesAfter && indices == indicesAfter && 0 == outside ? "PASS" : "FAIL" );
+
+	device->closeDevice ();
+	device->drop ();
+}
+
+
+/*
+	shader scenenodes one per mesh buffer against the batched chunks.
+	one frame from the first spawn point on the null driver
+*/
+static void benchBatching ( const core::array < path > &archives )
+{
+	printf ( "\n-- shader node batching\n" );
+
+	for ( u32 batch = 0; batch != 2; ++batch )
+	{
+		IrrlichtDevice *device = createNullDevice ();
+		if ( 0 == device )
+			return;
+
+		IFileSystem *fs = device->getFileSystem ();
+		ISceneManager *smgr = device->getSceneManager ();
+		IArchiveLoader *loader = new CArchiveLoaderMappedZip ( fs );
+		fs->addArchiveLoader ( loader );
+		loader->drop ();
+
+		for ( u32 i = 0; i != archives.size (); ++i )
+			fs->addFileArchive ( archives[i], true, false );
+
+		const path map = findMap ( fs );
+		Q3LevelLoadParameter loadParam;
+		IQ3LevelMesh *mesh = loadMap ( device, map, loadParam );
+		if ( 0 == mesh )
+		{
+			device->closeDevice ();
+			device->drop ();
+			return;
+		}
+
+		smgr->addOctreeSceneNode ( mesh->getMesh ( E_Q3_MESH_GEOMETRY ), 0, -1, 2048 );
+
+		ISceneNode *shaderParent = smgr->addEmptySceneNode ();
+		u64 build = 0;
+		{
+			SScopeTimer t ( build );
+			Q3ShaderFactory ( loadParam, device, mesh, E_Q3_MESH_ITEMS, shaderParent, 0, false, batch != 0 );
+			Q3ShaderFactory ( loadParam, device, mesh, E_Q3_MESH_FOG, shaderParent, 0, false, batch != 0 );
+			Q3ShaderFactory ( loadParam, device, mesh, E_Q3_MESH_UNRESOLVED, shaderParent, 0, false, batch != 0 );
+		}
+		CEntityTable entities;
+		entities.build ( mesh->getEntityList () );
+		CItemBatchSceneNode *items = Q3ModelFactory ( loadParam, device, mesh, entities, 0, false );
+
+		ICameraSceneNode *camera = smgr->addCameraSceneNode ();
+		camera->setFarValue ( 20000.f );
+		Q3StartPosition ( entities, camera, 0, vector3df () );
+
+		IVideoDriver *driver = device->getVideoDriver ();
+		driver->beginScene ( true, true, SColor ( 0, 0, 0, 0 ) );
+		smgr->drawAll ();
+		driver->endScene ();
+
+		SFrameStats stats;
+		getFrameStats ( device, stats );
+
+		printf ( "%s: %u shader nodes built in %.2f ms, %u registered, %u culled, %u draws, %u primitives\n",
+			batch ? "batched   " : "per buffer", shaderParent->getChildren ().size (), ms ( build ),
+			stats.Registered, stats.Culled, stats.DrawCalls, stats.Primitives );
+
+		if ( batch && items )
+			printf ( "items     : %u instances of %u distinct meshes, %u buffer draws\n",
+				items->getInstanceCount (), items->getModelCount (), items->getDrawCalls () );
+
+		device->closeDevice ();
+		device->drop ();
+	}
+}
+
+
+/*
+	SVarGroup lookups against the interned flat hash, over every stage of
+	every shader script of each shipped map
+*/
+static void benchVarLookup ( const core::array < path > &archives )
+{
+	printf ( "\n-- shader variable lookup\n" );
+
+	static const c8 * key[] =
+	{
+		"map", "clampmap", "animmap", "blendfunc", "rgbgen", "alphagen", "tcgen", "tcmod",
+		"alphafunc", "depthwrite", "depthfunc", "deformvertexes", "surfaceparm", "cull",
+		"sort", "nomipmaps", "skyparms", "qer_editorimage", 0
+	};
+
+	u32 symbols[32];
+	u32 keyCount = 0;
+	for ( ; key[keyCount]; ++keyCount )
+		symbols[keyCount] = symbol ( key[keyCount] );
+
+	for ( u32 a = 0; a != archives.size (); ++a )
+	{
+		IrrlichtDevice *device = createNullDevice ();
+		if ( 0 == device )
+			return;
+
+		IFileSystem *fs = device->getFileSystem ();
+		IArchiveLoader *loader = new CArchiveLoaderMappedZip ( fs );
+		fs->addArchiveLoader ( loader );
+		loader->drop ();
+		fs->addFileArchive ( archives[a], true, false );
+
+		const path map = findMap ( fs );
+		Q3LevelLoadParameter loadParam;
+		loadParam.loadAllShaders = 1;
+		IQ3LevelMesh *mesh = loadMap ( device, map, loadParam );
+		if ( 0 == mesh )
+		{
+			device->closeDevice ();
+			device->drop ();
+			continue;
+		}
+
+		core::array < const SVarGroup* > group;
+		u32 shaderCount = 0;
+		for ( const IShader *shader; 0 != ( shader = mesh->getShader ( shaderCount ) ); ++shaderCount )
+		{
+			for ( u32 g = 0; g != shader->getGroupSize (); ++g )
+				group.push_back ( shader->getGroup ( g ) );
+		}
+
+		const u32 rounds = 20;
+		const u32 lookups = rounds * group.size () * keyCount * 2;
+		u32 found = 0;
+
+#ifdef ALLOCATION_HOOK
+		const u32 heapAlloc = HeapAllocations;
+#endif
+		u64 stock = 0;
+		{
+			SScopeTimer t ( stock );
+			for ( u32 r = 0; r != rounds; ++r )
+				for ( u32 g = 0; g != group.size (); ++g )
+					for ( u32 k = 0; k != keyCount; ++k )
+						found += group[g]->get ( key[k] ).size () + group[g]->isDefined ( key[k] );
+		}
+		c8 stockAlloc[48];
+#ifdef ALLOCATION_HOOK
+		snprintf ( stockAlloc, sizeof ( stockAlloc ), "%u allocations", (u32) ( HeapAllocations - heapAlloc ) );
+#else
+		snprintf ( stockAlloc, sizeof ( stockAlloc ), "allocations not counted" );
+#endif
+
+		core::array < CVarTable > table;
+		table.reallocate ( group.size () );
+		u32 alloc = getAllocationCount ();
+		u64 build = 0;
+		{
+			SScopeTimer t ( build );
+			for ( u32 g = 0; g != group.size (); ++g )
+				table.push_back ( CVarTable ( group[g] ) );
+		}
+		const u32 buildAlloc = getAllocationCount () - alloc;
+
+		alloc = getAllocationCount ();
+		u64 hashed = 0;
+		{
+			SScopeTimer t ( hashed );
+			for ( u32 r = 0; r != rounds; ++r )
+				for ( u32 g = 0; g != table.size (); ++g )
+					for ( u32 k = 0; k != keyCount; ++k )
+						found -= table[g].get ( symbols[k] ).size () + table[g].isDefined ( symbols[k] );
+		}
+		const u32 hashedAlloc = getAllocationCount () - alloc;
+
+		printf ( "%s: %u shaders, %u variable groups%s\n",
+			map.c_str (), shaderCount, group.size (), found ? ", RESULTS DIFFER" : "" );
+		printf ( "  SVarGroup: %.2f M lookups/s, %s\n",
+			lookups / ( stock ? (f32) stock : 1.f ), stockAlloc );
+		printf ( "  CVarTable: %.2f M lookups/s, %u allocations, built in %.2f ms, %u allocations\n",
+			lookups / ( hashed ? (f32) hashed : 1.f ), hashedAlloc, ms ( build ), buildAlloc );
+
+		device->closeDevice ();
+		device->drop ();
+	}
+}
+
+
+// heap held by the shader list of the level mesh, strings counted with their terminator
+static u32 getShaderListBytes ( IQ3LevelMesh *mesh, u32 &shaderCount )
+{
+	u32 bytes = 0;
+	shaderCount = 0;
+	for ( const IShader *shader; 0 != ( shader = mesh->getShader ( shaderCount ) ); ++shaderCount )
+	{
+		bytes += sizeof ( IShader ) + shader->name.size () + 1;
+		for ( u32 g = 0; g != shader->getGroupSize (); ++g )
+		{
+			const SVarGroup *group = shader->getGroup ( g );
+			bytes += sizeof ( SVarGroup ) + group->Variable.allocated_size () * sizeof ( SVariable );
+			for ( u32 v = 0; v != group->Variable.size (); ++v )
+				bytes += group->Variable[v].name.size () + group->Variable[v].content.size () + 2;
+		}
+	}
+	return bytes;
+}
+
+/*
+	all shader scripts of the shipped maps: the irrlicht loader against the
+	zero copy parser, serial and on the worker pool
+*/
+static void benchShaderScripts ( const core::array < path > &archives )
+{
+	printf ( "\n-- shader scripts\n" );
+
+	u64 loadTime[2] = { 0, 0 };
+	u32 stockBytes = 0;
+	u32 stockCount = 0;
+	for ( u32 all = 0; all != 2; ++all )
+	{
+		IrrlichtDevice *device = createNullDevice ();
+		if ( 0 == device )
+			return;
+
+		IFileSystem *fs = device->getFileSystem ();
+		IArchiveLoader *loader = new CArchiveLoaderMappedZip ( fs );
+		fs->addArchiveLoader ( loader );
+		loader->drop ();
+		for ( u32 i = 0; i != archives.size (); ++i )
+			fs->addFileArchive ( archives[i], true, false );
+
+		Q3LevelLoadParameter loadParam;
+		loadParam.loadAllShaders = all;
+		IQ3LevelMesh *mesh;
+		{
+			SScopeTimer t ( loadTime[all] );
+			mesh = loadMap ( device, findMap ( fs ), loadParam );
+		}
+		if ( all && mesh )
+			stockBytes = getShaderListBytes ( mesh, stockCount );
+
+		device->closeDevice ();
+		device->drop ();
+	}
+
+	printf ( "irrlicht : %u shaders, scripts add %.2f ms to the map load, ~%u KB shader list\n",
+		stockCount, ms ( loadTime[1] > loadTime[0] ? loadTime[1] - loadTime[0] : 0 ), stockBytes >> 10 );
+
+	IrrlichtDevice *device = createNullDevice ();
+	if ( 0 == device )
+		return;
+
+	IFileSystem *fs = device->getFileSystem ();
+	IArchiveLoader *loader = new CArchiveLoaderMappedZip ( fs );
+	fs->addArchiveLoader ( loader );
+	loader->drop ();
+	for ( u32 i = 0; i != archives.size (); ++i )
+		fs->addFileArchive ( archives[i], true, false );
+
+	static const c8 * passName[] = { "serial  ", "parallel" };
+	for ( u32 parallel = 0; parallel != 2; ++parallel )
+	{
+		CShaderLibrary library;
+		const u32 alloc = getAllocationCount ();
+		u64 parse = 0;
+		{
+			SScopeTimer t ( parse );
+			library.loadScripts ( fs, parallel != 0 );
+		}
+
+		printf ( "%s: %u shaders from %u scripts in %.2f ms, %u KB, %u allocations, %u scripts with errors\n",
+			passName[parallel], library.getShaderCount (), library.getScriptCount (), ms ( parse ),
+			library.getMemoryUsage () >> 10, getAllocationCount () - alloc, library.getErrorCount () );
+	}
+
+	device->closeDevice ();
+	device->drop ();
+}
+
+
+/*
+	batch waveforms against SModifierFunction::evaluate: accuracy over
+	random phases and throughput for a deformVertexes sized array
+*/
+static void benchWaveform ()
+{
+	printf ( "\n-- waveform\n" );
+
+	static const eQ3ModifierFunction func[] = { SINUS, COSINUS, SQUARE, TRIANGLE, SAWTOOTH, SAWTOOTH_INVERSE };
+	static const c8 * funcName[] = { "sin", "cos", "square", "triangle", "sawtooth", "inversesawtooth" };
+
+	const u32 count = 65536;
+	core::array < f32 > offset;
+	core::array < f32 > out;
+	offset.set_used ( count );
+	out.set_used ( count );
+
+	u32 seed = 0x69666966;
+	for ( u32 i = 0; i != count; ++i )
+	{
+		seed = seed * 1664525 + 1013904223;
+		offset[i] = ( seed >> 8 ) * ( 16.f / 16777216.f ) - 8.f;
+	}
+
+	const u32 rounds = 50;
+	for ( u32 k = 0; k != sizeof ( func ) / sizeof ( func[0] ); ++k )
+	{
+		SModifierFunction f;
+		f.func = func[k];
+		f.base = 0.5f;
+		f.amp = 2.f;
+		f.phase = 0.25f;
+		f.frequency = 1.7f;
+		const f32 dt = 12.345f;
+
+		// the discontinuous waves may flip where the phase sum rounds differently
+		evaluateWaveform ( f, dt, offset.const_pointer (), out.pointer (), count );
+		f32 maxError = 0.f;
+		u32 flips = 0;
+		for ( u32 i = 0; i != count; ++i )
+		{
+			const f32 e = fabsf ( out[i] - f.evaluate ( dt + offset[i] ) );
+			if ( e > 0.01f )
+				flips += 1;
+			else
+				maxError = core::max_ ( maxError, e );
+		}
+		const bool pass = maxError < 1e-4f * f.amp && flips * 1000 < count;
+
+		f32 sum = 0.f;
+		u64 scalar = 0;
+		{
+			SScopeTimer t ( scalar );
+			for ( u32 r = 0; r != rounds; ++r )
+				for ( u32 i = 0; i != count; ++i )
+					sum += f.evaluate ( dt + r + offset[i] );
+		}
+
+		u64 batch = 0;
+		{
+			SScopeTimer t ( batch );
+			for ( u32 r = 0; r != rounds; ++r )
+			{
+				evaluateWaveform ( f, dt + r, offset.const_pointer (), out.pointer (), count );
+				sum -= out[r];
+			}
+		}
+
+		const f32 values = (f32) rounds * count;
+		printf ( "%-16s: %s max error %.2e, %u flips, scalar %.1f M/s, batch %.1f M/s%s\n",
+			funcName[k], pass ? "PASS" : "FAIL", maxError, flips,
+			values / ( scalar ? scalar : 1 ), values / ( batch ? batch : 1 ), sum == 12345.f ? " " : "" );
+	}
+}
+
+/*
+	random streams: bulk fill against next (), the same numbers from
+	forked job streams on the worker pool as serial, and throughput
+*/
+static void benchRandom ()
+{
+	printf ( "\n-- random\n" );
+
+	const u32 jobs = 64;
+	const u32 perJob = 16384;
+	const u32 count = jobs * perJob;
+
+	core::array < f32 > serial;
+	core::array < f32 > parallel;
+	serial.set_used ( count );
+	parallel.set_used ( count );
+
+	CRandom root ( 0x69666966, RANDOM_PARTICLE );
+
+	CRandom a = root.fork ( 7 );
+	CRandom b = root.fork ( 7 );
+	bool same = true;
+	for ( u32 i = 0; i != perJob; ++i )
+		serial[i] = a.frand ( -1.f, 1.f );
+	b.fill ( parallel.pointer (), perJob, -1.f, 1.f );
+	for ( u32 i = 0; i != perJob; ++i )
+		same &= serial[i] == parallel[i];
+	printf ( "fill = next      : %s\n", same ? "PASS" : "FAIL" );
+
+	u64 serialTime = 0;
+	{
+		SScopeTimer t ( serialTime );
+		for ( u32 j = 0; j != jobs; ++j )
+		{
+			CRandom r = root.fork ( j );
+			r.fill ( serial.pointer () + j * perJob, perJob );
+		}
+	}
+
+	u64 parallelTime = 0;
+	{
+		SScopeTimer t ( parallelTime );
+		f32 *out = parallel.pointer ();
+		for ( u32 j = 0; j != jobs; ++j )
+		{
+			getWorkerPool ()->push ( [&root, out, j, perJob] ()
+			{
+				CRandom r = root.fork ( j );
+				r.fill ( out + j * perJob, perJob );
+			} );
+		}
+		getWorkerPool ()->wait ();
+	}
+
+	same = memcmp ( serial.const_pointer (), parallel.const_pointer (), count * sizeof ( f32 ) ) == 0;
+	printf ( "jobs on %u threads: %s\n", getWorkerPool ()->getThreadCount (), same ? "PASS" : "FAIL" );
+
+	// mean and bucket spread of the serial fill
+	u32 bucket[16] = { 0 };
+	f64 sum = 0.0;
+	for ( u32 i = 0; i != count; ++i )
+	{
+		sum += serial[i];
+		bucket [ (u32) ( serial[i] * 16.f ) ] += 1;
+	}
+	u32 low = count;
+	u32 high = 0;
+	for ( u32 i = 0; i != 16; ++i )
+	{
+		low = core::min_ ( low, bucket[i] );
+		high = core::max_ ( high, bucket[i] );
+	}
+	printf ( "mean %.4f, buckets %u..%u of %u\n", sum / count, low, high, count / 16 );
+
+	u64 nextTime = 0;
+	u32 x = 0;
+	{
+		SScopeTimer t ( nextTime );
+		CRandom r = root.fork ( 0 );
+		for ( u32 i = 0; i != count; ++i )
+			x += r.next ();
+	}
+	printf ( "next %.1f M/s, fill %.1f M/s, %u jobs %.1f M/s%s\n",
+		(f32) count / ( nextTime ? nextTime : 1 ),
+		(f32) count / ( serialTime ? serialTime : 1 ),
+		jobs, (f32) count / ( parallelTime ? parallelTime : 1 ), x == 12345 ? " " : "" );
+}
+
+
+/*
+	spatial hash with 10k moving entities: update per tick, radius
+	queries from jobs on the worker pool while the grid is read only,
+	checked against a brute force scan
+*/
+static void benchSpatialHash ()
+{
+	printf ( "\n-- spatial hash\n" );
+
+	const u32 count = 10000;
+	const u32 ticks = 30;
+	const u32 queries = 1000;
+	const f32 dt = 1.f / 30.f;
+	const f32 range = 200.f;
+
+	core::array < vector3df > pos;
+	core::array < vector3df > vel;
+	core::array < f32 > radius;
+	pos.set_used ( count );
+	vel.set_used ( count );
+	radius.set_used ( count );
+
+	CSpatialHash hash ( 128.f );
+	CRandom r ( 0x69666966, RANDOM_AI );
+	for ( u32 i = 0; i != count; ++i )
+	{
+		pos[i].set ( r.frand ( -4096.f, 4096.f ), r.frand ( -256.f, 512.f ), r.frand ( -4096.f, 4096.f ) );
+		vel[i].set ( r.frand ( -320.f, 320.f ), 0.f, r.frand ( -320.f, 320.f ) );
+		radius[i] = r.frand ( 8.f, 48.f );
+		hash.add ( pos[i], radius[i] );
+	}
+
+	u64 updateTime = 0;
+	u64 queryTime = 0;
+	u64 bruteTime = 0;
+	u32 found = 0;
+	u32 bruteFound = 0;
+
+	const u32 jobs = 16;
+	core::array < u32 > jobFound;
+	jobFound.set_used ( jobs );
+
+	for ( u32 tick = 0; tick != ticks; ++tick )
+	{
+		{
+			SScopeTimer t ( updateTime );
+			for ( u32 i = 0; i != count; ++i )
+			{
+				pos[i] += vel[i] * dt;
+				hash.move ( i, pos[i] );
+			}
+			hash.update ();
+		}
+
+		{
+			SScopeTimer t ( queryTime );
+			const CSpatialHash *grid = &hash;
+			const vector3df *p = pos.const_pointer ();
+			u32 *out = jobFound.pointer ();
+			for ( u32 j = 0; j != jobs; ++j )
+			{
+				getWorkerPool ()->push ( [grid, p, out, j, jobs, queries, range] ()
+				{
+					core::array < u32 > near;
+					u32 n = 0;
+					for ( u32 q = j; q < queries; q += jobs )
+					{
+						near.set_used ( 0 );
+						n += grid->queryRadius ( p[q], range, near );
+					}
+					out[j] = n;
+				} );
+			}
+			getWorkerPool ()->wait ();
+		}
+		for ( u32 j = 0; j != jobs; ++j )
+			found += jobFound[j];
+
+		{
+			SScopeTimer t ( bruteTime );
+			for ( u32 q = 0; q != queries; ++q )
+			{
+				for ( u32 i = 0; i != count; ++i )
+				{
+					const f32 reach = range + radius[i];
+					if ( pos[i].getDistanceFromSQ ( pos[q] ) <= reach * reach )
+						bruteFound += 1;
+				}
+			}
+		}
+	}
+
+	printf ( "queries = brute  : %s ( %u found )\n", found == bruteFound ? "PASS" : "FAIL", found );
+	printf ( "update %.3f ms/tick, %u KB\n", ms ( updateTime ) / ticks, hash.getMemoryFootprint () >> 10 );
+	printf ( "%u radius queries on %u threads %.3f ms/tick, brute force %.3f ms/tick\n",
+		queries, getWorkerPool ()->getThreadCount (), ms ( queryTime ) / ticks, ms ( bruteTime ) / ticks );
+
+	// hit scan from the first entities through the crowd
+	u64 rayTime = 0;
+	u32 hits = 0;
+	{
+		SScopeTimer t ( rayTime );
+		for ( u32 q = 0; q != queries; ++q )
+		{
+			vector3df dir = vel[q];
+			dir.normalize ();
+			const line3df ray ( pos[q], pos[q] + dir * 2048.f );
+			f32 at;
+			u32 id;
+			if ( hash.raycast ( ray, at, id, q ) )
+				hits += 1;
+		}
+	}
+	printf ( "%u raycasts of 2048 units %.3f ms, %u hits\n", queries, ms ( rayTime ), hits );
+}
+
+
+/*
+	100k boxes against a frustum, one classifyPlaneRelation loop per box
+	like the scene nodes do against the batch of eight boxes per plane
+*/
+static void benchCulling ()
+{
+	printf ( "\n-- frustum culling\n" );
+
+	const u32 count = 100000;
+	const u32 frames = 100;
+
+	core::array < aabbox3df > box;
+	box.reallocate ( count );
+	CBoxCuller culler;
+	CRandom r ( 0x69666966, RANDOM_AI );
+	for ( u32 i = 0; i != count; ++i )
+	{
+		const vector3df center ( r.frand ( -8192.f, 8192.f ), r.frand ( -1024.f, 1024.f ), r.frand ( -8192.f, 8192.f ) );
+		const vector3df extent ( r.frand ( 4.f, 128.f ), r.frand ( 4.f, 128.f ), r.frand ( 4.f, 128.f ) );
+		box.push_back ( aabbox3df ( center - extent, center + extent ) );
+		culler.add ( box[i] );
+	}
+
+	matrix4 projection;
+	projection.buildProjectionMatrixPerspectiveFovLH ( core::PI / 2.5f, 4.f / 3.f, 1.f, 8000.f );
+
+	core::array < u32 > mask;
+	core::array < u32 > reference;
+	u64 nodeTime = 0;
+	u64 scalarTime = 0;
+	u64 batchTime = 0;
+	u32 nodeVisible = 0;
+	u32 batchVisible = 0;
+	bool same = true;
+
+	for ( u32 f = 0; f != frames; ++f )
+	{
+		// turning on the spot
+		const f32 angle = f * ( 2.f * core::PI / frames );
+		matrix4 view;
+		view.buildCameraLookAtMatrixLH ( vector3df ( 0.f ), vector3df ( cosf ( angle ), 0.f, sinf ( angle ) ),
+			vector3df ( 0.f, 1.f, 0.f ) );
+		const SViewFrustum frustum ( projection * view );
+
+		{
+			SScopeTimer t ( nodeTime );
+			for ( u32 i = 0; i != count; ++i )
+			{
+				bool visible = true;
+				for ( u32 p = 0; visible && p != SViewFrustum::VF_PLANE_COUNT; ++p )
+					visible = box[i].classifyPlaneRelation ( frustum.planes[p] ) != ISREL3D_FRONT;
+				nodeVisible += visible ? 1 : 0;
+			}
+		}
+		{
+			SScopeTimer t ( scalarTime );
+			culler.cullScalar ( frustum, reference );
+		}
+		{
+			SScopeTimer t ( batchTime );
+			batchVisible += culler.cull ( frustum, mask );
+		}
+
+		for ( u32 w = 0; w != mask.size (); ++w )
+			same = same && mask[w] == reference[w];
+	}
+
+	printf ( "batch = per box  : %s ( %u visible per frame )\n", same && nodeVisible == batchVisible ? "PASS" : "FAIL",
+		batchVisible / frames );
+	printf ( "%u boxes: per box %.3f ms, scalar mask %.3f ms, batch %.3f ms ( %.1fx )\n", count,
+		ms ( nodeTime ) / frames, ms ( scalarTime ) / frames, ms ( batchTime ) / frames,
+		(f32) nodeTime / core::max_ ( batchTime, (u64) 1 ) );
+}
+
+
+/*
+	camera facing quads with SSE2 against the plain loop, then a frame of
+	bullets as billboard nodes against the sprite batch on the null driver
+*/
+static void benchSprites ()
+{
+	printf ( "\n-- sprite batch\n" );
+
+	const u32 count = 20000;
+	const u32 passes = 50;
+	core::array < f32 > x, y, z, size;
+	core::array < u32 > color;
+	CRandom r ( 0x69666966, RANDOM_PARTICLE );
+	for ( u32 i = 0; i != count; ++i )
+	{
+		x.push_back ( r.frand ( -512.f, 512.f ) );
+		y.push_back ( r.frand ( -512.f, 512.f ) );
+		z.push_back ( r.frand ( 16.f, 1024.f ) );
+		size.push_back ( r.frand ( 1.f, 10.f ) );
+		color.push_back ( r.next () );
+	}
+
+	const vector3df right = vector3df ( 1.f, 0.f, 0.2f ).normalize ();
+	const vector3df up = vector3df ( 0.f, 1.f, 0.f );
+	const vector3df normal = right.crossProduct ( up );
+
+	core::array < S3DVertex > batch, scalar;
+	batch.set_used ( count * 4 );
+	scalar.set_used ( count * 4 );
+	u64 batchTime = 0, scalarTime = 0;
+	for ( u32 pass = 0; pass != passes; ++pass )
+	{
+		{
+			SScopeTimer t ( scalarTime );
+			CSpriteBatchSceneNode::buildQuadsScalar ( x.const_pointer (), y.const_pointer (), z.const_pointer (),
+				size.const_pointer (), color.const_pointer (), count, right, up, normal, scalar.pointer () );
+		}
+		{
+			SScopeTimer t ( batchTime );
+			CSpriteBatchSceneNode::buildQuads ( x.const_pointer (), y.const_pointer (), z.const_pointer (),
+				size.const_pointer (), color.const_pointer (), count, right, up, normal, batch.pointer () );
+		}
+	}
+
+	bool same = true;
+	for ( u32 i = 0; i != batch.size () && same; ++i )
+		same = batch[i] == scalar[i];
+	printf ( "sse2 = scalar    : %s\n", same ? "PASS" : "FAIL" );
+
+	// the group materials cull back faces, every quad has to face the camera
+	static const vector3df eye[] = { vector3df ( 0.f, 0.f, -100.f ), vector3df ( 100.f, 40.f, 0.f ), vector3df ( -30.f, 90.f, 70.f ) };
+	bool front = true;
+	for ( u32 e = 0; e != sizeof ( eye ) / sizeof ( eye[0] ); ++e )
+		front &= CSpriteBatchSceneNode::isFrontFacing ( eye[e], vector3df ( 0.f ), vector3df ( 0.f, 1.f, 0.f ) );
+	printf ( "front facing     : %s\n", front ? "PASS" : "FAIL" );
+	printf ( "%u quads: scalar %.3f ms, batch %.3f ms ( %.1fx )\n", count,
+		ms ( scalarTime ) / passes, ms ( batchTime ) / passes, (f32) scalarTime / core::max_ ( batchTime, (u64) 1 ) );
+
+	IrrlichtDevice *device = createNullDevice ();
+	if ( 0 == device )
+		return;
+
+	ISceneManager *smgr = device->getSceneManager ();
+	IVideoDriver *driver = device->getVideoDriver ();
+	smgr->addCameraSceneNode ( 0, vector3df ( 0.f ), vector3df ( 0.f, 0.f, 1.f ) );
+
+	ITexture *texture[2];
+	texture[0] = driver->addTexture ( dimension2du ( 64, 64 ), "bullet" );
+	texture[1] = driver->addTexture ( dimension2du ( 64, 64 ), "smoke" );
+
+	const u32 bullets = 2000;
+	const u32 frames = 20;
+	for ( u32 mode = 0; mode != 2; ++mode )
+	{
+		ISceneNode *parent = smgr->addEmptySceneNode ();
+		CSpriteBatchSceneNode *sprites = 0;
+		if ( mode )
+		{
+			sprites = new CSpriteBatchSceneNode ( parent, smgr );
+			sprites->drop ();
+		}
+
+		for ( u32 i = 0; i != bullets; ++i )
+		{
+			const vector3df start ( r.frand ( -200.f, 200.f ), r.frand ( -200.f, 200.f ), r.frand ( 50.f, 500.f ) );
+			if ( sprites )
+				sprites->addSprite ( texture[i & 1], EMT_TRANSPARENT_ADD_COLOR, 10.f, start, start + vector3df ( 0.f, 0.f, 1000.f ),
+					device->getTimer ()->getTime (), 1000000 );
+			else
+			{
+				ISceneNode *node = smgr->addBillboardSceneNode ( parent, dimension2d<f32> ( 10.f, 10.f ), start );
+				node->setMaterialFlag ( EMF_LIGHTING, false );
+				node->setMaterialTexture ( 0, texture[i & 1] );
+				node->setMaterialFlag ( EMF_ZWRITE_ENABLE, false );
+				node->setMaterialType ( EMT_TRANSPARENT_ADD_COLOR );
+			}
+		}
+
+		u64 frameTime = 0;
+		for ( u32 f = 0; f != frames; ++f )
+		{
+			device->getTimer ()->tick ();
+			SScopeTimer t ( frameTime );
+			driver->beginScene ( true, true, SColor ( 0 ) );
+			smgr->drawAll ();
+			driver->endScene ();
+		}
+
+		printf ( "%u bullets as %s: %u draws, %.3f ms per frame\n", bullets, mode ? "sprite batch" : "billboard nodes",
+			mode ? sprites->getDrawCalls () : bullets, ms ( frameTime ) / frames );
+		parent->remove ();
+	}
+
+	device->closeDevice ();
+	device->drop ();
+}
+
+
+/*
+	drawAll over groups of cube nodes under empty parents, walked by the
+	scene manager against the same groups below the parallel node. the null
+	driver draws nothing, what is left is traversal and culling
+*/
+static void benchTraversal ()
+{
+	printf ( "\n-- parallel traversal\n" );
+
+	IrrlichtDevice *device = createNullDevice ();
+	if ( 0 == device )
+		return;
+
+	ISceneManager *smgr = device->getSceneManager ();
+	IVideoDriver *driver = device->getVideoDriver ();
+	ICameraSceneNode *camera = smgr->addCameraSceneNode ( 0, vector3df ( 0.f ), vector3df ( 0.f, 0.f, 1.f ) );
+	camera->setFarValue ( 4000.f );
+
+	const u32 groups = 8;
+	const u32 nodes = 20000;
+	const u32 frames = 20;
+	CRandom r ( 0x69666966, RANDOM_AI );
+
+	for ( u32 mode = 0; mode != 2; ++mode )
+	{
+		CParallelSceneNode *parallel = 0;
+		ISceneNode *top = smgr->getRootSceneNode ();
+		if ( mode )
+		{
+			parallel = new CParallelSceneNode ( top, smgr );
+			parallel->drop ();
+			top = parallel;
+		}
+
+		core::array < ISceneNode* > parent;
+		for ( u32 g = 0; g != groups; ++g )
+			parent.push_back ( smgr->addEmptySceneNode ( top ) );
+
+		for ( u32 i = 0; i != nodes; ++i )
+		{
+			const vector3df pos ( r.frand ( -4000.f, 4000.f ), r.frand ( -500.f, 500.f ), r.frand ( -4000.f, 4000.f ) );
+			ISceneNode *node = smgr->addCubeSceneNode ( 8.f, parent[i % groups], -1, pos );
+			node->setAutomaticCulling ( EAC_FRUSTUM_BOX );
+		}
+
+		u64 frameTime = 0;
+		for ( u32 f = 0; f != frames; ++f )
+		{
+			// turning on the spot
+			const f32 angle = f * ( 2.f * core::PI / frames );
+			camera->setTarget ( vector3df ( cosf ( angle ), 0.f, sinf ( angle ) ) );
+
+			device->getTimer ()->tick ();
+			SScopeTimer t ( frameTime );
+			driver->beginScene ( true, true, SColor ( 0 ) );
+			smgr->drawAll ();
+			driver->endScene ();
+		}
+
+		SFrameStats stats;
+		getFrameStats ( device, stats );
+		if ( parallel )
+		{
+			const SParallelStats &p = parallel->getStats ();
+			printf ( "parallel node   : %.3f ms per frame, %u registered, %u culled on %u chunks ( animate %.3f ms, cull %.3f ms )\n",
+				ms ( frameTime ) / frames, p.Registered, p.Culled, p.Chunks, ms ( p.AnimateMicro ), ms ( p.CullMicro ) );
+			parallel->remove ();
+		}
+		else
+		{
+			printf ( "scene manager   : %.3f ms per frame, %u registered, %u culled\n",
+				ms ( frameTime ) / frames, stats.Registered, stats.Culled );
+			for ( u32 g = 0; g != groups; ++g )
+				parent[g]->remove ();
+		}
+	}
+
+	device->closeDevice ();
+	device->drop ();
+}
+
+
+//! key and draw for the comparison sort
+struct SQueueEntry
+{
+	u64 Key;
+	u32 Index;
+
+	bool operator< ( const SQueueEntry &o ) const
+	{
+		return Key != o.Key ? Key < o.Key : Index < o.Index;
+	}
+};
+
+/*
+	a frame of draws in submit order, the keys packed like the render queue
+	does. the radix sort against the heap sort of core::array, and the
+	state switches of both orders
+*/
+static void benchRenderQueue ()
+{
+	printf ( "\n-- render queue\n" );
+
+	const u32 count = 4096;
+	const u32 frames = 100;
+	const u32 states = 300;
+
+	CRandom r ( 0x69666966, RANDOM_AI );
+	core::array < u64 > submitted;
+	submitted.reallocate ( count );
+	for ( u32 i = 0; i != count; ++i )
+	{
+		const u64 state = r.rand ( states ) + 1;
+		const u64 depth = r.rand ( 1 << 19 );
+		if ( r.rand ( 5 ) )
+			submitted.push_back ( state << 19 | depth );
+		else
+			submitted.push_back ( 1ull << 63 | ( ( 1 << 19 ) - 1 - depth ) << 44 | state );
+	}
+
+	core::array < u64 > key, keyTemp;
+	core::array < u32 > index, indexTemp;
+	core::array < SQueueEntry > entry;
+	u64 radixTime = 0, heapTime = 0;
+	bool same = true;
+
+	for ( u32 f = 0; f != frames; ++f )
+	{
+		{
+			SScopeTimer t ( radixTime );
+			key = submitted;
+			index.set_used ( count );
+			for ( u32 i = 0; i != count; ++i )
+				index[i] = i;
+			CRenderQueueSceneNode::sortKeys ( key, index, keyTemp, indexTemp );
+		}
+		{
+			SScopeTimer t ( heapTime );
+			entry.set_used ( count );
+			for ( u32 i = 0; i != count; ++i )
+			{
+				entry[i].Key = submitted[i];
+				entry[i].Index = i;
+			}
+			// the array still thinks it is sorted from the last frame
+			entry.set_sorted ( false );
+			entry.sort ();
+		}
+
+		// the radix sort is stable, ties keep the submit order like the tiebreak
+		for ( u32 i = 0; i != count; ++i )
+			same = same && key[i] == entry[i].Key && index[i] == entry[i].Index;
+	}
+
+	u32 submitSwitches = 0, sortedSwitches = 0;
+	u64 lastSubmit = ~0ull, lastSorted = ~0ull;
+	for ( u32 i = 0; i != count; ++i )
+	{
+		const u64 a = submitted[i] >> 63 ? submitted[i] & 0xFFFFFFFFFFFull : submitted[i] >> 19;
+		const u64 b = key[i] >> 63 ? key[i] & 0xFFFFFFFFFFFull : key[i] >> 19;
+		submitSwitches += a != lastSubmit ? 1 : 0;
+		sortedSwitches += b != lastSorted ? 1 : 0;
+		lastSubmit = a;
+		lastSorted = b;
+	}
+
+	printf ( "radix = heap sort: %s\n", same ? "PASS" : "FAIL" );
+	printf ( "%u draws: radix %.3f ms, heap sort %.3f ms ( %.1fx )\n", count,
+		ms ( radixTime ) / frames, ms ( heapTime ) / frames, (f32) heapTime / core::max_ ( radixTime, (u64) 1 ) );
+	printf ( "state switches of %u states: %u in submit order, %u sorted\n", states, submitSwitches, sortedSwitches );
+}
+
+
+/*
+	job system: the cost of a job spawned from the main thread and from
+	inside a job, the main thread affinity round trip, and a parallel
+	loop on 2 to 32 threads against the same loop on one
+*/
+static void jobWork ( f32 *out, u32 first, u32 last )
+{
+	for ( u32 i = first; i != last; ++i )
+	{
+		f32 x = (f32) i;
+		for ( u32 k = 0; k != 32; ++k )
+			x = x * 0.999f + 0.5f;
+		out[i] = x;
+	}
+}
+
+static void benchJobs ()
+{
+	printf ( "\n-- jobs\n" );
+
+	CJobSystem *system = getJobSystem ();
+	system->setProfiling ( false );
+
+	const u32 jobs = 100000;
+	const u32 parents = 64;
+	std::atomic < u32 > ran ( 0 );
+	std::atomic < u32 > * const counter = &ran;
+
+	u64 mainTime = 0;
+	{
+		SScopeTimer t ( mainTime );
+		SJobCounter done;
+		for ( u32 i = 0; i != jobs; ++i )
+			system->spawn ( [counter] () { *counter += 1; }, &done );
+		system->wait ( done );
+	}
+
+	// the children go to the deque of the worker, idle workers steal them
+	u64 workerTime = 0;
+	{
+		SScopeTimer t ( workerTime );
+		SJobCounter done;
+		for ( u32 p = 0; p != parents; ++p )
+		{
+			system->spawn ( [system, counter, jobs, parents] ()
+			{
+				SJobCounter children;
+				for ( u32 i = 0; i != jobs / parents; ++i )
+					system->spawn ( [counter] () { *counter += 1; }, &children );
+				system->wait ( children );
+			}, &done );
+		}
+		system->wait ( done );
+	}
+
+	// a worker hands irrlicht work to the main thread, which runs it while waiting
+	const u32 trips = 1000;
+	u64 mainAffinity = 0;
+	bool onMain = true;
+	{
+		SScopeTimer t ( mainAffinity );
+		SJobCounter done;
+		bool *check = &onMain;
+		for ( u32 i = 0; i != trips; ++i )
+		{
+			system->spawn ( [system, counter, check, &done] ()
+			{
+				system->spawnMain ( [system, counter, check] ()
+				{
+					*check &= system->isMainThread ();
+					*counter += 1;
+				}, &done );
+			}, &done );
+		}
+		system->wait ( done );
+	}
+
+	system->setProfiling ( true );
+	const u32 expected = jobs + ( jobs / parents ) * parents + trips;
+	printf ( "spawn: %.0f ns/job from the main thread, %.0f ns/job from jobs, %.2f us per main thread round trip %s\n",
+		mainTime * 1000.f / jobs, workerTime * 1000.f / ( parents + ( jobs / parents ) * parents ),
+		(f32) mainAffinity / trips, ran.load () == expected && onMain ? "PASS" : "FAIL" );
+
+	const u32 count = 1 << 21;
+	const u32 grain = 4096;
+	const u32 rounds = 4;
+	core::array < f32 > out;
+	out.set_used ( count );
+	f32 *o = out.pointer ();
+
+	// the same call for both, a direct call would be inlined and vectorized differently
+	const tRangeJob body = [o] ( u32 first, u32 last ) { jobWork ( o, first, last ); };
+
+	u64 serial = 0;
+	{
+		SScopeTimer t ( serial );
+		for ( u32 r = 0; r != rounds; ++r )
+			body ( 0, count );
+	}
+	const f32 reference = o [ count - 1 ];
+	printf ( "parallel for of %u items, %u rounds. the game runs %u threads\n", count, rounds, system->getThreadCount () + 1 );
+	printf ( " 1 thread : %.2f ms\n", ms ( serial ) / rounds );
+
+	for ( u32 threads = 2; threads <= 32; threads *= 2 )
+	{
+		CJobSystem scaled ( threads - 1 );
+		u64 time = 0;
+		{
+			SScopeTimer t ( time );
+			for ( u32 r = 0; r != rounds; ++r )
+				scaled.parallelFor ( 0, count, grain, body );
+		}
+
+		SJobStats stats;
+		scaled.getStats ( stats );
+		printf ( "%2u threads: %.2f ms, speedup %.2f, %u jobs, %u stolen %s\n",
+			threads, ms ( time ) / rounds, (f32) serial / core::max_ ( time, (u64) 1 ),
+			stats.Jobs, stats.Steals, o [ count - 1 ] == reference ? "PASS" : "FAIL" );
+	}
+}
+
+
+s32 runBenchmarks ( funcptr_createDeviceEx createDevice )
+{
+	CreateDevice = createDevice;
+#ifdef ALLOCATION_HOOK
+	_CrtSetAllocHook ( countHeapAllocation );
+#endif
+
+	benchWaveform ();
+	benchRandom ();
+	benchSpatialHash ();
+	benchJobs ();
+	benchCulling ();
+	benchRenderQueue ();
+	benchSprites ();
+	benchTraversal ();
+
+	core::array < path > archives;
+	getMapArchives ( archives );
+	if ( archives.empty () )
+	{
+		printf ( "no map archives in maps/maps.txt\n" );
+		return 1;
+	}
+
+	benchArchive ( archives );
+	benchCollision ( archives );
+	benchCharacters ( archives );
+	benchEnemies ( archives );
+	benchNavMesh ( archives );
+	benchVisibility ( archives );
+	benchCompactMesh ( archives );
+	benchLightmapAtlas ( archives );
+	benchBatching ( archives );
+	benchVarLookup ( archives );
+	benchShaderScripts ( archives );
+	return 0;
+}
@@ -0,0 +1,17 @@
+/*!
+	Benchmarks.
+	started with "-bench" on the command line, results go to the console
+
+	Runs on the null driver, so it works on machines without a gpu.
+	Maps are taken from maps/maps.txt like the map browser does.
+*/
+#ifndef __QUAKE3_BENCHMARK__H_INCLUDED__
+#define __QUAKE3_BENCHMARK__H_INCLUDED__
+
+#include <irrlicht.h>
+
+using namespace irr;
+
+s32 runBenchmarks ( funcptr_createDeviceEx createDevice );
+
+#endif // __QUAKE3_BENCHMARK__H_INCLUDED__
@@ -0,0 +1,196 @@
+/*!
+	Box Culler.
+	view frustum test of many boxes at once, the result as a bitmask
+*/
+
+#include "boxcull.h"
+
+#include <string.h>
+#include <math.h>
+
+#if defined(__AVX__)
+#define BOXCULL_AVX
+#include <immintrin.h>
+#elif defined(_M_IX86) || defined(_M_X64) || defined(__SSE2__)
+#define BOXCULL_SSE2
+#include <emmintrin.h>
+#endif
+
+using namespace core;
+using namespace scene;
+
+static inline u32 bitCount ( u32 v )
+{
+	v = v - ( ( v >> 1 ) & 0x55555555 );
+	v = ( v & 0x33333333 ) + ( ( v >> 2 ) & 0x33333333 );
+	return ( ( ( v + ( v >> 4 ) ) & 0x0F0F0F0F ) * 0x01010101 ) >> 24;
+}
+
+CBoxCuller::CBoxCuller ()
+: Count ( 0 )
+{
+}
+
+void CBoxCuller::clear ()
+{
+	CenterX.clear ();
+	CenterY.clear ();
+	CenterZ.clear ();
+	ExtentX.clear ();
+	ExtentY.clear ();
+	ExtentZ.clear ();
+	Count = 0;
+}
+
+// room for one more box, whole blocks of LANES
+void CBoxCuller::grow ()
+{
+	if ( Count < CenterX.size () )
+		return;
+
+	array < f32 > *field[6] = { &CenterX, &CenterY, &CenterZ, &ExtentX, &ExtentY, &ExtentZ };
+	for ( u32 f = 0; f != 6; ++f )
+	{
+		for ( u32 k = 0; k != LANES; ++k )
+			field[f]->push_back ( 0.f );
+	}
+}
+
+u32 CBoxCuller::add ( const aabbox3df &box )
+{
+	grow ();
+	Count += 1;
+	set ( Count - 1, box );
+	return Count - 1;
+}
+
+void CBoxCuller::set ( u32 index, const aabbox3df &box )
+{
+	CenterX[index] = ( box.MinEdge.X + box.MaxEdge.X ) * 0.5f;
+	CenterY[index] = ( box.MinEdge.Y + box.MaxEdge.Y ) * 0.5f;
+	CenterZ[index] = ( box.MinEdge.Z + box.MaxEdge.Z ) * 0.5f;
+	ExtentX[index] = ( box.MaxEdge.X - box.MinEdge.X ) * 0.5f;
+	ExtentY[index] = ( box.MaxEdge.Y - box.MinEdge.Y ) * 0.5f;
+	ExtentZ[index] = ( box.MaxEdge.Z - box.MinEdge.Z ) * 0.5f;
+}
+
+void CBoxCuller::fill ( array < u32 > &mask ) const
+{
+	const u32 words = ( Count + 31 ) >> 5;
+	mask.set_used ( words );
+	for ( u32 w = 0; w != words; ++w )
+		mask[w] = 0xFFFFFFFF;
+	if ( Count & 31 )
+		mask[words - 1] = ( 1u << ( Count & 31 ) ) - 1;
+}
+
+/*
+	a box is outside a plane if its center is further in front than the
+	projected half extent, like aabbox3d::classifyPlaneRelation == ISREL3D_FRONT
+*/
+u32 CBoxCuller::cull ( const SViewFrustum &frustum, array < u32 > &mask ) const
+{
+#if defined(BOXCULL_AVX) || defined(BOXCULL_SSE2)
+	const u32 words = ( Count + 31 ) >> 5;
+	mask.set_used ( words );
+	if ( 0 == words )
+		return 0;
+	memset ( mask.pointer (), 0, words * sizeof ( u32 ) );
+
+	f32 plane[SViewFrustum::VF_PLANE_COUNT][7];
+	for ( u32 p = 0; p != SViewFrustum::VF_PLANE_COUNT; ++p )
+	{
+		const plane3df &f = frustum.planes[p];
+		plane[p][0] = f.Normal.X;
+		plane[p][1] = f.Normal.Y;
+		plane[p][2] = f.Normal.Z;
+		plane[p][3] = f.D;
+		plane[p][4] = fabsf ( f.Normal.X );
+		plane[p][5] = fabsf ( f.Normal.Y );
+		plane[p][6] = fabsf ( f.Normal.Z );
+	}
+
+	const f32 *cx = CenterX.const_pointer ();
+	const f32 *cy = CenterY.const_pointer ();
+	const f32 *cz = CenterZ.const_pointer ();
+	const f32 *ex = ExtentX.const_pointer ();
+	const f32 *ey = ExtentY.const_pointer ();
+	const f32 *ez = ExtentZ.const_pointer ();
+
+	for ( u32 i = 0; i < Count; i += LANES )
+	{
+#ifdef BOXCULL_AVX
+		const __m256 x = _mm256_loadu_ps ( cx + i ), y = _mm256_loadu_ps ( cy + i ), z = _mm256_loadu_ps ( cz + i );
+		const __m256 hx = _mm256_loadu_ps ( ex + i ), hy = _mm256_loadu_ps ( ey + i ), hz = _mm256_loadu_ps ( ez + i );
+		__m256 out = _mm256_setzero_ps ();
+		for ( u32 p = 0; p != SViewFrustum::VF_PLANE_COUNT; ++p )
+		{
+			const f32 *f = plane[p];
+			const __m256 d = _mm256_add_ps ( _mm256_add_ps ( _mm256_mul_ps ( x, _mm256_set1_ps ( f[0] ) ),
+								_mm256_mul_ps ( y, _mm256_set1_ps ( f[1] ) ) ),
+								_mm256_add_ps ( _mm256_mul_ps ( z, _mm256_set1_ps ( f[2] ) ), _mm256_set1_ps ( f[3] ) ) );
+			const __m256 r = _mm256_add_ps ( _mm256_add_ps ( _mm256_mul_ps ( hx, _mm256_set1_ps ( f[4] ) ),
+								_mm256_mul_ps ( hy, _mm256_set1_ps ( f[5] ) ) ), _mm256_mul_ps ( hz, _mm256_set1_ps ( f[6] ) ) );
+			out = _mm256_or_ps ( out, _mm256_cmp_ps ( _mm256_sub_ps ( d, r ), _mm256_setzero_ps (), _CMP_GT_OQ ) );
+		}
+		const u32 bits = ~_mm256_movemask_ps ( out ) & 0xFF;
+#else
+		u32 bits = 0;
+		for ( u32 h = 0; h != 2; ++h )
+		{
+			const u32 k = i + h * 4;
+			const __m128 x = _mm_loadu_ps ( cx + k ), y = _mm_loadu_ps ( cy + k ), z = _mm_loadu_ps ( cz + k );
+			const __m128 hx = _mm_loadu_ps ( ex + k ), hy = _mm_loadu_ps ( ey + k ), hz = _mm_loadu_ps ( ez + k );
+			__m128 out = _mm_setzero_ps ();
+			for ( u32 p = 0; p != SViewFrustum::VF_PLANE_COUNT; ++p )
+			{
+				const f32 *f = plane[p];
+				const __m128 d = _mm_add_ps ( _mm_add_ps ( _mm_mul_ps ( x, _mm_set1_ps ( f[0] ) ), _mm_mul_ps ( y, _mm_set1_ps ( f[1] ) ) ),
+									_mm_add_ps ( _mm_mul_ps ( z, _mm_set1_ps ( f[2] ) ), _mm_set1_ps ( f[3] ) ) );
+				const __m128 r = _mm_add_ps ( _mm_add_ps ( _mm_mul_ps ( hx, _mm_set1_ps ( f[4] ) ), _mm_mul_ps ( hy, _mm_set1_ps ( f[5] ) ) ),
+									_mm_mul_ps ( hz, _mm_set1_ps ( f[6] ) ) );
+				out = _mm_or_ps ( out, _mm_cmpgt_ps ( _mm_sub_ps ( d, r ), _mm_setzero_ps () ) );
+			}
+			bits |= ( ~_mm_movemask_ps ( out ) & 0xF ) << ( h * 4 );
+		}
+#endif
+		mask[i >> 5] |= bits << ( i & 31 );
+	}
+
+	// the padding lanes
+	if ( Count & 31 )
+		mask[words - 1] &= ( 1u << ( Count & 31 ) ) - 1;
+
+	u32 visible = 0;
+	for ( u32 w = 0; w != words; ++w )
+		visible += bitCount ( mask[w] );
+	return visible;
+#else
+	return cullScalar ( frustum, mask );
+#endif
+}
+
+u32 CBoxCuller::cullScalar ( const SViewFrustum &frustum, array < u32 > &mask ) const
+{
+	const u32 words = ( Count + 31 ) >> 5;
+	mask.set_used ( words );
+	if ( words )
+		memset ( mask.pointer (), 0, words * sizeof ( u32 ) );
+
+	u32 visible = 0;
+	for ( u32 i = 0; i != Count; ++i )
+	{
+		const aabbox3df box = getBox ( i );
+
+		bool inside = true;
+		for ( u32 p = 0; inside && p != SViewFrustum::VF_PLANE_COUNT; ++p )
+			inside = box.classifyPlaneRelation ( frustum.planes[p] ) != ISREL3D_FRONT;
+
+		if ( inside )
+		{
+			mask[i >> 5] |= 1u << ( i & 31 );
+			visible += 1;
+		}
+	}
+	return visible;
+}
@@ -0,0 +1,74 @@
+/*!
+	Box Culler.
+	view frustum test of many boxes at once, the result as a bitmask
+
+	Scene nodes test their box against the frustum one by one in the
+	scene manager traversal, behind a virtual call each. The boxes of the
+	map runs, shader nodes, items and enemies are kept here instead, as
+	centers and half extents in one array per field. A plane is tested
+	against eight boxes at once, two SSE2 registers or one AVX register
+	when the compiler targets it. Bit i of the mask is set if box i is not
+	completely outside a plane, the draw code reads the bits.
+*/
+#ifndef __QUAKE3_BOXCULL__H_INCLUDED__
+#define __QUAKE3_BOXCULL__H_INCLUDED__
+
+#include <irrlicht.h>
+
+using namespace irr;
+
+class CBoxCuller
+{
+public:
+	CBoxCuller ();
+
+	void clear ();
+
+	//! index of the new box
+	u32 add ( const core::aabbox3df &box );
+
+	//! moving boxes are set again before the next cull
+	void set ( u32 index, const core::aabbox3df &box );
+
+	u32 size () const { return Count; }
+
+	core::aabbox3df getBox ( u32 index ) const
+	{
+		const core::vector3df center ( CenterX[index], CenterY[index], CenterZ[index] );
+		const core::vector3df extent ( ExtentX[index], ExtentY[index], ExtentZ[index] );
+		return core::aabbox3df ( center - extent, center + extent );
+	}
+
+	/*!
+		mask receives ( size + 31 ) / 32 words, the bits past size are clear.
+		returns the boxes inside or clipped
+	*/
+	u32 cull ( const scene::SViewFrustum &frustum, core::array < u32 > &mask ) const;
+
+	//! mask of size boxes all visible, for a scene without camera
+	void fill ( core::array < u32 > &mask ) const;
+
+	static bool isVisible ( const core::array < u32 > &mask, u32 index )
+	{
+		return ( mask[index >> 5] >> ( index & 31 ) & 1 ) != 0;
+	}
+
+	//! plain loop over the boxes, same mask as cull
+	u32 cullScalar ( const scene::SViewFrustum &frustum, core::array < u32 > &mask ) const;
+
+private:
+	enum { LANES = 8 };
+
+	void grow ();
+
+	// padded to a multiple of LANES, the padding is never visible
+	core::array < f32 > CenterX;
+	core::array < f32 > CenterY;
+	core::array < f32 > CenterZ;
+	core::array < f32 > ExtentX;
+	core::array < f32 > ExtentY;
+	core::array < f32 > ExtentZ;
+	u32 Count;
+};
+
+#endif // __QUAKE3_BOXCULL__H_INCLUDED__
@@ -0,0 +1,286 @@
+/*!
+	Collision BVH.
+	bounding volume hierarchy over the triangles of a collision map
+*/
+
+#include "bvh.h"
+#include "q3collision.h"
+
+using namespace core;
+
+// below MAX_SPLIT_DEPTH the split halves the run, the tree never gets deeper than 96
+static const u32 MAX_SPLIT_DEPTH = 64;
+static const u32 STACK_SIZE = 128;
+
+CCollisionBVH::CCollisionBVH ()
+{
+	Box.reset ( 0.f, 0.f, 0.f );
+}
+
+void CCollisionBVH::clear ()
+{
+	Node.clear ();
+	Triangle.clear ();
+	Flags.clear ();
+	Box.reset ( 0.f, 0.f, 0.f );
+}
+
+/*
+	boxes are computed from the triangles after the split,
+	the split itself only looks at the centroids
+*/
+static void fitTriangles ( aabbox3df &box, const triangle3df *t, u32 count )
+{
+	box.reset ( t[0].pointA );
+	for ( u32 i = 0; i != count; ++i )
+	{
+		box.addInternalPoint ( t[i].pointA );
+		box.addInternalPoint ( t[i].pointB );
+		box.addInternalPoint ( t[i].pointC );
+	}
+}
+
+void CCollisionBVH::build ( const SCollisionMap &map, u32 leafSize )
+{
+	clear ();
+
+	const u32 count = map.getTriangleCount ();
+	if ( 0 == count )
+		return;
+
+	array < triangle3df > source;
+	array < vector3df > centroid;
+	array < u32 > order;
+	source.set_used ( count );
+	centroid.set_used ( count );
+	order.set_used ( count );
+
+	for ( u32 i = 0; i != count; ++i )
+	{
+		triangle3df &t = source[i];
+		t.pointA = map.Vertex [ map.Index [ i * 3 + 0 ] ];
+		t.pointB = map.Vertex [ map.Index [ i * 3 + 1 ] ];
+		t.pointC = map.Vertex [ map.Index [ i * 3 + 2 ] ];
+		centroid[i] = ( t.pointA + t.pointB + t.pointC ) * ( 1.f / 3.f );
+		order[i] = i;
+	}
+
+	Node.reallocate ( 2 * count / core::max_ ( leafSize, 1u ) + 1 );
+	SNode root;
+	Node.push_back ( root );
+	split ( 0, 0, count, 0, order, centroid, core::max_ ( leafSize, 1u ) );
+
+	Triangle.set_used ( count );
+	Flags.set_used ( count );
+	for ( u32 i = 0; i != count; ++i )
+	{
+		Triangle[i] = source [ order[i] ];
+		Flags[i] = map.TriangleFlags [ order[i] ];
+	}
+
+	// children come after their parent, fit bottom up
+	for ( u32 i = Node.size (); i-- != 0; )
+	{
+		SNode &n = Node[i];
+		if ( n.Count )
+			fitTriangles ( n.Box, Triangle.const_pointer () + n.First, n.Count );
+		else
+		{
+			n.Box = Node [ n.First ].Box;
+			n.Box.addInternalBox ( Node [ n.First + 1 ].Box );
+		}
+	}
+	Box = Node[0].Box;
+}
+
+/*
+	midpoint split of the centroid bounds on the longest axis.
+	falls back to halving the run when all centroids land on one side
+*/
+void CCollisionBVH::split ( u32 node, u32 first, u32 count, u32 depth, array < u32 > &order,
+							const array < vector3df > &centroid, u32 leafSize )
+{
+	const array < vector3df > &c = centroid;
+
+	aabbox3df centroidBox ( c [ order[first] ] );
+	for ( u32 i = first + 1; i != first + count; ++i )
+		centroidBox.addInternalPoint ( c [ order[i] ] );
+
+	if ( count <= leafSize )
+	{
+		Node[node].First = first;
+		Node[node].Count = count;
+		return;
+	}
+
+	const vector3df extent = centroidBox.getExtent ();
+	const u32 axis = extent.X > extent.Y ? ( extent.X > extent.Z ? 0 : 2 ) : ( extent.Y > extent.Z ? 1 : 2 );
+	const f32 mid = axis == 0 ? centroidBox.getCenter ().X : axis == 1 ? centroidBox.getCenter ().Y : centroidBox.getCenter ().Z;
+
+	u32 left = first;
+	u32 right = first + count;
+	while ( left < right )
+	{
+		const vector3df &p = c [ order[left] ];
+		const f32 v = axis == 0 ? p.X : axis == 1 ? p.Y : p.Z;
+		if ( v < mid )
+			left += 1;
+		else
+			core::swap ( order[left], order [ --right ] );
+	}
+
+	u32 leftCount = left - first;
+	if ( 0 == leftCount || count == leftCount || depth >= MAX_SPLIT_DEPTH )
+		leftCount = count / 2;
+
+	const u32 child = Node.size ();
+	SNode n;
+	Node.push_back ( n );
+	Node.push_back ( n );
+	Node[node].First = child;
+	Node[node].Count = 0;
+
+	split ( child, first, leftCount, depth + 1, order, centroid, leafSize );
+	split ( child + 1, first + leftCount, count - leftCount, depth + 1, order, centroid, leafSize );
+}
+
+void CCollisionBVH::query ( const aabbox3df &box, array < u32 > &out ) const
+{
+	if ( Node.empty () )
+		return;
+
+	u32 stack [ STACK_SIZE ];
+	u32 top = 0;
+	stack [ top++ ] = 0;
+
+	while ( top )
+	{
+		const SNode &n = Node [ stack [ --top ] ];
+		if ( !n.Box.intersectsWithBox ( box ) )
+			continue;
+
+		if ( n.Count )
+		{
+			for ( u32 i = n.First; i != n.First + n.Count; ++i )
+			{
+				const triangle3df &t = Triangle[i];
+				aabbox3df tb ( t.pointA );
+				tb.addInternalPoint ( t.pointB );
+				tb.addInternalPoint ( t.pointC );
+				if ( tb.intersectsWithBox ( box ) )
+					out.push_back ( i );
+			}
+		}
+		else
+		{
+			stack [ top++ ] = n.First;
+			stack [ top++ ] = n.First + 1;
+		}
+	}
+}
+
+// slab test, t of the entry point or a negative value
+static f32 rayBox ( const aabbox3df &box, const vector3df &start, const vector3df &inv, f32 maxT )
+{
+	f32 t0 = 0.f;
+	f32 t1 = maxT;
+	for ( u32 a = 0; a != 3; ++a )
+	{
+		const f32 s = a == 0 ? start.X : a == 1 ? start.Y : start.Z;
+		const f32 i = a == 0 ? inv.X : a == 1 ? inv.Y : inv.Z;
+		const f32 lo = a == 0 ? box.MinEdge.X : a == 1 ? box.MinEdge.Y : box.MinEdge.Z;
+		const f32 hi = a == 0 ? box.MaxEdge.X : a == 1 ? box.MaxEdge.Y : box.MaxEdge.Z;
+
+		f32 n = ( lo - s ) * i;
+		f32 f = ( hi - s ) * i;
+		if ( n > f )
+			core::swap ( n, f );
+		t0 = core::max_ ( t0, n );
+		t1 = core::min_ ( t1, f );
+		if ( t0 > t1 )
+			return -1.f;
+	}
+	return t0;
+}
+
+// moeller trumbore, two sided. t along dir or a negative value
+static f32 rayTriangle ( const triangle3df &t, const vector3df &start, const vector3df &dir )
+{
+	const vector3df e1 = t.pointB - t.pointA;
+	const vector3df e2 = t.pointC - t.pointA;
+	const vector3df p = dir.crossProduct ( e2 );
+	const f32 det = e1.dotProduct ( p );
+	if ( fabsf ( det ) < 1e-12f )
+		return -1.f;
+
+	const f32 inv = 1.f / det;
+	const vector3df s = start - t.pointA;
+	const f32 u = s.dotProduct ( p ) * inv;
+	if ( u < 0.f || u > 1.f )
+		return -1.f;
+
+	const vector3df q = s.crossProduct ( e1 );
+	const f32 v = dir.dotProduct ( q ) * inv;
+	if ( v < 0.f || u + v > 1.f )
+		return -1.f;
+
+	return e2.dotProduct ( q ) * inv;
+}
+
+bool CCollisionBVH::raycast ( const line3df &ray, vector3df &hit, u32 *triangle ) const
+{
+	if ( Node.empty () )
+		return false;
+
+	const vector3df dir = ray.end - ray.start;
+	const vector3df inv (	dir.X != 0.f ? 1.f / dir.X : FLT_MAX,
+							dir.Y != 0.f ? 1.f / dir.Y : FLT_MAX,
+							dir.Z != 0.f ? 1.f / dir.Z : FLT_MAX );
+
+	f32 best = 1.f;
+	s32 bestTriangle = -1;
+
+	u32 stack [ STACK_SIZE ];
+	u32 top = 0;
+	stack [ top++ ] = 0;
+
+	while ( top )
+	{
+		const SNode &n = Node [ stack [ --top ] ];
+		if ( rayBox ( n.Box, ray.start, inv, best ) < 0.f )
+			continue;
+
+		if ( n.Count )
+		{
+			for ( u32 i = n.First; i != n.First + n.Count; ++i )
+			{
+				const f32 t = rayTriangle ( Triangle[i], ray.start, dir );
+				if ( t >= 0.f && t < best )
+				{
+					best = t;
+					bestTriangle = i;
+				}
+			}
+		}
+		else
+		{
+			stack [ top++ ] = n.First;
+			stack [ top++ ] = n.First + 1;
+		}
+	}
+
+	if ( bestTriangle < 0 )
+		return false;
+
+	hit = ray.start + dir * best;
+	if ( triangle )
+		*triangle = bestTriangle;
+	return true;
+}
+
+u32 CCollisionBVH::getMemoryFootprint () const
+{
+	return	Node.allocated_size () * sizeof ( SNode ) +
+			Triangle.allocated_size () * sizeof ( triangle3df ) +
+			Flags.allocated_size () * sizeof ( u32 );
+}
@@ -0,0 +1,61 @@
+/*!
+	Collision BVH.
+	bounding volume hierarchy over the triangles of a collision map
+
+	Static, built once per map. Triangles are copied in leaf order so a
+	leaf is one contiguous run. Children of a node are stored next to
+	each other. Queries only read, any number of threads may share it.
+*/
+#ifndef __QUAKE3_BVH__H_INCLUDED__
+#define __QUAKE3_BVH__H_INCLUDED__
+
+#include <irrlicht.h>
+
+using namespace irr;
+
+struct SCollisionMap;
+
+class CCollisionBVH
+{
+public:
+	CCollisionBVH ();
+
+	//! leafSize triangles at most per leaf
+	void build ( const SCollisionMap &map, u32 leafSize = 4 );
+	void clear ();
+
+	//! triangles whose bounding box overlaps box, appended to out
+	void query ( const core::aabbox3df &box, core::array < u32 > &out ) const;
+
+	//! nearest triangle hit along the ray
+	bool raycast ( const core::line3df &ray, core::vector3df &hit, u32 *triangle = 0 ) const;
+
+	u32 getTriangleCount () const { return Triangle.size (); }
+	const core::triangle3df & getTriangle ( u32 i ) const { return Triangle[i]; }
+	u32 getTriangleFlags ( u32 i ) const { return Flags[i]; }
+
+	u32 getNodeCount () const { return Node.size (); }
+	const core::aabbox3df & getBox () const { return Box; }
+
+	//! heap bytes held by the arrays
+	u32 getMemoryFootprint () const;
+
+private:
+	//! Count 0: inner node, children at First and First + 1
+	struct SNode
+	{
+		core::aabbox3df Box;
+		u32 First;
+		u32 Count;
+	};
+
+	void split ( u32 node, u32 first, u32 count, u32 depth, core::array < u32 > &order,
+				const core::array < core::vector3df > &centroid, u32 leafSize );
+
+	core::array < SNode > Node;
+	core::array < core::triangle3df > Triangle;	// leaf order
+	core::array < u32 > Flags;
+	core::aabbox3df Box;
+};
+
+#endif // __QUAKE3_BVH__H_INCLUDED__
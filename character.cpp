@@ -0,0 +1,640 @@
+/*!
+	Character Controller.
+	moves players and bots as swept ellipsoids through the collision bvh
+*/
+
+#include "character.h"
+#include "bvh.h"
+#include "jobs.h"
+
+using namespace core;
+using namespace scene;
+
+/*
+	the sweep runs in ellipsoid space where the character is a unit sphere.
+	y is up, as everywhere in the game
+*/
+static const f32 VERY_CLOSE = 0.005f;	// gap kept to surfaces, ellipsoid space
+static const u32 MAX_SLIDES = 5;
+static const f32 GROUND_SNAP = 2.f;		// walking down slopes and stairs keeps ground contact
+static const u32 BATCH_JOB = 32;		// characters per worker job
+
+
+SCharacter::SCharacter ()
+: Radius ( 30.f, 45.f, 30.f ), Translation ( 0.f, 40.f, 0.f ), GroundNormal ( 0.f, 1.f, 0.f ),
+	HitTriangle ( -1 ), OnGround ( false ), Crouched ( false )
+{
+}
+
+// smallest root in [0,maxR). a start inside the sphere does not count
+static inline bool lowestRoot ( f32 a, f32 b, f32 c, f32 maxR, f32 &root )
+{
+	const f32 det = b * b - 4.f * a * c;
+	if ( det < 0.f )
+		return false;
+
+	const f32 q = sqrtf ( det );
+	const f32 r1 = ( -b - q ) / ( 2.f * a );
+	const f32 r2 = ( -b + q ) / ( 2.f * a );
+	const f32 r = core::min_ ( r1, r2 );
+	if ( r < 0.f || r >= maxR )
+		return false;
+
+	root = r;
+	return true;
+}
+
+static inline bool pointInTriangle ( const vector3df &p, const vector3df &a, const vector3df &b,
+									const vector3df &c, const vector3df &n )
+{
+	return	( b - a ).crossProduct ( p - a ).dotProduct ( n ) >= 0.f &&
+			( c - b ).crossProduct ( p - b ).dotProduct ( n ) >= 0.f &&
+			( a - c ).crossProduct ( p - c ).dotProduct ( n ) >= 0.f;
+}
+
+/*
+	unit sphere at base moving by vel against the triangle abc, two sided.
+	t is the earliest contact found so far and only gets smaller.
+	face tells a contact inside the triangle from one on an edge or vertex
+*/
+static bool sweepSphere ( const vector3df &base, const vector3df &vel,
+						const vector3df &a, const vector3df &b, const vector3df &c,
+						f32 &t, vector3df &point, bool &face )
+{
+	vector3df n = ( b - a ).crossProduct ( c - a );
+	const f32 length = n.getLength ();
+	if ( length < 1e-9f )
+		return false;
+	n /= length;
+	const vector3df normal = n;
+
+	f32 dist = n.dotProduct ( base - a );
+	if ( dist < 0.f )
+	{
+		n = -n;
+		dist = -dist;
+	}
+
+	const f32 nv = n.dotProduct ( vel );
+	if ( nv < -1e-9f )
+	{
+		// touches the plane at t0, edges and vertices can not be hit earlier
+		f32 t0 = ( 1.f - dist ) / nv;
+		if ( t0 >= t )
+			return false;
+		if ( t0 < 0.f )
+			t0 = 0.f;
+
+		const vector3df p = base - n + vel * t0;
+		if ( pointInTriangle ( p, a, b, c, normal ) )
+		{
+			t = t0;
+			point = p;
+			face = true;
+			return true;
+		}
+	}
+	else
+	if ( nv > 1e-9f || dist >= 1.f )
+		return false;
+
+	bool found = false;
+	const f32 vv = vel.getLengthSQ ();
+	f32 root;
+
+	const vector3df *vertex[3] = { &a, &b, &c };
+	for ( u32 i = 0; i != 3; ++i )
+	{
+		const vector3df &p = *vertex[i];
+		if ( lowestRoot ( vv, 2.f * vel.dotProduct ( base - p ), ( p - base ).getLengthSQ () - 1.f, t, root ) )
+		{
+			t = root;
+			point = p;
+			face = false;
+			found = true;
+		}
+	}
+
+	for ( u32 i = 0; i != 3; ++i )
+	{
+		const vector3df &p1 = *vertex[i];
+		const vector3df edge = *vertex [ ( i + 1 ) % 3 ] - p1;
+		const vector3df toVertex = p1 - base;
+		const f32 edgeSq = edge.getLengthSQ ();
+		const f32 edgeVel = edge.dotProduct ( vel );
+		const f32 edgeTo = edge.dotProduct ( toVertex );
+
+		const f32 qa = edgeSq * -vv + edgeVel * edgeVel;
+		const f32 qb = edgeSq * ( 2.f * vel.dotProduct ( toVertex ) ) - 2.f * edgeVel * edgeTo;
+		const f32 qc = edgeSq * ( 1.f - toVertex.getLengthSQ () ) + edgeTo * edgeTo;
+
+		if ( fabsf ( qa ) > 1e-12f && lowestRoot ( qa, qb, qc, t, root ) )
+		{
+			const f32 f = ( edgeVel * root - edgeTo ) / edgeSq;
+			if ( f >= 0.f && f <= 1.f )
+			{
+				t = root;
+				point = p1 + edge * f;
+				face = false;
+				found = true;
+			}
+		}
+	}
+
+	return found;
+}
+
+// closest point of the triangle abc to p
+static vector3df closestPoint ( const vector3df &p, const vector3df &a, const vector3df &b, const vector3df &c )
+{
+	const vector3df ab = b - a;
+	const vector3df ac = c - a;
+	const vector3df ap = p - a;
+	const f32 d1 = ab.dotProduct ( ap );
+	const f32 d2 = ac.dotProduct ( ap );
+	if ( d1 <= 0.f && d2 <= 0.f )
+		return a;
+
+	const vector3df bp = p - b;
+	const f32 d3 = ab.dotProduct ( bp );
+	const f32 d4 = ac.dotProduct ( bp );
+	if ( d3 >= 0.f && d4 <= d3 )
+		return b;
+
+	const f32 vc = d1 * d4 - d3 * d2;
+	if ( vc <= 0.f && d1 >= 0.f && d3 <= 0.f )
+		return a + ab * ( d1 / ( d1 - d3 ) );
+
+	const vector3df cp = p - c;
+	const f32 d5 = ab.dotProduct ( cp );
+	const f32 d6 = ac.dotProduct ( cp );
+	if ( d6 >= 0.f && d5 <= d6 )
+		return c;
+
+	const f32 vb = d5 * d2 - d1 * d6;
+	if ( vb <= 0.f && d2 >= 0.f && d6 <= 0.f )
+		return a + ac * ( d2 / ( d2 - d6 ) );
+
+	const f32 va = d3 * d6 - d5 * d4;
+	if ( va <= 0.f && ( d4 - d3 ) >= 0.f && ( d5 - d6 ) >= 0.f )
+		return b + ( c - b ) * ( ( d4 - d3 ) / ( ( d4 - d3 ) + ( d5 - d6 ) ) );
+
+	const f32 denom = 1.f / ( va + vb + vc );
+	return a + ab * ( vb * denom ) + ac * ( vc * denom );
+}
+
+static inline vector3df inverse ( const vector3df &v )
+{
+	return vector3df ( 1.f / v.X, 1.f / v.Y, 1.f / v.Z );
+}
+
+static inline f32 horizontal ( const vector3df &v )
+{
+	return v.X * v.X + v.Z * v.Z;
+}
+
+
+CCharacterController::CCharacterController ( const CCollisionBVH *world )
+: World ( world ), Gravity ( 0.f, -800.f, 0.f ), StepHeight ( 18.f ),
+	StandRadius ( 30.f, 45.f, 30.f ), StandTranslation ( 0.f, 40.f, 0.f ),
+	CrouchRadius ( 30.f, 20.f, 30.f ), CrouchTranslation ( 0.f, 20.f, 0.f )
+{
+	setMaxSlope ( 45.f );
+}
+
+void CCharacterController::setMaxSlope ( f32 degrees )
+{
+	MinWalkNormal = cosf ( degrees * DEGTORAD );
+}
+
+void CCharacterController::setStandShape ( const vector3df &radius, const vector3df &translation )
+{
+	StandRadius = radius;
+	StandTranslation = translation;
+}
+
+void CCharacterController::setCrouchShape ( const vector3df &radius, const vector3df &translation )
+{
+	CrouchRadius = radius;
+	CrouchTranslation = translation;
+}
+
+void CCharacterController::init ( SCharacter &c, const vector3df &position ) const
+{
+	c = SCharacter ();
+	c.Position = position;
+	c.Radius = StandRadius;
+	c.Translation = StandTranslation;
+}
+
+/*
+	earliest contact of the ellipsoid moving from center by move.
+	point is in ellipsoid space
+*/
+bool CCharacterController::sweep ( const vector3df &center, const vector3df &radius, const vector3df &move,
+									f32 &t, vector3df &point, s32 &triangle, bool &face, array < u32 > &scratch ) const
+{
+	if ( 0 == World )
+		return false;
+
+	const vector3df inv = inverse ( radius );
+	const vector3df base = center * inv;
+	const vector3df vel = move * inv;
+	if ( vel.getLengthSQ () < 1e-12f )
+		return false;
+
+	aabbox3df box ( center );
+	box.addInternalPoint ( center + move );
+	box.MinEdge -= radius + vector3df ( 1.f );
+	box.MaxEdge += radius + vector3df ( 1.f );
+
+	scratch.set_used ( 0 );
+	World->query ( box, scratch );
+
+	t = 1.f;
+	bool hit = false;
+	for ( u32 i = 0; i != scratch.size (); ++i )
+	{
+		const triangle3df &tri = World->getTriangle ( scratch[i] );
+		if ( sweepSphere ( base, vel, tri.pointA * inv, tri.pointB * inv, tri.pointC * inv, t, point, face ) )
+		{
+			triangle = scratch[i];
+			hit = true;
+		}
+	}
+	return hit;
+}
+
+/*
+	collide and slide. the move is cut at the first contact, the rest is
+	projected on the plane tangent to the contact and swept again.
+	walking treats slopes steeper than the limit and edges below the
+	center as vertical walls, the round bottom would ride up any ledge.
+	ledges up to the step height are climbed by the step in moveOne
+*/
+vector3df CCharacterController::slide ( const vector3df &center, const vector3df &radius, vector3df move,
+										eSlideMode mode, SContact &contact, array < u32 > &scratch ) const
+{
+	contact.Triangle = -1;
+	contact.Ground = false;
+
+	const vector3df inv = inverse ( radius );
+	vector3df pos = center;
+
+	for ( u32 i = 0; i != MAX_SLIDES; ++i )
+	{
+		f32 t;
+		vector3df pointE;
+		s32 triangle;
+		bool face;
+		if ( !sweep ( pos, radius, move, t, pointE, triangle, face, scratch ) )
+		{
+			pos += move;
+			break;
+		}
+
+		const vector3df posE = pos * inv;
+		const vector3df velE = move * inv;
+		const f32 length = velE.getLength ();
+		const f32 dist = length * t;
+
+		vector3df newPosE = posE;
+		if ( dist > VERY_CLOSE )
+			newPosE += velE * ( ( dist - VERY_CLOSE ) / length );
+
+		vector3df normalE = ( posE + velE * t ) - pointE;
+		normalE.normalize ();
+		vector3df normal = normalE * inv;
+		normal.normalize ();
+
+		// faces by their slope, edges carry the character when they touch the bottom cap
+		contact.Ground = ( face ? normal.Y : normalE.Y ) >= MinWalkNormal;
+
+		if ( mode == SLIDE_FALL && contact.Ground )
+		{
+			contact.Point = pointE * radius;
+			contact.Normal = normal;
+			contact.Triangle = triangle;
+			pos = newPosE * radius;
+			break;
+		}
+
+		if ( mode == SLIDE_WALK && normal.Y > 0.f && ( normal.Y < MinWalkNormal || !face ) )
+		{
+			normal.Y = 0.f;
+			normal.normalize ();
+			normalE = normal * radius;
+			normalE.normalize ();
+		}
+
+		contact.Point = pointE * radius;
+		contact.Normal = normal;
+		contact.Triangle = triangle;
+
+		const vector3df destE = posE + velE;
+		const vector3df newDestE = destE - normalE * normalE.dotProduct ( destE - newPosE );
+
+		pos = newPosE * radius;
+		move = ( newDestE - newPosE ) * radius;
+		if ( move.getLengthSQ () < 1e-6f )
+			break;
+	}
+	return pos;
+}
+
+bool CCharacterController::fits ( const vector3df &center, const vector3df &radius, array < u32 > &scratch ) const
+{
+	if ( 0 == World )
+		return true;
+
+	const vector3df inv = inverse ( radius );
+	const vector3df base = center * inv;
+
+	scratch.set_used ( 0 );
+	World->query ( aabbox3df ( center - radius, center + radius ), scratch );
+
+	for ( u32 i = 0; i != scratch.size (); ++i )
+	{
+		const triangle3df &tri = World->getTriangle ( scratch[i] );
+		const vector3df p = closestPoint ( base, tri.pointA * inv, tri.pointB * inv, tri.pointC * inv );
+		if ( p.getDistanceFromSQ ( base ) < 1.f - 1e-3f )
+			return false;
+	}
+	return true;
+}
+
+void CCharacterController::moveOne ( SCharacter &c, f32 dt, array < u32 > &scratch ) const
+{
+	const vector3df radius = c.Radius;
+	vector3df center = c.Position - c.Translation;
+	const bool wasOnGround = c.OnGround;
+
+	vector3df wish = c.Wish;
+	c.Wish.set ( 0.f, 0.f, 0.f );
+	c.HitTriangle = -1;
+
+	SContact contact;
+
+	// no gravity, fly through the level but not through walls
+	if ( Gravity.getLengthSQ () == 0.f )
+	{
+		center = slide ( center, radius, wish + c.Velocity * dt, SLIDE_FLY, contact, scratch );
+		if ( contact.Triangle >= 0 )
+		{
+			c.HitTriangle = contact.Triangle;
+			c.HitPoint = contact.Point;
+		}
+		c.OnGround = false;
+		c.Position = center + c.Translation;
+		return;
+	}
+
+	// walk, try to step over what blocks the way on the ground
+	wish.Y = 0.f;
+	if ( wish.getLengthSQ () > 0.f )
+	{
+		vector3df walked = slide ( center, radius, wish, SLIDE_WALK, contact, scratch );
+
+		// lift just over the blocking edge, a round bottom touches it before the feet are there
+		const f32 lift = contact.Point.Y - ( center.Y - radius.Y );
+		if ( wasOnGround && contact.Triangle >= 0 && contact.Normal.Y < MinWalkNormal && lift <= StepHeight )
+		{
+			SContact step;
+			const vector3df up = slide ( center, radius, vector3df ( 0.f, core::max_ ( lift, 0.f ) + 1.f, 0.f ), SLIDE_FLY, step, scratch );
+			const vector3df over = slide ( up, radius, wish, SLIDE_WALK, step, scratch );
+			const vector3df down = slide ( over, radius, vector3df ( 0.f, center.Y - up.Y, 0.f ), SLIDE_FALL, step, scratch );
+
+			if ( step.Triangle >= 0 && step.Ground &&
+				horizontal ( down - center ) > horizontal ( walked - center ) + 0.01f )
+			{
+				walked = down;
+				contact = step;
+			}
+		}
+
+		center = walked;
+		if ( contact.Triangle >= 0 )
+		{
+			c.HitTriangle = contact.Triangle;
+			c.HitPoint = contact.Point;
+		}
+	}
+
+	// gravity and jumps
+	c.Velocity += Gravity * dt;
+	center = slide ( center, radius, c.Velocity * dt, SLIDE_FALL, contact, scratch );
+
+	c.OnGround = false;
+	if ( contact.Triangle >= 0 )
+	{
+		c.HitTriangle = contact.Triangle;
+		c.HitPoint = contact.Point;
+
+		// lose the speed going into the surface
+		const f32 into = c.Velocity.dotProduct ( contact.Normal );
+		if ( into < 0.f )
+			c.Velocity -= contact.Normal * into;
+
+		if ( contact.Ground )
+		{
+			c.OnGround = true;
+			c.GroundNormal = contact.Normal;
+		}
+	}
+
+	if ( !c.OnGround && wasOnGround && c.Velocity.Y <= 0.f )
+	{
+		const vector3df snapped = slide ( center, radius, vector3df ( 0.f, -GROUND_SNAP, 0.f ), SLIDE_FALL, contact, scratch );
+		if ( contact.Triangle >= 0 && contact.Ground )
+		{
+			center = snapped;
+			c.OnGround = true;
+			c.GroundNormal = contact.Normal;
+		}
+	}
+
+	if ( c.OnGround )
+		c.Velocity.Y = 0.f;
+
+	c.Position = center + c.Translation;
+}
+
+/*
+	small batches run inline, large ones in jobs of BATCH_JOB characters.
+	the bvh is only read, every job has its own scratch list
+*/
+void CCharacterController::move ( SCharacter *character, u32 count, f32 dt ) const
+{
+	if ( dt <= 0.f )
+		return;
+
+	const CCharacterController *self = this;
+	getJobSystem ()->parallelFor ( 0, count, BATCH_JOB, [self, character, dt] ( u32 first, u32 last )
+	{
+		array < u32 > scratch;
+		for ( u32 i = first; i != last; ++i )
+			self->moveOne ( character[i], dt, scratch );
+	} );
+}
+
+void CCharacterController::jump ( SCharacter &c, f32 speed ) const
+{
+	if ( !c.OnGround )
+		return;
+
+	c.Velocity.Y = speed;
+	c.OnGround = false;
+}
+
+bool CCharacterController::crouch ( SCharacter &c, bool down ) const
+{
+	if ( down == c.Crouched )
+		return true;
+
+	const vector3df &radius = down ? CrouchRadius : StandRadius;
+	const vector3df &translation = down ? CrouchTranslation : StandTranslation;
+
+	const vector3df feet = c.Position - c.Translation - vector3df ( 0.f, c.Radius.Y, 0.f );
+	const vector3df center = feet + vector3df ( 0.f, radius.Y, 0.f );
+
+	if ( !down )
+	{
+		array < u32 > scratch;
+		if ( !fits ( center, radius, scratch ) )
+			return false;
+	}
+
+	c.Radius = radius;
+	c.Translation = translation;
+	c.Position = center + translation;
+	c.Crouched = down;
+	return true;
+}
+
+
+CCharacterAnimator::CCharacterAnimator ( const CCharacterController &controller, ISceneNode *node,
+										const vector3df &radius, const vector3df &translation )
+: Controller ( controller ), Node ( node ), World ( 0 ), Callback ( 0 ),
+	LastTime ( 0 ), FirstUpdate ( true ), AnimateTarget ( true ), WantCrouch ( false )
+{
+#ifdef _DEBUG
+	setDebugName ( "CCharacterAnimator" );
+#endif
+	Character.Radius = radius;
+	Character.Translation = translation;
+	if ( Node )
+		Character.Position = Node->getPosition ();
+}
+
+CCharacterAnimator::~CCharacterAnimator ()
+{
+	if ( World )
+		World->drop ();
+	if ( Callback )
+		Callback->drop ();
+}
+
+/*
+	the fps camera animator ran before and moved the node,
+	that movement is the wish. OnAnimate ( 0 ) after a teleport resets
+*/
+void CCharacterAnimator::animateNode ( ISceneNode *node, u32 timeMs )
+{
+	if ( node != Node )
+	{
+		setTargetNode ( node );
+		return;
+	}
+
+	if ( FirstUpdate || 0 == timeMs )
+	{
+		Character.Position = Node->getPosition ();
+		Character.Velocity.set ( 0.f, 0.f, 0.f );
+		LastTime = timeMs;
+		FirstUpdate = 0 == timeMs;
+		return;
+	}
+
+	const f32 dt = core::min_ ( ( timeMs - LastTime ) * 0.001f, 0.1f );
+	LastTime = timeMs;
+
+	if ( Character.Crouched && !WantCrouch )
+		Controller.crouch ( Character, false );
+
+	const vector3df wanted = Node->getPosition ();
+	const vector3df old = Character.Position;
+	Character.Wish += wanted - old;
+	Controller.move ( &Character, 1, dt );
+
+	if ( Character.HitTriangle >= 0 )
+	{
+		Triangle = Controller.getWorld ()->getTriangle ( Character.HitTriangle );
+
+		// a consumed collision moves the node fully
+		if ( Callback && Callback->onCollision ( *this ) )
+			Character.Position = wanted;
+	}
+
+	Node->setPosition ( Character.Position );
+
+	if ( AnimateTarget && Node->getType () == ESNT_CAMERA )
+	{
+		ICameraSceneNode *camera = (ICameraSceneNode*) Node;
+		camera->setTarget ( camera->getTarget () + Character.Position - wanted );
+	}
+}
+
+ISceneNodeAnimator* CCharacterAnimator::createClone ( ISceneNode *node, ISceneManager * )
+{
+	CCharacterAnimator *a = new CCharacterAnimator ( Controller, node, Character.Radius, Character.Translation );
+	a->setWorld ( World );
+	a->setAnimateTarget ( AnimateTarget );
+	return a;
+}
+
+void CCharacterAnimator::setEllipsoidRadius ( const vector3df &radius )
+{
+	Character.Radius = radius;
+}
+
+void CCharacterAnimator::setEllipsoidTranslation ( const vector3df &translation )
+{
+	Character.Translation = translation;
+}
+
+void CCharacterAnimator::jump ( f32 jumpSpeed )
+{
+	Controller.jump ( Character, jumpSpeed * 30.f );
+}
+
+void CCharacterAnimator::crouch ( bool down )
+{
+	WantCrouch = down;
+	Controller.crouch ( Character, down );
+}
+
+void CCharacterAnimator::setWorld ( ITriangleSelector *world )
+{
+	if ( world )
+		world->grab ();
+	if ( World )
+		World->drop ();
+	World = world;
+}
+
+void CCharacterAnimator::setTargetNode ( ISceneNode *node )
+{
+	Node = node;
+	FirstUpdate = true;
+	if ( Node )
+		Character.Position = Node->getPosition ();
+}
+
+void CCharacterAnimator::setCollisionCallback ( ICollisionCallback *callback )
+{
+	if ( callback )
+		callback->grab ();
+	if ( Callback )
+		Callback->drop ();
+	Callback = callback;
+}
@@ -0,0 +1,171 @@
+/*!
+	Character Controller.
+	moves players and bots as swept ellipsoids through the collision bvh
+
+	Each move is swept against every triangle along the whole path, so
+	fast characters do not tunnel and the result does not depend on the
+	frame rate. Walking steps up ledges up to the step height, slopes
+	steeper than the slope limit act as walls, crouching shrinks the
+	ellipsoid and standing up checks for room first. move () advances
+	any number of characters per call, large batches run on the workers.
+*/
+#ifndef __QUAKE3_CHARACTER__H_INCLUDED__
+#define __QUAKE3_CHARACTER__H_INCLUDED__
+
+#include <irrlicht.h>
+
+using namespace irr;
+
+class CCollisionBVH;
+
+struct SCharacter
+{
+	SCharacter ();
+
+	core::vector3df Position;		// of the node, the ellipsoid is centered at Position - Translation
+	core::vector3df Velocity;		// units per second, gravity and jumps
+	core::vector3df Wish;			// walk displacement for the next move, consumed by it
+	core::vector3df Radius;
+	core::vector3df Translation;
+
+	// contact of the last move
+	core::vector3df GroundNormal;
+	core::vector3df HitPoint;
+	s32 HitTriangle;				// -1 for no contact
+
+	bool OnGround;
+	bool Crouched;
+};
+
+class CCharacterController
+{
+public:
+	CCharacterController ( const CCollisionBVH *world = 0 );
+
+	void setWorld ( const CCollisionBVH *world ) { World = world; }
+	const CCollisionBVH * getWorld () const { return World; }
+
+	//! units per second^2, zero lets characters fly
+	void setGravity ( const core::vector3df &gravity ) { Gravity = gravity; }
+	const core::vector3df & getGravity () const { return Gravity; }
+
+	void setStepHeight ( f32 height ) { StepHeight = height; }
+
+	//! steepest walkable slope in degrees
+	void setMaxSlope ( f32 degrees );
+
+	//! ellipsoid of a standing and a crouching character
+	void setStandShape ( const core::vector3df &radius, const core::vector3df &translation );
+	void setCrouchShape ( const core::vector3df &radius, const core::vector3df &translation );
+
+	//! a character with the standing shape
+	void init ( SCharacter &c, const core::vector3df &position ) const;
+
+	//! advance count characters by dt seconds
+	void move ( SCharacter *character, u32 count, f32 dt ) const;
+
+	//! starts a jump if the character stands on the ground
+	void jump ( SCharacter &c, f32 speed ) const;
+
+	//! change the shape, feet stay in place. false if there is no room to stand up
+	bool crouch ( SCharacter &c, bool down ) const;
+
+private:
+	enum eSlideMode
+	{
+		SLIDE_FLY = 0,
+		SLIDE_WALK,		// steep slopes and low edges are walls
+		SLIDE_FALL		// stops on ground instead of sliding off it
+	};
+
+	struct SContact
+	{
+		core::vector3df Point;
+		core::vector3df Normal;		// the plane slid along
+		s32 Triangle;
+		bool Ground;				// can stand on it
+	};
+
+	void moveOne ( SCharacter &c, f32 dt, core::array < u32 > &scratch ) const;
+
+	core::vector3df slide ( const core::vector3df &center, const core::vector3df &radius,
+		core::vector3df move, eSlideMode mode, SContact &contact, core::array < u32 > &scratch ) const;
+
+	bool sweep ( const core::vector3df &center, const core::vector3df &radius, const core::vector3df &move,
+		f32 &t, core::vector3df &point, s32 &triangle, bool &face, core::array < u32 > &scratch ) const;
+
+	bool fits ( const core::vector3df &center, const core::vector3df &radius, core::array < u32 > &scratch ) const;
+
+	const CCollisionBVH *World;
+	core::vector3df Gravity;
+	f32 StepHeight;
+	f32 MinWalkNormal;
+	core::vector3df StandRadius;
+	core::vector3df StandTranslation;
+	core::vector3df CrouchRadius;
+	core::vector3df CrouchTranslation;
+};
+
+/*!
+	drop in for the irrlicht collision response animator on the camera.
+	the fps camera moves the node, the animator takes the difference
+	as the walk wish and runs it through a single character
+*/
+class CCharacterAnimator : public scene::ISceneNodeAnimatorCollisionResponse
+{
+public:
+	CCharacterAnimator ( const CCharacterController &controller, scene::ISceneNode *node,
+		const core::vector3df &radius, const core::vector3df &translation );
+	virtual ~CCharacterAnimator ();
+
+	virtual void animateNode ( scene::ISceneNode *node, u32 timeMs );
+	virtual scene::ISceneNodeAnimator* createClone ( scene::ISceneNode *node, scene::ISceneManager *newManager = 0 );
+	virtual scene::ESCENE_NODE_ANIMATOR_TYPE getType () const { return scene::ESNAT_COLLISION_RESPONSE; }
+
+	virtual bool isFalling () const { return !Character.OnGround; }
+	virtual void setEllipsoidRadius ( const core::vector3df &radius );
+	virtual core::vector3df getEllipsoidRadius () const { return Character.Radius; }
+	virtual void setGravity ( const core::vector3df &gravity ) { Controller.setGravity ( gravity ); }
+	virtual core::vector3df getGravity () const { return Controller.getGravity (); }
+
+	//! speed as the fps camera passes it, units per 1/30 s. 9 is quake3's 270 units/s
+	virtual void jump ( f32 jumpSpeed );
+
+	virtual void setAnimateTarget ( bool enable ) { AnimateTarget = enable; }
+	virtual bool getAnimateTarget () const { return AnimateTarget; }
+	virtual void setEllipsoidTranslation ( const core::vector3df &translation );
+	virtual core::vector3df getEllipsoidTranslation () const { return Character.Translation; }
+
+	//! kept for the interface, the controller collides against its bvh
+	virtual void setWorld ( scene::ITriangleSelector *world );
+	virtual scene::ITriangleSelector* getWorld () const { return World; }
+
+	virtual void setTargetNode ( scene::ISceneNode *node );
+	virtual scene::ISceneNode* getTargetNode () const { return Node; }
+
+	virtual bool collisionOccurred () const { return Character.HitTriangle >= 0; }
+	virtual const core::vector3df & getCollisionPoint () const { return Character.HitPoint; }
+	virtual const core::triangle3df & getCollisionTriangle () const { return Triangle; }
+	virtual const core::vector3df & getCollisionResultPosition () const { return Character.Position; }
+	virtual scene::ISceneNode* getCollisionNode () const { return 0; }
+	virtual void setCollisionCallback ( scene::ICollisionCallback *callback );
+
+	//! crouch with the shapes of the controller. standing up is retried each frame until there is room
+	void crouch ( bool down );
+
+	SCharacter & getCharacter () { return Character; }
+
+private:
+	CCharacterController Controller;		// own copy, gravity is per animator
+	scene::ISceneNode *Node;
+	scene::ITriangleSelector *World;
+	scene::ICollisionCallback *Callback;
+	SCharacter Character;
+	core::triangle3df Triangle;
+	u32 LastTime;
+	bool FirstUpdate;
+	bool AnimateTarget;
+	bool WantCrouch;
+};
+
+#endif // __QUAKE3_CHARACTER__H_INCLUDED__
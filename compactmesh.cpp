@@ -0,0 +1,151 @@
+/*!
+	Compact Mesh.
+	static map geometry quantized to 20 bytes per vertex for the cpu
+*/
+
+#include "compactmesh.h"
+
+#include <math.h>
+
+using namespace core;
+using namespace scene;
+using namespace video;
+
+static const f32 STEPS = 65535.f;
+
+static inline u16 quantize ( f32 v, f32 origin, f32 step )
+{
+	if ( step <= 0.f )
+		return 0;
+	return (u16) core::clamp ( floorf ( ( v - origin ) / step + 0.5f ), 0.f, STEPS );
+}
+
+/*
+	the unit vector is projected onto the octahedron |x|+|y|+|z| = 1, the
+	lower half folded over the upper one, x and y stored in a byte each
+*/
+void encodeNormal ( const vector3df &normal, u8 *out )
+{
+	const f32 l1 = fabsf ( normal.X ) + fabsf ( normal.Y ) + fabsf ( normal.Z );
+	f32 x = 0.f, y = 0.f;
+	if ( l1 > 0.f )
+	{
+		x = normal.X / l1;
+		y = normal.Y / l1;
+		if ( normal.Z < 0.f )
+		{
+			const f32 fx = ( 1.f - fabsf ( y ) ) * ( x < 0.f ? -1.f : 1.f );
+			const f32 fy = ( 1.f - fabsf ( x ) ) * ( y < 0.f ? -1.f : 1.f );
+			x = fx;
+			y = fy;
+		}
+	}
+	out[0] = (u8) floorf ( ( x * 0.5f + 0.5f ) * 255.f + 0.5f );
+	out[1] = (u8) floorf ( ( y * 0.5f + 0.5f ) * 255.f + 0.5f );
+}
+
+vector3df decodeNormal ( const u8 *in )
+{
+	vector3df n ( in[0] * ( 2.f / 255.f ) - 1.f, in[1] * ( 2.f / 255.f ) - 1.f, 0.f );
+	n.Z = 1.f - fabsf ( n.X ) - fabsf ( n.Y );
+	if ( n.Z < 0.f )
+	{
+		const f32 x = ( 1.f - fabsf ( n.Y ) ) * ( n.X < 0.f ? -1.f : 1.f );
+		const f32 y = ( 1.f - fabsf ( n.X ) ) * ( n.Y < 0.f ? -1.f : 1.f );
+		n.X = x;
+		n.Y = y;
+	}
+	return n.normalize ();
+}
+
+void CCompactMesh::clear ()
+{
+	Buffer.clear ();
+	Vertex.clear ();
+	Index.clear ();
+}
+
+void CCompactMesh::build ( IMesh *mesh )
+{
+	clear ();
+	if ( 0 == mesh )
+		return;
+
+	for ( u32 m = 0; m != mesh->getMeshBufferCount (); ++m )
+	{
+		IMeshBuffer *mb = mesh->getMeshBuffer ( m );
+		if ( mb->getVertexType () != EVT_2TCOORDS || mb->getIndexType () != EIT_16BIT || 0 == mb->getVertexCount () )
+			continue;
+
+		const S3DVertex2TCoords *v = (const S3DVertex2TCoords*) mb->getVertices ();
+		const u32 count = mb->getVertexCount ();
+
+		// the ranges of this buffer
+		aabbox3df box ( v[0].Pos );
+		vector2df tmin = v[0].TCoords, tmax = v[0].TCoords;
+		for ( u32 i = 1; i != count; ++i )
+		{
+			box.addInternalPoint ( v[i].Pos );
+			tmin.X = core::min_ ( tmin.X, v[i].TCoords.X );
+			tmin.Y = core::min_ ( tmin.Y, v[i].TCoords.Y );
+			tmax.X = core::max_ ( tmax.X, v[i].TCoords.X );
+			tmax.Y = core::max_ ( tmax.Y, v[i].TCoords.Y );
+		}
+
+		SCompactBuffer b;
+		b.Origin = box.MinEdge;
+		b.Step = ( box.MaxEdge - box.MinEdge ) / STEPS;
+		b.TOrigin = tmin;
+		b.TStep = ( tmax - tmin ) / STEPS;
+		b.FirstVertex = Vertex.size ();
+		b.VertexCount = count;
+		b.FirstIndex = Index.size ();
+		b.IndexCount = mb->getIndexCount ();
+		b.Transparent = mb->getMaterial ().isTransparent ();
+
+		Vertex.reallocate ( Vertex.size () + count );
+		for ( u32 i = 0; i != count; ++i )
+		{
+			SCompactVertex c;
+			c.Pos[0] = quantize ( v[i].Pos.X, b.Origin.X, b.Step.X );
+			c.Pos[1] = quantize ( v[i].Pos.Y, b.Origin.Y, b.Step.Y );
+			c.Pos[2] = quantize ( v[i].Pos.Z, b.Origin.Z, b.Step.Z );
+			encodeNormal ( v[i].Normal, c.Normal );
+			c.Color = v[i].Color.color;
+			c.TCoords[0] = quantize ( v[i].TCoords.X, b.TOrigin.X, b.TStep.X );
+			c.TCoords[1] = quantize ( v[i].TCoords.Y, b.TOrigin.Y, b.TStep.Y );
+			c.TCoords2[0] = quantize ( v[i].TCoords2.X, 0.f, 1.f / STEPS );
+			c.TCoords2[1] = quantize ( v[i].TCoords2.Y, 0.f, 1.f / STEPS );
+			Vertex.push_back ( c );
+		}
+
+		const u16 *index = mb->getIndices ();
+		Index.reallocate ( Index.size () + b.IndexCount );
+		for ( u32 i = 0; i != b.IndexCount; ++i )
+			Index.push_back ( index[i] );
+
+		Buffer.push_back ( b );
+	}
+}
+
+void CCompactMesh::decode ( const SCompactBuffer &buffer, const SCompactVertex &v, S3DVertex2TCoords &out )
+{
+	out.Pos = getPosition ( buffer, v );
+	out.Normal = decodeNormal ( v.Normal );
+	out.Color.color = v.Color;
+	out.TCoords.X = buffer.TOrigin.X + v.TCoords[0] * buffer.TStep.X;
+	out.TCoords.Y = buffer.TOrigin.Y + v.TCoords[1] * buffer.TStep.Y;
+	out.TCoords2.X = v.TCoords2[0] * ( 1.f / STEPS );
+	out.TCoords2.Y = v.TCoords2[1] * ( 1.f / STEPS );
+}
+
+u32 CCompactMesh::getMemoryFootprint () const
+{
+	return Buffer.size () * sizeof ( SCompactBuffer ) + Vertex.size () * sizeof ( SCompactVertex ) +
+		Index.size () * sizeof ( u16 );
+}
+
+u32 CCompactMesh::getSourceFootprint () const
+{
+	return Vertex.size () * sizeof ( S3DVertex2TCoords ) + Index.size () * sizeof ( u16 );
+}
@@ -0,0 +1,86 @@
+/*!
+	Compact Mesh.
+	static map geometry quantized to 20 bytes per vertex for the cpu
+
+	The loader writes the map surfaces as S3DVertex2TCoords, 44 bytes of
+	floats per vertex, which the drivers need for drawing. The code reading
+	the geometry on the cpu gets a quantized copy instead: positions are
+	16 bit steps across the box of their buffer, the normal is octahedral
+	in two bytes, texture coordinates are 16 bit steps across their range
+	in the buffer, and lightmap coordinates, always inside 0..1, are 16 bit
+	fixed point. Every field is decoded on the fly where it is read.
+
+	A coordinate is off by at most half a step, the buffer extent / 131070,
+	below a tenth of a unit for buffers up to 8192 units across.
+*/
+#ifndef __QUAKE3_COMPACTMESH__H_INCLUDED__
+#define __QUAKE3_COMPACTMESH__H_INCLUDED__
+
+#include <irrlicht.h>
+
+using namespace irr;
+
+struct SCompactVertex
+{
+	u16 Pos[3];
+	u8 Normal[2];		// octahedral
+	u32 Color;
+	u16 TCoords[2];
+	u16 TCoords2[2];	// lightmap
+};
+
+//! ranges the vertices of one mesh buffer are quantized against
+struct SCompactBuffer
+{
+	core::vector3df Origin;
+	core::vector3df Step;		// units per position step
+	core::vector2df TOrigin;
+	core::vector2df TStep;
+	u32 FirstVertex;
+	u32 VertexCount;
+	u32 FirstIndex;
+	u32 IndexCount;
+	bool Transparent;
+};
+
+//! two bytes for a unit vector
+void encodeNormal ( const core::vector3df &normal, u8 *out );
+core::vector3df decodeNormal ( const u8 *in );
+
+class CCompactMesh
+{
+public:
+	//! every lightmapped buffer with 16 bit indices, the others are skipped
+	void build ( scene::IMesh *mesh );
+	void clear ();
+
+	u32 getBufferCount () const { return Buffer.size (); }
+	const SCompactBuffer & getBuffer ( u32 index ) const { return Buffer[index]; }
+	u32 getVertexCount () const { return Vertex.size (); }
+
+	//! indices of a buffer are relative to its first vertex
+	const u16 * getIndices ( const SCompactBuffer &buffer ) const { return Index.const_pointer () + buffer.FirstIndex; }
+	const SCompactVertex * getVertices ( const SCompactBuffer &buffer ) const { return Vertex.const_pointer () + buffer.FirstVertex; }
+
+	static core::vector3df getPosition ( const SCompactBuffer &buffer, const SCompactVertex &v )
+	{
+		return core::vector3df ( buffer.Origin.X + v.Pos[0] * buffer.Step.X,
+								buffer.Origin.Y + v.Pos[1] * buffer.Step.Y,
+								buffer.Origin.Z + v.Pos[2] * buffer.Step.Z );
+	}
+
+	//! the full vertex back in the driver format
+	static void decode ( const SCompactBuffer &buffer, const SCompactVertex &v, video::S3DVertex2TCoords &out );
+
+	u32 getMemoryFootprint () const;
+
+	//! what the same vertices and indices take as S3DVertex2TCoords
+	u32 getSourceFootprint () const;
+
+private:
+	core::array < SCompactBuffer > Buffer;
+	core::array < SCompactVertex > Vertex;
+	core::array < u16 > Index;
+};
+
+#endif // __QUAKE3_COMPACTMESH__H_INCLUDED__
@@ -0,0 +1,60 @@
+/*!
+	CRC32.
+	zip / png polynomial ( 0xEDB88320 ), slice-by-8
+*/
+
+#include "crc32.h"
+
+// tables, built at startup
+static struct SCrcTables
+{
+	u32 T[8][256];
+
+	SCrcTables ()
+	{
+		for ( u32 i = 0; i != 256; ++i )
+		{
+			u32 c = i;
+			for ( u32 k = 0; k != 8; ++k )
+				c = c & 1 ? ( c >> 1 ) ^ 0xEDB88320 : c >> 1;
+			T[0][i] = c;
+		}
+
+		for ( u32 i = 0; i != 256; ++i )
+		{
+			for ( u32 s = 1; s != 8; ++s )
+				T[s][i] = ( T[s - 1][i] >> 8 ) ^ T[0][ T[s - 1][i] & 0xFF ];
+		}
+	}
+} Crc;
+
+u32 crc32 ( u32 crc, const void *data, u32 size )
+{
+	const u8 *p = (const u8*) data;
+	crc = ~crc;
+
+	// align to 4 bytes for the word loads
+	while ( size && ( (size_t) p & 3 ) )
+	{
+		crc = ( crc >> 8 ) ^ Crc.T[0][ ( crc ^ *p++ ) & 0xFF ];
+		size -= 1;
+	}
+
+	// little endian word loads
+	while ( size >= 8 )
+	{
+		const u32 a = *(const u32*) p ^ crc;
+		const u32 b = *(const u32*) ( p + 4 );
+		crc =	Crc.T[7][ a & 0xFF ] ^ Crc.T[6][ ( a >> 8 ) & 0xFF ] ^
+				Crc.T[5][ ( a >> 16 ) & 0xFF ] ^ Crc.T[4][ a >> 24 ] ^
+				Crc.T[3][ b & 0xFF ] ^ Crc.T[2][ ( b >> 8 ) & 0xFF ] ^
+				Crc.T[1][ ( b >> 16 ) & 0xFF ] ^ Crc.T[0][ b >> 24 ];
+		p += 8;
+		size -= 8;
+	}
+
+	while ( size-- )
+		crc = ( crc >> 8 ) ^ Crc.T[0][ ( crc ^ *p++ ) & 0xFF ];
+
+	return ~crc;
+}
@@ -0,0 +1,18 @@
+/*!
+	CRC32.
+	zip / png polynomial ( 0xEDB88320 ), slice-by-8
+
+	Eight bytes are folded per step through eight 256 entry tables,
+	about 4-5x the speed of the byte wise table walk.
+*/
+#ifndef __QUAKE3_CRC32__H_INCLUDED__
+#define __QUAKE3_CRC32__H_INCLUDED__
+
+#include <irrlicht.h>
+
+using namespace irr;
+
+//! continue a crc. start with crc = 0
+u32 crc32 ( u32 crc, const void *data, u32 size );
+
+#endif // __QUAKE3_CRC32__H_INCLUDED__
@@ -0,0 +1,594 @@
+/*!
+	Enemy Manager.
+	hundreds of enemies sharing one mesh, state kept in arrays per field
+*/
+
+#include "enemy.h"
+#include "character.h"
+#include "bvh.h"
+#include "navmesh.h"
+#include "occlusion.h"
+#include "random.h"
+#include "jobs.h"
+#include <atomic>
+
+using namespace core;
+using namespace scene;
+using namespace video;
+
+static const u32 CHUNK = 32;				// enemies per worker job
+static const u32 NO_HASH = 0xFFFFFFFF;
+
+static const vector3df RADIUS ( 20.f, 36.f, 20.f );
+static const s32 HEALTH = 100;
+static const f32 SPEED = 160.f;				// units per second
+static const f32 SIGHT_RANGE = 2048.f;
+static const f32 ATTACK_RANGE = 64.f;
+static const s32 ATTACK_DAMAGE = 10;
+static const f32 ATTACK_TIME = 1.f;
+static const f32 THINK_TIME = 0.25f;		// sight checks are raycasts, not every frame
+static const f32 DEAD_TIME = 3.f;
+static const f32 SEPARATION = 64.f;			// neighbours closer than this push apart
+static const f32 REPATH_TIME = 1.f;			// seconds between route requests of one enemy
+static const u32 MAX_REQUESTS = 16;			// route requests per tick
+static const f32 CORNER_REACHED = 24.f;
+static const f32 LOD_NEAR = 512.f;			// sub frame poses closer than this
+static const f32 LOD_FAR = 1536.f;			// beyond, a new pose every fourth tick
+
+enum eEnemyFlag
+{
+	ENEMY_ON_GROUND = 1,
+	ENEMY_SEES_TARGET = 2
+};
+
+/*
+	dwarf.x has a single 56 frame animation set, the clips play parts
+	of it. indexed by eEnemyState
+*/
+struct SEnemyClip
+{
+	f32 Begin;
+	f32 End;
+	f32 Fps;
+	bool Loop;
+};
+
+static const SEnemyClip Clips[] =
+{
+	{ 0.f, 0.f, 0.f, false },		// gone
+	{ 0.f, 0.f, 0.f, false },		// idle
+	{ 0.f, 55.f, 25.f, true },		// chase
+	{ 0.f, 55.f, 50.f, true },		// attack
+	{ 0.f, 0.f, 0.f, false }		// dead
+};
+
+static inline f32 clipFrame ( const SEnemyClip &clip, f32 time )
+{
+	const f32 length = clip.End - clip.Begin;
+	if ( length <= 0.f )
+		return clip.Begin;
+
+	const f32 f = time * clip.Fps;
+	return clip.Begin + ( clip.Loop ? fmodf ( f, length + 1.f ) : core::min_ ( f, length ) );
+}
+
+CEnemyManager::CEnemyManager ()
+: SceneManager ( 0 ), Mesh ( 0 ), Texture ( 0 ), Parent ( 0 ), Controller ( 0 ), Navigation ( 0 ), Occlusion ( 0 ),
+	Alive ( 0 ), Reach ( 0.f ), Hash ( 128.f ), Tick ( 0 )
+{
+}
+
+CEnemyManager::~CEnemyManager ()
+{
+	clear ();
+}
+
+bool CEnemyManager::init ( ISceneManager *smgr, const CCharacterController *controller,
+							const c8 *meshName, const c8 *textureName )
+{
+	clear ();
+
+	SceneManager = smgr;
+	Controller = controller;
+	Mesh = smgr->getMesh ( meshName );
+	Texture = smgr->getVideoDriver ()->getTexture ( textureName );
+	if ( 0 == Mesh )
+		return false;
+
+	// the culling box has to hold the mesh standing, turned and fallen over
+	vector3df corner[8];
+	Mesh->getBoundingBox ().getEdges ( corner );
+	for ( u32 i = 0; i != 8; ++i )
+		Reach = core::max_ ( Reach, corner[i].getLength () );
+
+	// poses are skinned here, the mesh itself stays in the bind pose
+	if ( Mesh->getMeshType () == EAMT_SKINNED && Skin.init ( (ISkinnedMesh*) Mesh ) )
+	{
+		Skin.setMaterialTexture ( 0, Texture );
+		Skin.setMaterialFlag ( EMF_LIGHTING, true );
+	}
+
+	Parent = smgr->addEmptySceneNode ();
+	Parent->setName ( "enemies" );
+	return true;
+}
+
+void CEnemyManager::clear ()
+{
+	if ( Parent )
+		Parent->remove ();
+
+	SceneManager = 0;
+	Mesh = 0;
+	Texture = 0;
+	Parent = 0;
+	Controller = 0;
+	Navigation = 0;
+	Occlusion = 0;
+	Alive = 0;
+	Tick = 0;
+
+	PosX.clear ();
+	PosY.clear ();
+	PosZ.clear ();
+	VelX.clear ();
+	VelY.clear ();
+	VelZ.clear ();
+	Yaw.clear ();
+	Health.clear ();
+	State.clear ();
+	Flags.clear ();
+	Think.clear ();
+	Cooldown.clear ();
+	Clip.clear ();
+	ClipTime.clear ();
+	Ticket.clear ();
+	Repath.clear ();
+	Route.clear ();
+	RouteStep.clear ();
+	HashId.clear ();
+	HashOwner.clear ();
+	PoseKey.clear ();
+	Node.clear ();
+	Bounds.clear ();
+	OnScreen.clear ();
+	Reach = 0.f;
+	Hash.clear ();
+	Skin.clear ();
+}
+
+s32 CEnemyManager::spawn ( const vector3df &position, f32 yaw )
+{
+	if ( 0 == Mesh )
+		return -1;
+
+	// reuse a slot whose enemy has vanished, its node stays
+	u32 i = 0;
+	while ( i != State.size () && State[i] != ENEMY_GONE )
+		i += 1;
+
+	if ( i == State.size () )
+	{
+		// the pose is set by sync, a mesh without joints stays in its first frame
+		IMeshSceneNode *node;
+		if ( Skin.getVertexCount () )
+		{
+			node = SceneManager->addMeshSceneNode ( 0, Parent );
+			node->setReadOnlyMaterials ( true );
+		}
+		else
+		{
+			node = SceneManager->addMeshSceneNode ( Mesh->getMesh ( 0 ), Parent );
+			node->setMaterialTexture ( 0, Texture );
+			node->setMaterialFlag ( EMF_LIGHTING, true );
+		}
+
+		PosX.push_back ( 0.f );
+		PosY.push_back ( 0.f );
+		PosZ.push_back ( 0.f );
+		VelX.push_back ( 0.f );
+		VelY.push_back ( 0.f );
+		VelZ.push_back ( 0.f );
+		Yaw.push_back ( 0.f );
+		Health.push_back ( 0 );
+		State.push_back ( ENEMY_GONE );
+		Flags.push_back ( 0 );
+		Think.push_back ( 0.f );
+		Cooldown.push_back ( 0.f );
+		Clip.push_back ( ENEMY_GONE );
+		ClipTime.push_back ( 0.f );
+		Ticket.push_back ( 0 );
+		Repath.push_back ( 0.f );
+		Route.push_back ( array < vector3df > () );
+		RouteStep.push_back ( 0 );
+		HashId.push_back ( NO_HASH );
+		PoseKey.push_back ( 0 );
+		Node.push_back ( node );
+
+		// shown or hidden by the batch cull in sync
+		node->setAutomaticCulling ( EAC_OFF );
+		Bounds.add ( aabbox3df ( position ) );
+	}
+
+	PosX[i] = position.X;
+	PosY[i] = position.Y;
+	PosZ[i] = position.Z;
+	VelX[i] = 0.f;
+	VelY[i] = 0.f;
+	VelZ[i] = 0.f;
+	Yaw[i] = yaw;
+	Health[i] = HEALTH;
+	State[i] = ENEMY_IDLE;
+	Flags[i] = 0;
+	Cooldown[i] = 0.f;
+	Clip[i] = ENEMY_IDLE;
+	ClipTime[i] = 0.f;
+	Ticket[i] = 0;
+	Route[i].set_used ( 0 );
+	RouteStep[i] = 0;
+
+	// spread the sight checks and route requests over the frames
+	Think[i] = getRandom ( RANDOM_AI ).frand ( 0.f, THINK_TIME );
+	Repath[i] = getRandom ( RANDOM_AI ).frand ( 0.f, REPATH_TIME );
+
+	HashId[i] = Hash.add ( position + vector3df ( 0.f, RADIUS.Y, 0.f ), RADIUS.Y );
+	if ( HashOwner.size () <= HashId[i] )
+		HashOwner.set_used ( HashId[i] + 1 );
+	HashOwner [ HashId[i] ] = i;
+
+	Node[i]->setPosition ( position );
+	Node[i]->setRotation ( vector3df ( 0.f, yaw, 0.f ) );
+	Node[i]->setVisible ( true );
+
+	Alive += 1;
+	return i;
+}
+
+bool CEnemyManager::damage ( u32 index, s32 amount )
+{
+	if ( index >= State.size () || State[index] < ENEMY_IDLE || State[index] > ENEMY_ATTACK )
+		return false;
+
+	Health[index] -= amount;
+	if ( Health[index] > 0 )
+		return false;
+
+	State[index] = ENEMY_DEAD;
+	Think[index] = DEAD_TIME;
+	Clip[index] = ENEMY_DEAD;
+	ClipTime[index] = 0.f;
+	VelX[index] = 0.f;
+	VelZ[index] = 0.f;
+	Ticket[index] = 0;
+	Route[index].set_used ( 0 );
+	Alive -= 1;
+	return true;
+}
+
+/*
+	ai and movement of one chunk. reads the hash, writes only the
+	enemies first .. first + count
+*/
+s32 CEnemyManager::think ( u32 first, u32 count, const vector3df &target, f32 dt, array < u32 > &scratch )
+{
+	const CCollisionBVH *world = Controller ? Controller->getWorld () : 0;
+	const vector3df eye ( 0.f, RADIUS.Y * 1.8f, 0.f );
+
+	SCharacter body [ CHUNK ];
+	u32 bodyOf [ CHUNK ];
+	u32 bodies = 0;
+	s32 dealt = 0;
+
+	for ( u32 i = first; i != first + count; ++i )
+	{
+		if ( ENEMY_GONE == State[i] )
+			continue;
+
+		ClipTime[i] += dt;
+
+		if ( ENEMY_DEAD == State[i] )
+		{
+			Think[i] -= dt;
+			if ( Think[i] <= 0.f )
+				State[i] = ENEMY_GONE;
+			continue;
+		}
+
+		const vector3df pos ( PosX[i], PosY[i], PosZ[i] );
+		vector3df to = target - pos;
+		to.Y = 0.f;
+		const f32 distSQ = to.getLengthSQ ();
+
+		Think[i] -= dt;
+		if ( Think[i] <= 0.f )
+		{
+			Think[i] += THINK_TIME;
+			bool sees = distSQ < SIGHT_RANGE * SIGHT_RANGE;
+			vector3df hit;
+			if ( sees && world && world->raycast ( line3df ( pos + eye, target ), hit ) )
+				sees = false;
+			Flags[i] = (u8) ( sees ? Flags[i] | ENEMY_SEES_TARGET : Flags[i] & ~ENEMY_SEES_TARGET );
+		}
+
+		u8 state = ENEMY_IDLE;
+		if ( Flags[i] & ENEMY_SEES_TARGET )
+			state = distSQ < ATTACK_RANGE * ATTACK_RANGE ? ENEMY_ATTACK : ENEMY_CHASE;
+		else
+		{
+			// out of sight, walk the corners of the route
+			const array < vector3df > &corner = Route[i];
+			while ( RouteStep[i] < corner.size () )
+			{
+				vector3df d = corner [ RouteStep[i] ] - pos;
+				d.Y = 0.f;
+				if ( d.getLengthSQ () > CORNER_REACHED * CORNER_REACHED )
+					break;
+				RouteStep[i] += 1;
+			}
+			if ( RouteStep[i] < corner.size () )
+			{
+				to = corner [ RouteStep[i] ] - pos;
+				to.Y = 0.f;
+				state = ENEMY_CHASE;
+			}
+		}
+		State[i] = state;
+
+		vector3df vel ( 0.f, 0.f, 0.f );
+		if ( ENEMY_CHASE == state )
+		{
+			vel = to;
+			vel.setLength ( SPEED );
+
+			// push away from the neighbours so a crowd does not merge
+			scratch.set_used ( 0 );
+			Hash.queryRadius ( pos + vector3df ( 0.f, RADIUS.Y, 0.f ), SEPARATION, scratch );
+			for ( u32 n = 0; n != scratch.size (); ++n )
+			{
+				if ( scratch[n] == HashId[i] )
+					continue;
+				vector3df away = pos + vector3df ( 0.f, RADIUS.Y, 0.f ) - Hash.getPosition ( scratch[n] );
+				away.Y = 0.f;
+				const f32 d = away.getLength ();
+				if ( d > 0.001f && d < SEPARATION )
+					vel += away * ( SPEED * ( 1.f - d / SEPARATION ) / d );
+			}
+		}
+		else if ( ENEMY_ATTACK == state )
+		{
+			Cooldown[i] -= dt;
+			if ( Cooldown[i] <= 0.f )
+			{
+				Cooldown[i] = ATTACK_TIME;
+				dealt += ATTACK_DAMAGE;
+			}
+		}
+
+		if ( state != ENEMY_ATTACK )
+			Cooldown[i] = core::max_ ( Cooldown[i] - dt, 0.f );
+
+		if ( to.getLengthSQ () > 0.f && state != ENEMY_IDLE )
+			Yaw[i] = atan2f ( to.X, to.Z ) * core::RADTODEG;
+
+		if ( Clip[i] != state )
+		{
+			Clip[i] = state;
+			ClipTime[i] = 0.f;
+		}
+
+		VelX[i] = vel.X;
+		VelZ[i] = vel.Z;
+
+		if ( Controller )
+		{
+			SCharacter &c = body [ bodies ];
+			c.Position = pos;
+			c.Velocity.set ( 0.f, VelY[i], 0.f );
+			c.Wish = vel * dt;
+			c.Radius = RADIUS;
+			c.Translation.set ( 0.f, -RADIUS.Y, 0.f );
+			c.OnGround = ( Flags[i] & ENEMY_ON_GROUND ) != 0;
+			bodyOf [ bodies++ ] = i;
+		}
+		else
+		{
+			PosX[i] += vel.X * dt;
+			PosZ[i] += vel.Z * dt;
+		}
+	}
+
+	if ( bodies )
+	{
+		Controller->move ( body, bodies, dt );
+		for ( u32 b = 0; b != bodies; ++b )
+		{
+			const u32 i = bodyOf[b];
+			PosX[i] = body[b].Position.X;
+			PosY[i] = body[b].Position.Y;
+			PosZ[i] = body[b].Position.Z;
+			VelY[i] = body[b].Velocity.Y;
+			Flags[i] = (u8) ( body[b].OnGround ? Flags[i] | ENEMY_ON_GROUND : Flags[i] & ~ENEMY_ON_GROUND );
+		}
+	}
+
+	return dealt;
+}
+
+/*
+	main thread: collects the routes finished last tick and asks for new
+	ones for the enemies that lost sight of the target
+*/
+void CEnemyManager::route ( const vector3df &target, f32 dt )
+{
+	if ( 0 == Navigation )
+		return;
+
+	u32 requests = 0;
+	for ( u32 i = 0; i != State.size (); ++i )
+	{
+		if ( State[i] < ENEMY_IDLE || State[i] > ENEMY_ATTACK )
+			continue;
+
+		if ( Ticket[i] && Navigation->poll ( Ticket[i], Route[i] ) )
+		{
+			Ticket[i] = 0;
+			RouteStep[i] = 0;
+		}
+
+		Repath[i] -= dt;
+		if ( Flags[i] & ENEMY_SEES_TARGET )
+		{
+			// ask at once when sight is lost again
+			Route[i].set_used ( 0 );
+			Repath[i] = 0.f;
+			continue;
+		}
+
+		const vector3df pos ( PosX[i], PosY[i], PosZ[i] );
+		if ( Repath[i] > 0.f || requests == MAX_REQUESTS ||
+			pos.getDistanceFromSQ ( target ) > SIGHT_RANGE * SIGHT_RANGE )
+			continue;
+
+		// a result still in flight is dropped, the target has moved on
+		Ticket[i] = Navigation->request ( pos, target );
+		Repath[i] = REPATH_TIME;
+		requests += 1;
+	}
+}
+
+/*
+	main thread: hash and scene nodes follow the arrays. the poses of all
+	nodes are requested first, so the missing ones are skinned in one go
+*/
+void CEnemyManager::sync ()
+{
+	const s32 lastFrame = Mesh->getFrameCount () - 1;
+	const bool skinned = Skin.getVertexCount () != 0;
+
+	ICameraSceneNode *camera = SceneManager->getActiveCamera ();
+	const vector3df eye = camera ? camera->getAbsolutePosition () : vector3df ( 0.f, 0.f, 0.f );
+	const SViewFrustum *frustum = camera ? camera->getViewFrustum () : 0;
+
+	// all enemies against the frustum at once
+	for ( u32 i = 0; i != State.size (); ++i )
+	{
+		const vector3df pos ( PosX[i], PosY[i], PosZ[i] );
+		Bounds.set ( i, aabbox3df ( pos - vector3df ( Reach ), pos + vector3df ( Reach ) ) );
+	}
+	if ( frustum )
+		Bounds.cull ( *frustum, OnScreen );
+	else
+		Bounds.fill ( OnScreen );
+
+	// sync runs before the scene is drawn, the depth buffer is the one of the last frame
+	if ( Occlusion )
+		Occlusion->cull ( Bounds, OnScreen );
+
+	Tick += 1;
+	for ( u32 i = 0; i != State.size (); ++i )
+	{
+		IMeshSceneNode *node = Node[i];
+		if ( State[i] == ENEMY_GONE || State[i] == ENEMY_DEAD )
+		{
+			if ( HashId[i] != NO_HASH )
+			{
+				Hash.remove ( HashId[i] );
+				HashId[i] = NO_HASH;
+			}
+			if ( State[i] == ENEMY_GONE )
+			{
+				if ( node->isVisible () )
+					node->setVisible ( false );
+				continue;
+			}
+		}
+
+		const vector3df pos ( PosX[i], PosY[i], PosZ[i] );
+		if ( HashId[i] != NO_HASH )
+			Hash.move ( HashId[i], pos + vector3df ( 0.f, RADIUS.Y, 0.f ) );
+
+		// the feet are the origin, the dead fall over backwards
+		node->setPosition ( pos );
+		node->setRotation ( vector3df ( State[i] == ENEMY_DEAD ? -90.f : 0.f, Yaw[i], 0.f ) );
+
+		const bool visible = CBoxCuller::isVisible ( OnScreen, i );
+		if ( node->isVisible () != visible )
+			node->setVisible ( visible );
+
+		if ( !skinned )
+			continue;
+
+		// animation lod, the coarser the grid the more enemies share a pose
+		u32 step = 1;
+		bool hold = false;
+		if ( frustum )
+		{
+			const f32 distSQ = eye.getDistanceFromSQ ( pos );
+			if ( distSQ > LOD_NEAR * LOD_NEAR )
+				step = Skin.getSubFrames ();
+			hold = ( !visible || distSQ > LOD_FAR * LOD_FAR ) && ( ( Tick + i ) & 3 ) != 0 && node->getMesh ();
+		}
+
+		if ( !hold )
+			PoseKey[i] = Skin.getKey ( core::min_ ( clipFrame ( Clips [ Clip[i] ], ClipTime[i] ), (f32) lastFrame ), step );
+		Skin.request ( PoseKey[i] );
+	}
+
+	Hash.update ();
+
+	if ( !skinned )
+		return;
+
+	Skin.skin ();
+	for ( u32 i = 0; i != State.size (); ++i )
+	{
+		if ( State[i] == ENEMY_GONE )
+			continue;
+
+		IMesh *pose = Skin.getPose ( PoseKey[i] );
+		if ( pose && Node[i]->getMesh () != pose )
+			Node[i]->setMesh ( pose );
+	}
+}
+
+s32 CEnemyManager::update ( const vector3df &target, f32 dt )
+{
+	if ( 0 == Mesh || State.empty () || dt <= 0.f )
+		return 0;
+
+	dt = core::min_ ( dt, 0.1f );
+
+	route ( target, dt );
+
+	std::atomic < s32 > dealt ( 0 );
+
+	CEnemyManager *self = this;
+	getJobSystem ()->parallelFor ( 0, State.size (), CHUNK, [self, target, dt, &dealt] ( u32 first, u32 last )
+	{
+		array < u32 > scratch;
+		for ( ; first < last; first += CHUNK )
+			dealt += self->think ( first, core::min_ ( CHUNK, last - first ), target, dt, scratch );
+	} );
+
+	sync ();
+	return dealt;
+}
+
+bool CEnemyManager::raycast ( const line3df &ray, f32 &t, u32 &index ) const
+{
+	u32 id;
+	if ( !Hash.raycast ( ray, t, id ) )
+		return false;
+
+	index = HashOwner[id];
+	return State[index] >= ENEMY_IDLE && State[index] <= ENEMY_ATTACK;
+}
+
+void CEnemyManager::getPositions ( array < vector3df > &out ) const
+{
+	for ( u32 i = 0; i != State.size (); ++i )
+	{
+		if ( State[i] >= ENEMY_IDLE && State[i] <= ENEMY_ATTACK )
+			out.push_back ( getPosition ( i ) );
+	}
+}
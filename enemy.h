@@ -0,0 +1,130 @@
+/*!
+	Enemy Manager.
+	hundreds of enemies sharing one mesh, state kept in arrays per field
+
+	Transform, velocity, health, ai state and animation clip live in
+	one array each, indexed by enemy. update () thinks and moves the
+	enemies in chunks on the worker pool, each job writes only its own
+	range and reads the spatial hash of the previous frame. Afterwards
+	the main thread sorts the hash and copies the results to the scene
+	nodes, the only part touching irrlicht. The boxes of all enemies are
+	culled against the view in one batch, and optionally against the
+	occluders of the last frame, which shows and hides the nodes instead
+	of their own frustum test. The nodes draw poses of a
+	shared skin cache, close enemies on sub frames, distant ones on whole
+	frames, and far or off screen ones keep their pose for a few ticks.
+	An enemy that lost sight of the target asks the navigation query
+	for a route and follows its corners until it sees the target again.
+*/
+#ifndef __QUAKE3_ENEMY__H_INCLUDED__
+#define __QUAKE3_ENEMY__H_INCLUDED__
+
+#include <irrlicht.h>
+#include "spatialhash.h"
+#include "skin.h"
+#include "boxcull.h"
+
+using namespace irr;
+
+class CCharacterController;
+class CNavQuery;
+class COcclusionCuller;
+
+enum eEnemyState
+{
+	ENEMY_GONE = 0,		// free slot, node hidden
+	ENEMY_IDLE,
+	ENEMY_CHASE,
+	ENEMY_ATTACK,
+	ENEMY_DEAD
+};
+
+class CEnemyManager
+{
+public:
+	CEnemyManager ();
+	~CEnemyManager ();
+
+	//! loads the mesh once for all enemies. controller 0 moves them without collision
+	bool init ( scene::ISceneManager *smgr, const CCharacterController *controller,
+				const c8 *meshName = "dwarf.x", const c8 *textureName = "dwarf.jpg" );
+
+	//! removes all enemies and their nodes
+	void clear ();
+
+	//! routes around walls when out of sight. 0 waits where it lost sight
+	void setNavigation ( CNavQuery *query ) { Navigation = query; }
+
+	//! hides enemies behind the map, tested against the last frame. 0 for none
+	void setOcclusion ( COcclusionCuller *occlusion ) { Occlusion = occlusion; }
+
+	//! index of the new enemy, feet at position
+	s32 spawn ( const core::vector3df &position, f32 yaw = 0.f );
+
+	//! true if the hit killed it
+	bool damage ( u32 index, s32 amount );
+
+	//! think and move all enemies towards target. returns the damage dealt to the target
+	s32 update ( const core::vector3df &target, f32 dt );
+
+	//! nearest living enemy hit by the segment, t in [0,1] along it
+	bool raycast ( const core::line3df &ray, f32 &t, u32 &index ) const;
+
+	//! positions of the living enemies
+	void getPositions ( core::array < core::vector3df > &out ) const;
+
+	u32 getCount () const { return State.size (); }
+	u32 getAliveCount () const { return Alive; }
+	eEnemyState getState ( u32 index ) const { return (eEnemyState) State[index]; }
+	core::vector3df getPosition ( u32 index ) const { return core::vector3df ( PosX[index], PosY[index], PosZ[index] ); }
+	s32 getHealth ( u32 index ) const { return Health[index]; }
+
+	const CSpatialHash & getHash () const { return Hash; }
+	const CSkinCache & getSkin () const { return Skin; }
+
+private:
+	s32 think ( u32 first, u32 count, const core::vector3df &target, f32 dt, core::array < u32 > &scratch );
+	void route ( const core::vector3df &target, f32 dt );
+	void sync ();
+
+	scene::ISceneManager *SceneManager;
+	scene::IAnimatedMesh *Mesh;
+	video::ITexture *Texture;
+	scene::ISceneNode *Parent;
+	const CCharacterController *Controller;
+	CNavQuery *Navigation;
+	COcclusionCuller *Occlusion;
+	u32 Alive;
+
+	core::array < f32 > PosX;
+	core::array < f32 > PosY;
+	core::array < f32 > PosZ;
+	core::array < f32 > VelX;
+	core::array < f32 > VelY;
+	core::array < f32 > VelZ;
+	core::array < f32 > Yaw;
+	core::array < s32 > Health;
+	core::array < u8 > State;
+	core::array < u8 > Flags;		// ENEMY_ON_GROUND, ENEMY_SEES_TARGET
+	core::array < f32 > Think;		// seconds to the next sight check, dead: seconds to vanish
+	core::array < f32 > Cooldown;	// seconds to the next attack
+	core::array < u8 > Clip;
+	core::array < f32 > ClipTime;
+	core::array < u32 > Ticket;		// route request in flight, 0 none
+	core::array < f32 > Repath;		// seconds to the next route request
+	core::array < core::array < core::vector3df > > Route;
+	core::array < u32 > RouteStep;	// next corner of the route
+	core::array < u32 > HashId;
+	core::array < u32 > HashOwner;	// enemy of a hash id
+	core::array < u32 > PoseKey;
+	core::array < scene::IMeshSceneNode* > Node;
+	CBoxCuller Bounds;
+	core::array < u32 > OnScreen;	// bit per enemy
+	f32 Reach;						// mesh radius around the feet, any rotation
+
+	CSpatialHash Hash;
+	CSkinCache Skin;
+	u32 Tick;
+};
+
+#endif // __QUAKE3_ENEMY__H_INCLUDED__
@@ -0,0 +1,170 @@
+/*!
+	Entity Table.
+	the entity list of a map compiled into typed tables per classname
+*/
+
+#include "entitytable.h"
+#include "vartable.h"
+
+using namespace core;
+using namespace scene;
+using namespace quake3;
+
+CEntityTable::CEntityTable ()
+: Spawn ( -1 )
+{
+}
+
+void CEntityTable::clear ()
+{
+	Strings.clear ();
+	Class.clear ();
+	ClassOfName.clear ();
+	TargetOfName.clear ();
+	Spawn = -1;
+}
+
+// string pool id of a key value, -1 for an empty value
+static s32 internValue ( CStringPool &strings, const stringc &value )
+{
+	return value.size () ? (s32) strings.intern ( value.c_str (), value.size () ) : -1;
+}
+
+/*
+	the only place the key strings are parsed
+*/
+void CEntityTable::build ( tQ3EntityList &list )
+{
+	clear ();
+
+	const u32 SymOrigin = symbol ( "origin" );
+	const u32 SymAngle = symbol ( "angle" );
+	const u32 SymAngles = symbol ( "angles" );
+	const u32 SymSpawnFlags = symbol ( "spawnflags" );
+	const u32 SymTarget = symbol ( "target" );
+	const u32 SymTargetName = symbol ( "targetname" );
+	const u32 SymModel = symbol ( "model" );
+	CVarTable vars;
+
+	for ( u32 e = 0; e != list.size (); ++e )
+	{
+		const IEntity &entity = list[e];
+		const SVarGroup *group = entity.getGroup ( 1 );
+		if ( 0 == group || 0 == entity.name.size () )
+			continue;
+
+		const u32 name = Strings.intern ( entity.name.c_str (), entity.name.size () );
+		while ( ClassOfName.size () < Strings.size () )
+			ClassOfName.push_back ( -1 );
+
+		if ( ClassOfName[name] < 0 )
+		{
+			ClassOfName[name] = Class.size ();
+			Class.push_back ( SEntityClass () );
+			Class.getLast ().Name = name;
+		}
+		SEntityClass &c = Class[ ClassOfName[name] ];
+
+		vars.build ( group );
+
+		// getAsFloat steps past the end of an empty string, only parse what is there
+		u32 pos = 0;
+		vector3df origin;
+		if ( vars.get ( SymOrigin ).size () )
+			origin = getAsVector3df ( vars.get ( SymOrigin ), pos );
+
+		f32 angle = 0.f;
+		pos = 0;
+		if ( vars.isDefined ( SymAngle ) )
+			angle = getAsFloat ( vars.get ( SymAngle ), pos );
+		else
+		if ( vars.get ( SymAngles ).findFirst ( ' ' ) > 0 )
+		{
+			getAsFloat ( vars.get ( SymAngles ), pos );
+			angle = getAsFloat ( vars.get ( SymAngles ), pos );
+		}
+
+		pos = 0;
+		const s32 spawnflags = (s32) getAsFloat ( vars.get ( SymSpawnFlags ), pos );
+		const s32 target = internValue ( Strings, vars.get ( SymTarget ) );
+		const s32 targetName = internValue ( Strings, vars.get ( SymTargetName ) );
+
+		const stringc &brush = vars.get ( SymModel );
+		const s32 model = brush.size () > 1 && brush[0] == '*' ? atoi ( brush.c_str () + 1 ) : -1;
+
+		c.Origin.push_back ( origin );
+		c.Angle.push_back ( angle );
+		c.SpawnFlags.push_back ( spawnflags );
+		c.Target.push_back ( target );
+		c.TargetName.push_back ( targetName );
+		c.Model.push_back ( model );
+	}
+
+	// targetname -> entity
+	TargetOfName.set_used ( Strings.size () );
+	memset ( TargetOfName.pointer (), 0, TargetOfName.size () * sizeof ( u32 ) );
+	for ( u32 c = 0; c != Class.size (); ++c )
+	{
+		for ( u32 r = 0; r != Class[c].size () && r < 0xFFFF; ++r )
+		{
+			const s32 t = Class[c].TargetName[r];
+			if ( t >= 0 && 0 == TargetOfName[t] )
+				TargetOfName[t] = ( ( c << 16 ) | r ) + 1;
+		}
+	}
+
+	// the order of Q3StartPosition
+	Spawn = findClass ( "info_player_start" );
+	if ( Spawn < 0 )
+		Spawn = findClass ( "info_player_deathmatch" );
+}
+
+s32 CEntityTable::findClass ( const c8 *classname ) const
+{
+	const s32 name = Strings.find ( classname );
+	return name >= 0 && (u32) name < ClassOfName.size () ? ClassOfName[name] : -1;
+}
+
+const SEntityClass * CEntityTable::getClass ( const c8 *classname ) const
+{
+	const s32 c = findClass ( classname );
+	return c >= 0 ? &Class[c] : 0;
+}
+
+bool CEntityTable::findTarget ( u32 name, u32 &classIndex, u32 &row ) const
+{
+	if ( name >= TargetOfName.size () || 0 == TargetOfName[name] )
+		return false;
+
+	classIndex = ( TargetOfName[name] - 1 ) >> 16;
+	row = ( TargetOfName[name] - 1 ) & 0xFFFF;
+	return true;
+}
+
+s32 CEntityTable::selectSpawnPoint ( const vector3df *enemy, u32 enemyCount, s32 index ) const
+{
+	const SEntityClass *spawn = getSpawnPoints ();
+	if ( 0 == spawn || 0 == spawn->size () )
+		return -1;
+
+	if ( 0 == enemyCount )
+		return core::clamp ( index, 0, (s32) spawn->size () - 1 );
+
+	s32 best = 0;
+	f32 bestDistance = -1.f;
+	for ( u32 s = 0; s != spawn->size (); ++s )
+	{
+		const vector3df &p = spawn->Origin[s];
+
+		f32 nearest = FLT_MAX;
+		for ( u32 e = 0; e != enemyCount; ++e )
+			nearest = core::min_ ( nearest, p.getDistanceFromSQ ( enemy[e] ) );
+
+		if ( nearest > bestDistance )
+		{
+			bestDistance = nearest;
+			best = s;
+		}
+	}
+	return best;
+}
@@ -0,0 +1,70 @@
+/*!
+	Entity Table.
+	the entity list of a map compiled into typed tables per classname
+
+	Built once at map load. Every classname gets a table of arrays
+	( origin, angle, spawnflags, target, targetname, brush model ),
+	so spawn, item and trigger code indexes arrays instead of searching
+	and parsing the key strings of the entity list.
+*/
+#ifndef __QUAKE3_ENTITYTABLE__H_INCLUDED__
+#define __QUAKE3_ENTITYTABLE__H_INCLUDED__
+
+#include <irrlicht.h>
+#include "intern.h"
+
+using namespace irr;
+
+//! one classname, structure of arrays
+struct SEntityClass
+{
+	u32 Name;								// id in the string pool
+	core::array < core::vector3df > Origin;
+	core::array < f32 > Angle;				// yaw in degrees
+	core::array < s32 > SpawnFlags;
+	core::array < s32 > Target;				// string pool id or -1
+	core::array < s32 > TargetName;			// string pool id or -1
+	core::array < s32 > Model;				// brush model "*n" or -1
+
+	u32 size () const { return Origin.size (); }
+};
+
+class CEntityTable
+{
+public:
+	CEntityTable ();
+
+	void build ( scene::quake3::tQ3EntityList &list );
+	void clear ();
+
+	//! class index of a classname or -1
+	s32 findClass ( const c8 *classname ) const;
+
+	const SEntityClass * getClass ( const c8 *classname ) const;
+	const SEntityClass & getClass ( u32 index ) const { return Class[index]; }
+	u32 getClassCount () const { return Class.size (); }
+
+	//! the player spawn points, info_player_start or info_player_deathmatch
+	const SEntityClass * getSpawnPoints () const { return Spawn >= 0 ? &Class[Spawn] : 0; }
+
+	/*!
+		spawn point furthest away from the nearest enemy.
+		without enemies the spawn points are used in turn, starting at index
+	*/
+	s32 selectSpawnPoint ( const core::vector3df *enemy, u32 enemyCount, s32 index ) const;
+
+	//! entity with the given targetname, false if none
+	bool findTarget ( u32 name, u32 &classIndex, u32 &row ) const;
+
+	const CStringPool & getStrings () const { return Strings; }
+	CStringPool & getStrings () { return Strings; }
+
+private:
+	CStringPool Strings;
+	core::array < SEntityClass > Class;
+	core::array < s32 > ClassOfName;		// string pool id -> class or -1
+	core::array < u32 > TargetOfName;		// string pool id -> ( class << 16 ) | row + 1, 0 = none
+	s32 Spawn;
+};
+
+#endif // __QUAKE3_ENTITYTABLE__H_INCLUDED__
@@ -0,0 +1,426 @@
+/*!
+	Inflate.
+	streaming deflate decoder ( RFC 1951 ) working on an in-memory source
+*/
+
+#include "inflate.h"
+#include <string.h>
+
+static const u16 LengthBase[29] =
+{
+	3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+	35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258
+};
+static const u8 LengthExtra[29] =
+{
+	0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+	3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0
+};
+static const u16 DistBase[30] =
+{
+	1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
+	257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145,
+	8193, 12289, 16385, 24577
+};
+static const u8 DistExtra[30] =
+{
+	0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6,
+	7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13
+};
+static const u8 CodeLengthOrder[19] =
+{
+	16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15
+};
+
+/*
+	build the canonical code from the code lengths.
+	incomplete codes are allowed ( single distance code ), over subscribed are not
+*/
+static bool buildHuffman ( SInflateHuffman &h, const u8 *length, u32 n )
+{
+	u32 i;
+	memset ( h.Count, 0, sizeof ( h.Count ) );
+	for ( i = 0; i != n; ++i )
+		h.Count [ length[i] ] += 1;
+	h.Count[0] = 0;
+
+	s32 left = 1;
+	for ( i = 1; i != 16; ++i )
+	{
+		left <<= 1;
+		left -= h.Count[i];
+		if ( left < 0 )
+			return false;
+	}
+
+	u16 offset[16];
+	u16 next[16];
+	offset[1] = 0;
+	for ( i = 1; i != 15; ++i )
+		offset[i + 1] = offset[i] + h.Count[i];
+
+	u32 code = 0;
+	for ( i = 1; i != 16; ++i )
+	{
+		code = ( code + h.Count[i - 1] ) << 1;
+		next[i] = (u16) code;
+	}
+
+	memset ( h.Fast, 0, sizeof ( h.Fast ) );
+	for ( i = 0; i != n; ++i )
+	{
+		const u32 len = length[i];
+		if ( 0 == len )
+			continue;
+
+		h.Symbol [ offset[len]++ ] = (u16) i;
+
+		u32 c = next[len]++;
+		if ( len > INFLATE_FAST_BITS )
+			continue;
+
+		// codes are stored msb first, the bit buffer is lsb first
+		u32 rev = 0;
+		for ( u32 b = 0; b != len; ++b )
+		{
+			rev = ( rev << 1 ) | ( c & 1 );
+			c >>= 1;
+		}
+		for ( u32 j = rev; j < ( 1u << INFLATE_FAST_BITS ); j += 1 << len )
+			h.Fast[j] = (u16) ( ( len << 9 ) | i );
+	}
+	return true;
+}
+
+// fixed tables, built at startup
+static struct SFixedTables
+{
+	SInflateHuffman Lit;
+	SInflateHuffman Dist;
+
+	SFixedTables ()
+	{
+		u8 length[288];
+		u32 i;
+		for ( i = 0; i != 144; ++i ) length[i] = 8;
+		for ( ; i != 256; ++i ) length[i] = 9;
+		for ( ; i != 280; ++i ) length[i] = 7;
+		for ( ; i != 288; ++i ) length[i] = 8;
+		buildHuffman ( Lit, length, 288 );
+
+		for ( i = 0; i != 30; ++i ) length[i] = 5;
+		buildHuffman ( Dist, length, 30 );
+	}
+} FixedTables;
+
+
+void SInflateStream::init ( const u8 *source, u32 sourceSize )
+{
+	In = source;
+	InSize = sourceSize;
+	InPos = 0;
+	BitBuf = 0;
+	BitCount = 0;
+	TotalOut = 0;
+	StoredLeft = 0;
+	CopyLen = 0;
+	CopyDist = 0;
+	BlockType = -1;
+	Final = false;
+	Done = false;
+	Error = false;
+	Lit = 0;
+	Dist = 0;
+}
+
+// fill the bit buffer. past the end zeros are shifted in, callers check InPos
+bool SInflateStream::need ( u32 count )
+{
+	while ( BitCount < count )
+	{
+		if ( InPos < InSize )
+			BitBuf |= (u32) In [ InPos ] << BitCount;
+		else
+		if ( InPos > InSize + 4 )
+			return false;
+
+		InPos += 1;
+		BitCount += 8;
+	}
+	return true;
+}
+
+u32 SInflateStream::bits ( u32 count )
+{
+	if ( !need ( count ) )
+	{
+		Error = true;
+		return 0;
+	}
+	const u32 v = BitBuf & ( ( 1u << count ) - 1 );
+	BitBuf >>= count;
+	BitCount -= count;
+	return v;
+}
+
+s32 SInflateStream::decode ( const SInflateHuffman &h )
+{
+	need ( 15 );
+
+	const u32 e = h.Fast [ BitBuf & ( ( 1u << INFLATE_FAST_BITS ) - 1 ) ];
+	if ( e )
+	{
+		const u32 len = e >> 9;
+		BitBuf >>= len;
+		BitCount -= len;
+		return e & 0x1FF;
+	}
+
+	// long code, walk the canonical code one bit at a time
+	s32 code = 0;
+	s32 first = 0;
+	s32 index = 0;
+	for ( u32 len = 1; len != 16; ++len )
+	{
+		code |= BitBuf & 1;
+		BitBuf >>= 1;
+		BitCount -= 1;
+
+		const s32 count = h.Count[len];
+		if ( code - count < first )
+			return h.Symbol [ index + ( code - first ) ];
+
+		index += count;
+		first += count;
+		first <<= 1;
+		code <<= 1;
+	}
+	return -1;
+}
+
+bool SInflateStream::readDynamicTables ()
+{
+	u8 length [ 288 + 30 ];
+
+	const u32 nlen = bits ( 5 ) + 257;
+	const u32 ndist = bits ( 5 ) + 1;
+	const u32 ncode = bits ( 4 ) + 4;
+	if ( nlen > 286 || ndist > 30 )
+		return false;
+
+	u32 i;
+	for ( i = 0; i != 19; ++i )
+		length [ CodeLengthOrder[i] ] = i < ncode ? (u8) bits ( 3 ) : 0;
+
+	SInflateHuffman lencode;
+	if ( !buildHuffman ( lencode, length, 19 ) )
+		return false;
+
+	i = 0;
+	while ( i < nlen + ndist )
+	{
+		s32 sym = decode ( lencode );
+		if ( sym < 0 )
+			return false;
+
+		if ( sym < 16 )
+		{
+			length [ i++ ] = (u8) sym;
+			continue;
+		}
+
+		u8 value = 0;
+		u32 repeat;
+		if ( sym == 16 )
+		{
+			if ( 0 == i )
+				return false;
+			value = length [ i - 1 ];
+			repeat = 3 + bits ( 2 );
+		}
+		else
+		if ( sym == 17 )
+			repeat = 3 + bits ( 3 );
+		else
+			repeat = 11 + bits ( 7 );
+
+		if ( i + repeat > nlen + ndist )
+			return false;
+		while ( repeat-- )
+			length [ i++ ] = value;
+	}
+
+	// end of block code is required
+	if ( 0 == length[256] )
+		return false;
+
+	if ( !buildHuffman ( DynLit, length, nlen ) || !buildHuffman ( DynDist, length + nlen, ndist ) )
+		return false;
+
+	Lit = &DynLit;
+	Dist = &DynDist;
+	return !Error;
+}
+
+bool SInflateStream::beginBlock ()
+{
+	Final = bits ( 1 ) != 0;
+	BlockType = (s32) bits ( 2 );
+
+	switch ( BlockType )
+	{
+		case 0:
+		{
+			// drop to a byte boundary, give the unused whole bytes back to the input
+			bits ( BitCount & 7 );
+			InPos -= BitCount >> 3;
+			BitBuf = 0;
+			BitCount = 0;
+
+			if ( InPos + 4 > InSize )
+				return false;
+
+			const u32 len = In[InPos] | ( In[InPos + 1] << 8 );
+			const u32 nlen = In[InPos + 2] | ( In[InPos + 3] << 8 );
+			InPos += 4;
+			if ( len != ( ~nlen & 0xFFFF ) )
+				return false;
+
+			StoredLeft = len;
+			if ( 0 == StoredLeft )
+				BlockType = -1;
+			return true;
+		}
+		case 1:
+			Lit = &FixedTables.Lit;
+			Dist = &FixedTables.Dist;
+			return true;
+		case 2:
+			return readDynamicTables ();
+	}
+	return false;
+}
+
+inline void SInflateStream::put ( u8 *dest, u8 value )
+{
+	*dest = value;
+	Window [ TotalOut & ( INFLATE_WINDOW_SIZE - 1 ) ] = value;
+	TotalOut += 1;
+}
+
+u32 SInflateStream::read ( u8 *dest, u32 size )
+{
+	u32 produced = 0;
+
+	while ( produced < size && !Done && !Error )
+	{
+		// pending match
+		if ( CopyLen )
+		{
+			u32 n = core::min_ ( CopyLen, size - produced );
+			CopyLen -= n;
+			while ( n-- )
+			{
+				put ( dest + produced, Window [ ( TotalOut - CopyDist ) & ( INFLATE_WINDOW_SIZE - 1 ) ] );
+				produced += 1;
+			}
+			continue;
+		}
+
+		// stored block, straight from the source
+		if ( StoredLeft )
+		{
+			u32 n = core::min_ ( StoredLeft, size - produced );
+			if ( InPos + n > InSize )
+			{
+				Error = true;
+				break;
+			}
+			for ( u32 i = 0; i != n; ++i )
+				put ( dest + produced + i, In [ InPos + i ] );
+			InPos += n;
+			produced += n;
+			StoredLeft -= n;
+			if ( 0 == StoredLeft )
+				BlockType = -1;
+			continue;
+		}
+
+		if ( BlockType < 0 )
+		{
+			if ( Final )
+			{
+				Done = true;
+				break;
+			}
+			if ( !beginBlock () )
+				Error = true;
+			continue;
+		}
+
+		const s32 sym = decode ( *Lit );
+		if ( sym < 0 || InPos > InSize + 4 )
+		{
+			Error = true;
+			break;
+		}
+
+		if ( sym < 256 )
+		{
+			put ( dest + produced, (u8) sym );
+			produced += 1;
+		}
+		else
+		if ( sym == 256 )
+		{
+			BlockType = -1;
+		}
+		else
+		{
+			const u32 l = sym - 257;
+			if ( l >= 29 )
+			{
+				Error = true;
+				break;
+			}
+			CopyLen = LengthBase[l] + bits ( LengthExtra[l] );
+
+			const s32 d = decode ( *Dist );
+			if ( d < 0 || d >= 30 )
+			{
+				Error = true;
+				break;
+			}
+			CopyDist = DistBase[d] + bits ( DistExtra[d] );
+			if ( CopyDist > TotalOut || CopyDist > INFLATE_WINDOW_SIZE )
+				Error = true;
+		}
+	}
+
+	return produced;
+}
+
+u32 SInflateStream::skip ( u32 count )
+{
+	u8 scratch[1024];
+	u32 skipped = 0;
+	while ( skipped < count )
+	{
+		const u32 n = read ( scratch, core::min_ ( count - skipped, (u32) sizeof ( scratch ) ) );
+		if ( 0 == n )
+			break;
+		skipped += n;
+	}
+	return skipped;
+}
+
+
+bool inflateBuffer ( u8 *dest, u32 destSize, const u8 *source, u32 sourceSize )
+{
+	SInflateStream *stream = new SInflateStream ();
+	stream->init ( source, sourceSize );
+	const u32 n = stream->read ( dest, destSize );
+	const bool ok = n == destSize && !stream->hasError ();
+	delete stream;
+	return ok;
+}
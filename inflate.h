@@ -0,0 +1,76 @@
+/*!
+	Inflate.
+	streaming deflate decoder ( RFC 1951 ) working on an in-memory source
+
+	The decoder only keeps the 32k history window, output is produced
+	on demand into the caller's buffer. Used by the mapped zip reader
+	so deflated entries are never staged as a whole.
+*/
+#ifndef __QUAKE3_INFLATE__H_INCLUDED__
+#define __QUAKE3_INFLATE__H_INCLUDED__
+
+#include <irrlicht.h>
+
+using namespace irr;
+
+const u32 INFLATE_WINDOW_SIZE = 32768;
+const u32 INFLATE_FAST_BITS = 10;
+
+//! canonical huffman code with a direct lookup for short codes
+struct SInflateHuffman
+{
+	u16 Fast [ 1 << INFLATE_FAST_BITS ];	// ( length << 9 ) | symbol, 0 = use slow path
+	u16 Count [ 16 ];
+	u16 Symbol [ 288 ];
+};
+
+struct SInflateStream
+{
+	//! reset to the start of a raw deflate stream
+	void init ( const u8 *source, u32 sourceSize );
+
+	//! decode up to size bytes. returns the number of bytes written
+	u32 read ( u8 *dest, u32 size );
+
+	//! decode and throw away count bytes
+	u32 skip ( u32 count );
+
+	bool isDone () const { return Done; }
+	bool hasError () const { return Error; }
+	u32 getTotalOut () const { return TotalOut; }
+
+private:
+	bool need ( u32 bits );
+	u32 bits ( u32 count );
+	s32 decode ( const SInflateHuffman &h );
+	bool beginBlock ();
+	bool readDynamicTables ();
+	void put ( u8 *dest, u8 value );
+
+	const u8 *In;
+	u32 InSize;
+	u32 InPos;
+	u32 BitBuf;
+	u32 BitCount;
+
+	u32 TotalOut;
+	u32 StoredLeft;
+	u32 CopyLen;
+	u32 CopyDist;
+	s32 BlockType;		// -1 between blocks
+	bool Final;
+	bool Done;
+	bool Error;
+
+	const SInflateHuffman *Lit;
+	const SInflateHuffman *Dist;
+	SInflateHuffman DynLit;
+	SInflateHuffman DynDist;
+
+	u8 Window [ INFLATE_WINDOW_SIZE ];
+};
+
+//! inflate a whole stream at once. returns false on corrupt data
+bool inflateBuffer ( u8 *dest, u32 destSize, const u8 *source, u32 sourceSize );
+
+#endif // __QUAKE3_INFLATE__H_INCLUDED__
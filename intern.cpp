@@ -0,0 +1,89 @@
+/*!
+	String Pool.
+	interned names, compared and hashed as small integers
+*/
+
+#include "intern.h"
+
+using namespace core;
+
+// fnv-1a
+static u32 hashString ( const c8 *name, u32 length )
+{
+	u32 h = 2166136261u;
+	for ( u32 i = 0; i != length; ++i )
+		h = ( h ^ (u8) name[i] ) * 16777619u;
+	return h;
+}
+
+CStringPool::CStringPool ()
+{
+	clear ();
+}
+
+void CStringPool::clear ()
+{
+	Text.clear ();
+	Offset.clear ();
+	Offset.push_back ( 0 );
+	Hash.clear ();
+	Slot.set_used ( 64 );
+	memset ( Slot.pointer (), 0, Slot.size () * sizeof ( u32 ) );
+}
+
+s32 CStringPool::find ( const c8 *name, u32 length ) const
+{
+	const u32 hash = hashString ( name, length );
+	const u32 mask = Slot.size () - 1;
+
+	for ( u32 slot = hash & mask; Slot[slot]; slot = ( slot + 1 ) & mask )
+	{
+		const u32 id = Slot[slot] - 1;
+		if ( Hash[id] == hash && getLength ( id ) == length && 0 == memcmp ( getString ( id ), name, length ) )
+			return id;
+	}
+	return -1;
+}
+
+u32 CStringPool::intern ( const c8 *name, u32 length )
+{
+	const s32 found = find ( name, length );
+	if ( found >= 0 )
+		return found;
+
+	// keep the load below one half
+	if ( ( Hash.size () + 1 ) * 2 > Slot.size () )
+		grow ();
+
+	const u32 id = Hash.size ();
+	const u32 hash = hashString ( name, length );
+	Hash.push_back ( hash );
+
+	for ( u32 i = 0; i != length; ++i )
+		Text.push_back ( name[i] );
+	Text.push_back ( 0 );
+	Offset.push_back ( Text.size () );
+
+	const u32 mask = Slot.size () - 1;
+	u32 slot = hash & mask;
+	while ( Slot[slot] )
+		slot = ( slot + 1 ) & mask;
+	Slot[slot] = id + 1;
+
+	return id;
+}
+
+void CStringPool::grow ()
+{
+	Slot.set_used ( Slot.size () * 2 );
+	memset ( Slot.pointer (), 0, Slot.size () * sizeof ( u32 ) );
+
+	const u32 mask = Slot.size () - 1;
+	for ( u32 id = 0; id != Hash.size (); ++id )
+	{
+		u32 slot = Hash[id] & mask;
+		while ( Slot[slot] )
+			slot = ( slot + 1 ) & mask;
+		Slot[slot] = id + 1;
+	}
+}
@@ -0,0 +1,44 @@
+/*!
+	String Pool.
+	interned names, compared and hashed as small integers
+
+	A name is stored once and referred to by its id. Ids are dense and
+	stay valid until clear(). Lookup is an open addressing hash table.
+*/
+#ifndef __QUAKE3_INTERN__H_INCLUDED__
+#define __QUAKE3_INTERN__H_INCLUDED__
+
+#include <irrlicht.h>
+#include "profile.h"
+
+using namespace irr;
+
+class CStringPool
+{
+public:
+	CStringPool ();
+
+	//! id of name, added if new. case sensitive
+	u32 intern ( const c8 *name, u32 length );
+	u32 intern ( const c8 *name ) { return intern ( name, (u32) strlen ( name ) ); }
+
+	//! id of name or -1
+	s32 find ( const c8 *name, u32 length ) const;
+	s32 find ( const c8 *name ) const { return find ( name, (u32) strlen ( name ) ); }
+
+	const c8 * getString ( u32 id ) const { return Text.const_pointer () + Offset[id]; }
+	u32 getLength ( u32 id ) const { return Offset[id + 1] - Offset[id] - 1; }
+	u32 size () const { return Hash.size (); }
+
+	void clear ();
+
+private:
+	void grow ();
+
+	core::array < c8, CCountingAllocator < c8 > > Text;		// zero terminated names back to back
+	core::array < u32, CCountingAllocator < u32 > > Offset;	// id -> start in Text, one extra for the end
+	core::array < u32, CCountingAllocator < u32 > > Hash;
+	core::array < u32, CCountingAllocator < u32 > > Slot;		// open addressing, id + 1, 0 = empty
+};
+
+#endif // __QUAKE3_INTERN__H_INCLUDED__
@@ -0,0 +1,254 @@
+/*!
+	Item Batch.
+	draws every map item ( weapons, ammo, health.. ) from one scenenode
+*/
+
+#include "itembatch.h"
+#include "q3factory.h"
+#include "waveform.h"
+#include "occlusion.h"
+#include "renderqueue.h"
+
+using namespace core;
+using namespace scene;
+using namespace video;
+
+CItemBatchSceneNode::CItemBatchSceneNode ( ISceneNode *parent, ISceneManager *mgr, s32 id )
+: ISceneNode ( parent, mgr, id ), Occlusion ( 0 ), Queue ( 0 ), TimeMs ( 0 ), DrawCalls ( 0 ), HasSolid ( false ), HasTransparent ( false )
+{
+#ifdef _DEBUG
+	setDebugName ( "CItemBatchSceneNode" );
+#endif
+	Box.reset ( 0.f, 0.f, 0.f );
+}
+
+CItemBatchSceneNode::~CItemBatchSceneNode ()
+{
+	for ( u32 i = 0; i != Model.size (); ++i )
+		Model[i].Mesh->drop ();
+}
+
+u32 CItemBatchSceneNode::addModel ( IMesh *mesh )
+{
+	SModel m;
+	m.Mesh = mesh;
+	m.FirstMaterial = Material.size ();
+	mesh->grab ();
+
+	// any yaw stays inside the radius around the y axis, bounce adds 60 units
+	const aabbox3df &box = mesh->getBoundingBox ();
+	f32 r = 0.f;
+	for ( u32 i = 0; i != 4; ++i )
+	{
+		const f32 x = i & 1 ? box.MaxEdge.X : box.MinEdge.X;
+		const f32 z = i & 2 ? box.MaxEdge.Z : box.MinEdge.Z;
+		r = core::max_ ( r, x * x + z * z );
+	}
+	r = sqrtf ( r );
+	m.Swept.MinEdge.set ( -r, box.MinEdge.Y, -r );
+	m.Swept.MaxEdge.set ( r, box.MaxEdge.Y + 60.f, r );
+
+	for ( u32 i = 0; i != mesh->getMeshBufferCount (); ++i )
+	{
+		const SMaterial &material = mesh->getMeshBuffer ( i )->getMaterial ();
+		Material.push_back ( material );
+		if ( material.isTransparent () )
+			HasTransparent = true;
+		else
+			HasSolid = true;
+	}
+
+	Model.push_back ( m );
+	return Model.size () - 1;
+}
+
+void CItemBatchSceneNode::addInstance ( u32 model, const vector3df &position, u32 special )
+{
+	if ( Position.empty () )
+		Box.reset ( position );
+
+	Position.push_back ( position );
+	InstanceModel.push_back ( model );
+	Special.push_back ( special );
+	// items next to each other should not bounce in lockstep
+	Phase.push_back ( fract ( ( position.X + position.Z ) * ( 1.f / 256.f ) ) * 2.f );
+	Transform.push_back ( matrix4 () );
+
+	aabbox3df box = Model[model].Swept;
+	box.MinEdge += position;
+	box.MaxEdge += position;
+	Box.addInternalBox ( box );
+	Bounds.add ( box );
+}
+
+void CItemBatchSceneNode::setRenderQueue ( CRenderQueueSceneNode *queue )
+{
+	Queue = queue;
+	MaterialKey.set_used ( Material.size () );
+	for ( u32 i = 0; i != Material.size (); ++i )
+		MaterialKey[i] = queue ? queue->getStateKey ( Material[i] ) : 0;
+}
+
+void CItemBatchSceneNode::OnAnimate ( u32 timeMs )
+{
+	TimeMs = timeMs;
+	ISceneNode::OnAnimate ( timeMs );
+}
+
+void CItemBatchSceneNode::OnRegisterSceneNode ()
+{
+	if ( IsVisible && Position.size () )
+	{
+		// cull every instance against the frustum
+		ICameraSceneNode *camera = SceneManager->getActiveCamera ();
+		const SViewFrustum *frustum = camera ? camera->getViewFrustum () : 0;
+
+		u32 visible = Position.size ();
+		if ( frustum )
+			visible = Bounds.cull ( *frustum, Visible );
+		else
+			Bounds.fill ( Visible );
+
+		if ( Occlusion && visible )
+			visible -= Occlusion->cull ( Bounds, Visible );
+
+		if ( visible && Queue )
+		{
+			animate ();
+			submit ();
+		}
+		else if ( visible )
+		{
+			animate ();
+
+			if ( HasSolid )
+				SceneManager->registerNodeForRendering ( this, ESNRP_SOLID );
+			if ( HasTransparent )
+				SceneManager->registerNodeForRendering ( this, ESNRP_TRANSPARENT );
+		}
+	}
+
+	ISceneNode::OnRegisterSceneNode ();
+}
+
+/*
+	rotate and bounce of the visible instances.
+	rotation like a rotation animator with 2 degrees per 10 ms,
+	bounce 60 units up and down in 2 seconds as one cos wave batch
+*/
+void CItemBatchSceneNode::animate ()
+{
+	BounceIndex.set_used ( 0 );
+	BouncePhase.set_used ( 0 );
+	for ( u32 i = 0; i != Position.size (); ++i )
+	{
+		if ( CBoxCuller::isVisible ( Visible, i ) && ( Special[i] & SPECIAL_SFX_BOUNCE ) )
+		{
+			BounceIndex.push_back ( i );
+			BouncePhase.push_back ( Phase[i] );
+		}
+	}
+
+	if ( BounceIndex.size () )
+	{
+		quake3::SModifierFunction bounce;
+		bounce.func = quake3::COSINUS;
+		bounce.base = 30.f;
+		bounce.amp = -30.f;
+		bounce.frequency = 0.5f;
+
+		// the period is 2 seconds, keep the time small for float precision
+		BounceHeight.set_used ( BounceIndex.size () );
+		evaluateWaveform ( bounce, ( TimeMs % 2000 ) * 0.001f,
+			BouncePhase.const_pointer (), BounceHeight.pointer (), BounceIndex.size () );
+	}
+
+	const f32 yaw = fmodf ( TimeMs * 0.2f, 360.f );
+	u32 next = 0;
+
+	for ( u32 i = 0; i != Position.size (); ++i )
+	{
+		if ( !CBoxCuller::isVisible ( Visible, i ) )
+			continue;
+
+		const u32 special = Special[i];
+		vector3df p = Position[i];
+
+		if ( next < BounceIndex.size () && BounceIndex[next] == i )
+			p.Y += BounceHeight [ next++ ];
+
+		matrix4 &m = Transform[i];
+		if ( special & SPECIAL_SFX_ROTATE )
+			m.setRotationDegrees ( vector3df ( 0.f, yaw, 0.f ) );
+		else
+		if ( special & SPECIAL_SFX_ROTATE_1 )
+			m.setRotationDegrees ( vector3df ( 0.f, 360.f - yaw * 0.5f, 0.f ) );
+		else
+			m.makeIdentity ();
+		m.setTranslation ( p );
+	}
+}
+
+void CItemBatchSceneNode::render ()
+{
+	const bool transparent = SceneManager->getSceneNodeRenderPass () == ESNRP_TRANSPARENT;
+	if ( !transparent || !HasSolid )
+		DrawCalls = 0;
+
+	draw ( transparent );
+}
+
+// instances grouped by mesh buffer, the material is set once per buffer
+void CItemBatchSceneNode::draw ( bool transparent )
+{
+	IVideoDriver *driver = SceneManager->getVideoDriver ();
+
+	for ( u32 m = 0; m != Model.size (); ++m )
+	{
+		IMesh *mesh = Model[m].Mesh;
+		for ( u32 b = 0; b != mesh->getMeshBufferCount (); ++b )
+		{
+			const SMaterial &material = Material[ Model[m].FirstMaterial + b ];
+			if ( material.isTransparent () != transparent )
+				continue;
+
+			IMeshBuffer *buffer = mesh->getMeshBuffer ( b );
+			bool set = false;
+
+			for ( u32 i = 0; i != Position.size (); ++i )
+			{
+				if ( InstanceModel[i] != m || !CBoxCuller::isVisible ( Visible, i ) )
+					continue;
+
+				if ( !set )
+				{
+					driver->setMaterial ( material );
+					set = true;
+				}
+				driver->setTransform ( ETS_WORLD, Transform[i] );
+				driver->drawMeshBuffer ( buffer );
+				DrawCalls += 1;
+			}
+		}
+	}
+}
+
+// every visible instance of every buffer, the queue sorts them with the map
+void CItemBatchSceneNode::submit ()
+{
+	DrawCalls = 0;
+	for ( u32 i = 0; i != Position.size (); ++i )
+	{
+		if ( !CBoxCuller::isVisible ( Visible, i ) )
+			continue;
+
+		const SModel &model = Model[ InstanceModel[i] ];
+		for ( u32 b = 0; b != model.Mesh->getMeshBufferCount (); ++b )
+		{
+			const u32 m = model.FirstMaterial + b;
+			Queue->submit ( MaterialKey[m], Material[m].isTransparent (), Position[i],
+				model.Mesh->getMeshBuffer ( b ), &Material[m], &Transform[i] );
+			DrawCalls += 1;
+		}
+	}
+}
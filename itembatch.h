@@ -0,0 +1,96 @@
+/*!
+	Item Batch.
+	draws every map item ( weapons, ammo, health.. ) from one scenenode
+
+	Each distinct model is added once with its materials. Items are
+	instances referencing a model, so identical items share mesh buffers
+	and materials. Instances are culled against the view frustum as one
+	batch of boxes covering every rotation and bounce height, the ones
+	inside can be tested against an occlusion culler. Rotate and bounce are
+	evaluated in one batch for the visible instances only.
+	Instances are drawn grouped by mesh buffer, so each material is set
+	once per frame, or handed to a render queue sorting them with the map.
+*/
+#ifndef __QUAKE3_ITEMBATCH__H_INCLUDED__
+#define __QUAKE3_ITEMBATCH__H_INCLUDED__
+
+#include <irrlicht.h>
+#include "boxcull.h"
+
+using namespace irr;
+
+class COcclusionCuller;
+class CRenderQueueSceneNode;
+
+class CItemBatchSceneNode : public scene::ISceneNode
+{
+public:
+	CItemBatchSceneNode ( scene::ISceneNode *parent, scene::ISceneManager *mgr, s32 id = -1 );
+	virtual ~CItemBatchSceneNode ();
+
+	//! add a model, the materials of the buffers are taken from the mesh. returns the model index
+	u32 addModel ( scene::IMesh *mesh );
+
+	//! add an item, special is a combination of eItemSpecialEffect
+	void addInstance ( u32 model, const core::vector3df &position, u32 special );
+
+	u32 getModelCount () const { return Model.size (); }
+	u32 getInstanceCount () const { return Position.size (); }
+
+	//! rendered for this frame before the items register, 0 for none
+	void setOcclusion ( COcclusionCuller *occlusion ) { Occlusion = occlusion; }
+
+	//! instances are submitted to the queue instead of drawn here, after all models are added
+	void setRenderQueue ( CRenderQueueSceneNode *queue );
+
+	//! mesh buffer draws of the last frame
+	u32 getDrawCalls () const { return DrawCalls; }
+
+	virtual void OnRegisterSceneNode ();
+	virtual void OnAnimate ( u32 timeMs );
+	virtual void render ();
+
+	virtual const core::aabbox3d<f32>& getBoundingBox () const { return Box; }
+	virtual u32 getMaterialCount () const { return Material.size (); }
+	virtual video::SMaterial& getMaterial ( u32 i ) { return Material[i]; }
+
+private:
+	struct SModel
+	{
+		scene::IMesh *Mesh;
+		u32 FirstMaterial;
+		core::aabbox3d<f32> Swept;	// mesh box rotated around y and bounced
+	};
+
+	void draw ( bool transparent );
+	void submit ();
+	void animate ();
+
+	core::array < SModel > Model;
+	core::array < video::SMaterial > Material;	// one per model mesh buffer
+	core::array < u64 > MaterialKey;			// of the render queue
+
+	// instances, structure of arrays
+	core::array < core::vector3df > Position;
+	core::array < u32 > InstanceModel;
+	core::array < u32 > Special;
+	core::array < f32 > Phase;					// bounce offset in seconds
+	core::array < core::matrix4 > Transform;	// visible instances only
+	CBoxCuller Bounds;
+	core::array < u32 > Visible;				// bit per instance
+
+	// bounce batch of the visible instances
+	core::array < u32 > BounceIndex;
+	core::array < f32 > BouncePhase;
+	core::array < f32 > BounceHeight;
+
+	COcclusionCuller *Occlusion;
+	CRenderQueueSceneNode *Queue;
+	core::aabbox3d<f32> Box;
+	u32 TimeMs;
+	u32 DrawCalls;
+	bool HasSolid;
+	bool HasTransparent;
+};
+
+#endif // __QUAKE3_ITEMBATCH__H_INCLUDED__
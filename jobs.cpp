@@ -0,0 +1,415 @@
+/*!
+	Job System.
+	work stealing scheduler, the worker pool and parallel loops run on it
+*/
+
+#include "jobs.h"
+#include "profile.h"
+
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <vector>
+#include <chrono>
+
+#if defined(_MSC_VER)
+#define JOBS_TLS __declspec(thread)
+#else
+#define JOBS_TLS __thread
+#endif
+
+struct SJob
+{
+	tJob Run;
+	SJobCounter *Counter;
+};
+
+struct SJobQueue
+{
+	std::mutex Lock;
+	std::deque < SJob > Jobs;
+};
+
+//! written by one thread, read by getStats
+struct SJobThreadStats
+{
+	SJobThreadStats () : Jobs ( 0 ), MainJobs ( 0 ), Steals ( 0 ), Busy ( 0 ) {}
+
+	std::atomic < u32 > Jobs;
+	std::atomic < u32 > MainJobs;
+	std::atomic < u32 > Steals;
+	std::atomic < u64 > Busy;
+};
+
+static const u32 WAIT_SPIN = 64;		// yields of a waiting thread before it sleeps
+
+// the system and the worker index of the calling thread, -1 outside the workers
+static JOBS_TLS SJobSystemData *CurrentSystem = 0;
+static JOBS_TLS s32 CurrentWorker = -1;
+
+struct SJobSystemData
+{
+	SJobSystemData () : Queued ( 0 ), Sleepers ( 0 ), Profiling ( true ), Quit ( false ), StatsStart ( 0 ) {}
+
+	std::vector < std::thread > Threads;
+	std::vector < SJobQueue* > Queue;			// deque of each worker
+	SJobQueue Shared;							// spawned outside the workers
+	SJobQueue Main;
+	std::vector < SJobThreadStats* > Stats;		// per worker, the last one for all other threads
+	std::atomic < u32 > Queued;					// jobs in Queue and Shared
+	std::atomic < u32 > Sleepers;
+	std::mutex SleepLock;
+	std::condition_variable Wake;
+	std::thread::id MainThread;
+	std::atomic < bool > Profiling;
+	bool Quit;
+	u64 StatsStart;
+
+	s32 getWorker () const
+	{
+		return CurrentSystem == this ? CurrentWorker : -1;
+	}
+
+	SJobThreadStats & getThreadStats ( s32 worker )
+	{
+		return *Stats [ worker >= 0 ? worker : Stats.size () - 1 ];
+	}
+
+	static bool popBack ( SJobQueue &q, SJob &job )
+	{
+		std::lock_guard < std::mutex > lock ( q.Lock );
+		if ( q.Jobs.empty () )
+			return false;
+		job = q.Jobs.back ();
+		q.Jobs.pop_back ();
+		return true;
+	}
+
+	static bool popFront ( SJobQueue &q, SJob &job )
+	{
+		std::lock_guard < std::mutex > lock ( q.Lock );
+		if ( q.Jobs.empty () )
+			return false;
+		job = q.Jobs.front ();
+		q.Jobs.pop_front ();
+		return true;
+	}
+
+	/*
+		own deque newest first, then the shared queue, then the oldest job
+		of the other workers
+	*/
+	bool pop ( s32 worker, SJob &job, bool &stolen )
+	{
+		stolen = false;
+		if ( 0 == Queued.load () )
+			return false;
+
+		bool found = ( worker >= 0 && popBack ( *Queue[worker], job ) ) || popFront ( Shared, job );
+
+		const u32 n = Queue.size ();
+		for ( u32 k = 1; !found && k <= n; ++k )
+		{
+			const u32 victim = ( worker + k ) % n;
+			if ( (s32) victim != worker && popFront ( *Queue[victim], job ) )
+				found = stolen = true;
+		}
+
+		if ( found )
+			Queued -= 1;
+		return found;
+	}
+
+	void push ( SJobQueue &q, const SJob &job )
+	{
+		{
+			std::lock_guard < std::mutex > lock ( q.Lock );
+			q.Jobs.push_back ( job );
+		}
+
+		// a worker counts itself asleep before it looks at Queued the last time
+		Queued += 1;
+		if ( Sleepers.load () )
+		{
+			{
+				std::lock_guard < std::mutex > lock ( SleepLock );
+			}
+			Wake.notify_one ();
+		}
+	}
+
+	void execute ( SJob &job, SJobThreadStats &stats, bool main )
+	{
+		if ( Profiling.load ( std::memory_order_relaxed ) )
+		{
+			const u64 start = getTimeMicro ();
+			job.Run ();
+			stats.Busy += getTimeMicro () - start;
+		}
+		else
+		{
+			job.Run ();
+		}
+
+		stats.Jobs += 1;
+		if ( main )
+			stats.MainJobs += 1;
+
+		// the waiter may leave as soon as the counter drops, touch it no more
+		if ( job.Counter && 1 == job.Counter->Count.fetch_sub ( 1 ) && Sleepers.load () )
+		{
+			{
+				std::lock_guard < std::mutex > lock ( SleepLock );
+			}
+			Wake.notify_all ();
+		}
+	}
+
+	void run ( s32 worker )
+	{
+		CurrentSystem = this;
+		CurrentWorker = worker;
+		SJobThreadStats &stats = *Stats[worker];
+
+		for (;;)
+		{
+			SJob job;
+			bool stolen;
+			if ( pop ( worker, job, stolen ) )
+			{
+				if ( stolen )
+					stats.Steals += 1;
+				execute ( job, stats, false );
+				continue;
+			}
+
+			std::unique_lock < std::mutex > lock ( SleepLock );
+			Sleepers += 1;
+			while ( !Quit && 0 == Queued.load () )
+				Wake.wait ( lock );
+			Sleepers -= 1;
+
+			if ( Quit && 0 == Queued.load () )
+				return;
+		}
+	}
+};
+
+
+CJobSystem::CJobSystem ( u32 threadCount )
+: Data ( new SJobSystemData () )
+{
+	if ( 0 == threadCount )
+	{
+		u32 hw = std::thread::hardware_concurrency ();
+		threadCount = hw > 1 ? hw - 1 : 1;
+	}
+
+	Data->MainThread = std::this_thread::get_id ();
+	Data->StatsStart = getTimeMicro ();
+
+	for ( u32 i = 0; i != threadCount; ++i )
+	{
+		Data->Queue.push_back ( new SJobQueue () );
+		Data->Stats.push_back ( new SJobThreadStats () );
+	}
+	Data->Stats.push_back ( new SJobThreadStats () );
+
+	for ( u32 i = 0; i != threadCount; ++i )
+		Data->Threads.push_back ( std::thread ( &SJobSystemData::run, Data, (s32) i ) );
+}
+
+CJobSystem::~CJobSystem ()
+{
+	if ( isMainThread () )
+		runMainJobs ();
+
+	{
+		std::lock_guard < std::mutex > lock ( Data->SleepLock );
+		Data->Quit = true;
+	}
+	Data->Wake.notify_all ();
+
+	for ( u32 i = 0; i != Data->Threads.size (); ++i )
+		Data->Threads[i].join ();
+
+	for ( u32 i = 0; i != Data->Queue.size (); ++i )
+		delete Data->Queue[i];
+	for ( u32 i = 0; i != Data->Stats.size (); ++i )
+		delete Data->Stats[i];
+	delete Data;
+}
+
+void CJobSystem::spawn ( const tJob &job, SJobCounter *counter )
+{
+	if ( counter )
+		counter->Count += 1;
+
+	SJob j;
+	j.Run = job;
+	j.Counter = counter;
+
+	const s32 worker = Data->getWorker ();
+	Data->push ( worker >= 0 ? *Data->Queue[worker] : Data->Shared, j );
+}
+
+void CJobSystem::spawnMain ( const tJob &job, SJobCounter *counter )
+{
+	if ( counter )
+		counter->Count += 1;
+
+	SJob j;
+	j.Run = job;
+	j.Counter = counter;
+
+	std::lock_guard < std::mutex > lock ( Data->Main.Lock );
+	Data->Main.Jobs.push_back ( j );
+}
+
+void CJobSystem::wait ( SJobCounter &counter )
+{
+	const bool main = isMainThread ();
+	const s32 worker = Data->getWorker ();
+	SJobThreadStats &stats = Data->getThreadStats ( worker );
+
+	u32 idle = 0;
+	while ( !counter.done () )
+	{
+		SJob job;
+		bool stolen;
+		if ( main && SJobSystemData::popFront ( Data->Main, job ) )
+		{
+			Data->execute ( job, stats, true );
+			idle = 0;
+		}
+		else if ( Data->pop ( worker, job, stolen ) )
+		{
+			if ( stolen )
+				stats.Steals += 1;
+			Data->execute ( job, stats, false );
+			idle = 0;
+		}
+		else if ( ++idle < WAIT_SPIN )
+		{
+			std::this_thread::yield ();
+		}
+		else
+		{
+			// the jobs left run elsewhere, sleep until the last one is done or new work comes.
+			// main thread jobs do not wake, the timeout picks them up
+			std::unique_lock < std::mutex > lock ( Data->SleepLock );
+			Data->Sleepers += 1;
+			if ( !counter.done () && 0 == Data->Queued.load () )
+				Data->Wake.wait_for ( lock, std::chrono::milliseconds ( 1 ) );
+			Data->Sleepers -= 1;
+		}
+	}
+}
+
+void CJobSystem::parallelFor ( u32 begin, u32 end, u32 grain, const tRangeJob &body )
+{
+	if ( end <= begin )
+		return;
+
+	const u32 count = end - begin;
+	grain = core::max_ ( grain, 1u );
+	const u32 pieces = core::min_ ( ( count + grain - 1 ) / grain, ( getThreadCount () + 1 ) * 4 );
+	if ( pieces < 2 )
+	{
+		body ( begin, end );
+		return;
+	}
+
+	// the first piece stays on this thread
+	const u32 size = count / pieces;
+	const u32 rest = count % pieces;
+	const u32 own = begin + size + ( rest ? 1 : 0 );
+
+	SJobCounter counter;
+	const tRangeJob *run = &body;
+	u32 first = own;
+	for ( u32 p = 1; p != pieces; ++p )
+	{
+		const u32 last = first + size + ( p < rest ? 1 : 0 );
+		spawn ( [run, first, last] () { (*run) ( first, last ); }, &counter );
+		first = last;
+	}
+
+	body ( begin, own );
+	wait ( counter );
+}
+
+void CJobSystem::runMainJobs ()
+{
+	if ( !isMainThread () )
+		return;
+
+	SJobThreadStats &stats = Data->getThreadStats ( -1 );
+
+	// only what is queued now, a job queueing another one does not stall the frame
+	u32 count;
+	{
+		std::lock_guard < std::mutex > lock ( Data->Main.Lock );
+		count = Data->Main.Jobs.size ();
+	}
+
+	SJob job;
+	while ( count-- && SJobSystemData::popFront ( Data->Main, job ) )
+		Data->execute ( job, stats, true );
+}
+
+u32 CJobSystem::getThreadCount () const
+{
+	return Data->Threads.size ();
+}
+
+bool CJobSystem::isMainThread () const
+{
+	return std::this_thread::get_id () == Data->MainThread;
+}
+
+void CJobSystem::setProfiling ( bool on )
+{
+	Data->Profiling = on;
+}
+
+void CJobSystem::getStats ( SJobStats &stats, bool reset )
+{
+	const u64 now = getTimeMicro ();
+
+	stats.Jobs = 0;
+	stats.MainJobs = 0;
+	stats.Steals = 0;
+	stats.Busy = 0;
+	stats.Threads = Data->Threads.size () + 1;
+	stats.Wall = now - Data->StatsStart;
+
+	for ( u32 i = 0; i != Data->Stats.size (); ++i )
+	{
+		SJobThreadStats &s = *Data->Stats[i];
+		stats.Jobs += reset ? s.Jobs.exchange ( 0 ) : s.Jobs.load ();
+		stats.MainJobs += reset ? s.MainJobs.exchange ( 0 ) : s.MainJobs.load ();
+		stats.Steals += reset ? s.Steals.exchange ( 0 ) : s.Steals.load ();
+		stats.Busy += reset ? s.Busy.exchange ( 0 ) : s.Busy.load ();
+	}
+
+	if ( reset )
+		Data->StatsStart = now;
+}
+
+
+static CJobSystem *Jobs = 0;
+
+CJobSystem * getJobSystem ()
+{
+	if ( 0 == Jobs )
+		Jobs = new CJobSystem ();
+	return Jobs;
+}
+
+void jobs_shutdown ()
+{
+	delete Jobs;
+	Jobs = 0;
+}
@@ -0,0 +1,103 @@
+/*!
+	Job System.
+	work stealing scheduler, the worker pool and parallel loops run on it
+
+	Every worker owns a deque. A job spawned on a worker goes to the back
+	of its deque and is taken from there again while it is hot in the
+	cache, an idle worker steals from the front of another deque. Jobs
+	spawned from other threads wait in a shared queue. A job may count
+	down a counter when it is done, waiting on a counter runs other jobs
+	instead of blocking, so jobs can spawn children and wait for them.
+
+	Jobs spawned with main thread affinity are kept apart and only run
+	on the thread that created the system, in runMainJobs () or while it
+	waits. Only those may call the video driver or the scene manager.
+*/
+#ifndef __QUAKE3_JOBS__H_INCLUDED__
+#define __QUAKE3_JOBS__H_INCLUDED__
+
+#include <irrlicht.h>
+#include <functional>
+#include <atomic>
+
+using namespace irr;
+
+typedef std::function < void () > tJob;
+typedef std::function < void ( u32 first, u32 last ) > tRangeJob;
+
+//! jobs not done yet. spawn raises it, the end of the job lowers it
+struct SJobCounter
+{
+	SJobCounter () : Count ( 0 ) {}
+
+	bool done () const { return 0 == Count.load (); }
+
+	std::atomic < u32 > Count;
+
+private:
+	SJobCounter ( const SJobCounter & );
+	SJobCounter & operator= ( const SJobCounter & );
+};
+
+//! what the threads did since the last reset
+struct SJobStats
+{
+	u32 Jobs;			// run on any thread
+	u32 MainJobs;		// of those, with main thread affinity
+	u32 Steals;			// taken from the deque of another worker
+	u32 Threads;		// workers and the main thread
+	u64 Busy;			// microseconds spent in jobs, summed over the threads
+	u64 Wall;			// microseconds since the last reset
+};
+
+struct SJobSystemData;
+
+class CJobSystem
+{
+public:
+	//! threadCount 0 picks the number of hardware threads - 1. the creating thread is the main thread
+	CJobSystem ( u32 threadCount = 0 );
+
+	//! runs the jobs still queued, then joins the workers
+	~CJobSystem ();
+
+	//! runs on any worker
+	void spawn ( const tJob &job, SJobCounter *counter = 0 );
+
+	//! runs on the main thread only
+	void spawnMain ( const tJob &job, SJobCounter *counter = 0 );
+
+	//! runs other jobs until the counter is zero
+	void wait ( SJobCounter &counter );
+
+	/*!
+		body ( first, last ) over [begin,end) in pieces of at least grain
+		items, the calling thread takes a piece too. returns when all
+		pieces are done
+	*/
+	void parallelFor ( u32 begin, u32 end, u32 grain, const tRangeJob &body );
+
+	//! the main thread jobs queued so far, once per frame
+	void runMainJobs ();
+
+	u32 getThreadCount () const;
+	bool isMainThread () const;
+
+	//! time every job for the stats, costs two clock reads per job
+	void setProfiling ( bool on );
+	void getStats ( SJobStats &stats, bool reset = true );
+
+private:
+	CJobSystem ( const CJobSystem & );
+	CJobSystem & operator= ( const CJobSystem & );
+
+	SJobSystemData *Data;
+};
+
+//! the system shared by the game, created on first use from the main thread
+CJobSystem * getJobSystem ();
+
+//! runs what is still queued and joins the threads
+void jobs_shutdown ();
+
+#endif // __QUAKE3_JOBS__H_INCLUDED__
@@ -0,0 +1,371 @@
+/*!
+	Level Shot Cache.
+	thumbnails for the map browser
+*/
+
+#include "levelshots.h"
+#include "worker.h"
+
+#include <stdio.h>
+
+#if defined(_IRR_WINDOWS_API_)
+	#include <direct.h>
+	#define q3_mkdir(x) _mkdir(x)
+#else
+	#include <sys/stat.h>
+	#define q3_mkdir(x) mkdir(x, 0755)
+#endif
+
+using namespace core;
+using namespace video;
+using namespace io;
+
+//! cache file layout: magic, width, height, R8G8B8 pixels
+static const u32 LEVELSHOT_MAGIC = 0x3153564C; // "LVS1"
+
+static u64 fnv1a ( u64 hash, const void *data, u32 size )
+{
+	const u8 *p = (const u8*) data;
+	for ( u32 i = 0; i != size; ++i )
+	{
+		hash ^= p[i];
+		hash *= 0x100000001B3ULL;
+	}
+	return hash;
+}
+
+//! bytes of a thumbnail, R8G8B8
+static const u32 LEVELSHOT_BYTES = LEVELSHOT_SIZE * LEVELSHOT_SIZE * 3;
+
+// runs on a worker
+static u8 * readCacheFile ( const path &filename )
+{
+	FILE *f = fopen ( filename.c_str (), "rb" );
+	if ( 0 == f )
+		return 0;
+
+	u32 header[3];
+	u8 *pixels = 0;
+	if ( fread ( header, sizeof ( header ), 1, f ) == 1 &&
+		header[0] == LEVELSHOT_MAGIC &&
+		header[1] == LEVELSHOT_SIZE && header[2] == LEVELSHOT_SIZE )
+	{
+		pixels = new u8 [ LEVELSHOT_BYTES ];
+		if ( fread ( pixels, LEVELSHOT_BYTES, 1, f ) != 1 )
+		{
+			delete [] pixels;
+			pixels = 0;
+		}
+	}
+	fclose ( f );
+	return pixels;
+}
+
+// runs on a worker
+static void writeCacheFile ( const u8 *pixels, const path &filename )
+{
+	FILE *f = fopen ( filename.c_str (), "wb" );
+	if ( 0 == f )
+		return;
+
+	u32 header[3];
+	header[0] = LEVELSHOT_MAGIC;
+	header[1] = LEVELSHOT_SIZE;
+	header[2] = LEVELSHOT_SIZE;
+	fwrite ( header, sizeof ( header ), 1, f );
+	fwrite ( pixels, LEVELSHOT_BYTES, 1, f );
+	fclose ( f );
+}
+
+// the formats the jpg and tga loaders hand out
+static bool isReadable ( ECOLOR_FORMAT format )
+{
+	return format == ECF_R8G8B8 || format == ECF_A8R8G8B8 || format == ECF_A1R5G5B5 || format == ECF_R5G6B5;
+}
+
+static u32 readPixel ( const u8 *row, u32 x, ECOLOR_FORMAT format )
+{
+	switch ( format )
+	{
+		case ECF_R8G8B8:
+			row += x * 3;
+			return 0xFF000000 | ( row[0] << 16 ) | ( row[1] << 8 ) | row[2];
+		case ECF_A8R8G8B8:
+			return ( (const u32*) row ) [x];
+		case ECF_A1R5G5B5:
+			return A1R5G5B5toA8R8G8B8 ( ( (const u16*) row ) [x] );
+		case ECF_R5G6B5:
+			return R5G6B5toA8R8G8B8 ( ( (const u16*) row ) [x] );
+		default:
+			return 0;
+	}
+}
+
+/*
+	runs on a worker. every thumbnail texel is the mean of the source
+	texels it covers, what copyToScalingBoxFilter does without the image
+*/
+static u8 * scaleBoxFilter ( const u8 *src, const dimension2du &size, u32 pitch, ECOLOR_FORMAT format )
+{
+	u8 *pixels = new u8 [ LEVELSHOT_BYTES ];
+	u8 *out = pixels;
+
+	for ( u32 y = 0; y != LEVELSHOT_SIZE; ++y )
+	{
+		const u32 y0 = y * size.Height / LEVELSHOT_SIZE;
+		const u32 y1 = core::max_ ( ( y + 1 ) * size.Height / LEVELSHOT_SIZE, y0 + 1 );
+		for ( u32 x = 0; x != LEVELSHOT_SIZE; ++x )
+		{
+			const u32 x0 = x * size.Width / LEVELSHOT_SIZE;
+			const u32 x1 = core::max_ ( ( x + 1 ) * size.Width / LEVELSHOT_SIZE, x0 + 1 );
+
+			u32 sum[3] = { 0, 0, 0 };
+			for ( u32 sy = y0; sy != y1; ++sy )
+			{
+				const u8 *row = src + sy * pitch;
+				for ( u32 sx = x0; sx != x1; ++sx )
+				{
+					const u32 c = readPixel ( row, sx, format );
+					sum[0] += ( c >> 16 ) & 0xFF;
+					sum[1] += ( c >> 8 ) & 0xFF;
+					sum[2] += c & 0xFF;
+				}
+			}
+
+			const u32 n = ( y1 - y0 ) * ( x1 - x0 );
+			*out++ = (u8) ( sum[0] / n );
+			*out++ = (u8) ( sum[1] / n );
+			*out++ = (u8) ( sum[2] / n );
+		}
+	}
+	return pixels;
+}
+
+
+CLevelShotCache::CLevelShotCache ( IrrlichtDevice *device, const path &cacheDir )
+: Device ( device ), CacheDir ( cacheDir ), Generation ( 0 )
+{
+	q3_mkdir ( CacheDir.c_str () );
+}
+
+CLevelShotCache::~CLevelShotCache ()
+{
+	// jobs reference this object
+	getWorkerPool ()->wait ();
+	clear ();
+}
+
+/*
+	hash the archive name, its size and the tail of the file.
+	for a zip the tail is the end of central directory record,
+	which changes whenever the content changes
+*/
+u64 CLevelShotCache::hashArchive ( const path &archiveName )
+{
+	u64 hash = 0xCBF29CE484222325ULL;
+	hash = fnv1a ( hash, archiveName.c_str (), archiveName.size () );
+
+	FILE *f = fopen ( archiveName.c_str (), "rb" );
+	if ( 0 == f )
+		return hash;
+
+	fseek ( f, 0, SEEK_END );
+	long size = ftell ( f );
+	hash = fnv1a ( hash, &size, sizeof ( size ) );
+
+	u8 tail[64];
+	long tailSize = core::min_ ( size, (long) sizeof ( tail ) );
+	fseek ( f, size - tailSize, SEEK_SET );
+	if ( fread ( tail, tailSize, 1, f ) == 1 )
+		hash = fnv1a ( hash, tail, tailSize );
+
+	fclose ( f );
+	return hash;
+}
+
+void CLevelShotCache::addArchive ( const path &archiveName )
+{
+	if ( ArchiveName.linear_search ( archiveName ) >= 0 )
+		return;
+
+	ArchiveName.push_back ( archiveName );
+	ArchiveHash.push_back ( hashArchive ( archiveName ) );
+}
+
+/*
+	the cache file is named after the hash of the archive holding the map
+*/
+path CLevelShotCache::getCacheFile ( const path &mapFile ) const
+{
+	IFileSystem *fs = Device->getFileSystem ();
+
+	path name ( mapFile );
+	if ( name.size () && name[0] == '/' )
+		name = name.subString ( 1, name.size () - 1 );
+
+	u64 hash = 0;
+	for ( u32 i = 0; i != fs->getFileArchiveCount (); ++i )
+	{
+		const IFileList *list = fs->getFileArchive ( i )->getFileList ();
+		if ( list->findFile ( name ) < 0 )
+			continue;
+
+		s32 index = ArchiveName.linear_search ( list->getPath () );
+		if ( index >= 0 )
+			hash = ArchiveHash [ index ];
+		break;
+	}
+
+	path base ( name );
+	deletePathFromFilename ( base );
+	cutFilenameExtension ( base, base );
+
+	c8 buf[32];
+	snprintf ( buf, sizeof ( buf ), "%08x%08x_", (u32) ( hash >> 32 ), (u32) hash );
+	return CacheDir + "/" + buf + base + ".lvs";
+}
+
+u32 CLevelShotCache::addMap ( const path &mapFile )
+{
+	SSlot slot;
+	slot.MapFile = mapFile;
+	slot.CacheFile = getCacheFile ( mapFile );
+	slot.State = SLOT_IDLE;
+	slot.Pixels = 0;
+
+	std::lock_guard < std::mutex > lock ( Lock );
+	Slot.push_back ( slot );
+	return Slot.size () - 1;
+}
+
+/*
+	first try the disk cache on a worker. a miss comes back as SLOT_NEED_SOURCE,
+	then update() reads the levelshot out of the archive on the main thread.
+*/
+void CLevelShotCache::request ( u32 slot )
+{
+	path cacheFile;
+	u32 generation;
+	{
+		std::lock_guard < std::mutex > lock ( Lock );
+		if ( slot >= Slot.size () || Slot[slot].State != SLOT_IDLE )
+			return;
+
+		Slot[slot].State = SLOT_PENDING;
+		cacheFile = Slot[slot].CacheFile;
+		generation = Generation;
+	}
+
+	CLevelShotCache *self = this;
+	getWorkerPool ()->push ( [self, slot, generation, cacheFile] ()
+	{
+		u8 *pixels = readCacheFile ( cacheFile );
+		self->finish ( slot, generation, pixels, SLOT_NEED_SOURCE );
+	} );
+}
+
+// hand a worker result back to the slot, drop it if the list was rebuilt meanwhile
+void CLevelShotCache::finish ( u32 slot, u32 generation, u8 *pixels, eSlotState failState )
+{
+	std::lock_guard < std::mutex > lock ( Lock );
+	if ( generation != Generation || slot >= Slot.size () )
+	{
+		delete [] pixels;
+		return;
+	}
+	Slot[slot].Pixels = pixels;
+	Slot[slot].State = pixels ? SLOT_READY : failState;
+}
+
+u32 CLevelShotCache::update ( gui::IGUISpriteBank *bank )
+{
+	IVideoDriver *driver = Device->getVideoDriver ();
+	IFileSystem *fs = Device->getFileSystem ();
+	u32 uploaded = 0;
+
+	std::lock_guard < std::mutex > lock ( Lock );
+	for ( u32 i = 0; i != Slot.size (); ++i )
+	{
+		SSlot &s = Slot[i];
+
+		if ( s.State == SLOT_NEED_SOURCE )
+		{
+			// get level screenshot. reformat texture to 128x128
+			path c ( s.MapFile );
+			deletePathFromFilename ( c );
+			cutFilenameExtension ( c, c );
+			c = path ( "levelshots/" ) + c;
+
+			IReadFile *file = 0;
+			if ( fs->existFile ( c + ".jpg" ) )
+				file = fs->createAndOpenFile ( c + ".jpg" );
+			else
+			if ( fs->existFile ( c + ".tga" ) )
+				file = fs->createAndOpenFile ( c + ".tga" );
+
+			if ( 0 == file )
+			{
+				s.State = SLOT_MISSING;
+				continue;
+			}
+
+			// the image loaders belong to the driver, they run here
+			IImage *image = driver->createImageFromFile ( file );
+			file->drop ();
+
+			if ( 0 == image || !isReadable ( image->getColorFormat () ) )
+			{
+				if ( image )
+					image->drop ();
+				s.State = SLOT_MISSING;
+				continue;
+			}
+
+			s.State = SLOT_PENDING;
+			CLevelShotCache *self = this;
+			const u32 slot = i;
+			const u32 generation = Generation;
+			const path cacheFile = s.CacheFile;
+			const u8 *src = (const u8*) image->lock ();
+			image->unlock ();
+			// scale the decoded texels on a worker, store the result in the disk cache
+			getWorkerPool ()->push ( [self, image, src, slot, generation, cacheFile] ()
+			{
+				u8 *pixels = scaleBoxFilter ( src, image->getDimension (), image->getPitch (), image->getColorFormat () );
+				image->drop ();
+
+				writeCacheFile ( pixels, cacheFile );
+				self->finish ( slot, generation, pixels, SLOT_MISSING );
+			} );
+			continue;
+		}
+
+		if ( s.State != SLOT_READY )
+			continue;
+
+		// the image takes the pixels
+		IImage *image = driver->createImageFromData ( ECF_R8G8B8,
+			dimension2du ( LEVELSHOT_SIZE, LEVELSHOT_SIZE ), s.Pixels, true );
+		s.Pixels = 0;
+		ITexture *tex = driver->addTexture ( s.CacheFile, image );
+		image->drop ();
+		s.State = SLOT_UPLOADED;
+
+		if ( bank && i < bank->getTextureCount () )
+			bank->setTexture ( i, tex );
+		uploaded += 1;
+	}
+
+	return uploaded;
+}
+
+void CLevelShotCache::clear ()
+{
+	std::lock_guard < std::mutex > lock ( Lock );
+	for ( u32 i = 0; i != Slot.size (); ++i )
+	{
+		delete [] Slot[i].Pixels;
+	}
+	Slot.clear ();
+	Generation += 1;
+}
@@ -0,0 +1,81 @@
+/*!
+	Level Shot Cache.
+	thumbnails for the map browser
+
+	Every levelshot is decoded and box filtered once, the 128x128 result
+	is written to an on-disk cache keyed by the hash of its archive.
+	Thumbnails are only built for rows the map list actually shows,
+	scaling and cache io runs on the worker pool, decoding stays with the
+	image loaders of the driver on the main thread.
+*/
+#ifndef __QUAKE3_LEVELSHOTS__H_INCLUDED__
+#define __QUAKE3_LEVELSHOTS__H_INCLUDED__
+
+#include <irrlicht.h>
+#include <mutex>
+
+using namespace irr;
+
+//! size of a map browser thumbnail
+const u32 LEVELSHOT_SIZE = 128;
+
+class CLevelShotCache
+{
+public:
+	CLevelShotCache ( IrrlichtDevice *device, const io::path &cacheDir );
+	~CLevelShotCache ();
+
+	//! hash used as cache key for all maps inside an archive
+	static u64 hashArchive ( const io::path &archiveName );
+
+	//! remember the archive hash. call once after mounting
+	void addArchive ( const io::path &archiveName );
+
+	//! register a map, returns the thumbnail slot. nothing is decoded
+	u32 addMap ( const io::path &mapFile );
+
+	//! decode the slot on a worker unless it is loaded or in flight
+	void request ( u32 slot );
+
+	//! upload finished thumbnails into the bank, returns the count
+	u32 update ( gui::IGUISpriteBank *bank );
+
+	//! forget all slots, e.g. the map list is rebuilt
+	void clear ();
+
+	u32 getSlotCount () const { return Slot.size (); }
+
+private:
+	enum eSlotState
+	{
+		SLOT_IDLE = 0,
+		SLOT_PENDING,
+		SLOT_NEED_SOURCE,
+		SLOT_READY,
+		SLOT_UPLOADED,
+		SLOT_MISSING
+	};
+
+	struct SSlot
+	{
+		io::path MapFile;
+		io::path CacheFile;
+		eSlotState State;
+		u8 *Pixels;				// R8G8B8 thumbnail, until uploaded
+	};
+
+	io::path getCacheFile ( const io::path &mapFile ) const;
+	void finish ( u32 slot, u32 generation, u8 *pixels, eSlotState failState );
+
+	IrrlichtDevice *Device;
+	io::path CacheDir;
+	u32 Generation;
+
+	core::array < io::path > ArchiveName;
+	core::array < u64 > ArchiveHash;
+	core::array < SSlot > Slot;
+
+	std::mutex Lock;
+};
+
+#endif // __QUAKE3_LEVELSHOTS__H_INCLUDED__
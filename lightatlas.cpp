@@ -0,0 +1,469 @@
+/*!
+	Lightmap Atlas.
+	the 128x128 lightmaps of the map packed into a few large pages at load
+*/
+
+#include "lightatlas.h"
+#include "profile.h"
+
+#include <stdio.h>
+#include <string.h>
+
+using namespace core;
+using namespace scene;
+using namespace video;
+
+static const u32 MIN_PAGE_SIZE = 256;
+static const u32 MAX_BUFFER_VERTICES = 65535;
+
+void CSkylinePacker::init ( u32 width, u32 height )
+{
+	Width = width;
+	Height = height;
+	Used = 0;
+
+	SSegment s;
+	s.X = 0;
+	s.Y = 0;
+	s.Width = width;
+	Skyline.set_used ( 0 );
+	Skyline.push_back ( s );
+}
+
+// the height the rectangle rests at with its left edge on segment
+bool CSkylinePacker::fit ( u32 segment, u32 width, u32 height, u32 &y ) const
+{
+	if ( Skyline[segment].X + width > Width )
+		return false;
+
+	y = 0;
+	u32 left = width;
+	for ( u32 i = segment; left; ++i )
+	{
+		y = core::max_ ( y, Skyline[i].Y );
+		if ( y + height > Height )
+			return false;
+		left -= core::min_ ( left, Skyline[i].Width );
+	}
+	return true;
+}
+
+bool CSkylinePacker::pack ( u32 width, u32 height, u32 &x, u32 &y )
+{
+	s32 best = -1;
+	u32 bestY = 0;
+	for ( u32 i = 0; i != Skyline.size (); ++i )
+	{
+		u32 at;
+		if ( fit ( i, width, height, at ) && ( best < 0 || at < bestY ) )
+		{
+			best = i;
+			bestY = at;
+		}
+	}
+	if ( best < 0 )
+		return false;
+
+	x = Skyline[best].X;
+	y = bestY;
+
+	SSegment s;
+	s.X = x;
+	s.Y = y + height;
+	s.Width = width;
+	Skyline.insert ( s, best );
+
+	// the segments under the new one are cut away
+	const u32 end = x + width;
+	for ( u32 i = best + 1; i < Skyline.size (); )
+	{
+		SSegment &n = Skyline[i];
+		if ( n.X >= end )
+			break;
+
+		const u32 cut = end - n.X;
+		if ( n.Width > cut )
+		{
+			n.X += cut;
+			n.Width -= cut;
+			break;
+		}
+		Skyline.erase ( i );
+	}
+
+	for ( u32 i = 0; i + 1 < Skyline.size (); )
+	{
+		if ( Skyline[i].Y == Skyline[i + 1].Y )
+		{
+			Skyline[i].Width += Skyline[i + 1].Width;
+			Skyline.erase ( i + 1 );
+		}
+		else
+			i += 1;
+	}
+
+	Used += width * height;
+	return true;
+}
+
+CLightmapAtlas::CLightmapAtlas ( u32 gutter )
+: Gutter ( gutter ), PageSize ( 0 ), Occupancy ( 0.f )
+{
+	memset ( &Stats, 0, sizeof ( Stats ) );
+}
+
+// the pages belong to the driver
+void CLightmapAtlas::clear ()
+{
+	Lightmap.clear ();
+	Page.clear ();
+	PageSize = 0;
+	Occupancy = 0.f;
+	memset ( &Stats, 0, sizeof ( Stats ) );
+}
+
+s32 CLightmapAtlas::findLightmap ( ITexture *texture ) const
+{
+	for ( u32 i = 0; i != Lightmap.size (); ++i )
+		if ( Lightmap[i].Texture == texture )
+			return i;
+	return -1;
+}
+
+static bool isLightmapped ( IMeshBuffer *mb )
+{
+	return mb->getVertexType () == EVT_2TCOORDS && mb->getIndexType () == EIT_16BIT &&
+		mb->getVertexCount () && mb->getMaterial ().getTexture ( 1 );
+}
+
+struct SDrawState
+{
+	size_t Texture;
+	size_t Lightmap;
+
+	bool operator < ( const SDrawState &other ) const
+	{
+		return Texture < other.Texture || ( Texture == other.Texture && Lightmap < other.Lightmap );
+	}
+};
+
+u32 CLightmapAtlas::countSwitches ( IMesh *mesh )
+{
+	array < SDrawState > state;
+	for ( u32 b = 0; b != mesh->getMeshBufferCount (); ++b )
+	{
+		const SMaterial &m = mesh->getMeshBuffer ( b )->getMaterial ();
+		SDrawState s;
+		s.Texture = (size_t) m.getTexture ( 0 );
+		s.Lightmap = (size_t) m.getTexture ( 1 );
+		state.push_back ( s );
+	}
+	state.sort ();
+
+	u32 switches = 0;
+	for ( u32 i = 0; i != state.size (); ++i )
+	{
+		switches += 0 == i || state[i].Texture != state[i - 1].Texture ? 1 : 0;
+		switches += 0 == i || state[i].Lightmap != state[i - 1].Lightmap ? 1 : 0;
+	}
+	return switches;
+}
+
+struct SPlaceOrder
+{
+	u32 Height;
+	u32 Index;
+
+	// tallest first, heapsort needs the index to keep equal ones in order
+	bool operator < ( const SPlaceOrder &other ) const
+	{
+		return Height > other.Height || ( Height == other.Height && Index < other.Index );
+	}
+};
+
+// returns the pages needed
+u32 CLightmapAtlas::place ( u32 pageSize )
+{
+	array < SPlaceOrder > order;
+	for ( u32 i = 0; i != Lightmap.size (); ++i )
+	{
+		SPlaceOrder o;
+		o.Height = Lightmap[i].Height;
+		o.Index = i;
+		order.push_back ( o );
+	}
+	order.sort ();
+
+	array < CSkylinePacker > packer;
+	for ( u32 k = 0; k != order.size (); ++k )
+	{
+		SLightmap &l = Lightmap[ order[k].Index ];
+		const u32 w = l.Width + 2 * Gutter;
+		const u32 h = l.Height + 2 * Gutter;
+
+		l.Page = -1;
+		if ( w > pageSize || h > pageSize )
+			continue;
+
+		u32 x, y;
+		for ( u32 p = 0; p != packer.size () && l.Page < 0; ++p )
+			if ( packer[p].pack ( w, h, x, y ) )
+				l.Page = p;
+
+		if ( l.Page < 0 )
+		{
+			packer.push_back ( CSkylinePacker () );
+			packer.getLast ().init ( pageSize, pageSize );
+			packer.getLast ().pack ( w, h, x, y );
+			l.Page = packer.size () - 1;
+		}
+		l.X = x + Gutter;
+		l.Y = y + Gutter;
+	}
+
+	Occupancy = 0.f;
+	for ( u32 p = 0; p != packer.size (); ++p )
+		Occupancy += packer[p].getOccupancy ();
+	if ( packer.size () )
+		Occupancy /= packer.size ();
+
+	return packer.size ();
+}
+
+bool CLightmapAtlas::pack ( IMesh *geometry, u32 maxPageSize )
+{
+	clear ();
+	if ( 0 == geometry )
+		return false;
+
+	const u64 start = getTimeMicro ();
+
+	for ( u32 b = 0; b != geometry->getMeshBufferCount (); ++b )
+	{
+		IMeshBuffer *mb = geometry->getMeshBuffer ( b );
+		if ( !isLightmapped ( mb ) )
+			continue;
+
+		ITexture *texture = mb->getMaterial ().getTexture ( 1 );
+		if ( findLightmap ( texture ) >= 0 )
+			continue;
+
+		SLightmap l;
+		l.Texture = texture;
+		l.Width = texture->getSize ().Width;
+		l.Height = texture->getSize ().Height;
+		l.Page = -1;
+		l.X = 0;
+		l.Y = 0;
+		Lightmap.push_back ( l );
+	}
+
+	Stats.BuffersBefore = geometry->getMeshBufferCount ();
+	Stats.SwitchesBefore = countSwitches ( geometry );
+	Stats.Lightmaps = Lightmap.size ();
+
+	// the smallest page taking all lightmaps, else as many of the largest as needed
+	u32 pages = 0;
+	for ( PageSize = MIN_PAGE_SIZE; PageSize < maxPageSize; PageSize <<= 1 )
+	{
+		pages = place ( PageSize );
+		if ( pages <= 1 )
+			break;
+	}
+	if ( PageSize >= maxPageSize )
+	{
+		PageSize = maxPageSize;
+		pages = place ( PageSize );
+	}
+
+	Stats.Pages = pages;
+	Stats.PageSize = PageSize;
+	Stats.Occupancy = (u32) ( Occupancy * 100.f + 0.5f );
+	Stats.Micro = (u32) ( getTimeMicro () - start );
+	return pages != 0;
+}
+
+// the texels of a texture as an image, 0 if the driver can't lock it
+static IImage * readTexture ( IVideoDriver *driver, ITexture *texture )
+{
+	const u8 *data = (const u8*) texture->lock ( ETLM_READ_ONLY );
+	if ( 0 == data )
+		return 0;
+
+	IImage *image = driver->createImage ( texture->getColorFormat (), texture->getSize () );
+	u8 *dest = (u8*) image->lock ();
+	const u32 row = core::min_ ( image->getPitch (), texture->getPitch () );
+	for ( u32 y = 0; y != texture->getSize ().Height; ++y )
+		memcpy ( dest + y * image->getPitch (), data + y * texture->getPitch (), row );
+	image->unlock ();
+
+	texture->unlock ();
+	return image;
+}
+
+bool CLightmapAtlas::createPages ( IVideoDriver *driver, const io::path &name )
+{
+	const u64 start = getTimeMicro ();
+
+	array < IImage* > image;
+	for ( u32 p = 0; p != Stats.Pages; ++p )
+	{
+		IImage *page = driver->createImage ( ECF_A8R8G8B8, dimension2du ( PageSize, PageSize ) );
+		page->fill ( SColor ( 255, 0, 0, 0 ) );
+		image.push_back ( page );
+	}
+
+	// the edge texels are repeated into the gutter
+	const s32 g = (s32) Gutter;
+	for ( u32 i = 0; i != Lightmap.size (); ++i )
+	{
+		const SLightmap &l = Lightmap[i];
+		if ( l.Page < 0 )
+			continue;
+
+		IImage *source = readTexture ( driver, l.Texture );
+		if ( 0 == source )
+		{
+			Stats.Unreadable += 1;
+			continue;
+		}
+
+		IImage *page = image[l.Page];
+		const s32 w = (s32) source->getDimension ().Width;
+		const s32 h = (s32) source->getDimension ().Height;
+		for ( s32 y = -g; y < h + g; ++y )
+			for ( s32 x = -g; x < w + g; ++x )
+				page->setPixel ( l.X + x, l.Y + y,
+					source->getPixel ( core::clamp ( x, 0, w - 1 ), core::clamp ( y, 0, h - 1 ) ) );
+		source->drop ();
+	}
+
+	// the mesh keeps the single lightmaps, no page goes to the driver
+	if ( Stats.Unreadable )
+	{
+		for ( u32 p = 0; p != image.size (); ++p )
+			image[p]->drop ();
+		Stats.Micro += (u32) ( getTimeMicro () - start );
+		return false;
+	}
+
+	// mip levels would blend across the gutters
+	const bool mipMaps = driver->getTextureCreationFlag ( ETCF_CREATE_MIP_MAPS );
+	driver->setTextureCreationFlag ( ETCF_CREATE_MIP_MAPS, false );
+
+	c8 buf[32];
+	for ( u32 p = 0; p != image.size (); ++p )
+	{
+		snprintf ( buf, sizeof ( buf ), "_lightmap_atlas_%u", p );
+		Page.push_back ( driver->addTexture ( name + buf, image[p] ) );
+		image[p]->drop ();
+	}
+
+	driver->setTextureCreationFlag ( ETCF_CREATE_MIP_MAPS, mipMaps );
+
+	Stats.Micro += (u32) ( getTimeMicro () - start );
+	return true;
+}
+
+static void appendBuffer ( SMeshBufferLightMap *dest, IMeshBuffer *source )
+{
+	const u32 base = dest->Vertices.size ();
+	const S3DVertex2TCoords *v = (const S3DVertex2TCoords*) source->getVertices ();
+	const u16 *index = source->getIndices ();
+
+	for ( u32 i = 0; i != source->getVertexCount (); ++i )
+		dest->Vertices.push_back ( v[i] );
+
+	for ( u32 i = 0; i != source->getIndexCount (); ++i )
+		dest->Indices.push_back ( (u16) ( base + index[i] ) );
+
+	if ( 0 == base )
+		dest->BoundingBox = source->getBoundingBox ();
+	else
+		dest->BoundingBox.addInternalBox ( source->getBoundingBox () );
+}
+
+struct SMergeTarget
+{
+	SMeshBufferLightMap *Buffer;	// 0 while the slot holds a single buffer
+	u32 Slot;
+	u32 VertexCount;
+};
+
+void CLightmapAtlas::apply ( SMesh *geometry )
+{
+	if ( 0 == geometry || Page.size () != Stats.Pages )
+		return;
+
+	const u64 start = getTimeMicro ();
+
+	array < IMeshBuffer* > keep;
+	array < IMeshBuffer* > merged;
+	array < SMergeTarget > target;
+
+	for ( u32 b = 0; b != geometry->MeshBuffers.size (); ++b )
+	{
+		IMeshBuffer *mb = geometry->MeshBuffers[b];
+		const s32 lightmap = isLightmapped ( mb ) ? findLightmap ( mb->getMaterial ().getTexture ( 1 ) ) : -1;
+		if ( lightmap < 0 || Lightmap[lightmap].Page < 0 )
+		{
+			keep.push_back ( mb );
+			continue;
+		}
+
+		// onto the page, clamped to the lightmap as the gutter only covers the filter
+		const SLightmap &l = Lightmap[lightmap];
+		const f32 scale = 1.f / PageSize;
+		S3DVertex2TCoords *v = (S3DVertex2TCoords*) mb->getVertices ();
+		for ( u32 i = 0; i != mb->getVertexCount (); ++i )
+		{
+			v[i].TCoords2.X = ( l.X + core::clamp ( v[i].TCoords2.X, 0.f, 1.f ) * l.Width ) * scale;
+			v[i].TCoords2.Y = ( l.Y + core::clamp ( v[i].TCoords2.Y, 0.f, 1.f ) * l.Height ) * scale;
+		}
+		mb->getMaterial ().setTexture ( 1, Page[l.Page] );
+		mb->setDirty ( EBT_VERTEX );
+
+		u32 t = 0;
+		while ( t != target.size () && ( keep[ target[t].Slot ]->getMaterial () != mb->getMaterial () ||
+				target[t].VertexCount + mb->getVertexCount () > MAX_BUFFER_VERTICES ) )
+			t += 1;
+
+		if ( t == target.size () )
+		{
+			SMergeTarget add;
+			add.Buffer = 0;
+			add.Slot = keep.size ();
+			add.VertexCount = mb->getVertexCount ();
+			target.push_back ( add );
+			keep.push_back ( mb );
+			continue;
+		}
+
+		SMergeTarget &into = target[t];
+		if ( 0 == into.Buffer )
+		{
+			IMeshBuffer *first = keep[into.Slot];
+			into.Buffer = new SMeshBufferLightMap ();
+			into.Buffer->Material = first->getMaterial ();
+			into.Buffer->setHardwareMappingHint ( first->getHardwareMappingHint_Vertex (), EBT_VERTEX );
+			into.Buffer->setHardwareMappingHint ( first->getHardwareMappingHint_Index (), EBT_INDEX );
+			appendBuffer ( into.Buffer, first );
+			merged.push_back ( first );
+			keep[into.Slot] = into.Buffer;
+		}
+		appendBuffer ( into.Buffer, mb );
+		merged.push_back ( mb );
+		into.VertexCount += mb->getVertexCount ();
+	}
+
+	// the mesh takes over the references of the merged buffers
+	for ( u32 i = 0; i != merged.size (); ++i )
+		merged[i]->drop ();
+	geometry->MeshBuffers = keep;
+	geometry->recalculateBoundingBox ();
+	geometry->setDirty ();
+
+	Stats.BuffersAfter = geometry->getMeshBufferCount ();
+	Stats.SwitchesAfter = countSwitches ( geometry );
+	Stats.Micro += (u32) ( getTimeMicro () - start );
+}
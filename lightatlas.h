@@ -0,0 +1,114 @@
+/*!
+	Lightmap Atlas.
+	the 128x128 lightmaps of the map packed into a few large pages at load
+
+	The loader gives every lightmap a texture of its own and merges the
+	faces of a shader and lightmap into one buffer, so a shader lit by ten
+	lightmaps draws as ten buffers and the lightmap layer switches between
+	all of them. The lightmaps of the geometry mesh are placed on pages by
+	a skyline packer, every one inside a border of its edge texels so the
+	bilinear filter never reads a neighbour. The lightmap coordinates are
+	moved onto the page, and buffers left with the same material, now the
+	same shader and page, are merged.
+
+	The pages are read back from the lightmap textures. If the driver can
+	not lock one of them no page is created and the geometry keeps its
+	lightmaps. The shader nodes always keep the single lightmaps, only the
+	geometry mesh is rewritten.
+*/
+#ifndef __QUAKE3_LIGHTATLAS__H_INCLUDED__
+#define __QUAKE3_LIGHTATLAS__H_INCLUDED__
+
+#include <irrlicht.h>
+
+using namespace irr;
+
+//! rectangles placed bottom left along the top edge of the ones placed before
+class CSkylinePacker
+{
+public:
+	CSkylinePacker () : Width ( 0 ), Height ( 0 ), Used ( 0 ) {}
+
+	void init ( u32 width, u32 height );
+
+	//! false if the rectangle fits nowhere
+	bool pack ( u32 width, u32 height, u32 &x, u32 &y );
+
+	f32 getOccupancy () const { return Width && Height ? (f32) Used / ( (f32) Width * Height ) : 0.f; }
+
+private:
+	struct SSegment
+	{
+		u32 X;
+		u32 Y;
+		u32 Width;
+	};
+
+	bool fit ( u32 segment, u32 width, u32 height, u32 &y ) const;
+
+	core::array < SSegment > Skyline;
+	u32 Width;
+	u32 Height;
+	u32 Used;
+};
+
+struct SLightmapAtlasStats
+{
+	u32 Lightmaps;		// distinct lightmaps of the geometry
+	u32 Pages;
+	u32 PageSize;
+	u32 Occupancy;		// percent of the pages covered, gutters included
+	u32 Unreadable;		// lightmaps the driver could not lock
+	u32 BuffersBefore;
+	u32 BuffersAfter;
+	u32 SwitchesBefore;	// texture and lightmap switches drawing every buffer once, sorted
+	u32 SwitchesAfter;
+	u32 Micro;
+};
+
+class CLightmapAtlas
+{
+public:
+	CLightmapAtlas ( u32 gutter = 2 );
+
+	//! places the lightmaps of the lightmapped buffers, false if there are none
+	bool pack ( scene::IMesh *geometry, u32 maxPageSize );
+
+	//! copies the lightmaps onto the page textures. false if one could not be read, then no page is added
+	bool createPages ( video::IVideoDriver *driver, const io::path &name );
+
+	//! moves the lightmap coordinates onto the pages and merges the buffers sharing shader and page
+	void apply ( scene::SMesh *geometry );
+
+	void clear ();
+
+	u32 getPageCount () const { return Page.size (); }
+	video::ITexture * getPage ( u32 index ) const { return Page[index]; }
+	const SLightmapAtlasStats & getStats () const { return Stats; }
+
+	//! what the render queue switches drawing all buffers of mesh in one pass
+	static u32 countSwitches ( scene::IMesh *mesh );
+
+private:
+	struct SLightmap
+	{
+		video::ITexture *Texture;
+		u32 Width;
+		u32 Height;
+		s32 Page;			// -1 if larger than a page
+		u32 X;				// of the texels, inside the gutter
+		u32 Y;
+	};
+
+	s32 findLightmap ( video::ITexture *texture ) const;
+	u32 place ( u32 pageSize );
+
+	core::array < SLightmap > Lightmap;
+	core::array < video::ITexture* > Page;
+	u32 Gutter;
+	u32 PageSize;
+	f32 Occupancy;
+	SLightmapAtlasStats Stats;
+};
+
+#endif // __QUAKE3_LIGHTATLAS__H_INCLUDED__
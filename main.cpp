@@ -1,6 +1,8 @@
 
 #include "mainmenu.h"
 #include "q3factory.h"
+#include "benchmark.h"
+#include "random.h"
 
 	int IRRCALLCONV main(int argc, char* argv[])
 {
@@ -19,6 +21,17 @@
 		return game.retVal; // could not load dll
 	}
 
+	// timings on the null driver, no window
+	if ( argc > 1 && 0 == strcmp ( argv[1], "-bench" ) )
+		return runBenchmarks ( game.createExDevice );
+
+	// a fixed seed replays the same random sequences
+	for ( s32 i = 1; i + 1 < argc; ++i )
+	{
+		if ( 0 == strcmp ( argv[i], "-seed" ) )
+			setRandomSeed ( strtoul ( argv[i + 1], 0, 0 ) );
+	}
+
 	// start without asking for driver
 	game.retVal = 1;
 	
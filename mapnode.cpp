@@ -0,0 +1,542 @@
+/*!
+	Map Scene Node.
+	draws the map geometry through the bsp pvs and the view frustum
+*/
+
+#include "mapnode.h"
+#include "visibility.h"
+#include "q3bsp.h"
+#include "occlusion.h"
+#include "renderqueue.h"
+
+using namespace core;
+using namespace scene;
+using namespace video;
+
+static const f32 PATCH_EPSILON = 1.f;		// tessellated patch vertices against the control point box
+static const f32 NODE_MARGIN = 32.f;		// deformVertexes moves shader geometry out of its box
+
+//! a drawvert of a face or triangle soup, equal by position only
+struct SVertexKey
+{
+	vector3df Pos;
+	u32 Surface;
+
+	bool operator< ( const SVertexKey &o ) const
+	{
+		if ( Pos.X != o.Pos.X ) return Pos.X < o.Pos.X;
+		if ( Pos.Y != o.Pos.Y ) return Pos.Y < o.Pos.Y;
+		return Pos.Z < o.Pos.Z;
+	}
+};
+
+struct SPatchBox
+{
+	aabbox3df Box;
+	u32 Surface;
+};
+
+struct STriangleGroup
+{
+	u32 Group;
+	u32 Triangle;
+
+	bool operator< ( const STriangleGroup &o ) const
+	{
+		return Group != o.Group ? Group < o.Group : Triangle < o.Triangle;
+	}
+};
+
+// surfaces having a vertex at pos, appended to out
+static void findSurfaces ( array < SVertexKey > &key, const vector3df &pos, array < u32 > &out )
+{
+	SVertexKey k;
+	k.Pos = pos;
+	k.Surface = 0;
+
+	const s32 hit = key.binary_search ( k );
+	if ( hit < 0 )
+		return;
+
+	s32 first = hit;
+	while ( first > 0 && key[first - 1].Pos == pos )
+		first -= 1;
+	for ( u32 i = first; i != key.size () && key[i].Pos == pos; ++i )
+		out.push_back ( key[i].Surface );
+}
+
+static bool hasSurface ( const array < u32 > &list, u32 surface )
+{
+	for ( u32 i = 0; i != list.size (); ++i )
+		if ( list[i] == surface )
+			return true;
+	return false;
+}
+
+
+CQ3MapSceneNode::CQ3MapSceneNode ( IMesh *geometry, const CQ3Bsp &bsp, CQ3Visibility *vis,
+								ISceneNode *parent, ISceneManager *mgr, s32 id )
+: ISceneNode ( parent, mgr, id ), Vis ( vis ), Occlusion ( 0 ), Queue ( 0 ), SurfaceCount ( 0 ), Culling ( true ),
+	GroupsValid ( false ), HasSolid ( false ), HasTransparent ( false )
+{
+#ifdef _DEBUG
+	setDebugName ( "CQ3MapSceneNode" );
+#endif
+	memset ( &Stats, 0, sizeof ( Stats ) );
+	Box.reset ( 0.f, 0.f, 0.f );
+
+	// culled here, the scene manager sees one box around the whole map
+	setAutomaticCulling ( EAC_OFF );
+
+	build ( geometry, bsp );
+}
+
+CQ3MapSceneNode::~CQ3MapSceneNode ()
+{
+	for ( u32 i = 0; i != Buffer.size (); ++i )
+		Buffer[i].Mesh->drop ();
+	for ( u32 i = 0; i != Culled.size (); ++i )
+		Culled[i].Node->drop ();
+}
+
+/*
+	copies the buffers and sorts their triangles by surface group
+*/
+void CQ3MapSceneNode::build ( IMesh *geometry, const CQ3Bsp &bsp )
+{
+	u32 surfaceCount, vertCount;
+	const SQ3BspSurface *surface = bsp.getLump < SQ3BspSurface > ( BSP_SURFACES, surfaceCount );
+	const SQ3BspVertex *vert = bsp.getLump < SQ3BspVertex > ( BSP_DRAWVERTS, vertCount );
+	SurfaceCount = surfaceCount;
+
+	array < SVertexKey > key;
+	array < SPatchBox > patch;
+	for ( u32 s = 0; s != surfaceCount; ++s )
+	{
+		const SQ3BspSurface &f = surface[s];
+		if ( f.firstVert < 0 || f.numVerts <= 0 || (u32) ( f.firstVert + f.numVerts ) > vertCount )
+			continue;
+
+		if ( f.type == BSP_SURF_PLANAR || f.type == BSP_SURF_TRIANGLES )
+		{
+			for ( s32 v = 0; v != f.numVerts; ++v )
+			{
+				SVertexKey k;
+				k.Pos = q3ToIrr ( vert[f.firstVert + v].xyz );
+				k.Surface = s;
+				key.push_back ( k );
+			}
+		}
+		else if ( f.type == BSP_SURF_PATCH )
+		{
+			SPatchBox p;
+			p.Box.reset ( q3ToIrr ( vert[f.firstVert].xyz ) );
+			for ( s32 v = 1; v != f.numVerts; ++v )
+				p.Box.addInternalPoint ( q3ToIrr ( vert[f.firstVert + v].xyz ) );
+			p.Box.MinEdge -= vector3df ( PATCH_EPSILON );
+			p.Box.MaxEdge += vector3df ( PATCH_EPSILON );
+			p.Surface = s;
+			patch.push_back ( p );
+		}
+	}
+	key.sort ();
+
+	array < u32 > cand[3];
+	array < u32 > found;
+	array < STriangleGroup > order;
+
+	for ( u32 b = 0; b != geometry->getMeshBufferCount (); ++b )
+	{
+		IMeshBuffer *mb = geometry->getMeshBuffer ( b );
+		if ( 0 == mb->getIndexCount () )
+			continue;
+
+		if ( Buffer.empty () )
+			Box = mb->getBoundingBox ();
+		else
+			Box.addInternalBox ( mb->getBoundingBox () );
+
+		SBuffer buf;
+		buf.FirstRun = Run.size ();
+		buf.RunCount = 0;
+		buf.DrawCount = 0;
+		buf.StateKey = 0;
+		buf.Transparent = mb->getMaterial ().isTransparent ();
+		if ( buf.Transparent )
+			HasTransparent = true;
+		else
+			HasSolid = true;
+
+		// the loader writes lightmapped 16 bit buffers, anything else is drawn whole
+		buf.Own = mb->getVertexType () == EVT_2TCOORDS && mb->getIndexType () == EIT_16BIT;
+		if ( !buf.Own )
+		{
+			mb->grab ();
+			buf.Mesh = mb;
+
+			SRun run;
+			RunBounds.add ( mb->getBoundingBox () );
+			run.Group = SurfaceCount;
+			run.FirstIndex = 0;
+			run.IndexCount = mb->getIndexCount ();
+			Run.push_back ( run );
+			RunVisible.push_back ( 0 );
+			buf.RunCount = 1;
+			Buffer.push_back ( buf );
+			continue;
+		}
+
+		SMeshBufferLightMap *copy = new SMeshBufferLightMap ();
+		copy->Material = mb->getMaterial ();
+		copy->BoundingBox = mb->getBoundingBox ();
+
+		const S3DVertex2TCoords *v = (const S3DVertex2TCoords*) mb->getVertices ();
+		copy->Vertices.reallocate ( mb->getVertexCount () );
+		for ( u32 i = 0; i != mb->getVertexCount (); ++i )
+			copy->Vertices.push_back ( v[i] );
+
+		// vertices never change, the visible indices do
+		copy->setHardwareMappingHint ( EHM_STATIC, EBT_VERTEX );
+		copy->setHardwareMappingHint ( EHM_STREAM, EBT_INDEX );
+		buf.Mesh = copy;
+
+		const u16 *index = mb->getIndices ();
+		const u32 triangles = mb->getIndexCount () / 3;
+
+		order.set_used ( 0 );
+		for ( u32 t = 0; t != triangles; ++t )
+		{
+			const vector3df *p[3];
+			for ( u32 k = 0; k != 3; ++k )
+				p[k] = &v [ index[t * 3 + k] ].Pos;
+
+			// faces: every corner a drawvert of the surface
+			found.set_used ( 0 );
+			for ( u32 k = 0; k != 3; ++k )
+			{
+				cand[k].set_used ( 0 );
+				findSurfaces ( key, *p[k], cand[k] );
+			}
+			for ( u32 i = 0; i != cand[0].size (); ++i )
+			{
+				const u32 s = cand[0][i];
+				if ( hasSurface ( cand[1], s ) && hasSurface ( cand[2], s ) && !hasSurface ( found, s ) )
+					found.push_back ( s );
+			}
+
+			// patches: inside the control point box
+			for ( u32 i = 0; found.empty () && i != patch.size (); ++i )
+			{
+				const aabbox3df &box = patch[i].Box;
+				if ( box.isPointInside ( *p[0] ) && box.isPointInside ( *p[1] ) && box.isPointInside ( *p[2] ) )
+					found.push_back ( patch[i].Surface );
+			}
+
+			STriangleGroup g;
+			g.Group = getGroup ( found );
+			g.Triangle = t;
+			order.push_back ( g );
+
+			if ( g.Group != SurfaceCount )
+				Stats.Matched += 1;
+		}
+		order.sort ();
+
+		// runs of one group, their indices in sorted order
+		buf.Source.set_used ( triangles * 3 );
+		aabbox3df box;
+		for ( u32 i = 0; i != order.size (); ++i )
+		{
+			const u32 t = order[i].Triangle;
+			if ( 0 == i || order[i].Group != order[i - 1].Group )
+			{
+				if ( i )
+					RunBounds.add ( box );
+
+				SRun run;
+				run.Group = order[i].Group;
+				run.FirstIndex = i * 3;
+				run.IndexCount = 0;
+				box.reset ( v [ index[t * 3] ].Pos );
+				Run.push_back ( run );
+				RunVisible.push_back ( 0 );
+				buf.RunCount += 1;
+			}
+
+			SRun &run = Run.getLast ();
+			for ( u32 k = 0; k != 3; ++k )
+			{
+				buf.Source[i * 3 + k] = index[t * 3 + k];
+				box.addInternalPoint ( v [ index[t * 3 + k] ].Pos );
+			}
+			run.IndexCount += 3;
+		}
+		if ( order.size () )
+			RunBounds.add ( box );
+
+		Buffer.push_back ( buf );
+	}
+
+	GroupVisible.set_used ( SurfaceCount + 1 + Group.size () );
+	memset ( GroupVisible.pointer (), 1, GroupVisible.size () );
+
+	for ( u32 i = 0; i != Run.size (); ++i )
+		Stats.Triangles += Run[i].IndexCount / 3;
+}
+
+/*
+	group of the surfaces a triangle was found in. one surface is its own
+	group, none the always visible group
+*/
+u32 CQ3MapSceneNode::getGroup ( const array < u32 > &surfaces )
+{
+	if ( surfaces.empty () )
+		return SurfaceCount;
+	if ( 1 == surfaces.size () )
+		return surfaces[0];
+
+	array < u32 > sorted ( surfaces );
+	sorted.sort ();
+
+	for ( u32 g = 0; g != Group.size (); ++g )
+	{
+		const SGroup &group = Group[g];
+		if ( group.SurfaceCount != sorted.size () )
+			continue;
+
+		u32 k = 0;
+		while ( k != sorted.size () && GroupSurface[group.FirstSurface + k] == sorted[k] )
+			k += 1;
+		if ( k == sorted.size () )
+			return SurfaceCount + 1 + g;
+	}
+
+	SGroup group;
+	group.FirstSurface = GroupSurface.size ();
+	group.SurfaceCount = sorted.size ();
+	for ( u32 k = 0; k != sorted.size (); ++k )
+		GroupSurface.push_back ( sorted[k] );
+	Group.push_back ( group );
+	return SurfaceCount + Group.size ();
+}
+
+void CQ3MapSceneNode::setRenderQueue ( CRenderQueueSceneNode *queue )
+{
+	Queue = queue;
+	for ( u32 b = 0; b != Buffer.size (); ++b )
+		Buffer[b].StateKey = queue ? queue->getStateKey ( Buffer[b].Mesh->getMaterial () ) : 0;
+}
+
+void CQ3MapSceneNode::addCulledNode ( ISceneNode *node )
+{
+	if ( 0 == node || 0 == Vis || !Vis->isValid () )
+		return;
+
+	node->updateAbsolutePosition ();
+	aabbox3df box = node->getTransformedBoundingBox ();
+
+	// the frustum test moves here, into the batch of all culled nodes
+	node->setAutomaticCulling ( EAC_OFF );
+	NodeBounds.add ( box );
+
+	box.MinEdge -= vector3df ( NODE_MARGIN );
+	box.MaxEdge += vector3df ( NODE_MARGIN );
+
+	SCulledNode c;
+	c.Node = node;
+	c.FirstLeaf = CulledLeaf.size ();
+	Vis->findLeafs ( box, CulledLeaf );
+	c.LeafCount = CulledLeaf.size () - c.FirstLeaf;
+
+	node->grab ();
+	Culled.push_back ( c );
+}
+
+void CQ3MapSceneNode::addCulledNodes ( ISceneNode *parent )
+{
+	if ( 0 == parent )
+		return;
+
+	const list < ISceneNode* > &children = parent->getChildren ();
+	for ( list < ISceneNode* >::ConstIterator it = children.begin (); it != children.end (); ++it )
+		addCulledNode ( *it );
+}
+
+void CQ3MapSceneNode::cull ( const vector3df &eye, const SViewFrustum *frustum )
+{
+	const bool pvs = Culling && Vis && Vis->isValid ();
+
+	// the pvs only changes with the camera cluster
+	if ( pvs && ( Vis->update ( eye ) || !GroupsValid ) )
+	{
+		for ( u32 s = 0; s != SurfaceCount; ++s )
+			GroupVisible[s] = Vis->isSurfaceVisible ( s ) ? 1 : 0;
+
+		for ( u32 g = 0; g != Group.size (); ++g )
+		{
+			u8 visible = 0;
+			for ( u32 k = 0; !visible && k != Group[g].SurfaceCount; ++k )
+				visible = Vis->isSurfaceVisible ( GroupSurface[Group[g].FirstSurface + k] ) ? 1 : 0;
+			GroupVisible[SurfaceCount + 1 + g] = visible;
+		}
+		GroupsValid = true;
+	}
+	else if ( !pvs )
+	{
+		memset ( GroupVisible.pointer (), 1, GroupVisible.size () );
+		GroupsValid = false;
+	}
+
+	Stats.Drawn = 0;
+	Stats.PVSCulled = 0;
+	Stats.FrustumCulled = 0;
+	Stats.Nodes = Culled.size ();
+	Stats.NodesHidden = 0;
+	Stats.NodesOutside = 0;
+	Stats.NodesOccluded = 0;
+
+	// all boxes against the frustum at once, the loops below read the bits
+	if ( Culling && frustum )
+	{
+		RunBounds.cull ( *frustum, RunMask );
+		NodeBounds.cull ( *frustum, NodeMask );
+	}
+	else
+	{
+		RunBounds.fill ( RunMask );
+		NodeBounds.fill ( NodeMask );
+	}
+
+	for ( u32 i = 0; i != Culled.size (); ++i )
+	{
+		const SCulledNode &c = Culled[i];
+		bool visible = !pvs;
+		for ( u32 k = 0; !visible && k != c.LeafCount; ++k )
+			visible = Vis->isLeafVisible ( CulledLeaf[c.FirstLeaf + k] );
+
+		if ( !visible )
+		{
+			Stats.NodesHidden += 1;
+			NodeMask[i >> 5] &= ~( 1u << ( i & 31 ) );
+		}
+		else if ( !CBoxCuller::isVisible ( NodeMask, i ) )
+			Stats.NodesOutside += 1;
+	}
+
+	// the nodes left are tested against the occluders of this frame
+	if ( Culling && Occlusion )
+		Stats.NodesOccluded = Occlusion->cull ( NodeBounds, NodeMask );
+
+	for ( u32 i = 0; i != Culled.size (); ++i )
+	{
+		const bool visible = CBoxCuller::isVisible ( NodeMask, i );
+		if ( Culled[i].Node->isVisible () != visible )
+			Culled[i].Node->setVisible ( visible );
+	}
+
+	for ( u32 b = 0; b != Buffer.size (); ++b )
+	{
+		SBuffer &buf = Buffer[b];
+
+		bool changed = false;
+		u32 count = 0;
+		for ( u32 r = buf.FirstRun; r != buf.FirstRun + buf.RunCount; ++r )
+		{
+			const SRun &run = Run[r];
+
+			u8 visible = GroupVisible[run.Group];
+			if ( !visible )
+			{
+				Stats.PVSCulled += run.IndexCount / 3;
+			}
+			else if ( !CBoxCuller::isVisible ( RunMask, r ) )
+			{
+				visible = 0;
+				Stats.FrustumCulled += run.IndexCount / 3;
+			}
+
+			if ( visible )
+				count += run.IndexCount;
+			if ( RunVisible[r] != visible )
+			{
+				RunVisible[r] = visible;
+				changed = true;
+			}
+		}
+
+		Stats.Drawn += count / 3;
+		if ( !changed )
+			continue;
+
+		buf.DrawCount = count;
+		if ( !buf.Own )
+			continue;
+
+		// the visible runs are copied in order, the driver uploads the index buffer once
+		array < u16 > &indices = ( (SMeshBufferLightMap*) buf.Mesh )->Indices;
+		indices.set_used ( count );
+		u32 at = 0;
+		for ( u32 r = buf.FirstRun; r != buf.FirstRun + buf.RunCount; ++r )
+		{
+			if ( !RunVisible[r] )
+				continue;
+
+			memcpy ( indices.pointer () + at, buf.Source.const_pointer () + Run[r].FirstIndex, Run[r].IndexCount * sizeof ( u16 ) );
+			at += Run[r].IndexCount;
+		}
+		buf.Mesh->setDirty ( EBT_INDEX );
+	}
+}
+
+void CQ3MapSceneNode::OnRegisterSceneNode ()
+{
+	if ( IsVisible && Buffer.size () )
+	{
+		ICameraSceneNode *camera = SceneManager->getActiveCamera ();
+		if ( camera && Culling && Occlusion )
+			Occlusion->render ( camera->getProjectionMatrix () * camera->getViewMatrix () );
+
+		if ( camera )
+			cull ( camera->getAbsolutePosition (), camera->getViewFrustum () );
+		else
+			cull ( vector3df ( 0.f ), 0 );
+
+		if ( Stats.Drawn && Queue )
+		{
+			for ( u32 b = 0; b != Buffer.size (); ++b )
+			{
+				const SBuffer &buf = Buffer[b];
+				if ( buf.DrawCount )
+					Queue->submit ( buf.StateKey, buf.Transparent, buf.Mesh->getBoundingBox ().getCenter (),
+						buf.Mesh, &buf.Mesh->getMaterial (), &AbsoluteTransformation );
+			}
+		}
+		else if ( Stats.Drawn )
+		{
+			if ( HasSolid )
+				SceneManager->registerNodeForRendering ( this, ESNRP_SOLID );
+			if ( HasTransparent )
+				SceneManager->registerNodeForRendering ( this, ESNRP_TRANSPARENT );
+		}
+	}
+
+	ISceneNode::OnRegisterSceneNode ();
+}
+
+void CQ3MapSceneNode::render ()
+{
+	const bool transparent = SceneManager->getSceneNodeRenderPass () == ESNRP_TRANSPARENT;
+	IVideoDriver *driver = SceneManager->getVideoDriver ();
+
+	driver->setTransform ( ETS_WORLD, AbsoluteTransformation );
+
+	for ( u32 b = 0; b != Buffer.size (); ++b )
+	{
+		const SBuffer &buf = Buffer[b];
+		if ( 0 == buf.DrawCount || buf.Transparent != transparent )
+			continue;
+
+		driver->setMaterial ( buf.Mesh->getMaterial () );
+		driver->drawMeshBuffer ( buf.Mesh );
+	}
+}
@@ -0,0 +1,147 @@
+/*!
+	Map Scene Node.
+	draws the map geometry through the bsp pvs and the view frustum
+
+	The geometry mesh of the level loader has lost the bsp surfaces, its
+	buffers merge all faces of a shader and lightmap. Every triangle is
+	given back to the surface it came from: faces and triangle soups by
+	the exact position of their vertices, patches by the box of their
+	control points. The triangles of a buffer are sorted by surface into
+	runs. Each frame a run is drawn if one of its surfaces is in a leaf
+	the camera cluster sees and its box is inside the frustum. The index
+	buffer of a mesh buffer is only rewritten when its visible runs change,
+	mostly when the camera crosses into another cluster.
+
+	Scene nodes of shaders and fogs can be culled by the same pvs, they are
+	hidden when none of the leafs their box touches is visible. Their
+	frustum test is taken over too, the boxes of all runs and culled nodes
+	are tested in two batches. The map is not moved, its boxes are tested
+	in world space. With an occlusion culler the nodes left are tested
+	against the depth of the big map triangles as well.
+*/
+#ifndef __QUAKE3_MAPNODE__H_INCLUDED__
+#define __QUAKE3_MAPNODE__H_INCLUDED__
+
+#include <irrlicht.h>
+#include "boxcull.h"
+
+using namespace irr;
+
+class CQ3Bsp;
+class CQ3Visibility;
+class COcclusionCuller;
+class CRenderQueueSceneNode;
+
+//! triangles of the last frame
+struct SMapCullStats
+{
+	u32 Triangles;		// all map triangles
+	u32 Drawn;
+	u32 PVSCulled;		// in surfaces no visible leaf lists
+	u32 FrustumCulled;	// potentially visible, outside the view
+	u32 Nodes;			// culled shader nodes
+	u32 NodesHidden;	// of those, hidden by the pvs
+	u32 NodesOutside;	// potentially visible, outside the view
+	u32 NodesOccluded;	// in the view, behind the occluders
+	u32 Matched;		// triangles given back to a bsp surface
+};
+
+class CQ3MapSceneNode : public scene::ISceneNode
+{
+public:
+	//! vis has to be built from bsp and live as long as the node
+	CQ3MapSceneNode ( scene::IMesh *geometry, const CQ3Bsp &bsp, CQ3Visibility *vis,
+					scene::ISceneNode *parent, scene::ISceneManager *mgr, s32 id = -1 );
+	virtual ~CQ3MapSceneNode ();
+
+	//! hidden by the pvs from now on, the box is taken once
+	void addCulledNode ( scene::ISceneNode *node );
+
+	//! every child of parent
+	void addCulledNodes ( scene::ISceneNode *parent );
+
+	//! pvs and frustum culling, off draws everything
+	void setCulling ( bool on ) { Culling = on; }
+	bool getCulling () const { return Culling; }
+
+	//! rendered from the camera before the culled nodes are tested, 0 for none
+	void setOcclusion ( COcclusionCuller *occlusion ) { Occlusion = occlusion; }
+
+	//! the visible buffers are submitted to the queue instead of drawn here, 0 draws them here
+	void setRenderQueue ( CRenderQueueSceneNode *queue );
+
+	const SMapCullStats & getStats () const { return Stats; }
+
+	//! from the camera without drawing, fills the stats
+	void cull ( const core::vector3df &eye, const scene::SViewFrustum *frustum );
+
+	virtual void OnRegisterSceneNode ();
+	virtual void render ();
+
+	virtual const core::aabbox3d<f32>& getBoundingBox () const { return Box; }
+	virtual u32 getMaterialCount () const { return Buffer.size (); }
+	virtual video::SMaterial& getMaterial ( u32 i ) { return Buffer[i].Mesh->getMaterial (); }
+
+private:
+	//! triangles of one surface group in one buffer
+	struct SRun
+	{
+		u32 Group;
+		u32 FirstIndex;
+		u32 IndexCount;
+	};
+
+	struct SBuffer
+	{
+		scene::IMeshBuffer *Mesh;
+		core::array < u16 > Source;		// indices sorted into runs
+		u32 FirstRun;
+		u32 RunCount;
+		u32 DrawCount;					// indices of the visible runs
+		u64 StateKey;					// of the render queue
+		bool Own;						// copied, its indices are rewritten
+		bool Transparent;
+	};
+
+	//! triangles found in more than one surface
+	struct SGroup
+	{
+		u32 FirstSurface;
+		u32 SurfaceCount;
+	};
+
+	struct SCulledNode
+	{
+		scene::ISceneNode *Node;
+		u32 FirstLeaf;
+		u32 LeafCount;
+	};
+
+	void build ( scene::IMesh *geometry, const CQ3Bsp &bsp );
+	u32 getGroup ( const core::array < u32 > &surfaces );
+
+	CQ3Visibility *Vis;
+	COcclusionCuller *Occlusion;
+	CRenderQueueSceneNode *Queue;
+	core::array < SBuffer > Buffer;
+	core::array < SRun > Run;
+	core::array < u8 > RunVisible;
+	CBoxCuller RunBounds;
+	core::array < u32 > RunMask;
+	core::array < SGroup > Group;			// after the single surface groups and the always group
+	core::array < u32 > GroupSurface;
+	core::array < u8 > GroupVisible;
+	core::array < SCulledNode > Culled;
+	core::array < u32 > CulledLeaf;
+	CBoxCuller NodeBounds;
+	core::array < u32 > NodeMask;
+	u32 SurfaceCount;
+	core::aabbox3df Box;
+	SMapCullStats Stats;
+	bool Culling;
+	bool GroupsValid;						// GroupVisible follows the pvs
+	bool HasSolid;
+	bool HasTransparent;
+};
+
+#endif // __QUAKE3_MAPNODE__H_INCLUDED__
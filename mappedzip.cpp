@@ -0,0 +1,465 @@
+/*!
+	Mapped Zip Archive.
+	IFileArchive for .zip / .pk3 working on a memory mapped file
+*/
+
+#include "mappedzip.h"
+#include "inflate.h"
+#include "prefetch.h"
+
+#if defined(_IRR_WINDOWS_API_)
+	#include <windows.h>
+#else
+	#include <sys/mman.h>
+	#include <sys/stat.h>
+	#include <fcntl.h>
+	#include <unistd.h>
+#endif
+
+using namespace core;
+using namespace io;
+
+static SArchiveStats ArchiveStats = { 0, 0, 0, 0 };
+
+SArchiveStats & getArchiveStats ()
+{
+	return ArchiveStats;
+}
+
+// zip records are little endian and not aligned
+static inline u16 get16 ( const u8 *p )
+{
+	return (u16) ( p[0] | ( p[1] << 8 ) );
+}
+
+static inline u32 get32 ( const u8 *p )
+{
+	return (u32) p[0] | ( (u32) p[1] << 8 ) | ( (u32) p[2] << 16 ) | ( (u32) p[3] << 24 );
+}
+
+static inline u32 hashName ( const c8 *name, u32 size )
+{
+	u32 hash = 0x811C9DC5;
+	for ( u32 i = 0; i != size; ++i )
+	{
+		hash ^= (u8) name[i];
+		hash *= 0x01000193;
+	}
+	return hash;
+}
+
+
+CMappedFile::CMappedFile ()
+: Data ( 0 ), Size ( 0 )
+{
+	Handle[0] = 0;
+	Handle[1] = 0;
+}
+
+CMappedFile::~CMappedFile ()
+{
+#if defined(_IRR_WINDOWS_API_)
+	if ( Data )
+		UnmapViewOfFile ( Data );
+	if ( Handle[1] )
+		CloseHandle ( (HANDLE) Handle[1] );
+	if ( Handle[0] )
+		CloseHandle ( (HANDLE) Handle[0] );
+#else
+	if ( Data )
+		munmap ( (void*) Data, Size );
+#endif
+}
+
+bool CMappedFile::open ( const path &filename )
+{
+	FileName = filename;
+
+#if defined(_IRR_WINDOWS_API_)
+	HANDLE file = CreateFileA ( filename.c_str (), GENERIC_READ, FILE_SHARE_READ, 0,
+								OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_RANDOM_ACCESS, 0 );
+	if ( file == INVALID_HANDLE_VALUE )
+		return false;
+	Handle[0] = file;
+
+	Size = GetFileSize ( file, 0 );
+	if ( 0 == Size || Size == INVALID_FILE_SIZE )
+		return false;
+
+	HANDLE mapping = CreateFileMappingA ( file, 0, PAGE_READONLY, 0, 0, 0 );
+	if ( 0 == mapping )
+		return false;
+	Handle[1] = mapping;
+
+	Data = (const u8*) MapViewOfFile ( mapping, FILE_MAP_READ, 0, 0, 0 );
+#else
+	int fd = ::open ( filename.c_str (), O_RDONLY );
+	if ( fd < 0 )
+		return false;
+
+	struct stat info;
+	if ( fstat ( fd, &info ) != 0 || 0 == info.st_size )
+	{
+		close ( fd );
+		return false;
+	}
+	Size = (u32) info.st_size;
+
+	void *p = mmap ( 0, Size, PROT_READ, MAP_PRIVATE, fd, 0 );
+	close ( fd );
+	Data = p == MAP_FAILED ? 0 : (const u8*) p;
+#endif
+
+	return Data != 0;
+}
+
+
+/*
+	a stored entry. reads go straight from the mapping
+*/
+class CMappedReadFile : public IReadFile
+{
+public:
+	CMappedReadFile ( CMappedFile *file, const u8 *data, u32 size, const path &name )
+	: File ( file ), Data ( data ), Size ( size ), Pos ( 0 ), Name ( name )
+	{
+		File->grab ();
+	}
+
+	virtual ~CMappedReadFile () { File->drop (); }
+
+	virtual s32 read ( void* buffer, u32 sizeToRead )
+	{
+		const u32 n = core::min_ ( sizeToRead, Size - (u32) Pos );
+		memcpy ( buffer, Data + Pos, n );
+		Pos += n;
+		ArchiveStats.BytesViewed += n;
+		return n;
+	}
+
+	virtual bool seek ( long finalPos, bool relativeMovement = false )
+	{
+		const long p = relativeMovement ? Pos + finalPos : finalPos;
+		if ( p < 0 || p > (long) Size )
+			return false;
+		Pos = p;
+		return true;
+	}
+
+	virtual long getSize () const { return Size; }
+	virtual long getPos () const { return Pos; }
+	virtual const path& getFileName () const { return Name; }
+
+private:
+	CMappedFile *File;
+	const u8 *Data;
+	u32 Size;
+	long Pos;
+	path Name;
+};
+
+
+/*
+	a deflated entry. inflated on demand, seeking backwards restarts the stream
+*/
+class CInflateReadFile : public IReadFile
+{
+public:
+	CInflateReadFile ( CMappedFile *file, const u8 *data, u32 compressedSize, u32 size, const path &name )
+	: File ( file ), Data ( data ), CompressedSize ( compressedSize ), Size ( size ), Pos ( 0 ), Name ( name )
+	{
+		File->grab ();
+		Stream = new SInflateStream ();
+		Stream->init ( Data, CompressedSize );
+	}
+
+	virtual ~CInflateReadFile ()
+	{
+		delete Stream;
+		File->drop ();
+	}
+
+	virtual s32 read ( void* buffer, u32 sizeToRead )
+	{
+		const u32 n = Stream->read ( (u8*) buffer, core::min_ ( sizeToRead, Size - (u32) Pos ) );
+		Pos += n;
+		ArchiveStats.BytesInflated += n;
+		return n;
+	}
+
+	virtual bool seek ( long finalPos, bool relativeMovement = false )
+	{
+		const long p = relativeMovement ? Pos + finalPos : finalPos;
+		if ( p < 0 || p > (long) Size )
+			return false;
+
+		if ( p < Pos )
+		{
+			Stream->init ( Data, CompressedSize );
+			Pos = 0;
+		}
+
+		const u32 n = Stream->skip ( p - Pos );
+		ArchiveStats.BytesInflated += n;
+		Pos += n;
+		return Pos == p;
+	}
+
+	virtual long getSize () const { return Size; }
+	virtual long getPos () const { return Pos; }
+	virtual const path& getFileName () const { return Name; }
+
+private:
+	CMappedFile *File;
+	SInflateStream *Stream;
+	const u8 *Data;
+	u32 CompressedSize;
+	u32 Size;
+	long Pos;
+	path Name;
+};
+
+
+CMappedZipArchive::CMappedZipArchive ( CMappedFile *file, IFileList *list, bool ignoreCase, bool ignorePaths )
+: File ( file ), FileList ( list ), IgnoreCase ( ignoreCase ), IgnorePaths ( ignorePaths )
+{
+	File->grab ();
+}
+
+CMappedZipArchive::~CMappedZipArchive ()
+{
+	FileList->drop ();
+	File->drop ();
+}
+
+path CMappedZipArchive::normalize ( const path &filename ) const
+{
+	path name ( filename );
+	name.replace ( '\\', '/' );
+	if ( IgnorePaths )
+		deletePathFromFilename ( name );
+	if ( IgnoreCase )
+		name.make_lower ();
+	return name;
+}
+
+/*
+	find the end of central directory record and walk the directory.
+	only the directory pages of the mapping are touched
+*/
+bool CMappedZipArchive::scan ()
+{
+	const u8 *data = File->getData ();
+	const u32 size = File->getSize ();
+	if ( size < 22 )
+		return false;
+
+	// the record is at the end, followed by a comment of up to 64k
+	s32 eocd = -1;
+	const u32 stop = size > 65557 ? size - 65557 : 0;
+	for ( u32 p = size - 22 + 1; p-- > stop; )
+	{
+		if ( get32 ( data + p ) == 0x06054b50 )
+		{
+			eocd = p;
+			break;
+		}
+	}
+	if ( eocd < 0 )
+		return false;
+
+	const u32 count = get16 ( data + eocd + 10 );
+	const u32 dirSize = get32 ( data + eocd + 12 );
+	u32 pos = get32 ( data + eocd + 16 );
+	if ( pos + dirSize > size )
+		return false;
+
+	Entry.reallocate ( count );
+	Name.reallocate ( count );
+
+	for ( u32 i = 0; i != count; ++i )
+	{
+		if ( pos + 46 > size || get32 ( data + pos ) != 0x02014b50 )
+			return false;
+
+		const u8 *h = data + pos;
+		const u32 nameSize = get16 ( h + 28 );
+		const u32 extraSize = get16 ( h + 30 );
+		const u32 commentSize = get16 ( h + 32 );
+		if ( pos + 46 + nameSize > size )
+			return false;
+
+		path name;
+		name.append ( (const c8*) h + 46, nameSize );
+
+		SMappedZipEntry e;
+		e.Method = get16 ( h + 10 );
+		e.Crc = get32 ( h + 16 );
+		e.CompressedSize = get32 ( h + 20 );
+		e.Size = get32 ( h + 24 );
+		e.LocalOffset = get32 ( h + 42 );
+
+		const bool isDir = nameSize && name.lastChar () == '/';
+		FileList->addItem ( name, e.LocalOffset, e.Size, isDir, Entry.size () );
+
+		name = normalize ( name );
+		e.Hash = hashName ( name.c_str (), name.size () );
+		Entry.push_back ( e );
+		Name.push_back ( name );
+
+		pos += 46 + nameSize + extraSize + commentSize;
+	}
+
+	FileList->sort ();
+	buildIndex ();
+
+	ArchiveStats.BytesStaged += Entry.size () * sizeof ( SMappedZipEntry ) + Index.size () * sizeof ( u32 );
+	return true;
+}
+
+void CMappedZipArchive::buildIndex ()
+{
+	u32 capacity = 16;
+	while ( capacity < Entry.size () * 2 )
+		capacity <<= 1;
+
+	Index.set_used ( capacity );
+	memset ( Index.pointer (), 0, capacity * sizeof ( u32 ) );
+
+	for ( u32 i = 0; i != Entry.size (); ++i )
+	{
+		u32 slot = Entry[i].Hash & ( capacity - 1 );
+		while ( Index[slot] )
+			slot = ( slot + 1 ) & ( capacity - 1 );
+		Index[slot] = i + 1;
+	}
+}
+
+s32 CMappedZipArchive::findEntry ( const path &filename ) const
+{
+	if ( Index.empty () )
+		return -1;
+
+	const path name = normalize ( filename );
+	const u32 hash = hashName ( name.c_str (), name.size () );
+	const u32 mask = Index.size () - 1;
+
+	for ( u32 slot = hash & mask; Index[slot]; slot = ( slot + 1 ) & mask )
+	{
+		const u32 i = Index[slot] - 1;
+		if ( Entry[i].Hash == hash && Name[i] == name )
+			return i;
+	}
+	return -1;
+}
+
+const u8 * CMappedZipArchive::getEntryData ( u32 index )
+{
+	const SMappedZipEntry &e = Entry[index];
+	const u8 *data = File->getData ();
+	const u32 size = File->getSize ();
+
+	if ( e.LocalOffset + 30 > size || get32 ( data + e.LocalOffset ) != 0x04034b50 )
+		return 0;
+
+	const u32 start = e.LocalOffset + 30 + get16 ( data + e.LocalOffset + 26 ) + get16 ( data + e.LocalOffset + 28 );
+	if ( start + e.CompressedSize > size )
+		return 0;
+
+	return data + start;
+}
+
+IReadFile* CMappedZipArchive::createAndOpenFile ( const path& filename )
+{
+	const s32 index = findEntry ( filename );
+	if ( index < 0 )
+		return 0;
+
+	const SMappedZipEntry &e = Entry[index];
+	if ( Name[index].lastChar () == '/' )
+		return 0;
+
+	const u8 *data = getEntryData ( index );
+	if ( 0 == data )
+		return 0;
+
+	ArchiveStats.FilesOpened += 1;
+
+	switch ( e.Method )
+	{
+		case 0:
+			return new CMappedReadFile ( File, data, e.Size, filename );
+		case 8:
+		{
+			// inflated ahead of time by the prefetcher?
+			IReadFile *staged = getArchivePrefetcher ()->take ( this, index, filename );
+			if ( staged )
+				return staged;
+			return new CInflateReadFile ( File, data, e.CompressedSize, e.Size, filename );
+		}
+	}
+
+	// other methods are not used by quake3 archives
+	return 0;
+}
+
+IReadFile* CMappedZipArchive::createAndOpenFile ( u32 index )
+{
+	if ( index >= FileList->getFileCount () )
+		return 0;
+
+	return createAndOpenFile ( FileList->getFullFileName ( index ) );
+}
+
+
+CArchiveLoaderMappedZip::CArchiveLoaderMappedZip ( IFileSystem *fs )
+: FileSystem ( fs )
+{
+}
+
+bool CArchiveLoaderMappedZip::isALoadableFileFormat ( const path& filename ) const
+{
+	return hasFileExtension ( filename, "zip", "pk3" );
+}
+
+bool CArchiveLoaderMappedZip::isALoadableFileFormat ( IReadFile* file ) const
+{
+	u8 sig[4];
+	file->seek ( 0 );
+	const bool ok = file->read ( sig, 4 ) == 4 && get32 ( sig ) == 0x04034b50;
+	file->seek ( 0 );
+	return ok;
+}
+
+bool CArchiveLoaderMappedZip::isALoadableFileFormat ( E_FILE_ARCHIVE_TYPE fileType ) const
+{
+	return fileType == EFAT_ZIP;
+}
+
+IFileArchive* CArchiveLoaderMappedZip::createArchive ( const path& filename, bool ignoreCase, bool ignorePaths ) const
+{
+	CMappedFile *file = new CMappedFile ();
+	CMappedZipArchive *archive = 0;
+
+	if ( file->open ( filename ) )
+	{
+		archive = new CMappedZipArchive ( file,
+			FileSystem->createEmptyFileList ( filename, ignoreCase, ignorePaths ),
+			ignoreCase, ignorePaths );
+
+		if ( !archive->scan () )
+		{
+			archive->drop ();
+			archive = 0;
+		}
+	}
+
+	file->drop ();
+	return archive;
+}
+
+IFileArchive* CArchiveLoaderMappedZip::createArchive ( IReadFile* file, bool ignoreCase, bool ignorePaths ) const
+{
+	// only native files can be mapped, anything else goes to the builtin loader
+	return createArchive ( file->getFileName (), ignoreCase, ignorePaths );
+}
@@ -0,0 +1,114 @@
+/*!
+	Mapped Zip Archive.
+	IFileArchive for .zip / .pk3 working on a memory mapped file
+
+	The central directory is parsed once into a hashed index.
+	Stored entries are handed out as views into the mapping,
+	deflated entries are inflated while they are read, with
+	only the 32k window held in memory.
+*/
+#ifndef __QUAKE3_MAPPEDZIP__H_INCLUDED__
+#define __QUAKE3_MAPPEDZIP__H_INCLUDED__
+
+#include <irrlicht.h>
+
+using namespace irr;
+
+//! read only memory mapping of a native file
+class CMappedFile : public IReferenceCounted
+{
+public:
+	CMappedFile ();
+	virtual ~CMappedFile ();
+
+	bool open ( const io::path &filename );
+
+	const u8 * getData () const { return Data; }
+	u32 getSize () const { return Size; }
+	const io::path & getFileName () const { return FileName; }
+
+private:
+	const u8 *Data;
+	u32 Size;
+	io::path FileName;
+	void *Handle[2];
+};
+
+//! counters for the archive benchmark
+struct SArchiveStats
+{
+	u32 FilesOpened;
+	u32 BytesViewed;		// served straight from the mapping
+	u32 BytesInflated;		// produced by the streaming inflater
+	u32 BytesStaged;		// heap copies ( entry buffers, directory )
+};
+
+SArchiveStats & getArchiveStats ();
+
+struct SMappedZipEntry
+{
+	u32 Hash;
+	u32 LocalOffset;	// local file header, data follows it
+	u32 CompressedSize;
+	u32 Size;
+	u32 Crc;
+	u16 Method;			// 0 stored, 8 deflate
+};
+
+class CMappedZipArchive : public io::IFileArchive
+{
+public:
+	CMappedZipArchive ( CMappedFile *file, io::IFileList *list, bool ignoreCase, bool ignorePaths );
+	virtual ~CMappedZipArchive ();
+
+	//! parse the central directory, false if it is not a zip
+	bool scan ();
+
+	virtual io::IReadFile* createAndOpenFile ( const io::path& filename );
+	virtual io::IReadFile* createAndOpenFile ( u32 index );
+	virtual const io::IFileList* getFileList () const { return FileList; }
+	virtual io::E_FILE_ARCHIVE_TYPE getType () const { return io::EFAT_ZIP; }
+
+	//! entry index by name, -1 if missing. O(1)
+	s32 findEntry ( const io::path &filename ) const;
+
+	u32 getEntryCount () const { return Entry.size (); }
+	const SMappedZipEntry & getEntry ( u32 index ) const { return Entry[index]; }
+	const io::path & getEntryName ( u32 index ) const { return Name[index]; }
+
+	//! start of the entry data inside the mapping ( compressed for deflate )
+	const u8 * getEntryData ( u32 index );
+
+	CMappedFile * getMappedFile () const { return File; }
+
+private:
+	io::path normalize ( const io::path &filename ) const;
+	void buildIndex ();
+
+	CMappedFile *File;
+	io::IFileList *FileList;
+	bool IgnoreCase;
+	bool IgnorePaths;
+
+	core::array < SMappedZipEntry > Entry;
+	core::array < io::path > Name;
+	core::array < u32 > Index;		// open addressing, entry + 1, 0 = empty
+};
+
+//! archive loader, prefered over the builtin zip loader once added
+class CArchiveLoaderMappedZip : public io::IArchiveLoader
+{
+public:
+	CArchiveLoaderMappedZip ( io::IFileSystem *fs );
+
+	virtual bool isALoadableFileFormat ( const io::path& filename ) const;
+	virtual bool isALoadableFileFormat ( io::IReadFile* file ) const;
+	virtual bool isALoadableFileFormat ( io::E_FILE_ARCHIVE_TYPE fileType ) const;
+	virtual io::IFileArchive* createArchive ( const io::path& filename, bool ignoreCase, bool ignorePaths ) const;
+	virtual io::IFileArchive* createArchive ( io::IReadFile* file, bool ignoreCase, bool ignorePaths ) const;
+
+private:
+	io::IFileSystem *FileSystem;
+};
+
+#endif // __QUAKE3_MAPPEDZIP__H_INCLUDED__
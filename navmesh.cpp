@@ -0,0 +1,861 @@
+/*!
+	Navigation Mesh.
+	walkable cells of the voxelized collision map, a* on the workers
+*/
+
+#include "navmesh.h"
+#include "q3collision.h"
+#include "worker.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <float.h>
+
+#if defined(_IRR_WINDOWS_API_)
+	#include <direct.h>
+	#define q3_mkdir(x) _mkdir(x)
+#else
+	#include <sys/stat.h>
+	#define q3_mkdir(x) mkdir(x, 0755)
+#endif
+
+using namespace core;
+
+//! cache file layout: magic, key, origin, cell size, step, width, depth, node count, columns, nodes
+static const u32 NAVMESH_MAGIC = 0x3156414E; // "NAV1"
+
+static const u32 NO_SPAN = 0xFFFFFFFF;
+static const u32 MAX_EXPAND = 1 << 18;		// a* gives up after this many nodes
+static const s32 MAX_SNAP = 3;				// cells findNode looks around
+
+// 4 straight directions first, a diagonal needs both of its straight neighbours
+static const s32 DirX[8] = { 1, 0, -1, 0, 1, -1, -1, 1 };
+static const s32 DirZ[8] = { 0, 1, 0, -1, 1, 1, -1, -1 };
+static const u32 DiagA[8] = { 0, 0, 0, 0, 0, 2, 2, 0 };	// straight parts of a diagonal
+static const u32 DiagB[8] = { 0, 0, 0, 0, 1, 1, 3, 3 };
+
+static inline u32 dirOf ( s32 dx, s32 dz )
+{
+	for ( u32 d = 0; d != 8; ++d )
+		if ( DirX[d] == dx && DirZ[d] == dz )
+			return d;
+	return 0;
+}
+
+SNavParam::SNavParam ()
+: CellSize ( 16.f ), AgentRadius ( 30.f ), AgentHeight ( 90.f ), StepHeight ( 18.f ), MaxSlope ( 45.f )
+{
+}
+
+CNavMesh::CNavMesh ()
+: CellSize ( 16.f ), StepHeight ( 18.f ), Width ( 0 ), Depth ( 0 )
+{
+}
+
+void CNavMesh::clear ()
+{
+	Column.clear ();
+	Node.clear ();
+	Width = 0;
+	Depth = 0;
+}
+
+
+/*
+	heightfield, one sorted list of solid spans per column
+*/
+struct SNavSpan
+{
+	f32 Min;
+	f32 Max;
+	u32 Next;
+	u32 Walkable;
+};
+
+struct SHeightfield
+{
+	array < SNavSpan > Pool;
+	array < u32 > Head;
+	u32 Free;
+	f32 MergeFlags;		// tops this close share the walkable flag
+
+	SHeightfield () : Free ( NO_SPAN ), MergeFlags ( 1.f ) {}
+
+	void add ( u32 column, f32 min, f32 max, u32 walkable )
+	{
+		u32 prev = NO_SPAN;
+		u32 cur = Head[column];
+		while ( cur != NO_SPAN )
+		{
+			SNavSpan &s = Pool[cur];
+			if ( s.Min > max )
+				break;
+			if ( s.Max < min )
+			{
+				prev = cur;
+				cur = s.Next;
+				continue;
+			}
+
+			// overlap, the higher top decides if it can be stood on
+			min = core::min_ ( min, s.Min );
+			if ( fabsf ( s.Max - max ) <= MergeFlags )
+				walkable |= s.Walkable;
+			else if ( s.Max > max )
+				walkable = s.Walkable;
+			max = core::max_ ( max, s.Max );
+
+			const u32 next = s.Next;
+			if ( prev == NO_SPAN )
+				Head[column] = next;
+			else
+				Pool[prev].Next = next;
+			s.Next = Free;
+			Free = cur;
+			cur = next;
+		}
+
+		u32 n;
+		if ( Free != NO_SPAN )
+		{
+			n = Free;
+			Free = Pool[n].Next;
+		}
+		else
+		{
+			n = Pool.size ();
+			Pool.push_back ( SNavSpan () );
+		}
+
+		SNavSpan &s = Pool[n];
+		s.Min = min;
+		s.Max = max;
+		s.Walkable = walkable;
+		if ( prev == NO_SPAN )
+		{
+			s.Next = Head[column];
+			Head[column] = n;
+		}
+		else
+		{
+			s.Next = Pool[prev].Next;
+			Pool[prev].Next = n;
+		}
+	}
+};
+
+// splits a convex polygon at v along axis ( 0 x, 2 z ) into the part below and above
+static void splitPoly ( const vector3df *in, u32 n, vector3df *below, u32 &nb, vector3df *above, u32 &na, f32 v, u32 axis )
+{
+	nb = 0;
+	na = 0;
+	for ( u32 i = 0, j = n - 1; i != n; j = i, ++i )
+	{
+		const f32 da = v - ( axis ? in[j].Z : in[j].X );
+		const f32 db = v - ( axis ? in[i].Z : in[i].X );
+		if ( ( da >= 0.f ) != ( db >= 0.f ) )
+		{
+			const vector3df p = in[j] + ( in[i] - in[j] ) * ( da / ( da - db ) );
+			below [ nb++ ] = p;
+			above [ na++ ] = p;
+		}
+		if ( db > 0.f )
+			below [ nb++ ] = in[i];
+		else if ( db < 0.f )
+			above [ na++ ] = in[i];
+		else
+		{
+			below [ nb++ ] = in[i];
+			above [ na++ ] = in[i];
+		}
+	}
+}
+
+/*
+	clip the triangle to every cell it covers, the y range of the
+	clipped piece is the span. surfaces are two sided, a ceiling with
+	open space above becomes an island nobody can reach
+*/
+static void rasterize ( SHeightfield &hf, const triangle3df &t, const vector3df &origin, f32 cs,
+						u32 width, u32 depth, u32 walkable )
+{
+	aabbox3df box ( t.pointA );
+	box.addInternalPoint ( t.pointB );
+	box.addInternalPoint ( t.pointC );
+
+	const s32 x0 = core::s32_clamp ( (s32) floorf ( ( box.MinEdge.X - origin.X ) / cs ), 0, width - 1 );
+	const s32 x1 = core::s32_clamp ( (s32) floorf ( ( box.MaxEdge.X - origin.X ) / cs ), 0, width - 1 );
+	const s32 z0 = core::s32_clamp ( (s32) floorf ( ( box.MinEdge.Z - origin.Z ) / cs ), 0, depth - 1 );
+	const s32 z1 = core::s32_clamp ( (s32) floorf ( ( box.MaxEdge.Z - origin.Z ) / cs ), 0, depth - 1 );
+
+	// a triangle clipped by four cell edges has at most seven corners
+	vector3df inBuf[12];
+	vector3df remBuf[12];
+	vector3df rowBuf[12];
+	vector3df tmpBuf[12];
+	vector3df cell[12];
+
+	vector3df *rest = inBuf;
+	vector3df *rem = remBuf;
+	u32 nRest = 3;
+	rest[0] = t.pointA;
+	rest[1] = t.pointB;
+	rest[2] = t.pointC;
+
+	for ( s32 z = z0; z <= z1; ++z )
+	{
+		vector3df *row = rowBuf;
+		vector3df *rowRest = tmpBuf;
+		u32 nRow;
+		u32 nRem;
+		splitPoly ( rest, nRest, row, nRow, rem, nRem, origin.Z + ( z + 1 ) * cs, 2 );
+		core::swap ( rest, rem );
+		nRest = nRem;
+		if ( nRow < 3 )
+			continue;
+
+		for ( s32 x = x0; x <= x1; ++x )
+		{
+			u32 n;
+			u32 nRowRest;
+			splitPoly ( row, nRow, cell, n, rowRest, nRowRest, origin.X + ( x + 1 ) * cs, 0 );
+			core::swap ( row, rowRest );
+			nRow = nRowRest;
+			if ( n < 3 )
+				continue;
+
+			f32 lo = cell[0].Y;
+			f32 hi = cell[0].Y;
+			for ( u32 i = 1; i != n; ++i )
+			{
+				lo = core::min_ ( lo, cell[i].Y );
+				hi = core::max_ ( hi, cell[i].Y );
+			}
+			hf.add ( x + z * width, lo, hi, walkable );
+		}
+	}
+}
+
+void CNavMesh::build ( const SCollisionMap &map, const SNavParam &param )
+{
+	clear ();
+
+	const u32 triangles = map.getTriangleCount ();
+	if ( 0 == triangles )
+		return;
+
+	CellSize = param.CellSize;
+	StepHeight = param.StepHeight;
+	const f32 cs = CellSize;
+
+	aabbox3df bounds ( map.Vertex[0] );
+	for ( u32 i = 1; i != map.Vertex.size (); ++i )
+		bounds.addInternalPoint ( map.Vertex[i] );
+
+	Origin = bounds.MinEdge - vector3df ( cs, 0.f, cs );
+	Width = core::min_ ( (u32) ( ( bounds.MaxEdge.X - Origin.X ) / cs ) + 2, 65535u );
+	Depth = core::min_ ( (u32) ( ( bounds.MaxEdge.Z - Origin.Z ) / cs ) + 2, 65535u );
+	const u32 columns = Width * Depth;
+
+	SHeightfield hf;
+	hf.Head.set_used ( columns );
+	for ( u32 i = 0; i != columns; ++i )
+		hf.Head[i] = NO_SPAN;
+	hf.Pool.reallocate ( columns * 2 );
+
+	const f32 minWalkY = cosf ( param.MaxSlope * core::DEGTORAD );
+	for ( u32 i = 0; i != triangles; ++i )
+	{
+		const triangle3df t (	map.Vertex [ map.Index [ i * 3 + 0 ] ],
+								map.Vertex [ map.Index [ i * 3 + 1 ] ],
+								map.Vertex [ map.Index [ i * 3 + 2 ] ] );
+		vector3df n = t.getNormal ();
+		const f32 len = n.getLength ();
+		if ( len <= 0.f )
+			continue;
+		rasterize ( hf, t, Origin, cs, Width, Depth, fabsf ( n.Y ) / len >= minWalkY ? 1 : 0 );
+	}
+
+	// open tops with headroom become nodes, in column order
+	array < vector3df > pos;
+	array < f32 > ceiling;
+	array < u32 > column;
+	column.set_used ( columns + 1 );
+	for ( u32 c = 0; c != columns; ++c )
+	{
+		column[c] = pos.size ();
+		for ( u32 s = hf.Head[c]; s != NO_SPAN; s = hf.Pool[s].Next )
+		{
+			const SNavSpan &span = hf.Pool[s];
+			const f32 top = span.Next != NO_SPAN ? hf.Pool [ span.Next ].Min : FLT_MAX;
+			if ( span.Walkable && top - span.Max >= param.AgentHeight )
+			{
+				pos.push_back ( vector3df ( (f32) ( c % Width ), span.Max, (f32) ( c / Width ) ) );
+				ceiling.push_back ( top );
+			}
+		}
+	}
+	column[columns] = pos.size ();
+
+	const u32 count = pos.size ();
+	array < s32 > link;
+	link.set_used ( count * 8 );
+
+	for ( u32 n = 0; n != count; ++n )
+	{
+		const s32 x = (s32) pos[n].X;
+		const s32 z = (s32) pos[n].Z;
+		for ( u32 d = 0; d != 8; ++d )
+		{
+			s32 &l = link [ n * 8 + d ];
+			l = -1;
+			if ( d >= 4 && ( link [ n * 8 + DiagA[d] ] < 0 || link [ n * 8 + DiagB[d] ] < 0 ) )
+				continue;
+
+			const s32 nx = x + DirX[d];
+			const s32 nz = z + DirZ[d];
+			if ( nx < 0 || nz < 0 || nx >= (s32) Width || nz >= (s32) Depth )
+				continue;
+
+			const u32 c = nx + nz * Width;
+			for ( u32 m = column[c]; m != column [ c + 1 ]; ++m )
+			{
+				if ( fabsf ( pos[m].Y - pos[n].Y ) <= StepHeight &&
+					core::min_ ( ceiling[m], ceiling[n] ) - core::max_ ( pos[m].Y, pos[n].Y ) >= param.AgentHeight )
+				{
+					l = m;
+					break;
+				}
+			}
+		}
+	}
+
+	// distance in cells to the nearest node missing a straight neighbour
+	array < u32 > dist;
+	array < u32 > queue;
+	dist.set_used ( count );
+	queue.reallocate ( count );
+	for ( u32 n = 0; n != count; ++n )
+	{
+		const bool edge = link [ n * 8 + 0 ] < 0 || link [ n * 8 + 1 ] < 0 || link [ n * 8 + 2 ] < 0 || link [ n * 8 + 3 ] < 0;
+		dist[n] = edge ? 0 : 0xFFFFFFFF;
+		if ( edge )
+			queue.push_back ( n );
+	}
+	for ( u32 q = 0; q != queue.size (); ++q )
+	{
+		const u32 n = queue[q];
+		for ( u32 d = 0; d != 4; ++d )
+		{
+			const s32 m = link [ n * 8 + d ];
+			if ( m >= 0 && dist[m] == 0xFFFFFFFF )
+			{
+				dist[m] = dist[n] + 1;
+				queue.push_back ( m );
+			}
+		}
+	}
+
+	// keep the nodes the ellipsoid fits on
+	const u32 erode = (u32) core::max_ ( ceilf ( ( param.AgentRadius - cs * 0.5f ) / cs ), 0.f );
+	array < s32 > remap;
+	remap.set_used ( count );
+	u32 kept = 0;
+	for ( u32 n = 0; n != count; ++n )
+		remap[n] = dist[n] >= erode ? (s32) kept++ : -1;
+
+	Node.set_used ( kept );
+	Column.set_used ( columns + 1 );
+	for ( u32 c = 0; c != columns; ++c )
+	{
+		u32 first = 0;
+		while ( column[c] + first != column [ c + 1 ] && remap [ column[c] + first ] < 0 )
+			first += 1;
+		Column[c] = column[c] + first != column [ c + 1 ] ? remap [ column[c] + first ] : 0xFFFFFFFF;
+	}
+	Column[columns] = kept;
+	for ( u32 c = columns; c-- != 0; )
+	{
+		if ( Column[c] == 0xFFFFFFFF )
+			Column[c] = Column [ c + 1 ];
+	}
+
+	for ( u32 n = 0; n != count; ++n )
+	{
+		if ( remap[n] < 0 )
+			continue;
+
+		SNode &node = Node [ remap[n] ];
+		node.X = (u16) pos[n].X;
+		node.Z = (u16) pos[n].Z;
+		node.Y = (s16) core::s32_clamp ( (s32) floorf ( pos[n].Y + 0.5f ), -32768, 32767 );
+		node.Clearance = (u8) core::min_ ( dist[n], 255u );
+		node.Links = 0;
+		for ( u32 d = 0; d != 8; ++d )
+		{
+			const s32 m = link [ n * 8 + d ];
+			if ( m >= 0 && remap[m] >= 0 )
+				node.Links |= 1 << d;
+		}
+	}
+
+	// a diagonal whose straight neighbours got eroded would cut a corner
+	for ( u32 n = 0; n != kept; ++n )
+	{
+		SNode &node = Node[n];
+		for ( u32 d = 4; d != 8; ++d )
+		{
+			if ( ( node.Links & ( 1 << DiagA[d] ) ) == 0 || ( node.Links & ( 1 << DiagB[d] ) ) == 0 )
+				node.Links &= ~( 1 << d );
+		}
+	}
+}
+
+s32 CNavMesh::neighbour ( u32 node, u32 dir ) const
+{
+	const SNode &n = Node[node];
+	if ( 0 == ( n.Links & ( 1 << dir ) ) )
+		return -1;
+
+	const u32 c = ( n.X + DirX[dir] ) + ( n.Z + DirZ[dir] ) * Width;
+	for ( u32 m = Column[c]; m != Column [ c + 1 ]; ++m )
+	{
+		if ( core::abs_ ( Node[m].Y - n.Y ) <= StepHeight + 1.f )
+			return m;
+	}
+	return -1;
+}
+
+vector3df CNavMesh::getNodePosition ( u32 node ) const
+{
+	const SNode &n = Node[node];
+	return vector3df ( Origin.X + ( n.X + 0.5f ) * CellSize, n.Y, Origin.Z + ( n.Z + 0.5f ) * CellSize );
+}
+
+u32 CNavMesh::getLinkCount () const
+{
+	u32 links = 0;
+	for ( u32 n = 0; n != Node.size (); ++n )
+	{
+		for ( u32 b = Node[n].Links; b; b &= b - 1 )
+			links += 1;
+	}
+	return links;
+}
+
+s32 CNavMesh::findNode ( const vector3df &feet ) const
+{
+	if ( Node.empty () )
+		return -1;
+
+	const s32 cx = (s32) floorf ( ( feet.X - Origin.X ) / CellSize );
+	const s32 cz = (s32) floorf ( ( feet.Z - Origin.Z ) / CellSize );
+
+	// the highest floor not above the feet, in the nearest ring that has one
+	for ( s32 r = 0; r <= MAX_SNAP; ++r )
+	{
+		s32 best = -1;
+		for ( s32 z = cz - r; z <= cz + r; ++z )
+		for ( s32 x = cx - r; x <= cx + r; ++x )
+		{
+			if ( core::abs_ ( x - cx ) != r && core::abs_ ( z - cz ) != r )
+				continue;
+			if ( x < 0 || z < 0 || x >= (s32) Width || z >= (s32) Depth )
+				continue;
+
+			const u32 c = x + z * Width;
+			for ( u32 m = Column[c]; m != Column [ c + 1 ]; ++m )
+			{
+				if ( Node[m].Y <= feet.Y + StepHeight && ( best < 0 || Node[m].Y > Node[best].Y ) )
+					best = m;
+			}
+		}
+		if ( best >= 0 )
+			return best;
+	}
+	return -1;
+}
+
+// grid line from node to node, every step has to follow a link
+bool CNavMesh::walkable ( u32 from, u32 to ) const
+{
+	s32 x = Node[from].X;
+	s32 z = Node[from].Z;
+	const s32 tx = Node[to].X;
+	const s32 tz = Node[to].Z;
+	const s32 dx = core::abs_ ( tx - x );
+	const s32 dz = core::abs_ ( tz - z );
+	const s32 sx = tx > x ? 1 : -1;
+	const s32 sz = tz > z ? 1 : -1;
+	s32 err = dx - dz;
+
+	s32 cur = from;
+	while ( x != tx || z != tz )
+	{
+		const s32 e2 = 2 * err;
+		s32 mx = 0;
+		s32 mz = 0;
+		if ( e2 > -dz )
+		{
+			err -= dz;
+			mx = sx;
+		}
+		if ( e2 < dx )
+		{
+			err += dx;
+			mz = sz;
+		}
+		x += mx;
+		z += mz;
+
+		cur = neighbour ( cur, dirOf ( mx, mz ) );
+		if ( cur < 0 )
+			return false;
+	}
+	return cur == (s32) to;
+}
+
+// octile distance in cells, a lower bound of any path
+static inline f32 octile ( s32 dx, s32 dz, f32 cs )
+{
+	dx = core::abs_ ( dx );
+	dz = core::abs_ ( dz );
+	return cs * ( core::max_ ( dx, dz ) + 0.41421356f * core::min_ ( dx, dz ) );
+}
+
+static inline u64 openKey ( f32 f, u32 node )
+{
+	u32 bits;
+	memcpy ( &bits, &f, 4 );
+	return ( (u64) bits << 32 ) | node;
+}
+
+static void heapPush ( array < u64 > &heap, u64 key )
+{
+	heap.push_back ( key );
+	u32 i = heap.size () - 1;
+	while ( i )
+	{
+		const u32 parent = ( i - 1 ) / 2;
+		if ( heap[parent] <= key )
+			break;
+		heap[i] = heap[parent];
+		i = parent;
+	}
+	heap[i] = key;
+}
+
+static u64 heapPop ( array < u64 > &heap )
+{
+	const u64 top = heap[0];
+	const u64 last = heap.getLast ();
+	heap.erase ( heap.size () - 1 );
+	const u32 size = heap.size ();
+	if ( 0 == size )
+		return top;
+
+	u32 i = 0;
+	for ( ;; )
+	{
+		u32 child = i * 2 + 1;
+		if ( child >= size )
+			break;
+		if ( child + 1 < size && heap [ child + 1 ] < heap[child] )
+			child += 1;
+		if ( last <= heap[child] )
+			break;
+		heap[i] = heap[child];
+		i = child;
+	}
+	heap[i] = last;
+	return top;
+}
+
+bool CNavMesh::findPath ( const vector3df &from, const vector3df &to, array < vector3df > &path, SNavSearch &search ) const
+{
+	path.set_used ( 0 );
+	const s32 start = findNode ( from );
+	const s32 goal = findNode ( to );
+	if ( start < 0 || goal < 0 )
+		return false;
+
+	if ( start == goal )
+	{
+		path.push_back ( getNodePosition ( goal ) );
+		return true;
+	}
+
+	const u32 count = Node.size ();
+	if ( search.Cost.size () != count || 0 == ++search.Generation )
+	{
+		search.Cost.set_used ( count );
+		search.Parent.set_used ( count );
+		search.Visit.set_used ( count );
+		search.Closed.set_used ( count );
+		memset ( search.Visit.pointer (), 0, count * sizeof ( u32 ) );
+		memset ( search.Closed.pointer (), 0, count * sizeof ( u32 ) );
+		search.Generation = 1;
+	}
+	const u32 gen = search.Generation;
+	search.Open.set_used ( 0 );
+
+	const s32 gx = Node[goal].X;
+	const s32 gz = Node[goal].Z;
+	const f32 cs = CellSize;
+
+	search.Cost[start] = 0.f;
+	search.Parent[start] = start;
+	search.Visit[start] = gen;
+	heapPush ( search.Open, openKey ( octile ( Node[start].X - gx, Node[start].Z - gz, cs ), start ) );
+
+	bool found = false;
+	u32 expanded = 0;
+	while ( search.Open.size () )
+	{
+		const u32 n = (u32) heapPop ( search.Open );
+		if ( search.Closed[n] == gen )
+			continue;
+		search.Closed[n] = gen;
+
+		if ( n == (u32) goal )
+		{
+			found = true;
+			break;
+		}
+		if ( ++expanded > MAX_EXPAND )
+			break;
+
+		for ( u32 d = 0; d != 8; ++d )
+		{
+			const s32 m = neighbour ( n, d );
+			if ( m < 0 || search.Closed[m] == gen )
+				continue;
+
+			const f32 step = ( d < 4 ? cs : cs * 1.41421356f ) + fabsf ( (f32) ( Node[m].Y - Node[n].Y ) );
+			const f32 cost = search.Cost[n] + step;
+			if ( search.Visit[m] != gen || cost < search.Cost[m] )
+			{
+				search.Visit[m] = gen;
+				search.Cost[m] = cost;
+				search.Parent[m] = n;
+				heapPush ( search.Open, openKey ( cost + octile ( Node[m].X - gx, Node[m].Z - gz, cs ), m ) );
+			}
+		}
+	}
+
+	if ( !found )
+		return false;
+
+	array < u32 > &trail = search.Trail;
+	trail.set_used ( 0 );
+	for ( u32 n = goal; n != (u32) start; n = search.Parent[n] )
+		trail.push_back ( n );
+	trail.push_back ( start );
+
+	// string pulling, a corner is where the straight line stops being walkable
+	u32 anchor = start;
+	for ( s32 i = (s32) trail.size () - 2; i > 0; --i )
+	{
+		if ( !walkable ( anchor, trail [ i - 1 ] ) )
+		{
+			anchor = trail[i];
+			path.push_back ( getNodePosition ( anchor ) );
+		}
+	}
+	path.push_back ( getNodePosition ( goal ) );
+	return true;
+}
+
+
+static u64 fnv1a ( u64 hash, const void *data, u32 size )
+{
+	const u8 *p = (const u8*) data;
+	for ( u32 i = 0; i != size; ++i )
+	{
+		hash ^= p[i];
+		hash *= 0x100000001B3ULL;
+	}
+	return hash;
+}
+
+u64 CNavMesh::getKey ( const SCollisionMap &map, const SNavParam &param )
+{
+	u64 hash = 0xCBF29CE484222325ULL;
+	hash = fnv1a ( hash, &NAVMESH_MAGIC, sizeof ( NAVMESH_MAGIC ) );
+	hash = fnv1a ( hash, &param.CellSize, sizeof ( f32 ) );
+	hash = fnv1a ( hash, &param.AgentRadius, sizeof ( f32 ) );
+	hash = fnv1a ( hash, &param.AgentHeight, sizeof ( f32 ) );
+	hash = fnv1a ( hash, &param.StepHeight, sizeof ( f32 ) );
+	hash = fnv1a ( hash, &param.MaxSlope, sizeof ( f32 ) );
+	hash = fnv1a ( hash, map.Vertex.const_pointer (), map.Vertex.size () * sizeof ( vector3df ) );
+	hash = fnv1a ( hash, map.Index.const_pointer (), map.Index.size () * sizeof ( u32 ) );
+	return hash;
+}
+
+bool CNavMesh::save ( const io::path &file, u64 key ) const
+{
+	io::path dir ( file );
+	const s32 slash = core::max_ ( dir.findLast ( '/' ), dir.findLast ( '\\' ) );
+	if ( slash > 0 )
+		q3_mkdir ( dir.subString ( 0, slash ).c_str () );
+
+	FILE *f = fopen ( file.c_str (), "wb" );
+	if ( 0 == f )
+		return false;
+
+	const u32 nodes = Node.size ();
+	bool ok =	fwrite ( &NAVMESH_MAGIC, 4, 1, f ) == 1 &&
+				fwrite ( &key, 8, 1, f ) == 1 &&
+				fwrite ( &Origin, sizeof ( vector3df ), 1, f ) == 1 &&
+				fwrite ( &CellSize, 4, 1, f ) == 1 &&
+				fwrite ( &StepHeight, 4, 1, f ) == 1 &&
+				fwrite ( &Width, 4, 1, f ) == 1 &&
+				fwrite ( &Depth, 4, 1, f ) == 1 &&
+				fwrite ( &nodes, 4, 1, f ) == 1;
+	if ( ok && Column.size () )
+		ok = fwrite ( Column.const_pointer (), Column.size () * sizeof ( u32 ), 1, f ) == 1;
+	if ( ok && nodes )
+		ok = fwrite ( Node.const_pointer (), nodes * sizeof ( SNode ), 1, f ) == 1;
+
+	fclose ( f );
+	return ok;
+}
+
+bool CNavMesh::load ( const io::path &file, u64 key )
+{
+	clear ();
+
+	FILE *f = fopen ( file.c_str (), "rb" );
+	if ( 0 == f )
+		return false;
+
+	u32 magic = 0;
+	u64 fileKey = 0;
+	u32 nodes = 0;
+	bool ok =	fread ( &magic, 4, 1, f ) == 1 && magic == NAVMESH_MAGIC &&
+				fread ( &fileKey, 8, 1, f ) == 1 && fileKey == key &&
+				fread ( &Origin, sizeof ( vector3df ), 1, f ) == 1 &&
+				fread ( &CellSize, 4, 1, f ) == 1 &&
+				fread ( &StepHeight, 4, 1, f ) == 1 &&
+				fread ( &Width, 4, 1, f ) == 1 &&
+				fread ( &Depth, 4, 1, f ) == 1 &&
+				fread ( &nodes, 4, 1, f ) == 1 &&
+				Width <= 65535 && Depth <= 65535;
+
+	if ( ok )
+	{
+		Column.set_used ( Width * Depth + 1 );
+		Node.set_used ( nodes );
+		ok = fread ( Column.pointer (), Column.size () * sizeof ( u32 ), 1, f ) == 1 &&
+			( 0 == nodes || fread ( Node.pointer (), nodes * sizeof ( SNode ), 1, f ) == 1 ) &&
+			Column.getLast () == nodes;
+	}
+
+	fclose ( f );
+	if ( !ok )
+		clear ();
+	return ok;
+}
+
+u32 CNavMesh::getMemoryFootprint () const
+{
+	return Column.allocated_size () * sizeof ( u32 ) + Node.allocated_size () * sizeof ( SNode );
+}
+
+
+CNavQuery::CNavQuery ()
+: Mesh ( 0 ), NextTicket ( 1 ), Pending ( 0 )
+{
+}
+
+CNavQuery::~CNavQuery ()
+{
+	wait ();
+	for ( u32 i = 0; i != Search.size (); ++i )
+		delete Search[i];
+}
+
+void CNavQuery::wait ()
+{
+	std::unique_lock < std::mutex > guard ( Lock );
+	while ( Pending )
+		Done.wait ( guard );
+}
+
+void CNavQuery::setMesh ( const CNavMesh *mesh )
+{
+	wait ();
+	Mesh = mesh;
+	Finished.clear ();
+	Ready.clear ();
+}
+
+u32 CNavQuery::request ( const vector3df &from, const vector3df &to )
+{
+	if ( 0 == Mesh )
+		return 0;
+
+	const u32 ticket = NextTicket++;
+	if ( 0 == NextTicket )
+		NextTicket = 1;
+
+	{
+		std::lock_guard < std::mutex > guard ( Lock );
+		Pending += 1;
+	}
+
+	CNavQuery *self = this;
+	getWorkerPool ()->push ( [self, ticket, from, to] ()
+	{
+		self->run ( ticket, from, to );
+	} );
+	return ticket;
+}
+
+// runs on a worker
+void CNavQuery::run ( u32 ticket, const vector3df &from, const vector3df &to )
+{
+	SNavSearch *search = 0;
+	{
+		std::lock_guard < std::mutex > guard ( Lock );
+		if ( Search.size () )
+		{
+			search = Search.getLast ();
+			Search.erase ( Search.size () - 1 );
+		}
+	}
+	if ( 0 == search )
+		search = new SNavSearch ();
+
+	SResult result;
+	result.Ticket = ticket;
+	Mesh->findPath ( from, to, result.Path, *search );
+
+	std::lock_guard < std::mutex > guard ( Lock );
+	Search.push_back ( search );
+	Finished.push_back ( result );
+	if ( 0 == --Pending )
+		Done.notify_all ();
+}
+
+void CNavQuery::update ()
+{
+	Ready.clear ();
+
+	std::lock_guard < std::mutex > guard ( Lock );
+	Ready.swap ( Finished );
+}
+
+bool CNavQuery::poll ( u32 ticket, array < vector3df > &path )
+{
+	for ( u32 i = 0; i != Ready.size (); ++i )
+	{
+		if ( Ready[i].Ticket == ticket )
+		{
+			path.swap ( Ready[i].Path );
+			Ready[i].Ticket = 0;
+			return true;
+		}
+	}
+	return false;
+}
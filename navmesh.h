@@ -0,0 +1,144 @@
+/*!
+	Navigation Mesh.
+	walkable cells of the voxelized collision map, a* on the workers
+
+	The collision triangles are rasterized into columns of solid spans.
+	The top of a walkable span with room for a standing player above is
+	a node, nodes link to the eight neighbour columns when the step
+	between them is climbable. Nodes closer to a wall or ledge than the
+	player radius are dropped, so a path keeps the ellipsoid free. The
+	result is eight bytes per node and is cached on disk, keyed by the
+	geometry it was built from.
+*/
+#ifndef __QUAKE3_NAVMESH__H_INCLUDED__
+#define __QUAKE3_NAVMESH__H_INCLUDED__
+
+#include <irrlicht.h>
+#include <mutex>
+#include <condition_variable>
+
+using namespace irr;
+
+struct SCollisionMap;
+
+//! player sized by default
+struct SNavParam
+{
+	SNavParam ();
+
+	f32 CellSize;
+	f32 AgentRadius;
+	f32 AgentHeight;
+	f32 StepHeight;
+	f32 MaxSlope;		// degrees
+};
+
+//! scratch of one search, reused between queries
+struct SNavSearch
+{
+	SNavSearch () : Generation ( 0 ) {}
+
+	core::array < f32 > Cost;
+	core::array < u32 > Parent;
+	core::array < u32 > Visit;		// generation the node was reached in
+	core::array < u32 > Closed;		// generation the node was expanded in
+	core::array < u64 > Open;		// binary heap, f bits high, node low
+	core::array < u32 > Trail;
+	u32 Generation;
+};
+
+class CNavMesh
+{
+public:
+	CNavMesh ();
+
+	void build ( const SCollisionMap &map, const SNavParam &param = SNavParam () );
+	void clear ();
+
+	//! hash of the geometry and the parameters. a cache file with another key is stale
+	static u64 getKey ( const SCollisionMap &map, const SNavParam &param = SNavParam () );
+	bool save ( const io::path &file, u64 key ) const;
+	bool load ( const io::path &file, u64 key );
+
+	//! node of the floor under feet, -1 if there is none near
+	s32 findNode ( const core::vector3df &feet ) const;
+
+	//! a* between the floors under from and to. the corners of the path, the start is left out
+	bool findPath ( const core::vector3df &from, const core::vector3df &to,
+					core::array < core::vector3df > &path, SNavSearch &search ) const;
+
+	core::vector3df getNodePosition ( u32 node ) const;
+	u32 getNodeCount () const { return Node.size (); }
+	u32 getLinkCount () const;
+
+	//! heap bytes held by the arrays
+	u32 getMemoryFootprint () const;
+
+private:
+	struct SNode
+	{
+		u16 X;
+		u16 Z;
+		s16 Y;				// floor height, whole units
+		u8 Links;			// bit per direction
+		u8 Clearance;		// cells to the nearest wall or ledge
+	};
+
+	s32 neighbour ( u32 node, u32 dir ) const;
+	bool walkable ( u32 from, u32 to ) const;
+
+	core::vector3df Origin;
+	f32 CellSize;
+	f32 StepHeight;
+	u32 Width;
+	u32 Depth;
+	core::array < u32 > Column;		// nodes of column x + z * Width are Column[c] .. Column[c+1]
+	core::array < SNode > Node;
+};
+
+/*!
+	path requests run on the worker pool. update () once per tick hands
+	out what finished since the last tick, a result not polled in that
+	tick is dropped
+*/
+class CNavQuery
+{
+public:
+	CNavQuery ();
+	~CNavQuery ();
+
+	//! waits for the running searches
+	void setMesh ( const CNavMesh *mesh );
+	const CNavMesh * getMesh () const { return Mesh; }
+
+	//! ticket of the request, 0 if there is no mesh
+	u32 request ( const core::vector3df &from, const core::vector3df &to );
+
+	void update ();
+
+	//! true once the search is done, path is empty if there is no way
+	bool poll ( u32 ticket, core::array < core::vector3df > &path );
+
+	//! blocks until all requests are done
+	void wait ();
+
+private:
+	struct SResult
+	{
+		u32 Ticket;
+		core::array < core::vector3df > Path;
+	};
+
+	void run ( u32 ticket, const core::vector3df &from, const core::vector3df &to );
+
+	const CNavMesh *Mesh;
+	u32 NextTicket;
+	u32 Pending;
+	core::array < SResult > Finished;	// by the workers, under Lock
+	core::array < SResult > Ready;		// main thread
+	core::array < SNavSearch* > Search;	// free scratch, under Lock
+	std::mutex Lock;
+	std::condition_variable Done;
+};
+
+#endif // __QUAKE3_NAVMESH__H_INCLUDED__
@@ -0,0 +1,442 @@
+/*!
+	Occlusion Culler.
+	software depth buffer of the big map triangles, boxes are tested against it
+*/
+
+#include "occlusion.h"
+#include "profile.h"
+#include "compactmesh.h"
+
+#include <math.h>
+#include <string.h>
+
+#if defined(_M_IX86) || defined(_M_X64) || defined(__SSE2__)
+#define OCCLUSION_SSE2
+#include <emmintrin.h>
+#endif
+
+using namespace core;
+using namespace scene;
+using namespace video;
+
+static const u32 MAX_OCCLUDERS = 2048;
+static const f32 MIN_OCCLUDER_AREA = 4096.f;	// a 64 x 128 unit wall half
+static const f32 GUARD_BAND = 2.f;				// clip space x and y are clipped at this multiple of w
+
+//! triangle of the map geometry, the biggest become occluders
+struct SOccluderCandidate
+{
+	f32 Area;
+	u32 First;		// into the vertex list
+
+	bool operator< ( const SOccluderCandidate &o ) const
+	{
+		if ( Area != o.Area ) return Area > o.Area;
+		return First < o.First;
+	}
+};
+
+COcclusionCuller::COcclusionCuller ()
+: Ready ( false )
+{
+	memset ( &Stats, 0, sizeof ( Stats ) );
+	Depth.set_used ( WIDTH * HEIGHT );
+	TileMax.set_used ( TILES_X * TILES_Y );
+}
+
+void COcclusionCuller::clear ()
+{
+	Vertex.clear ();
+	Bounds.clear ();
+	Mask.clear ();
+	memset ( &Stats, 0, sizeof ( Stats ) );
+	Ready = false;
+}
+
+u32 COcclusionCuller::setOccluders ( const CCompactMesh &mesh )
+{
+	clear ();
+
+	array < vector3df > position;
+	array < SOccluderCandidate > candidate;
+
+	for ( u32 b = 0; b != mesh.getBufferCount (); ++b )
+	{
+		const SCompactBuffer &buffer = mesh.getBuffer ( b );
+		if ( buffer.Transparent )
+			continue;
+
+		const SCompactVertex *vertex = mesh.getVertices ( buffer );
+		const u16 *index = mesh.getIndices ( buffer );
+		for ( u32 i = 0; i + 2 < buffer.IndexCount; i += 3 )
+		{
+			const vector3df a = CCompactMesh::getPosition ( buffer, vertex[index[i]] );
+			const vector3df c = CCompactMesh::getPosition ( buffer, vertex[index[i + 1]] );
+			const vector3df d = CCompactMesh::getPosition ( buffer, vertex[index[i + 2]] );
+
+			SOccluderCandidate t;
+			t.Area = ( c - a ).crossProduct ( d - a ).getLength () * 0.5f;
+			if ( t.Area < MIN_OCCLUDER_AREA )
+				continue;
+
+			t.First = position.size ();
+			position.push_back ( a );
+			position.push_back ( c );
+			position.push_back ( d );
+			candidate.push_back ( t );
+		}
+	}
+
+	candidate.sort ();
+
+	const u32 count = core::min_ ( candidate.size (), MAX_OCCLUDERS );
+	Vertex.reallocate ( count * 3 );
+	for ( u32 i = 0; i != count; ++i )
+	{
+		const vector3df *v = position.const_pointer () + candidate[i].First;
+		aabbox3df box ( v[0] );
+		box.addInternalPoint ( v[1] );
+		box.addInternalPoint ( v[2] );
+
+		Vertex.push_back ( v[0] );
+		Vertex.push_back ( v[1] );
+		Vertex.push_back ( v[2] );
+		Bounds.add ( box );
+	}
+
+	Stats.Occluders = count;
+	return count;
+}
+
+void COcclusionCuller::getStats ( SOcclusionStats &stats, bool reset )
+{
+	stats = Stats;
+	if ( reset )
+	{
+		const u32 occluders = Stats.Occluders;
+		memset ( &Stats, 0, sizeof ( Stats ) );
+		Stats.Occluders = occluders;
+	}
+}
+
+void COcclusionCuller::render ( const matrix4 &viewProjection )
+{
+	SScopeTimer timer ( Stats.RasterMicro );
+
+	ViewProjection = viewProjection;
+	for ( u32 i = 0; i != WIDTH * HEIGHT; ++i )
+		Depth[i] = 1.f;
+
+	Bounds.cull ( SViewFrustum ( viewProjection ), Mask );
+
+	for ( u32 w = 0; w != Mask.size (); ++w )
+	{
+		for ( u32 bits = Mask[w]; bits; bits &= bits - 1 )
+		{
+			u32 bit = 0;
+			while ( 0 == ( bits >> bit & 1 ) )
+				bit += 1;
+
+			const vector3df *v = Vertex.const_pointer () + ( w * 32 + bit ) * 3;
+			f32 clip[3][4];
+			for ( u32 k = 0; k != 3; ++k )
+				viewProjection.transformVect ( clip[k], v[k] );
+
+			drawClipped ( clip );
+			Stats.Rasterized += 1;
+		}
+	}
+
+	buildTiles ();
+	Stats.Frames += 1;
+	Ready = true;
+}
+
+/*
+	distance of a clip space point to one of the clip planes, positive inside.
+	near z >= 0 like the direct3d depth range irrlicht projects to, then the
+	guard band around the screen so the edge functions keep their precision
+*/
+static inline f32 clipDistance ( const f32 *p, u32 plane )
+{
+	switch ( plane )
+	{
+		case 0: return p[2];
+		case 1: return GUARD_BAND * p[3] - p[0];
+		case 2: return GUARD_BAND * p[3] + p[0];
+		case 3: return GUARD_BAND * p[3] - p[1];
+		default: return GUARD_BAND * p[3] + p[1];
+	}
+}
+
+void COcclusionCuller::drawClipped ( const f32 clip[3][4] )
+{
+	// a triangle clipped by 5 planes has at most 8 corners
+	f32 poly[2][8][4];
+	u32 count = 3;
+	memcpy ( poly[0], clip, sizeof ( f32 ) * 12 );
+
+	u32 in = 0;
+	for ( u32 plane = 0; plane != 5; ++plane )
+	{
+		u32 inside = 0;
+		for ( u32 i = 0; i != count; ++i )
+			inside += clipDistance ( poly[in][i], plane ) >= 0.f ? 1 : 0;
+
+		if ( 0 == inside )
+			return;
+		if ( inside == count )
+			continue;
+
+		const u32 out = in ^ 1;
+		u32 n = 0;
+		for ( u32 i = 0; i != count; ++i )
+		{
+			const f32 *a = poly[in][i];
+			const f32 *b = poly[in][ ( i + 1 ) % count ];
+			const f32 da = clipDistance ( a, plane );
+			const f32 db = clipDistance ( b, plane );
+
+			if ( da >= 0.f )
+				memcpy ( poly[out][n++], a, sizeof ( f32 ) * 4 );
+
+			if ( ( da >= 0.f ) != ( db >= 0.f ) )
+			{
+				const f32 t = da / ( da - db );
+				for ( u32 c = 0; c != 4; ++c )
+					poly[out][n][c] = a[c] + ( b[c] - a[c] ) * t;
+				n += 1;
+			}
+		}
+		count = n;
+		in = out;
+	}
+
+	SScreenVertex s[8];
+	for ( u32 i = 0; i != count; ++i )
+	{
+		const f32 *p = poly[in][i];
+		const f32 iw = 1.f / p[3];
+		s[i].X = ( p[0] * iw * 0.5f + 0.5f ) * WIDTH;
+		s[i].Y = ( 0.5f - p[1] * iw * 0.5f ) * HEIGHT;
+		s[i].Z = p[2] * iw;
+	}
+
+	for ( u32 i = 2; i < count; ++i )
+	{
+		const SScreenVertex fan[3] = { s[0], s[i - 1], s[i] };
+		drawTriangle ( fan );
+	}
+}
+
+/*
+	edge functions are positive inside, a pixel is covered when its center
+	is. centers on an edge belong to both triangles, so the seams between
+	the triangles of a wall stay closed. the plane depth is moved back to
+	the farthest corner of the pixel
+*/
+void COcclusionCuller::drawTriangle ( const SScreenVertex *tri )
+{
+	SScreenVertex v[3] = { tri[0], tri[1], tri[2] };
+
+	f32 area = ( v[1].X - v[0].X ) * ( v[2].Y - v[0].Y ) - ( v[2].X - v[0].X ) * ( v[1].Y - v[0].Y );
+	if ( area < 0.f )
+	{
+		const SScreenVertex t = v[1];
+		v[1] = v[2];
+		v[2] = t;
+		area = -area;
+	}
+
+	if ( area <= 0.f )
+		return;
+
+	// the pixels whose center may be inside
+	const s32 x0 = core::max_ ( 0, (s32) floorf ( core::min_ ( v[0].X, v[1].X, v[2].X ) ) );
+	const s32 x1 = core::min_ ( (s32) WIDTH - 1, (s32) floorf ( core::max_ ( v[0].X, v[1].X, v[2].X ) ) );
+	const s32 y0 = core::max_ ( 0, (s32) floorf ( core::min_ ( v[0].Y, v[1].Y, v[2].Y ) ) );
+	const s32 y1 = core::min_ ( (s32) HEIGHT - 1, (s32) floorf ( core::max_ ( v[0].Y, v[1].Y, v[2].Y ) ) );
+	if ( x0 > x1 || y0 > y1 )
+		return;
+
+	f32 A[3], B[3], C[3];
+	for ( u32 e = 0; e != 3; ++e )
+	{
+		const SScreenVertex &a = v[e];
+		const SScreenVertex &b = v[ ( e + 1 ) % 3 ];
+		A[e] = a.Y - b.Y;
+		B[e] = b.X - a.X;
+		C[e] = - ( A[e] * a.X + B[e] * a.Y );
+	}
+
+	const f32 inv = 1.f / area;
+	const f32 dzdx = ( ( v[1].Z - v[0].Z ) * ( v[2].Y - v[0].Y ) - ( v[2].Z - v[0].Z ) * ( v[1].Y - v[0].Y ) ) * inv;
+	const f32 dzdy = ( ( v[2].Z - v[0].Z ) * ( v[1].X - v[0].X ) - ( v[1].Z - v[0].Z ) * ( v[2].X - v[0].X ) ) * inv;
+	const f32 dz = v[0].Z - dzdx * v[0].X - dzdy * v[0].Y + 0.5f * ( fabsf ( dzdx ) + fabsf ( dzdy ) );
+
+#ifdef OCCLUSION_SSE2
+	// whole groups of 4, the row is a multiple of 4 wide
+	const s32 xs = x0 & ~3;
+	const __m128 offset = _mm_set_ps ( 3.5f, 2.5f, 1.5f, 0.5f );
+	const __m128 zero = _mm_setzero_ps ();
+	const __m128 a0 = _mm_set1_ps ( A[0] ), a1 = _mm_set1_ps ( A[1] ), a2 = _mm_set1_ps ( A[2] ), az = _mm_set1_ps ( dzdx );
+	const __m128 s0 = _mm_set1_ps ( A[0] * 4.f ), s1 = _mm_set1_ps ( A[1] * 4.f ), s2 = _mm_set1_ps ( A[2] * 4.f ), sz = _mm_set1_ps ( dzdx * 4.f );
+	const __m128 px = _mm_add_ps ( _mm_set1_ps ( (f32) xs ), offset );
+
+	for ( s32 y = y0; y <= y1; ++y )
+	{
+		const f32 py = y + 0.5f;
+		__m128 e0 = _mm_add_ps ( _mm_mul_ps ( a0, px ), _mm_set1_ps ( B[0] * py + C[0] ) );
+		__m128 e1 = _mm_add_ps ( _mm_mul_ps ( a1, px ), _mm_set1_ps ( B[1] * py + C[1] ) );
+		__m128 e2 = _mm_add_ps ( _mm_mul_ps ( a2, px ), _mm_set1_ps ( B[2] * py + C[2] ) );
+		__m128 z = _mm_add_ps ( _mm_mul_ps ( az, px ), _mm_set1_ps ( dzdy * py + dz ) );
+
+		f32 *row = Depth.pointer () + y * WIDTH;
+		for ( s32 x = xs; x <= x1; x += 4 )
+		{
+			const __m128 covered = _mm_and_ps ( _mm_and_ps ( _mm_cmpge_ps ( e0, zero ), _mm_cmpge_ps ( e1, zero ) ),
+										_mm_cmpge_ps ( e2, zero ) );
+			const __m128 depth = _mm_loadu_ps ( row + x );
+			const __m128 nearer = _mm_min_ps ( depth, z );
+			_mm_storeu_ps ( row + x, _mm_or_ps ( _mm_and_ps ( covered, nearer ), _mm_andnot_ps ( covered, depth ) ) );
+
+			e0 = _mm_add_ps ( e0, s0 );
+			e1 = _mm_add_ps ( e1, s1 );
+			e2 = _mm_add_ps ( e2, s2 );
+			z = _mm_add_ps ( z, sz );
+		}
+	}
+#else
+	for ( s32 y = y0; y <= y1; ++y )
+	{
+		const f32 py = y + 0.5f;
+		f32 *row = Depth.pointer () + y * WIDTH;
+		for ( s32 x = x0; x <= x1; ++x )
+		{
+			const f32 px = x + 0.5f;
+			if ( A[0] * px + B[0] * py + C[0] >= 0.f &&
+				A[1] * px + B[1] * py + C[1] >= 0.f &&
+				A[2] * px + B[2] * py + C[2] >= 0.f )
+			{
+				const f32 z = dzdx * px + dzdy * py + dz;
+				if ( z < row[x] )
+					row[x] = z;
+			}
+		}
+	}
+#endif
+}
+
+void COcclusionCuller::buildTiles ()
+{
+	for ( u32 ty = 0; ty != TILES_Y; ++ty )
+	{
+		for ( u32 tx = 0; tx != TILES_X; ++tx )
+		{
+			f32 farthest = 0.f;
+			for ( u32 y = 0; y != TILE; ++y )
+			{
+				const f32 *row = Depth.const_pointer () + ( ty * TILE + y ) * WIDTH + tx * TILE;
+				for ( u32 x = 0; x != TILE; ++x )
+					farthest = core::max_ ( farthest, row[x] );
+			}
+			TileMax[ty * TILES_X + tx] = farthest;
+		}
+	}
+}
+
+bool COcclusionCuller::isVisible ( const aabbox3df &box ) const
+{
+	if ( !Ready )
+		return true;
+
+	f32 minX = (f32) WIDTH, maxX = 0.f, minY = (f32) HEIGHT, maxY = 0.f, minZ = 1.f;
+	for ( u32 i = 0; i != 8; ++i )
+	{
+		const vector3df corner ( i & 1 ? box.MaxEdge.X : box.MinEdge.X,
+								i & 2 ? box.MaxEdge.Y : box.MinEdge.Y,
+								i & 4 ? box.MaxEdge.Z : box.MinEdge.Z );
+		f32 p[4];
+		ViewProjection.transformVect ( p, corner );
+
+		// in front of the near plane or behind the eye
+		if ( p[3] <= 0.f || p[2] < 0.f )
+			return true;
+
+		const f32 iw = 1.f / p[3];
+		const f32 x = ( p[0] * iw * 0.5f + 0.5f ) * WIDTH;
+		const f32 y = ( 0.5f - p[1] * iw * 0.5f ) * HEIGHT;
+		minX = core::min_ ( minX, x );
+		maxX = core::max_ ( maxX, x );
+		minY = core::min_ ( minY, y );
+		maxY = core::max_ ( maxY, y );
+		minZ = core::min_ ( minZ, p[2] * iw );
+	}
+
+	// off screen is left to the frustum test
+	if ( maxX < 0.f || minX >= WIDTH || maxY < 0.f || minY >= HEIGHT )
+		return true;
+
+	/*
+		every pixel the rectangle touches and one more around it. a pixel
+		at the silhouette of an occluder is written when its center is
+		covered, a box behind its uncovered part also touches a neighbour
+		whose center is not
+	*/
+	const s32 x0 = core::max_ ( 0, (s32) floorf ( minX ) - 1 );
+	const s32 x1 = core::min_ ( (s32) WIDTH - 1, (s32) floorf ( maxX ) + 1 );
+	const s32 y0 = core::max_ ( 0, (s32) floorf ( minY ) - 1 );
+	const s32 y1 = core::min_ ( (s32) HEIGHT - 1, (s32) floorf ( maxY ) + 1 );
+
+	for ( s32 ty = y0 / TILE; ty <= y1 / TILE; ++ty )
+	{
+		for ( s32 tx = x0 / TILE; tx <= x1 / TILE; ++tx )
+		{
+			if ( minZ > TileMax[ty * TILES_X + tx] )
+				continue;
+
+			const s32 px0 = core::max_ ( x0, tx * TILE ), px1 = core::min_ ( x1, tx * TILE + TILE - 1 );
+			const s32 py0 = core::max_ ( y0, ty * TILE ), py1 = core::min_ ( y1, ty * TILE + TILE - 1 );
+			for ( s32 y = py0; y <= py1; ++y )
+			{
+				const f32 *row = Depth.const_pointer () + y * WIDTH;
+				for ( s32 x = px0; x <= px1; ++x )
+				{
+					if ( minZ <= row[x] )
+						return true;
+				}
+			}
+		}
+	}
+	return false;
+}
+
+u32 COcclusionCuller::cull ( const CBoxCuller &boxes, array < u32 > &mask )
+{
+	if ( !Ready )
+		return 0;
+
+	SScopeTimer timer ( Stats.TestMicro );
+
+	u32 occluded = 0;
+	const u32 words = core::min_ ( mask.size (), ( boxes.size () + 31 ) >> 5 );
+	for ( u32 w = 0; w != words; ++w )
+	{
+		for ( u32 bits = mask[w]; bits; bits &= bits - 1 )
+		{
+			u32 bit = 0;
+			while ( 0 == ( bits >> bit & 1 ) )
+				bit += 1;
+
+			Stats.Tests += 1;
+			if ( !isVisible ( boxes.getBox ( w * 32 + bit ) ) )
+			{
+				mask[w] &= ~( 1u << bit );
+				occluded += 1;
+			}
+		}
+	}
+
+	Stats.Occluded += occluded;
+	return occluded;
+}
@@ -0,0 +1,98 @@
+/*!
+	Occlusion Culler.
+	software depth buffer of the big map triangles, boxes are tested against it
+
+	The biggest opaque triangles of the map geometry are taken as occluders
+	when the map is loaded. Each frame the occluders inside the frustum are
+	rasterized into a small depth buffer, four pixels at once with SSE2,
+	with the farthest depth of the triangle over each pixel. The farthest
+	depth of every tile of 8x8 pixels is kept as a second level. A box is
+	occluded when the nearest point of its screen rectangle is behind every
+	pixel it touches and the pixels around them, so a box showing in a part
+	of a pixel the occluders do not cover stays visible. Most boxes are
+	decided by the tiles alone.
+
+	Boxes crossing the near plane are always visible. Nothing is occluded
+	before the first frame is rendered.
+*/
+#ifndef __QUAKE3_OCCLUSION__H_INCLUDED__
+#define __QUAKE3_OCCLUSION__H_INCLUDED__
+
+#include <irrlicht.h>
+#include "boxcull.h"
+
+using namespace irr;
+
+class CCompactMesh;
+
+//! counters since the last read
+struct SOcclusionStats
+{
+	u32 Frames;			// rendered depth buffers
+	u32 Occluders;		// triangles selected at load
+	u32 Rasterized;		// occluder triangles drawn, all frames
+	u32 Tests;			// boxes tested
+	u32 Occluded;		// of those, hidden
+	u64 RasterMicro;
+	u64 TestMicro;
+};
+
+class COcclusionCuller
+{
+public:
+	COcclusionCuller ();
+
+	void clear ();
+
+	//! the biggest opaque triangles of the map geometry, returns the number taken
+	u32 setOccluders ( const CCompactMesh &mesh );
+	u32 getOccluderCount () const { return Vertex.size () / 3; }
+
+	//! rasterize the occluders seen through projection * view
+	void render ( const core::matrix4 &viewProjection );
+
+	//! a depth buffer of this frame exists
+	bool isReady () const { return Ready; }
+
+	//! false if the box is behind the occluders
+	bool isVisible ( const core::aabbox3df &box ) const;
+
+	/*!
+		tests the boxes whose bit is set, the bits of occluded boxes are
+		cleared. returns the number of occluded boxes
+	*/
+	u32 cull ( const CBoxCuller &boxes, core::array < u32 > &mask );
+
+	void getStats ( SOcclusionStats &stats, bool reset = true );
+
+private:
+	enum
+	{
+		WIDTH = 256,
+		HEIGHT = 128,
+		TILE = 8,
+		TILES_X = WIDTH / TILE,
+		TILES_Y = HEIGHT / TILE
+	};
+
+	//! screen position in pixels and depth z/w
+	struct SScreenVertex
+	{
+		f32 X, Y, Z;
+	};
+
+	void drawTriangle ( const SScreenVertex *v );
+	void drawClipped ( const f32 clip[3][4] );
+	void buildTiles ();
+
+	core::array < core::vector3df > Vertex;		// 3 per occluder
+	CBoxCuller Bounds;							// box per occluder
+	core::array < u32 > Mask;
+	core::array < f32 > Depth;					// WIDTH * HEIGHT, rows top down
+	core::array < f32 > TileMax;				// farthest depth per tile
+	core::matrix4 ViewProjection;
+	SOcclusionStats Stats;
+	bool Ready;
+};
+
+#endif // __QUAKE3_OCCLUSION__H_INCLUDED__
@@ -0,0 +1,344 @@
+/*!
+	Archive Prefetcher.
+	inflates the entries a map load will touch on the worker pool
+*/
+
+#include "prefetch.h"
+#include "mappedzip.h"
+#include "inflate.h"
+#include "crc32.h"
+#include "worker.h"
+
+using namespace core;
+using namespace io;
+
+/*
+	a staged entry. owns the inflated bytes and gives the budget back on drop
+*/
+class CStagedReadFile : public IReadFile
+{
+public:
+	CStagedReadFile ( CArchivePrefetcher *owner, u8 *data, u32 size, const path &name )
+	: Owner ( owner ), Data ( data ), Size ( size ), Pos ( 0 ), Name ( name ) {}
+
+	virtual ~CStagedReadFile ()
+	{
+		delete [] Data;
+		Owner->release ( Size );
+	}
+
+	virtual s32 read ( void* buffer, u32 sizeToRead )
+	{
+		const u32 n = core::min_ ( sizeToRead, Size - (u32) Pos );
+		memcpy ( buffer, Data + Pos, n );
+		Pos += n;
+		return n;
+	}
+
+	virtual bool seek ( long finalPos, bool relativeMovement = false )
+	{
+		const long p = relativeMovement ? Pos + finalPos : finalPos;
+		if ( p < 0 || p > (long) Size )
+			return false;
+		Pos = p;
+		return true;
+	}
+
+	virtual long getSize () const { return Size; }
+	virtual long getPos () const { return Pos; }
+	virtual const path& getFileName () const { return Name; }
+
+private:
+	CArchivePrefetcher *Owner;
+	u8 *Data;
+	u32 Size;
+	long Pos;
+	path Name;
+};
+
+
+CArchivePrefetcher::CArchivePrefetcher ( u32 memoryCap )
+: Next ( 0 ), Staged ( 0 ), Running ( 0 ), MemoryCap ( memoryCap )
+{
+	memset ( &Stats, 0, sizeof ( Stats ) );
+}
+
+CArchivePrefetcher::~CArchivePrefetcher ()
+{
+	clear ();
+}
+
+/*
+	the bsp goes first, its shader lump queues the textures once it is inflated.
+	loadAllShaders parses every script, so all of them are queued
+*/
+u32 CArchivePrefetcher::prefetchMap ( IFileSystem *fs, const path &mapName )
+{
+	const u32 before = Request.size ();
+
+	for ( u32 i = 0; i != fs->getFileArchiveCount (); ++i )
+	{
+		CMappedZipArchive *archive = dynamic_cast < CMappedZipArchive* > ( fs->getFileArchive ( i ) );
+		if ( 0 == archive )
+			continue;
+
+		const s32 bsp = archive->findEntry ( mapName );
+		if ( bsp < 0 )
+			continue;
+
+		add ( archive, bsp, true );
+
+		for ( u32 e = 0; e != archive->getEntryCount (); ++e )
+		{
+			const path &name = archive->getEntryName ( e );
+			if ( name.find ( "scripts/" ) >= 0 && hasFileExtension ( name, "shader" ) )
+				add ( archive, e, false );
+		}
+	}
+
+	std::lock_guard < std::mutex > lock ( Lock );
+	pump ();
+	return Request.size () - before;
+}
+
+void CArchivePrefetcher::prefetch ( CMappedZipArchive *archive, u32 entry )
+{
+	add ( archive, entry, false );
+
+	std::lock_guard < std::mutex > lock ( Lock );
+	pump ();
+}
+
+// stored entries are views already, only deflated entries are worth staging
+void CArchivePrefetcher::add ( CMappedZipArchive *archive, u32 entry, bool parseTextures )
+{
+	if ( archive->getEntry ( entry ).Method != 8 )
+		return;
+
+	std::lock_guard < std::mutex > lock ( Lock );
+	for ( u32 i = 0; i != Request.size (); ++i )
+	{
+		if ( Request[i].Archive == archive && Request[i].Entry == entry )
+			return;
+	}
+
+	SRequest r;
+	r.Archive = archive;
+	r.Entry = entry;
+	r.Data = 0;
+	r.State = REQ_WAITING;
+	r.ParseTextures = parseTextures;
+
+	archive->grab ();
+	Request.push_back ( r );
+	Stats.Queued += 1;
+}
+
+// start jobs in queue order until the memory cap is reached. Lock is held
+void CArchivePrefetcher::pump ()
+{
+	while ( Next < Request.size () )
+	{
+		SRequest &r = Request[Next];
+		if ( r.State != REQ_WAITING )
+		{
+			Next += 1;
+			continue;
+		}
+
+		const u32 size = r.Archive->getEntry ( r.Entry ).Size;
+		if ( size > MemoryCap )
+		{
+			r.State = REQ_DONE;
+			Next += 1;
+			continue;
+		}
+
+		if ( Staged + size > MemoryCap )
+		{
+			Stats.CapStalls += 1;
+			break;
+		}
+
+		Staged += size;
+		Stats.PeakStaged = core::max_ ( Stats.PeakStaged, Staged );
+		r.State = REQ_INFLATING;
+		Running += 1;
+
+		const u32 index = Next;
+		CArchivePrefetcher *self = this;
+		getWorkerPool ()->push ( [self, index] () { self->run ( index ); } );
+		Next += 1;
+	}
+}
+
+// runs on a worker
+void CArchivePrefetcher::run ( u32 index )
+{
+	CMappedZipArchive *archive;
+	u32 entry;
+	bool parseTextures;
+	{
+		std::lock_guard < std::mutex > lock ( Lock );
+		archive = Request[index].Archive;
+		entry = Request[index].Entry;
+		parseTextures = Request[index].ParseTextures;
+	}
+
+	const SMappedZipEntry &e = archive->getEntry ( entry );
+	const u8 *source = archive->getEntryData ( entry );
+
+	u8 *data = new u8 [ e.Size ];
+	bool ok = source && inflateBuffer ( data, e.Size, source, e.CompressedSize );
+	bool crcError = ok && crc32 ( 0, data, e.Size ) != e.Crc;
+
+	if ( ok && !crcError && parseTextures )
+		addBspTextures ( archive, data, e.Size );
+
+	std::lock_guard < std::mutex > lock ( Lock );
+	SRequest &r = Request[index];
+	Running -= 1;
+
+	if ( ok && !crcError && r.State == REQ_INFLATING )
+	{
+		r.Data = data;
+		r.State = REQ_READY;
+		Stats.Inflated += 1;
+	}
+	else
+	{
+		// the loader falls back to streaming from the archive
+		delete [] data;
+		r.State = REQ_DONE;
+		Staged -= e.Size;
+		if ( crcError )
+			Stats.CrcErrors += 1;
+	}
+
+	Ready.notify_all ();
+	pump ();
+}
+
+/*
+	quake3 bsp: lump 1 holds 72 byte shader records, name[64] flags contents.
+	shaders without script are plain textures with an implicit extension
+*/
+void CArchivePrefetcher::addBspTextures ( CMappedZipArchive *archive, const u8 *bsp, u32 size )
+{
+	if ( size < 8 + 17 * 8 || memcmp ( bsp, "IBSP", 4 ) )
+		return;
+
+	u32 offset;
+	u32 length;
+	memcpy ( &offset, bsp + 8 + 1 * 8, 4 );
+	memcpy ( &length, bsp + 8 + 1 * 8 + 4, 4 );
+	if ( offset + length > size )
+		return;
+
+	static const c8 * extension[] = { ".jpg", ".tga" };
+
+	for ( u32 i = 0; i + 72 <= length; i += 72 )
+	{
+		c8 name[65];
+		memcpy ( name, bsp + offset + i, 64 );
+		name[64] = 0;
+
+		for ( u32 x = 0; x != 2; ++x )
+		{
+			const s32 entry = archive->findEntry ( path ( name ) + extension[x] );
+			if ( entry >= 0 )
+			{
+				add ( archive, entry, false );
+				break;
+			}
+		}
+	}
+}
+
+IReadFile * CArchivePrefetcher::take ( CMappedZipArchive *archive, u32 entry, const path &name )
+{
+	std::unique_lock < std::mutex > lock ( Lock );
+
+	for ( u32 i = 0; i != Request.size (); ++i )
+	{
+		if ( Request[i].Archive != archive || Request[i].Entry != entry )
+			continue;
+
+		if ( Request[i].State == REQ_WAITING )
+		{
+			// not started yet, the loader is faster streaming it itself
+			Request[i].State = REQ_DONE;
+			Stats.Misses += 1;
+			return 0;
+		}
+
+		while ( Request[i].State == REQ_INFLATING )
+			Ready.wait ( lock );
+
+		if ( Request[i].State != REQ_READY )
+			return 0;
+
+		Request[i].State = REQ_DONE;
+		u8 *data = Request[i].Data;
+		Request[i].Data = 0;
+		Stats.Hits += 1;
+
+		return new CStagedReadFile ( this, data, archive->getEntry ( entry ).Size, name );
+	}
+	return 0;
+}
+
+void CArchivePrefetcher::release ( u32 bytes )
+{
+	std::lock_guard < std::mutex > lock ( Lock );
+	Staged -= bytes;
+	pump ();
+}
+
+void CArchivePrefetcher::clear ()
+{
+	std::unique_lock < std::mutex > lock ( Lock );
+
+	// nothing new gets started
+	for ( u32 i = Next; i < Request.size (); ++i )
+	{
+		if ( Request[i].State == REQ_WAITING )
+			Request[i].State = REQ_DONE;
+	}
+	while ( Running )
+		Ready.wait ( lock );
+
+	for ( u32 i = 0; i != Request.size (); ++i )
+	{
+		if ( Request[i].Data )
+		{
+			Staged -= Request[i].Archive->getEntry ( Request[i].Entry ).Size;
+			delete [] Request[i].Data;
+		}
+		Request[i].Archive->drop ();
+	}
+	Request.clear ();
+	Next = 0;
+}
+
+SPrefetchStats CArchivePrefetcher::getStats ()
+{
+	std::lock_guard < std::mutex > lock ( Lock );
+	return Stats;
+}
+
+
+static CArchivePrefetcher *Prefetcher = 0;
+
+CArchivePrefetcher * getArchivePrefetcher ()
+{
+	if ( 0 == Prefetcher )
+		Prefetcher = new CArchivePrefetcher ( 64 * 1024 * 1024 );
+	return Prefetcher;
+}
+
+void prefetch_shutdown ()
+{
+	delete Prefetcher;
+	Prefetcher = 0;
+}
@@ -0,0 +1,97 @@
+/*!
+	Archive Prefetcher.
+	inflates the entries a map load will touch on the worker pool
+
+	Entries are inflated ahead of the loader into a staging pool
+	bounded by a memory cap. Read-ahead stops at the cap and resumes
+	when the loader consumes staged entries. Each staged entry is
+	checked against the crc of the zip directory.
+*/
+#ifndef __QUAKE3_PREFETCH__H_INCLUDED__
+#define __QUAKE3_PREFETCH__H_INCLUDED__
+
+#include <irrlicht.h>
+#include <mutex>
+#include <condition_variable>
+
+using namespace irr;
+
+class CMappedZipArchive;
+
+struct SPrefetchStats
+{
+	u32 Queued;
+	u32 Inflated;
+	u32 Hits;			// opened from the staging pool
+	u32 Misses;			// opened before the worker got to them
+	u32 CrcErrors;
+	u32 CapStalls;		// read-ahead stopped at the memory cap
+	u32 PeakStaged;
+};
+
+class CArchivePrefetcher
+{
+public:
+	CArchivePrefetcher ( u32 memoryCap );
+	~CArchivePrefetcher ();
+
+	void setMemoryCap ( u32 bytes ) { MemoryCap = bytes; }
+
+	//! queue the bsp, all shader scripts and the textures named in the bsp
+	u32 prefetchMap ( io::IFileSystem *fs, const io::path &mapName );
+
+	//! queue a single deflated entry
+	void prefetch ( CMappedZipArchive *archive, u32 entry );
+
+	//! hand out a staged entry, waits if it is inflating. 0 if not staged
+	io::IReadFile * take ( CMappedZipArchive *archive, u32 entry, const io::path &name );
+
+	//! wait for running jobs and drop everything staged
+	void clear ();
+
+	SPrefetchStats getStats ();
+
+	//! called by the staged read file
+	void release ( u32 bytes );
+
+private:
+	enum eRequestState
+	{
+		REQ_WAITING = 0,
+		REQ_INFLATING,
+		REQ_READY,
+		REQ_DONE
+	};
+
+	struct SRequest
+	{
+		CMappedZipArchive *Archive;
+		u32 Entry;
+		u8 *Data;
+		eRequestState State;
+		bool ParseTextures;
+	};
+
+	void add ( CMappedZipArchive *archive, u32 entry, bool parseTextures );
+	void pump ();
+	void run ( u32 request );
+	void addBspTextures ( CMappedZipArchive *archive, const u8 *bsp, u32 size );
+
+	core::array < SRequest > Request;
+	u32 Next;
+	u32 Staged;
+	u32 Running;
+	u32 MemoryCap;
+	SPrefetchStats Stats;
+
+	std::mutex Lock;
+	std::condition_variable Ready;
+};
+
+//! the prefetcher used by the mapped zip archives, created on first use
+CArchivePrefetcher * getArchivePrefetcher ();
+
+//! drop staged entries and delete the prefetcher
+void prefetch_shutdown ();
+
+#endif // __QUAKE3_PREFETCH__H_INCLUDED__
@@ -0,0 +1,61 @@
+/*!
+	Profile.
+	high resolution timing for benchmarks and frame statistics
+*/
+
+#include "profile.h"
+
+#include <atomic>
+
+static std::atomic < u32 > Allocations ( 0 );
+
+u32 getAllocationCount ()
+{
+	return Allocations;
+}
+
+void countAllocation ()
+{
+	Allocations += 1;
+}
+
+#if defined(_IRR_WINDOWS_API_)
+
+#include <windows.h>
+
+u64 getTimeMicro ()
+{
+	static LARGE_INTEGER frequency = { 0 };
+	if ( 0 == frequency.QuadPart )
+		QueryPerformanceFrequency ( &frequency );
+
+	LARGE_INTEGER now;
+	QueryPerformanceCounter ( &now );
+	return (u64) ( now.QuadPart / frequency.QuadPart ) * 1000000 +
+		(u64) ( now.QuadPart % frequency.QuadPart ) * 1000000 / frequency.QuadPart;
+}
+
+#else
+
+#include <time.h>
+
+u64 getTimeMicro ()
+{
+	timespec now;
+	clock_gettime ( CLOCK_MONOTONIC, &now );
+	return (u64) now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
+
+#endif
+
+void getFrameStats ( IrrlichtDevice *device, SFrameStats &stats )
+{
+	io::IAttributes *attr = device->getSceneManager ()->getParameters ();
+
+	stats.Registered = attr->getAttributeAsInt ( "calls" );
+	stats.Culled = attr->getAttributeAsInt ( "culled" );
+	stats.DrawCalls =	attr->getAttributeAsInt ( "drawn_solid" ) +
+						attr->getAttributeAsInt ( "drawn_transparent" ) +
+						attr->getAttributeAsInt ( "drawn_transparent_effect" );
+	stats.Primitives = device->getVideoDriver ()->getPrimitiveCountDrawn ();
+}
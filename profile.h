@@ -0,0 +1,53 @@
+/*!
+	Profile.
+	high resolution timing for benchmarks and frame statistics
+*/
+#ifndef __QUAKE3_PROFILE__H_INCLUDED__
+#define __QUAKE3_PROFILE__H_INCLUDED__
+
+#include <irrlicht.h>
+
+using namespace irr;
+
+//! monotonic time in microseconds
+u64 getTimeMicro ();
+
+//! adds the lifetime of the scope to a counter
+struct SScopeTimer
+{
+	SScopeTimer ( u64 &accumulate ) : Accumulate ( accumulate ), Start ( getTimeMicro () ) {}
+	~SScopeTimer () { Accumulate += getTimeMicro () - Start; }
+
+	u64 &Accumulate;
+	u64 Start;
+};
+
+//! allocations made through CCountingAllocator, the benchmarks read the difference around a loop
+u32 getAllocationCount ();
+void countAllocation ();
+
+//! irrAllocator that counts, for the tables whose allocations the benchmarks report
+template < typename T >
+class CCountingAllocator : public core::irrAllocator < T >
+{
+protected:
+	virtual void* internal_new ( size_t cnt )
+	{
+		countAllocation ();
+		return operator new ( cnt );
+	}
+};
+
+//! counters of the last drawn frame
+struct SFrameStats
+{
+	u32 Registered;		// nodes registered for rendering
+	u32 Culled;
+	u32 DrawCalls;		// nodes drawn, solid and transparent
+	u32 Primitives;
+};
+
+//! read the counters the scene manager and the driver keep for the last frame
+void getFrameStats ( IrrlichtDevice *device, SFrameStats &stats );
+
+#endif // __QUAKE3_PROFILE__H_INCLUDED__
@@ -0,0 +1,80 @@
+/*!
+	Quake3 Bsp.
+	raw access to the lumps of a Quake3 .bsp ( IBSP version 46 )
+*/
+
+#include "q3bsp.h"
+
+using namespace core;
+using namespace io;
+
+CQ3Bsp::CQ3Bsp ()
+: Data ( 0 ), Size ( 0 )
+{
+	memset ( Lump, 0, sizeof ( Lump ) );
+}
+
+CQ3Bsp::~CQ3Bsp ()
+{
+	delete [] Data;
+}
+
+bool CQ3Bsp::load ( IFileSystem *fs, const path &filename )
+{
+	IReadFile *file = fs->createAndOpenFile ( filename );
+	if ( 0 == file )
+		return false;
+
+	const bool ok = load ( file );
+	file->drop ();
+	return ok;
+}
+
+bool CQ3Bsp::load ( IReadFile *file )
+{
+	delete [] Data;
+	Data = 0;
+	Size = 0;
+	memset ( Lump, 0, sizeof ( Lump ) );
+
+	const u32 size = file->getSize ();
+	if ( size < 8 + BSP_LUMP_COUNT * 8 )
+		return false;
+
+	u8 *data = new u8 [ size ];
+	if ( file->read ( data, size ) != (s32) size || memcmp ( data, "IBSP", 4 ) )
+	{
+		delete [] data;
+		return false;
+	}
+
+	s32 version;
+	memcpy ( &version, data + 4, 4 );
+	if ( version != 46 )
+	{
+		delete [] data;
+		return false;
+	}
+
+	// every lump has to lie inside the file
+	memcpy ( Lump, data + 8, sizeof ( Lump ) );
+	for ( u32 i = 0; i != BSP_LUMP_COUNT; ++i )
+	{
+		if ( Lump[i].Offset > size || Lump[i].Size > size - Lump[i].Offset )
+		{
+			memset ( Lump, 0, sizeof ( Lump ) );
+			delete [] data;
+			return false;
+		}
+	}
+
+	Data = data;
+	Size = size;
+	return true;
+}
+
+const c8 * CQ3Bsp::getEntityString ( u32 &size ) const
+{
+	size = Lump[BSP_ENTITIES].Size;
+	return (const c8*) ( Data + Lump[BSP_ENTITIES].Offset );
+}
@@ -0,0 +1,203 @@
+/*!
+	Quake3 Bsp.
+	raw access to the lumps of a Quake3 .bsp ( IBSP version 46 )
+
+	The irrlicht loader turns a bsp into render meshes and drops everything
+	else. This reader keeps the file in memory and exposes the lumps as
+	typed arrays for collision, visibility and navigation.
+	Positions are quake3 space ( z up ), use q3ToIrr() for irrlicht space.
+*/
+#ifndef __QUAKE3_BSP__H_INCLUDED__
+#define __QUAKE3_BSP__H_INCLUDED__
+
+#include <irrlicht.h>
+
+using namespace irr;
+
+enum eQ3BspLump
+{
+	BSP_ENTITIES = 0,
+	BSP_SHADERS,
+	BSP_PLANES,
+	BSP_NODES,
+	BSP_LEAFS,
+	BSP_LEAFSURFACES,
+	BSP_LEAFBRUSHES,
+	BSP_MODELS,
+	BSP_BRUSHES,
+	BSP_BRUSHSIDES,
+	BSP_DRAWVERTS,
+	BSP_DRAWINDEXES,
+	BSP_FOGS,
+	BSP_SURFACES,
+	BSP_LIGHTMAPS,
+	BSP_LIGHTGRID,
+	BSP_VISIBILITY,
+	BSP_LUMP_COUNT
+};
+
+//! surface types
+enum eQ3BspSurface
+{
+	BSP_SURF_BAD = 0,
+	BSP_SURF_PLANAR,
+	BSP_SURF_PATCH,
+	BSP_SURF_TRIANGLES,
+	BSP_SURF_FLARE
+};
+
+//! content and surface flags used by the game
+enum eQ3BspContents
+{
+	BSP_CONTENTS_SOLID			= 0x1,
+	BSP_CONTENTS_LAVA			= 0x8,
+	BSP_CONTENTS_SLIME			= 0x10,
+	BSP_CONTENTS_WATER			= 0x20,
+	BSP_CONTENTS_FOG			= 0x40,
+	BSP_CONTENTS_AREAPORTAL		= 0x8000,
+	BSP_CONTENTS_PLAYERCLIP		= 0x10000,
+	BSP_CONTENTS_MONSTERCLIP	= 0x20000,
+	BSP_CONTENTS_TRIGGER		= 0x40000000,
+
+	BSP_SURF_NODAMAGE			= 0x1,
+	BSP_SURF_SLICK				= 0x2,
+	BSP_SURF_SKY				= 0x4,
+	BSP_SURF_NODRAW				= 0x80,
+	BSP_SURF_NONSOLID			= 0x4000
+};
+
+struct SQ3BspShader
+{
+	c8 name[64];
+	s32 surfaceFlags;
+	s32 contentFlags;
+};
+
+struct SQ3BspPlane
+{
+	f32 normal[3];
+	f32 dist;
+};
+
+struct SQ3BspNode
+{
+	s32 plane;
+	s32 children[2];	// negative = -( leaf + 1 )
+	s32 mins[3];
+	s32 maxs[3];
+};
+
+struct SQ3BspLeaf
+{
+	s32 cluster;		// -1 = opaque
+	s32 area;
+	s32 mins[3];
+	s32 maxs[3];
+	s32 firstLeafSurface;
+	s32 numLeafSurfaces;
+	s32 firstLeafBrush;
+	s32 numLeafBrushes;
+};
+
+struct SQ3BspModel
+{
+	f32 mins[3];
+	f32 maxs[3];
+	s32 firstSurface;
+	s32 numSurfaces;
+	s32 firstBrush;
+	s32 numBrushes;
+};
+
+struct SQ3BspBrush
+{
+	s32 firstSide;
+	s32 numSides;
+	s32 shader;
+};
+
+struct SQ3BspBrushSide
+{
+	s32 plane;
+	s32 shader;
+};
+
+struct SQ3BspVertex
+{
+	f32 xyz[3];
+	f32 st[2];
+	f32 lightmap[2];
+	f32 normal[3];
+	u8 color[4];
+};
+
+struct SQ3BspSurface
+{
+	s32 shader;
+	s32 fog;
+	s32 type;
+	s32 firstVert;
+	s32 numVerts;
+	s32 firstIndex;
+	s32 numIndexes;
+	s32 lightmapNum;
+	s32 lightmapX, lightmapY;
+	s32 lightmapWidth, lightmapHeight;
+	f32 lightmapOrigin[3];
+	f32 lightmapVecs[3][3];	// for patches [0] [1] are the bounds
+	s32 patchWidth;
+	s32 patchHeight;
+};
+
+struct SQ3BspVisibility
+{
+	s32 numClusters;
+	s32 bytesPerCluster;
+	// u8 bits [ numClusters * bytesPerCluster ] follows
+};
+
+//! quake3 is z up, irrlicht y up
+inline core::vector3df q3ToIrr ( const f32 *v )
+{
+	return core::vector3df ( v[0], v[2], v[1] );
+}
+
+inline core::vector3df q3ToIrr ( const s32 *v )
+{
+	return core::vector3df ( (f32) v[0], (f32) v[2], (f32) v[1] );
+}
+
+class CQ3Bsp
+{
+public:
+	CQ3Bsp ();
+	~CQ3Bsp ();
+
+	//! read the whole file, false if it is not a quake3 bsp
+	bool load ( io::IReadFile *file );
+	bool load ( io::IFileSystem *fs, const io::path &filename );
+
+	//! lump as array of T, count receives the number of records
+	template < class T >
+	const T * getLump ( eQ3BspLump lump, u32 &count ) const
+	{
+		count = Lump[lump].Size / sizeof ( T );
+		return (const T*) ( Data + Lump[lump].Offset );
+	}
+
+	const c8 * getEntityString ( u32 &size ) const;
+	u32 getFileSize () const { return Size; }
+
+private:
+	struct SLump
+	{
+		u32 Offset;
+		u32 Size;
+	};
+
+	u8 *Data;
+	u32 Size;
+	SLump Lump [ BSP_LUMP_COUNT ];
+};
+
+#endif // __QUAKE3_BSP__H_INCLUDED__
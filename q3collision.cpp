@@ -0,0 +1,430 @@
+/*!
+	Collision Map.
+	the parts of a quake3 map a server or a bot needs
+*/
+
+#include "q3collision.h"
+#include "q3bsp.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <float.h>
+
+using namespace core;
+using namespace io;
+
+void SCollisionMap::clear ()
+{
+	Vertex.clear ();
+	Index.clear ();
+	TriangleFlags.clear ();
+	Plane.clear ();
+	Brush.clear ();
+	WorldBrushCount = 0;
+	Spawn.clear ();
+	Trigger.clear ();
+	Box.reset ( 0.f, 0.f, 0.f );
+}
+
+u32 SCollisionMap::getContents ( const vector3df &p ) const
+{
+	u32 contents = 0;
+	for ( u32 i = 0; i != Brush.size (); ++i )
+	{
+		const SCollisionBrush &b = Brush[i];
+		if ( ( contents & b.Contents ) == b.Contents || !b.Box.isPointInside ( p ) )
+			continue;
+
+		u32 s = 0;
+		while ( s != b.PlaneCount && Plane[b.FirstPlane + s].getDistanceTo ( p ) <= 0.f )
+			s += 1;
+
+		if ( s == b.PlaneCount )
+			contents |= b.Contents;
+	}
+	return contents;
+}
+
+u32 SCollisionMap::getMemoryFootprint () const
+{
+	u32 bytes =	Vertex.allocated_size () * sizeof ( vector3df ) +
+				Index.allocated_size () * sizeof ( u32 ) +
+				TriangleFlags.allocated_size () * sizeof ( u32 ) +
+				Plane.allocated_size () * sizeof ( plane3df ) +
+				Brush.allocated_size () * sizeof ( SCollisionBrush ) +
+				Spawn.allocated_size () * sizeof ( SCollisionEntity ) +
+				Trigger.allocated_size () * sizeof ( SCollisionEntity );
+
+	for ( u32 i = 0; i != Spawn.size (); ++i )
+		bytes += Spawn[i].ClassName.size () + Spawn[i].Target.size () + Spawn[i].TargetName.size () + 3;
+	for ( u32 i = 0; i != Trigger.size (); ++i )
+		bytes += Trigger[i].ClassName.size () + Trigger[i].Target.size () + Trigger[i].TargetName.size () + 3;
+
+	return bytes;
+}
+
+
+/*
+	surfaces
+*/
+
+static bool isSolid ( const SQ3BspShader *shader, u32 shaderCount, s32 index )
+{
+	if ( index < 0 || (u32) index >= shaderCount )
+		return false;
+
+	const SQ3BspShader &s = shader[index];
+	return ( s.contentFlags & ( BSP_CONTENTS_SOLID | BSP_CONTENTS_PLAYERCLIP ) ) &&
+			!( s.surfaceFlags & BSP_SURF_NONSOLID );
+}
+
+static vector3df bezier ( const vector3df &a, const vector3df &b, const vector3df &c, f32 t )
+{
+	const f32 s = 1.f - t;
+	return a * ( s * s ) + b * ( 2.f * s * t ) + c * ( t * t );
+}
+
+// each 3x3 block of control points is a biquadratic patch
+static void addPatch ( SCollisionMap &map, const SQ3BspVertex *vert, s32 width, s32 height, u32 flags, u32 level )
+{
+	const u32 size = level + 1;
+	vector3df column[3];
+
+	for ( s32 py = 0; py + 2 < height; py += 2 )
+	{
+		for ( s32 px = 0; px + 2 < width; px += 2 )
+		{
+			const u32 base = map.Vertex.size ();
+
+			for ( u32 v = 0; v != size; ++v )
+			{
+				const f32 tv = (f32) v / level;
+				for ( u32 k = 0; k != 3; ++k )
+				{
+					column[k] = bezier (	q3ToIrr ( vert[ ( py + 0 ) * width + px + k ].xyz ),
+											q3ToIrr ( vert[ ( py + 1 ) * width + px + k ].xyz ),
+											q3ToIrr ( vert[ ( py + 2 ) * width + px + k ].xyz ), tv );
+				}
+
+				for ( u32 u = 0; u != size; ++u )
+					map.Vertex.push_back ( bezier ( column[0], column[1], column[2], (f32) u / level ) );
+			}
+
+			for ( u32 v = 0; v != level; ++v )
+			{
+				for ( u32 u = 0; u != level; ++u )
+				{
+					const u32 i = base + v * size + u;
+					map.Index.push_back ( i );
+					map.Index.push_back ( i + size );
+					map.Index.push_back ( i + 1 );
+					map.Index.push_back ( i + 1 );
+					map.Index.push_back ( i + size );
+					map.Index.push_back ( i + size + 1 );
+					map.TriangleFlags.push_back ( flags );
+					map.TriangleFlags.push_back ( flags );
+				}
+			}
+		}
+	}
+}
+
+static void addSurfaces ( const CQ3Bsp &bsp, SCollisionMap &map, s32 first, s32 count, u32 patchLevel )
+{
+	u32 shaderCount, surfaceCount, vertCount, indexCount;
+	const SQ3BspShader *shader = bsp.getLump < SQ3BspShader > ( BSP_SHADERS, shaderCount );
+	const SQ3BspSurface *surface = bsp.getLump < SQ3BspSurface > ( BSP_SURFACES, surfaceCount );
+	const SQ3BspVertex *vert = bsp.getLump < SQ3BspVertex > ( BSP_DRAWVERTS, vertCount );
+	const s32 *index = bsp.getLump < s32 > ( BSP_DRAWINDEXES, indexCount );
+
+	if ( first < 0 || count < 0 || (u32) ( first + count ) > surfaceCount )
+		return;
+
+	for ( s32 i = first; i != first + count; ++i )
+	{
+		const SQ3BspSurface &s = surface[i];
+		if ( !isSolid ( shader, shaderCount, s.shader ) )
+			continue;
+		if ( s.firstVert < 0 || s.numVerts < 0 || (u32) ( s.firstVert + s.numVerts ) > vertCount )
+			continue;
+
+		const u32 flags = shader[s.shader].surfaceFlags;
+
+		switch ( s.type )
+		{
+			case BSP_SURF_PLANAR:
+			case BSP_SURF_TRIANGLES:
+			{
+				if ( s.firstIndex < 0 || s.numIndexes < 0 || (u32) ( s.firstIndex + s.numIndexes ) > indexCount )
+					break;
+
+				const u32 base = map.Vertex.size ();
+				for ( s32 v = 0; v != s.numVerts; ++v )
+					map.Vertex.push_back ( q3ToIrr ( vert[s.firstVert + v].xyz ) );
+
+				// swapping y and z mirrors, so the winding is reversed like the level mesh does
+				for ( s32 k = 0; k + 2 < s.numIndexes; k += 3 )
+				{
+					const s32 *tri = index + s.firstIndex + k;
+					if ( (u32) tri[0] >= (u32) s.numVerts || (u32) tri[1] >= (u32) s.numVerts || (u32) tri[2] >= (u32) s.numVerts )
+						continue;
+
+					map.Index.push_back ( base + tri[2] );
+					map.Index.push_back ( base + tri[1] );
+					map.Index.push_back ( base + tri[0] );
+					map.TriangleFlags.push_back ( flags );
+				}
+			} break;
+
+			case BSP_SURF_PATCH:
+				if ( s.patchWidth * s.patchHeight <= s.numVerts && patchLevel )
+					addPatch ( map, vert + s.firstVert, s.patchWidth, s.patchHeight, flags, patchLevel );
+				break;
+		}
+	}
+}
+
+
+/*
+	brushes. q3map writes the 6 axial sides first, they give the bounds
+*/
+static void addBrushes ( const CQ3Bsp &bsp, SCollisionMap &map )
+{
+	u32 shaderCount, planeCount, brushCount, sideCount;
+	const SQ3BspShader *shader = bsp.getLump < SQ3BspShader > ( BSP_SHADERS, shaderCount );
+	const SQ3BspPlane *plane = bsp.getLump < SQ3BspPlane > ( BSP_PLANES, planeCount );
+	const SQ3BspBrush *brush = bsp.getLump < SQ3BspBrush > ( BSP_BRUSHES, brushCount );
+	const SQ3BspBrushSide *side = bsp.getLump < SQ3BspBrushSide > ( BSP_BRUSHSIDES, sideCount );
+
+	map.Brush.reallocate ( brushCount );
+
+	for ( u32 i = 0; i != brushCount; ++i )
+	{
+		const SQ3BspBrush &b = brush[i];
+
+		SCollisionBrush c;
+		c.FirstPlane = map.Plane.size ();
+		c.PlaneCount = 0;
+		c.Contents = b.shader >= 0 && (u32) b.shader < shaderCount ? shader[b.shader].contentFlags : 0;
+		// bevelled brushes without the axial sides are tested everywhere
+		c.Box.MinEdge.set ( -FLT_MAX, -FLT_MAX, -FLT_MAX );
+		c.Box.MaxEdge.set ( FLT_MAX, FLT_MAX, FLT_MAX );
+
+		if ( b.firstSide >= 0 && b.numSides >= 0 && (u32) ( b.firstSide + b.numSides ) <= sideCount )
+		{
+			for ( s32 k = 0; k != b.numSides; ++k )
+			{
+				const s32 p = side[b.firstSide + k].plane;
+				if ( p < 0 || (u32) p >= planeCount )
+					continue;
+
+				map.Plane.push_back ( plane3df ( q3ToIrr ( plane[p].normal ), -plane[p].dist ) );
+				c.PlaneCount += 1;
+			}
+
+			const SQ3BspBrushSide *s = side + b.firstSide;
+			bool axial = b.numSides >= 6;
+			for ( s32 k = 0; axial && k != 6; ++k )
+				axial = s[k].plane >= 0 && (u32) s[k].plane < planeCount;
+
+			if ( axial )
+			{
+				const f32 mins[3] = { -plane[s[0].plane].dist, -plane[s[2].plane].dist, -plane[s[4].plane].dist };
+				const f32 maxs[3] = { plane[s[1].plane].dist, plane[s[3].plane].dist, plane[s[5].plane].dist };
+				c.Box.MinEdge = q3ToIrr ( mins );
+				c.Box.MaxEdge = q3ToIrr ( maxs );
+			}
+		}
+
+		map.Brush.push_back ( c );
+	}
+}
+
+
+/*
+	entity lump: { "key" "value" ... } blocks
+*/
+struct SEntityKey
+{
+	stringc Key;
+	stringc Value;
+};
+
+static const c8 * parseQuoted ( const c8 *p, const c8 *end, stringc &out )
+{
+	const c8 *start = ++p;
+	while ( p < end && *p != '"' )
+		p += 1;
+	out = stringc ( start, (u32) ( p - start ) );
+	return p < end ? p + 1 : p;
+}
+
+static const stringc * findKey ( const core::array < SEntityKey > &keys, const c8 *key )
+{
+	for ( u32 i = 0; i != keys.size (); ++i )
+	{
+		if ( keys[i].Key.equals_ignore_case ( key ) )
+			return &keys[i].Value;
+	}
+	return 0;
+}
+
+static bool isSpawn ( const stringc &name )
+{
+	static const c8 * spawn[] =
+	{
+		"info_player_start", "info_player_deathmatch", "info_ut_spawn",
+		"team_CTF_redplayer", "team_CTF_blueplayer", "team_CTF_redspawn", "team_CTF_bluespawn", 0
+	};
+
+	for ( u32 i = 0; spawn[i]; ++i )
+	{
+		if ( name.equals_ignore_case ( spawn[i] ) )
+			return true;
+	}
+	return false;
+}
+
+static void addEntity ( const CQ3Bsp &bsp, SCollisionMap &map, const core::array < SEntityKey > &keys )
+{
+	const stringc *classname = findKey ( keys, "classname" );
+	if ( 0 == classname )
+		return;
+
+	const bool spawn = isSpawn ( *classname );
+	if ( !spawn && !classname->equalsn ( "trigger_", 8 ) )
+		return;
+
+	SCollisionEntity e;
+	e.ClassName = *classname;
+	e.Angle = 0.f;
+	e.Team = 0;
+	e.Model = -1;
+
+	const stringc *v;
+	if ( ( v = findKey ( keys, "target" ) ) )
+		e.Target = *v;
+	if ( ( v = findKey ( keys, "targetname" ) ) )
+		e.TargetName = *v;
+
+	f32 origin[3] = { 0.f, 0.f, 0.f };
+	if ( ( v = findKey ( keys, "origin" ) ) )
+		sscanf ( v->c_str (), "%f %f %f", origin, origin + 1, origin + 2 );
+	e.Origin = q3ToIrr ( origin );
+
+	f32 angles[3];
+	if ( ( v = findKey ( keys, "angle" ) ) )
+		e.Angle = (f32) atof ( v->c_str () );
+	else
+	if ( ( v = findKey ( keys, "angles" ) ) && sscanf ( v->c_str (), "%f %f %f", angles, angles + 1, angles + 2 ) == 3 )
+		e.Angle = angles[1];
+
+	if ( ( v = findKey ( keys, "team" ) ) )
+	{
+		if ( v->equals_ignore_case ( "red" ) )
+			e.Team = 1;
+		else
+		if ( v->equals_ignore_case ( "blue" ) )
+			e.Team = 2;
+		else
+			e.Team = atoi ( v->c_str () );
+	}
+	else
+	if ( classname->find ( "_red" ) >= 0 )
+		e.Team = 1;
+	else
+	if ( classname->find ( "_blue" ) >= 0 )
+		e.Team = 2;
+
+	e.Box.reset ( e.Origin );
+
+	u32 modelCount;
+	const SQ3BspModel *model = bsp.getLump < SQ3BspModel > ( BSP_MODELS, modelCount );
+	if ( ( v = findKey ( keys, "model" ) ) && (*v)[0] == '*' )
+	{
+		e.Model = atoi ( v->c_str () + 1 );
+		if ( e.Model > 0 && (u32) e.Model < modelCount )
+		{
+			e.Box.reset ( q3ToIrr ( model[e.Model].mins ) );
+			e.Box.addInternalPoint ( q3ToIrr ( model[e.Model].maxs ) );
+		}
+	}
+
+	if ( spawn )
+		map.Spawn.push_back ( e );
+	else
+		map.Trigger.push_back ( e );
+}
+
+static void addEntities ( const CQ3Bsp &bsp, SCollisionMap &map )
+{
+	u32 size;
+	const c8 *p = bsp.getEntityString ( size );
+	const c8 *end = p + size;
+
+	core::array < SEntityKey > keys;
+	SEntityKey key;
+	bool open = false;
+
+	while ( p < end && *p )
+	{
+		switch ( *p )
+		{
+			case '{':
+				keys.set_used ( 0 );
+				open = true;
+				p += 1;
+				break;
+			case '}':
+				if ( open )
+					addEntity ( bsp, map, keys );
+				open = false;
+				p += 1;
+				break;
+			case '"':
+				p = parseQuoted ( p, end, key.Key );
+				while ( p < end && *p != '"' && *p != '}' && *p )
+					p += 1;
+				if ( p < end && *p == '"' )
+				{
+					p = parseQuoted ( p, end, key.Value );
+					keys.push_back ( key );
+				}
+				break;
+			default:
+				p += 1;
+				break;
+		}
+	}
+}
+
+
+bool buildCollisionMap ( const CQ3Bsp &bsp, SCollisionMap &map, u32 patchLevel )
+{
+	map.clear ();
+
+	u32 modelCount;
+	const SQ3BspModel *model = bsp.getLump < SQ3BspModel > ( BSP_MODELS, modelCount );
+	if ( 0 == modelCount )
+		return false;
+
+	// world surfaces only, brush models move and are handled by their entity
+	addSurfaces ( bsp, map, model[0].firstSurface, model[0].numSurfaces, patchLevel );
+	addBrushes ( bsp, map );
+	map.WorldBrushCount = core::min_ ( (u32) core::max_ ( model[0].firstBrush + model[0].numBrushes, 0 ), map.Brush.size () );
+	addEntities ( bsp, map );
+
+	map.Box.reset ( q3ToIrr ( model[0].mins ) );
+	map.Box.addInternalPoint ( q3ToIrr ( model[0].maxs ) );
+
+	return true;
+}
+
+bool loadCollisionMap ( IFileSystem *fs, const path &mapName, SCollisionMap &map, u32 patchLevel )
+{
+	CQ3Bsp bsp;
+	if ( !bsp.load ( fs, mapName ) )
+		return false;
+
+	return buildCollisionMap ( bsp, map, patchLevel );
+}
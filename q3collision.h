@@ -0,0 +1,73 @@
+/*!
+	Collision Map.
+	the parts of a quake3 map a server or a bot needs
+
+	Reads the bsp lumps directly instead of going through the level mesh,
+	so no shader script is parsed, no texture or lightmap is decoded and
+	no scenenode is created. Keeps solid triangles, brushes with their
+	content flags, spawn points and trigger entities in irrlicht space.
+*/
+#ifndef __QUAKE3_COLLISION__H_INCLUDED__
+#define __QUAKE3_COLLISION__H_INCLUDED__
+
+#include <irrlicht.h>
+
+using namespace irr;
+
+class CQ3Bsp;
+
+//! convex brush, planes face outwards
+struct SCollisionBrush
+{
+	u32 FirstPlane;
+	u32 PlaneCount;
+	u32 Contents;
+	core::aabbox3df Box;
+};
+
+//! spawn points and triggers taken from the entity lump
+struct SCollisionEntity
+{
+	core::stringc ClassName;
+	core::stringc Target;
+	core::stringc TargetName;
+	core::vector3df Origin;
+	f32 Angle;
+	s32 Team;			// "team" key, 0 if not set
+	s32 Model;			// brush model "*n", -1 for point entities
+	core::aabbox3df Box;
+};
+
+struct SCollisionMap
+{
+	core::array < core::vector3df > Vertex;
+	core::array < u32 > Index;				// 3 per triangle
+	core::array < u32 > TriangleFlags;		// surface flags, 1 per triangle
+
+	core::array < core::plane3df > Plane;
+	core::array < SCollisionBrush > Brush;
+	u32 WorldBrushCount;					// brushes of model 0, the rest belong to entities
+
+	core::array < SCollisionEntity > Spawn;
+	core::array < SCollisionEntity > Trigger;
+
+	core::aabbox3df Box;
+
+	void clear ();
+
+	u32 getTriangleCount () const { return Index.size () / 3; }
+
+	//! content flags of all brushes containing p
+	u32 getContents ( const core::vector3df &p ) const;
+
+	//! heap bytes held by the arrays
+	u32 getMemoryFootprint () const;
+};
+
+//! build the collision map. patches are tessellated at level patchLevel
+bool buildCollisionMap ( const CQ3Bsp &bsp, SCollisionMap &map, u32 patchLevel = 4 );
+
+//! load a bsp from the file system and build its collision map
+bool loadCollisionMap ( io::IFileSystem *fs, const io::path &mapName, SCollisionMap &map, u32 patchLevel = 4 );
+
+#endif // __QUAKE3_COLLISION__H_INCLUDED__
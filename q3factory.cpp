@@ -1,6 +1,9 @@
 #include <irrlicht.h>
 #include "q3factory.h"
 #include "sound.h"
+#include "itembatch.h"
+#include "entitytable.h"
+#include "vartable.h"
 
 using namespace irr;
 using namespace scene;
@@ -10,6 +13,54 @@ using namespace core;
 using namespace quake3;
 
 
+/*
+	static batching. buffers with the same material ( shader, lightmap, flags )
+	inside the same chunk of space are merged into one buffer, so culling
+	still works per chunk
+*/
+static const f32 BATCH_CHUNK_SIZE = 1024.f;
+
+struct SBatchChunk
+{
+	SMeshBufferLightMap *Buffer;
+	IShader *Shader;
+	vector3di Cell;
+};
+
+// vertex deforms work on the vertices of one surface, keep them apart
+static bool isBatchable ( IMeshBuffer *meshBuffer, const IShader *shader, CVarTable &general, u32 symDeform )
+{
+	if ( 0 == shader || meshBuffer->getVertexType () != EVT_2TCOORDS || meshBuffer->getIndexType () != EIT_16BIT )
+		return false;
+
+	const SVarGroup *group = shader->getGroup ( 1 );
+	if ( 0 == group )
+		return true;
+
+	// buffers of a shader mostly follow each other, the table is kept for them
+	if ( general.getGroup () != group )
+		general.build ( group );
+	return 0 == general.isDefined ( symDeform );
+}
+
+static void appendBuffer ( SMeshBufferLightMap *dest, IMeshBuffer *source )
+{
+	const u32 base = dest->Vertices.size ();
+	const S3DVertex2TCoords *v = (const S3DVertex2TCoords*) source->getVertices ();
+	const u16 *index = source->getIndices ();
+
+	for ( u32 i = 0; i != source->getVertexCount (); ++i )
+		dest->Vertices.push_back ( v[i] );
+
+	for ( u32 i = 0; i != source->getIndexCount (); ++i )
+		dest->Indices.push_back ( (u16) ( base + index[i] ) );
+
+	if ( 0 == base )
+		dest->BoundingBox = source->getBoundingBox ();
+	else
+		dest->BoundingBox.addInternalBox ( source->getBoundingBox () );
+}
+
 /*!
 	Takes the mesh buffers and creates scenenodes for their associated shaders
 */
@@ -19,7 +70,8 @@ void Q3ShaderFactory (	Q3LevelLoadParameter &loadParam,
 						eQ3MeshIndex meshIndex,
 						ISceneNode *parent,
 						IMetaTriangleSelector *meta,
-						bool showShaderName )
+						bool showShaderName,
+						bool batch )
 {
 	if ( 0 == mesh || 0 == device )
 		return;
@@ -41,6 +93,9 @@ void Q3ShaderFactory (	Q3LevelLoadParameter &loadParam,
 		font = device->getGUIEnvironment()->getFont("Fonts\\fontlucida.png");
 	IVideoDriver *driver = device->getVideoDriver();
 	s32 sceneNodeID = 0;
+	core::array < SBatchChunk > chunk;
+	const u32 SymDeform = symbol ( "deformvertexes" );
+	CVarTable general;
 	for ( u32 i = 0; i!= additional_mesh->getMeshBufferCount (); ++i )
 	{
 		IMeshBuffer *meshBuffer = additional_mesh->getMeshBuffer ( i );
@@ -52,101 +107,296 @@ void Q3ShaderFactory (	Q3LevelLoadParameter &loadParam,
 		// the meshbuffer can be rendered without additional support, or it has no shader
 		IShader *shader = (IShader *) mesh->getShader ( shaderIndex );
 
+		if ( batch && isBatchable ( meshBuffer, shader, general, SymDeform ) )
+		{
+			const vector3df center = meshBuffer->getBoundingBox ().getCenter () / BATCH_CHUNK_SIZE;
+			const vector3di cell ( floor32 ( center.X ), floor32 ( center.Y ), floor32 ( center.Z ) );
+
+			u32 c = 0;
+			for ( ; c != chunk.size (); ++c )
+			{
+				if ( chunk[c].Cell == cell && chunk[c].Buffer->Material == material &&
+					chunk[c].Buffer->Vertices.size () + meshBuffer->getVertexCount () <= 65535 )
+					break;
+			}
+
+			if ( c == chunk.size () )
+			{
+				SBatchChunk add;
+				add.Buffer = new SMeshBufferLightMap ();
+				add.Buffer->Material = material;
+				add.Shader = shader;
+				add.Cell = cell;
+				chunk.push_back ( add );
+			}
+
+			appendBuffer ( chunk[c].Buffer, meshBuffer );
+			continue;
+		}
+
 			// create sceneNode
 			node = smgr->addQuake3SceneNode ( meshBuffer, shader, parent, sceneNodeID );
 			node->setAutomaticCulling ( scene::EAC_FRUSTUM_BOX );
 			sceneNodeID += 1;
 	}
 
+	// the shader node keeps a reference to the merged buffer
+	for ( u32 c = 0; c != chunk.size (); ++c )
+	{
+		node = smgr->addQuake3SceneNode ( chunk[c].Buffer, chunk[c].Shader, parent, sceneNodeID );
+		node->setAutomaticCulling ( scene::EAC_FRUSTUM_BOX );
+		sceneNodeID += 1;
+		chunk[c].Buffer->drop ();
+	}
+}
+
 
+/*!
+	the Quake3 items, searched by classname
+*/
+static const SItemElement Quake3ItemElement[] =
+{
+	{	"item_health",
+		{ "models/powerups/health/medium_cross.md3", "models/powerups/health/medium_sphere.md3" },
+		"sound/items/n_health.wav", "icons/iconh_yellow", "25 Health",
+		25, HEALTH, SUB_NONE, SPECIAL_SFX_BOUNCE | SPECIAL_SFX_ROTATE_1 },
+	{	"item_health_large",
+		{ "models/powerups/health/large_cross.md3", "models/powerups/health/large_sphere.md3" },
+		"sound/items/l_health.wav", "icons/iconh_red", "50 Health",
+		50, HEALTH, SUB_NONE, SPECIAL_SFX_BOUNCE | SPECIAL_SFX_ROTATE_1 },
+	{	"item_health_mega",
+		{ "models/powerups/health/mega_cross.md3", "models/powerups/health/mega_sphere.md3" },
+		"sound/items/m_health.wav", "icons/iconh_mega", "Mega Health",
+		100, HEALTH, SUB_NONE, SPECIAL_SFX_BOUNCE | SPECIAL_SFX_ROTATE_1 },
+	{	"item_health_small",
+		{ "models/powerups/health/small_cross.md3", "models/powerups/health/small_sphere.md3" },
+		"sound/items/s_health.wav", "icons/iconh_green", "5 Health",
+		5, HEALTH, SUB_NONE, SPECIAL_SFX_BOUNCE | SPECIAL_SFX_ROTATE_1 },
+	{	"ammo_bullets",
+		{ "models/powerups/ammo/machinegunam.md3", "" },
+		"sound/misc/am_pkup.wav", "icons/icona_machinegun", "Bullets",
+		50, AMMO, MACHINEGUN, SPECIAL_SFX_ROTATE },
+	{	"ammo_cells",
+		{ "models/powerups/ammo/plasmaam.md3", "" },
+		"sound/misc/am_pkup.wav", "icons/icona_plasma", "Cells",
+		30, AMMO, PLASMAGUN, SPECIAL_SFX_ROTATE },
+	{	"ammo_rockets",
+		{ "models/powerups/ammo/rocketam.md3", "" },
+		"sound/misc/am_pkup.wav", "icons/icona_rocket", "Rockets",
+		5, AMMO, ROCKET_LAUNCHER, SPECIAL_SFX_ROTATE },
+	{	"ammo_shells",
+		{ "models/powerups/ammo/shotgunam.md3", "" },
+		"sound/misc/am_pkup.wav", "icons/icona_shotgun", "Shells",
+		10, AMMO, SHOTGUN, SPECIAL_SFX_ROTATE },
+	{	"ammo_slugs",
+		{ "models/powerups/ammo/railgunam.md3", "" },
+		"sound/misc/am_pkup.wav", "icons/icona_railgun", "Slugs",
+		10, AMMO, RAILGUN, SPECIAL_SFX_ROTATE },
+	{	"item_armor_body",
+		{ "models/powerups/armor/armor_red.md3", "" },
+		"sound/misc/ar2_pkup.wav", "icons/iconr_red", "Heavy Armor",
+		100, ARMOR, SUB_NONE, SPECIAL_SFX_ROTATE },
+	{	"item_armor_combat",
+		{ "models/powerups/armor/armor_yel.md3", "" },
+		"sound/misc/ar2_pkup.wav", "icons/iconr_yellow", "Armor",
+		50, ARMOR, SUB_NONE, SPECIAL_SFX_ROTATE },
+	{	"item_armor_shard",
+		{ "models/powerups/armor/shard.md3", "" },
+		"sound/misc/ar1_pkup.wav", "icons/iconr_shard", "Armor Shard",
+		5, ARMOR, SUB_NONE, SPECIAL_SFX_ROTATE },
+	{	"weapon_gauntlet",
+		{ "models/weapons2/gauntlet/gauntlet.md3", "" },
+		"sound/misc/w_pkup.wav", "icons/iconw_gauntlet", "Gauntlet",
+		0, WEAPON, GAUNTLET, SPECIAL_SFX_ROTATE },
+	{	"weapon_shotgun",
+		{ "models/weapons2/shotgun/shotgun.md3", "" },
+		"sound/misc/w_pkup.wav", "icons/iconw_shotgun", "Shotgun",
+		10, WEAPON, SHOTGUN, SPECIAL_SFX_ROTATE },
+	{	"weapon_machinegun",
+		{ "models/weapons2/machinegun/machinegun.md3", "" },
+		"sound/misc/w_pkup.wav", "icons/iconw_machinegun", "Machinegun",
+		40, WEAPON, MACHINEGUN, SPECIAL_SFX_ROTATE },
+	{	"weapon_grenadelauncher",
+		{ "models/weapons2/grenadel/grenadel.md3", "" },
+		"sound/misc/w_pkup.wav", "icons/iconw_grenade", "Grenade Launcher",
+		10, WEAPON, GRENADE_LAUNCHER, SPECIAL_SFX_ROTATE },
+	{	"weapon_rocketlauncher",
+		{ "models/weapons2/rocketl/rocketl.md3", "" },
+		"sound/misc/w_pkup.wav", "icons/iconw_rocket", "Rocket Launcher",
+		10, WEAPON, ROCKET_LAUNCHER, SPECIAL_SFX_ROTATE },
+	{	"weapon_lightning",
+		{ "models/weapons2/lightning/lightning.md3", "" },
+		"sound/misc/w_pkup.wav", "icons/iconw_lightning", "Lightning Gun",
+		100, WEAPON, LIGHTNING, SPECIAL_SFX_ROTATE },
+	{	"weapon_railgun",
+		{ "models/weapons2/railgun/railgun.md3", "" },
+		"sound/misc/w_pkup.wav", "icons/iconw_railgun", "Railgun",
+		10, WEAPON, RAILGUN, SPECIAL_SFX_ROTATE },
+	{	"weapon_plasmagun",
+		{ "models/weapons2/plasma/plasma.md3", "" },
+		"sound/misc/w_pkup.wav", "icons/iconw_plasma", "Plasma Gun",
+		50, WEAPON, PLASMAGUN, SPECIAL_SFX_ROTATE },
+	{	"weapon_bfg",
+		{ "models/weapons2/bfg/bfg.md3", "" },
+		"sound/misc/w_pkup.wav", "icons/iconw_bfg", "BFG10K",
+		20, WEAPON, BFG, SPECIAL_SFX_ROTATE },
+	{	"weapon_grapplinghook",
+		{ "models/weapons2/grapple/grapple.md3", "" },
+		"sound/misc/w_pkup.wav", "icons/iconw_grapple", "Grappling Hook",
+		0, WEAPON, GRAPPLING_HOOK, SPECIAL_SFX_ROTATE },
+	{	0, { 0, 0 }, 0, 0, 0, 0, WEAPON, SUB_NONE, SPECIAL_SFX_NONE }
+};
+
+const SItemElement * getItemElement ( const stringc& key )
+{
+	for ( const SItemElement *item = Quake3ItemElement; item->key; ++item )
+	{
+		if ( 0 == strcmp ( key.c_str (), item->key ) )
+			return item;
+	}
+	return 0;
 }
 
+/*
+	loads a md3 item model once and resolves the textures of its buffers.
+	the materials live in the shared mesh, every instance uses them
+*/
+static IMesh * loadItemModel (	IrrlichtDevice *device, IQ3LevelMesh* masterMesh, const c8 *name )
+{
+	ISceneManager* smgr = device->getSceneManager();
+	IAnimatedMesh *animated = smgr->getMesh ( name );
+	if ( 0 == animated || animated->getMeshType () != EAMT_MD3 )
+		return 0;
+
+	IAnimatedMeshMD3* model = (IAnimatedMeshMD3*) animated;
+	SMD3Mesh * mesh = model->getOriginalMesh ();
+	IMesh *frame = model->getMesh ( 0 );
+	tTexArray textureArray;
+	const u32 SymMap = symbol ( "map" );
+	const u32 SymBlendFunc = symbol ( "blendfunc" );
+	CVarTable vars;
+
+	for ( u32 j = 0; j != mesh->Buffer.size () && j != frame->getMeshBufferCount (); ++j )
+	{
+		const SMD3MeshBuffer *meshBuffer = mesh->Buffer[j];
+		SMaterial &material = frame->getMeshBuffer ( j )->getMaterial ();
+		material.Lighting = false;
+
+		const IShader *shader = masterMesh->getShader ( meshBuffer->Shader.c_str (), false );
+		const SVarGroup *stage = shader ? shader->getGroup ( 2 ) : 0;
+
+		u32 pos = 0;
+		textureArray.clear ();
+		if ( stage )
+		{
+			vars.build ( stage );
+			getTextures ( textureArray, vars.get ( SymMap ), pos, device->getFileSystem (), device->getVideoDriver () );
+
+			SBlendFunc blendfunc ( EMFN_MODULATE_1X );
+			getBlendFunc ( vars.get ( SymBlendFunc ), blendfunc );
+			material.MaterialType = blendfunc.type;
+			material.MaterialTypeParam = blendfunc.param0;
+		}
+		else
+		{
+			getTextures ( textureArray, meshBuffer->Shader, pos, device->getFileSystem (), device->getVideoDriver () );
+		}
+
+		if ( textureArray.size () )
+			material.setTexture ( 0, textureArray[0] );
+	}
+	return frame;
+}
 
 /*!
 	create Items from Entity
 */
-void Q3ModelFactory (	Q3LevelLoadParameter &loadParam,
+CItemBatchSceneNode * Q3ModelFactory (	Q3LevelLoadParameter &loadParam,
 						IrrlichtDevice *device,
 						IQ3LevelMesh* masterMesh,
+						const CEntityTable &entities,
 						ISceneNode *parent,
 						bool showShaderName
 						)
 {
 	if ( 0 == masterMesh )
-		return;
+		return 0;
 
-	tQ3EntityList &entity = masterMesh->getEntityList ();
 	ISceneManager* smgr = device->getSceneManager();
+	u32 nodeCount = 0;
 
+	// distinct model names, the batch node holds the meshes
+	core::array < stringc > modelName;
+	core::array < s32 > modelIndex;
 
-	const SVarGroup *group;
-	IEntity search;
-	s32 index;
-	s32 lastIndex;
-	IAnimatedMeshMD3* model;
-	SMD3Mesh * mesh;
-	const SMD3MeshBuffer *meshBuffer;
-	IMeshSceneNode* node;
-	ISceneNodeAnimator* anim;
-	const IShader *shader;
-	u32 pos;
-	vector3df p;
-	u32 nodeCount = 0;
-	tTexArray textureArray;
+	CItemBatchSceneNode *batch = new CItemBatchSceneNode ( parent ? parent : smgr->getRootSceneNode (), smgr );
+	batch->setName ( "items" );
 
-	IGUIFont *font = 0;
-	if ( showShaderName )
-		font = device->getGUIEnvironment()->getFont("fontlucida.png");
+	for ( const SItemElement *item = Quake3ItemElement; item->key; ++item )
+	{
+		const SEntityClass *entity = entities.getClass ( item->key );
+		if ( 0 == entity )
+			continue;
 
+		for ( u32 g = 0; g != 2; ++g )
+		{
+			if ( 0 == item->model[g] || 0 == item->model[g][0] )
+				continue;
+
+			// each model is loaded once
+			s32 m = modelName.linear_search ( item->model[g] );
+			if ( m < 0 )
+			{
+				IMesh *mesh = loadItemModel ( device, masterMesh, item->model[g] );
+				modelName.push_back ( item->model[g] );
+				modelIndex.push_back ( mesh ? (s32) batch->addModel ( mesh ) : -1 );
+				m = modelName.size () - 1;
+			}
+			if ( modelIndex[m] < 0 )
+				continue;
+
+			// the outer model of a health item stands still, the inner one turns
+			u32 special = item->special;
+			if ( 0 == g && item->model[1][0] )
+				special &= ~SPECIAL_SFX_ROTATE_1;
+
+			for ( u32 e = 0; e != entity->size (); ++e )
+				batch->addInstance ( modelIndex[m], entity->Origin[e], special );
+		}
+		nodeCount += entity->size ();
+	}
+
+	c8 buf[128];
+	snprintf ( buf, sizeof ( buf ), "items: %u entities, %u instances, %u distinct meshes",
+		nodeCount, batch->getInstanceCount (), batch->getModelCount () );
+	device->getLogger ()->log ( buf, ELL_INFORMATION );
+
+	batch->drop ();
+	return batch;
 }
 
 /*!
 	so we need a good starting Position in the level.
-	we can ask the Quake3 Loader for all entities with class_name "info_player_deathmatch"
+	the spawn points come from the entity table, the one furthest
+	from the enemies is taken
 */
-s32 Q3StartPosition (	IQ3LevelMesh* mesh,
+s32 Q3StartPosition (	const CEntityTable &entities,
 						ICameraSceneNode* camera,
 						s32 startposIndex,
-						const vector3df &translation
+						const vector3df &translation,
+						const vector3df *enemy,
+						u32 enemyCount
 					)
 {
-	if ( 0 == mesh )
-		return 0;
-
-	tQ3EntityList &entityList = mesh->getEntityList ();
-
-	IEntity search;
-	search.name = "info_player_start";	// "info_player_deathmatch";
-
-	// find all entities in the multi-list
-	s32 lastIndex;
-	s32 index = entityList.binary_search_multi ( search, lastIndex );
-
-	if ( index < 0 )
-	{
-		search.name = "info_player_deathmatch";
-		index = entityList.binary_search_multi ( search, lastIndex );
-	}
-
+	const SEntityClass *spawn = entities.getSpawnPoints ();
+	const s32 index = entities.selectSpawnPoint ( enemy, enemyCount, startposIndex );
 	if ( index < 0 )
 		return 0;
 
-	index += core::clamp ( startposIndex, 0, lastIndex - index );
-
-	u32 parsepos;
-
-	const SVarGroup *group;
-	group = entityList[ index ].getGroup(1);
-
-	parsepos = 0;
-	vector3df pos = getAsVector3df ( group->get ( "origin" ), parsepos );
-	pos += translation;
-
-	parsepos = 0;
-	f32 angle = getAsFloat ( group->get ( "angle"), parsepos );
+	vector3df pos = spawn->Origin[index] + translation;
 
 	vector3df target ( 0.f, 0.f, 1.f );
-	target.rotateXZBy ( angle - 90.f, vector3df () );
+	target.rotateXZBy ( spawn->Angle[index] - 90.f, vector3df () );
 
 	if ( camera )
 	{
@@ -155,7 +405,7 @@ s32 Q3StartPosition (	IQ3LevelMesh* mesh,
 		//FPSCamera and animators catches reset on animate 0
 		camera->OnAnimate ( 0 );
 	}
-	return lastIndex - index + 1;
+	return spawn->size ();
 }
 
 
@@ -73,7 +73,9 @@ struct SItemElement
 
 /*!
 	Quake3 Model Factory.
-	Takes the mesh buffers and creates scenenodes for their associated shaders
+	Takes the mesh buffers and creates scenenodes for their associated shaders.
+	With batch set, buffers sharing shader, lightmap and material are merged
+	per spatial chunk into one scenenode
 */
 void Q3ShaderFactory (	Q3LevelLoadParameter &loadParam,
 						IrrlichtDevice *device, 
@@ -81,28 +83,40 @@ void Q3ShaderFactory (	Q3LevelLoadParameter &loadParam,
 						eQ3MeshIndex meshIndex,
 						ISceneNode *parent,
 						IMetaTriangleSelector *meta,
-						bool showShaderName 
+						bool showShaderName,
+						bool batch = true
 					);
 
 
+//! item description for a classname, 0 if it is no item
+const SItemElement * getItemElement ( const stringc& key );
+
+class CItemBatchSceneNode;
+class CEntityTable;
+
 /*!
-	Creates Model based on the entity list
+	Creates Model based on the entity list.
+	All items are instances in one batch node below parent
 */
-void Q3ModelFactory (	Q3LevelLoadParameter &loadParam,
+CItemBatchSceneNode * Q3ModelFactory (	Q3LevelLoadParameter &loadParam,
 						IrrlichtDevice *device, 
 						IQ3LevelMesh* masterMesh, 
+						const CEntityTable &entities,
 						ISceneNode *parent,
 						bool showShaderName
 					);
 
 /*!
 	so we need a good starting Position in the level.
-	we can ask the Quake3 Loader for all entities with class_name "info_player_deathmatch"
+	picks the spawn point furthest from the enemies, without enemies
+	startposIndex is used. returns the number of spawn points
 */
-s32 Q3StartPosition (	IQ3LevelMesh* mesh,
+s32 Q3StartPosition (	const CEntityTable &entities,
 						ICameraSceneNode* camera,
 						s32 startposIndex,
-						const vector3df &translation
+						const vector3df &translation,
+						const vector3df *enemy = 0,
+						u32 enemyCount = 0
 					);
 /*!
 	gets a accumulated force on a given surface
@@ -0,0 +1,149 @@
+/*!
+	Random.
+	counter based random streams, thread safe replacement for quake3::Noiser
+*/
+
+#include "random.h"
+#include <time.h>
+
+#if defined(_M_IX86) || defined(_M_X64) || defined(__SSE2__)
+#define RANDOM_SSE2
+#include <emmintrin.h>
+#endif
+
+/*
+	murmur3 finalizer, every input bit affects every output bit.
+	counter -> weyl step + key -> mix -> xor key -> mix
+*/
+static inline u32 mix32 ( u32 x )
+{
+	x ^= x >> 16;
+	x *= 0x85ebca6b;
+	x ^= x >> 13;
+	x *= 0xc2b2ae35;
+	x ^= x >> 16;
+	return x;
+}
+
+// splitmix64 step, spreads seed and stream over the key
+static inline u64 mix64 ( u64 x )
+{
+	x += 0x9E3779B97F4A7C15ull;
+	x = ( x ^ ( x >> 30 ) ) * 0xBF58476D1CE4E5B9ull;
+	x = ( x ^ ( x >> 27 ) ) * 0x94D049BB133111EBull;
+	return x ^ ( x >> 31 );
+}
+
+CRandom::CRandom ( u32 seed, u32 stream )
+: Counter ( 0 )
+{
+	const u64 key = mix64 ( ( (u64) seed << 32 ) | stream );
+	KeyLo = (u32) key;
+	KeyHi = (u32) ( key >> 32 );
+}
+
+u32 CRandom::hash ( u32 counter ) const
+{
+	return mix32 ( mix32 ( counter * 0x9E3779B9 + KeyLo ) ^ KeyHi );
+}
+
+CRandom CRandom::fork ( u32 index ) const
+{
+	CRandom r;
+	const u64 key = mix64 ( ( ( (u64) KeyHi << 32 ) | KeyLo ) ^ mix64 ( index ) );
+	r.KeyLo = (u32) key;
+	r.KeyHi = (u32) ( key >> 32 );
+	return r;
+}
+
+#ifdef RANDOM_SSE2
+
+// low 32 bit of a 32x32 multiply, sse2 has no pmulld
+static inline __m128i mul32 ( __m128i a, __m128i b )
+{
+	const __m128i even = _mm_mul_epu32 ( a, b );
+	const __m128i odd = _mm_mul_epu32 ( _mm_srli_epi64 ( a, 32 ), _mm_srli_epi64 ( b, 32 ) );
+	return _mm_unpacklo_epi32 ( _mm_shuffle_epi32 ( even, _MM_SHUFFLE ( 0, 0, 2, 0 ) ),
+								_mm_shuffle_epi32 ( odd, _MM_SHUFFLE ( 0, 0, 2, 0 ) ) );
+}
+
+static inline __m128i mix32_4 ( __m128i x )
+{
+	x = _mm_xor_si128 ( x, _mm_srli_epi32 ( x, 16 ) );
+	x = mul32 ( x, _mm_set1_epi32 ( 0x85ebca6b ) );
+	x = _mm_xor_si128 ( x, _mm_srli_epi32 ( x, 13 ) );
+	x = mul32 ( x, _mm_set1_epi32 ( 0xc2b2ae35 ) );
+	return _mm_xor_si128 ( x, _mm_srli_epi32 ( x, 16 ) );
+}
+
+// hash of counter .. counter + 3
+static inline __m128i hash4 ( u32 counter, u32 keyLo, u32 keyHi )
+{
+	__m128i c = _mm_add_epi32 ( _mm_set1_epi32 ( counter ), _mm_set_epi32 ( 3, 2, 1, 0 ) );
+	c = _mm_add_epi32 ( mul32 ( c, _mm_set1_epi32 ( 0x9E3779B9 ) ), _mm_set1_epi32 ( keyLo ) );
+	return mix32_4 ( _mm_xor_si128 ( mix32_4 ( c ), _mm_set1_epi32 ( keyHi ) ) );
+}
+
+#endif
+
+void CRandom::fill ( u32 *out, u32 count )
+{
+	u32 i = 0;
+#ifdef RANDOM_SSE2
+	for ( ; i + 4 <= count; i += 4 )
+		_mm_storeu_si128 ( (__m128i*) ( out + i ), hash4 ( Counter + i, KeyLo, KeyHi ) );
+#endif
+	for ( ; i != count; ++i )
+		out[i] = hash ( Counter + i );
+
+	Counter += count;
+}
+
+void CRandom::fill ( f32 *out, u32 count, f32 min, f32 max )
+{
+	const f32 range = max - min;
+	u32 i = 0;
+#ifdef RANDOM_SSE2
+	const __m128 scale = _mm_set1_ps ( 1.f / 16777216.f );
+	const __m128 vmin = _mm_set1_ps ( min );
+	const __m128 vrange = _mm_set1_ps ( range );
+	for ( ; i + 4 <= count; i += 4 )
+	{
+		const __m128i v = _mm_srli_epi32 ( hash4 ( Counter + i, KeyLo, KeyHi ), 8 );
+		const __m128 unit = _mm_mul_ps ( _mm_cvtepi32_ps ( v ), scale );
+		_mm_storeu_ps ( out + i, _mm_add_ps ( vmin, _mm_mul_ps ( unit, vrange ) ) );
+	}
+#endif
+	for ( ; i != count; ++i )
+		out[i] = min + toUnit ( hash ( Counter + i ) ) * range;
+
+	Counter += count;
+}
+
+
+static u32 Seed = 0x69666966;
+static bool Seeded = false;
+static CRandom System [ RANDOM_SYSTEM_COUNT ];
+
+void setRandomSeed ( u32 seed )
+{
+	if ( 0 == seed )
+		seed = mix32 ( (u32) time ( 0 ) ) | 1;
+
+	Seed = seed;
+	Seeded = true;
+	for ( u32 i = 0; i != RANDOM_SYSTEM_COUNT; ++i )
+		System[i] = CRandom ( seed, i );
+}
+
+u32 getRandomSeed ()
+{
+	return Seed;
+}
+
+CRandom & getRandom ( eRandomSystem system )
+{
+	if ( !Seeded )
+		setRandomSeed ( Seed );
+	return System[system];
+}
@@ -0,0 +1,73 @@
+/*!
+	Random.
+	counter based random streams, thread safe replacement for quake3::Noiser
+
+	A value is a hash of ( stream key, counter ), there is no shared
+	generator state. Each system owns a stream, jobs fork a child stream
+	by job index, so a seed gives the same numbers no matter how many
+	threads run the jobs. Saving seed and counters is enough for a replay.
+*/
+#ifndef __QUAKE3_RANDOM__H_INCLUDED__
+#define __QUAKE3_RANDOM__H_INCLUDED__
+
+#include <irrlicht.h>
+
+using namespace irr;
+
+//! one stream per game system, a new system does not shift the others
+enum eRandomSystem
+{
+	RANDOM_WEAPON = 0,
+	RANDOM_PARTICLE,
+	RANDOM_SHADER,
+	RANDOM_AI,
+	RANDOM_SYSTEM_COUNT
+};
+
+class CRandom
+{
+public:
+	CRandom ( u32 seed = 0, u32 stream = 0 );
+
+	//! raw 32 bit value
+	u32 next () { return hash ( Counter++ ); }
+
+	//! [0,1)
+	f32 frand () { return toUnit ( next () ); }
+
+	//! [min,max)
+	f32 frand ( f32 min, f32 max ) { return min + frand () * ( max - min ); }
+
+	//! [0,range)
+	u32 rand ( u32 range ) { return (u32) ( ( (u64) next () * range ) >> 32 ); }
+
+	//! bulk fill, same values as calling next () / frand () count times
+	void fill ( u32 *out, u32 count );
+	void fill ( f32 *out, u32 count, f32 min = 0.f, f32 max = 1.f );
+
+	//! independent child stream, e.g. one per job or per particle system
+	CRandom fork ( u32 index ) const;
+
+	//! position in the stream, for replays and skipping ahead
+	u32 getCounter () const { return Counter; }
+	void setCounter ( u32 counter ) { Counter = counter; }
+
+	//! value at any position, does not advance
+	u32 hash ( u32 counter ) const;
+
+	static f32 toUnit ( u32 v ) { return (f32) ( v >> 8 ) * ( 1.f / 16777216.f ); }
+
+private:
+	u32 KeyLo;
+	u32 KeyHi;
+	u32 Counter;
+};
+
+//! reseed all system streams. 0 picks a seed from the clock
+void setRandomSeed ( u32 seed );
+u32 getRandomSeed ();
+
+//! the stream of a system. owned by the main thread, jobs use fork ()
+CRandom & getRandom ( eRandomSystem system );
+
+#endif // __QUAKE3_RANDOM__H_INCLUDED__
@@ -0,0 +1,247 @@
+/*!
+	Render Queue.
+	draws of the map and item nodes sorted by a 64 bit key each frame
+*/
+
+#include "renderqueue.h"
+#include "profile.h"
+
+#include <string.h>
+
+using namespace core;
+using namespace scene;
+using namespace video;
+
+/*
+	solid:       pass 0 | state 44 | depth 19, same state front to back
+	transparent: pass 1 | far depth 19 | state 44, back to front
+	state is texture 16 | lightmap 16 | material 12
+*/
+static const u32 DEPTH_BITS = 19;
+static const u32 STATE_BITS = 44;
+static const u64 DEPTH_MAX = ( 1ull << DEPTH_BITS ) - 1;
+static const u64 STATE_MASK = ( 1ull << STATE_BITS ) - 1;
+static const u64 TRANSPARENT_PASS = 1ull << 63;
+static const u32 MAX_TEXTURE_ID = 0xFFFF;
+static const u32 MAX_MATERIAL_ID = 0xFFF;
+
+static inline u64 getState ( u64 key )
+{
+	return key & TRANSPARENT_PASS ? key & STATE_MASK : ( key >> DEPTH_BITS ) & STATE_MASK;
+}
+
+CRenderQueueSceneNode::CRenderQueueSceneNode ( ISceneNode *parent, ISceneManager *mgr, s32 id )
+: ISceneNode ( parent, mgr, id ), SolidCount ( 0 ), Sorted ( false ), DepthScale ( 0.f )
+{
+#ifdef _DEBUG
+	setDebugName ( "CRenderQueueSceneNode" );
+#endif
+	Registered[0] = false;
+	Registered[1] = false;
+	memset ( &Stats, 0, sizeof ( Stats ) );
+	memset ( &Frame, 0, sizeof ( Frame ) );
+	Box.reset ( 0.f, 0.f, 0.f );
+
+	// registered by the submits, the draws are culled by their nodes
+	setAutomaticCulling ( EAC_OFF );
+}
+
+u32 CRenderQueueSceneNode::getTextureId ( ITexture *texture )
+{
+	if ( 0 == texture )
+		return 0;
+
+	for ( u32 i = 0; i != Texture.size (); ++i )
+		if ( Texture[i] == texture )
+			return core::min_ ( i + 1, MAX_TEXTURE_ID );
+
+	Texture.push_back ( texture );
+	return core::min_ ( Texture.size (), MAX_TEXTURE_ID );
+}
+
+u64 CRenderQueueSceneNode::getStateKey ( const SMaterial &material )
+{
+	u32 id = 0;
+	while ( id != Material.size () && Material[id] != material )
+		id += 1;
+	if ( id == Material.size () )
+		Material.push_back ( material );
+
+	return (u64) getTextureId ( material.getTexture ( 0 ) ) << 28 |
+		(u64) getTextureId ( material.getTexture ( 1 ) ) << 12 |
+		core::min_ ( id, MAX_MATERIAL_ID );
+}
+
+void CRenderQueueSceneNode::submit ( u64 stateKey, bool transparent, const vector3df &center,
+								IMeshBuffer *buffer, const SMaterial *material, const matrix4 *transform )
+{
+	if ( Draw.empty () )
+	{
+		ICameraSceneNode *camera = SceneManager->getActiveCamera ();
+		Eye = camera ? camera->getAbsolutePosition () : vector3df ( 0.f );
+		DepthScale = camera ? DEPTH_MAX / core::max_ ( camera->getFarValue (), 1.f ) : 0.f;
+	}
+
+	const u64 depth = (u64) core::min_ ( Eye.getDistanceFrom ( center ) * DepthScale, (f32) DEPTH_MAX );
+
+	SDraw d;
+	d.Buffer = buffer;
+	d.Material = material;
+	d.Transform = transform;
+	Draw.push_back ( d );
+
+	if ( transparent )
+		Key.push_back ( TRANSPARENT_PASS | ( DEPTH_MAX - depth ) << STATE_BITS | ( stateKey & STATE_MASK ) );
+	else
+		Key.push_back ( ( stateKey & STATE_MASK ) << DEPTH_BITS | depth );
+
+	if ( !Registered[transparent] )
+	{
+		SceneManager->registerNodeForRendering ( this, transparent ? ESNRP_TRANSPARENT : ESNRP_SOLID );
+		Registered[transparent] = true;
+	}
+	Sorted = false;
+}
+
+// the draws of the last frame are gone, it starts over
+void CRenderQueueSceneNode::OnAnimate ( u32 timeMs )
+{
+	Stats = Frame;
+	Stats.Submitted = Draw.size ();
+	memset ( &Frame, 0, sizeof ( Frame ) );
+
+	Draw.set_used ( 0 );
+	Key.set_used ( 0 );
+	Registered[0] = false;
+	Registered[1] = false;
+	Sorted = false;
+
+	ISceneNode::OnAnimate ( timeMs );
+}
+
+void CRenderQueueSceneNode::sortKeys ( array < u64 > &key, array < u32 > &index,
+									array < u64 > &keyTemp, array < u32 > &indexTemp )
+{
+	const u32 n = key.size ();
+	if ( n < 2 )
+		return;
+
+	keyTemp.set_used ( n );
+	indexTemp.set_used ( n );
+
+	u64 *srcKey = key.pointer (), *dstKey = keyTemp.pointer ();
+	u32 *srcIndex = index.pointer (), *dstIndex = indexTemp.pointer ();
+
+	for ( u32 shift = 0; shift != 64; shift += 8 )
+	{
+		u32 count[256];
+		memset ( count, 0, sizeof ( count ) );
+		for ( u32 i = 0; i != n; ++i )
+			count[ ( srcKey[i] >> shift ) & 0xFF ] += 1;
+
+		// every key has the same byte, nothing moves
+		if ( count[ ( srcKey[0] >> shift ) & 0xFF ] == n )
+			continue;
+
+		u32 offset = 0;
+		for ( u32 b = 0; b != 256; ++b )
+		{
+			const u32 c = count[b];
+			count[b] = offset;
+			offset += c;
+		}
+
+		for ( u32 i = 0; i != n; ++i )
+		{
+			const u32 at = count[ ( srcKey[i] >> shift ) & 0xFF ]++;
+			dstKey[at] = srcKey[i];
+			dstIndex[at] = srcIndex[i];
+		}
+
+		u64 *k = srcKey; srcKey = dstKey; dstKey = k;
+		u32 *x = srcIndex; srcIndex = dstIndex; dstIndex = x;
+	}
+
+	if ( srcKey != key.pointer () )
+	{
+		memcpy ( key.pointer (), srcKey, n * sizeof ( u64 ) );
+		memcpy ( index.pointer (), srcIndex, n * sizeof ( u32 ) );
+	}
+}
+
+void CRenderQueueSceneNode::sort ()
+{
+	const u64 start = getTimeMicro ();
+
+	// what drawing in submit order would have cost
+	u64 last = ~0ull;
+	for ( u32 i = 0; i != Key.size (); ++i )
+	{
+		const u64 state = getState ( Key[i] );
+		Frame.SubmitOrderSwitches += state != last ? 1 : 0;
+		last = state;
+	}
+
+	Order.set_used ( Key.size () );
+	for ( u32 i = 0; i != Order.size (); ++i )
+		Order[i] = i;
+	sortKeys ( Key, Order, KeyTemp, OrderTemp );
+
+	SolidCount = 0;
+	while ( SolidCount != Key.size () && 0 == ( Key[SolidCount] & TRANSPARENT_PASS ) )
+		SolidCount += 1;
+
+	Frame.SortMicro += (u32) ( getTimeMicro () - start );
+	Sorted = true;
+}
+
+void CRenderQueueSceneNode::render ()
+{
+	if ( !Sorted )
+		sort ();
+
+	if ( SceneManager->getSceneNodeRenderPass () == ESNRP_TRANSPARENT )
+		draw ( SolidCount, Key.size () );
+	else
+		draw ( 0, SolidCount );
+}
+
+// nodes of the scene manager may have drawn in between, the first draw sets everything
+void CRenderQueueSceneNode::draw ( u32 first, u32 last )
+{
+	IVideoDriver *driver = SceneManager->getVideoDriver ();
+
+	u64 state = ~0ull;
+	const SMaterial *material = 0;
+	const matrix4 *transform = 0;
+	bool setTransform = true;
+
+	for ( u32 i = first; i != last; ++i )
+	{
+		const SDraw &d = Draw[ Order[i] ];
+		const u64 s = getState ( Key[i] );
+
+		// past the last material id states are shared, the pointer tells them apart
+		if ( s != state || ( ( s & MAX_MATERIAL_ID ) == MAX_MATERIAL_ID && d.Material != material && *d.Material != *material ) )
+		{
+			// texture and lightmap ids are the upper 32 bits of the state
+			const u64 changed = state ^ s;
+			Frame.TextureSwitches += ( changed >> 28 ) & 0xFFFF ? 1 : 0;
+			Frame.TextureSwitches += ( changed >> 12 ) & 0xFFFF ? 1 : 0;
+			Frame.MaterialSwitches += 1;
+
+			driver->setMaterial ( *d.Material );
+			material = d.Material;
+			state = s;
+		}
+
+		if ( setTransform || d.Transform != transform )
+		{
+			driver->setTransform ( ETS_WORLD, d.Transform ? *d.Transform : IdentityMatrix );
+			transform = d.Transform;
+			setTransform = false;
+		}
+
+		driver->drawMeshBuffer ( d.Buffer );
+	}
+}
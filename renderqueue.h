@@ -0,0 +1,95 @@
+/*!
+	Render Queue.
+	draws of the map and item nodes sorted by a 64 bit key each frame
+
+	The scene manager draws node after node in the order they registered,
+	sorted by the first texture at most. Nodes handing their mesh buffers
+	to the queue instead only submit a key, the buffer, the material and
+	the transform. The key packs the pass, a depth and the state: texture,
+	lightmap and material ids taken once when a node is built. Solid draws
+	sort by state and front to back inside the same state, transparent ones
+	back to front first, as blending needs. All keys of a frame are sorted
+	by one radix sort, then the draws are issued setting the material and
+	the transform only when they change.
+
+	The queue is a scene node itself, registered for a pass when the first
+	draw of that pass is submitted. Nodes of the scene manager, like the
+	shader stages, billboards and the weapon, keep their own order around
+	the queue.
+*/
+#ifndef __QUAKE3_RENDERQUEUE__H_INCLUDED__
+#define __QUAKE3_RENDERQUEUE__H_INCLUDED__
+
+#include <irrlicht.h>
+
+using namespace irr;
+
+//! counters of the last frame
+struct SRenderQueueStats
+{
+	u32 Submitted;
+	u32 MaterialSwitches;
+	u32 TextureSwitches;	// texture and lightmap layers
+	u32 SubmitOrderSwitches;// material switches drawing in submit order
+	u32 SortMicro;
+};
+
+class CRenderQueueSceneNode : public scene::ISceneNode
+{
+public:
+	CRenderQueueSceneNode ( scene::ISceneNode *parent, scene::ISceneManager *mgr, s32 id = -1 );
+
+	//! texture, lightmap and material ids, taken once per material when a node is built
+	u64 getStateKey ( const video::SMaterial &material );
+
+	/*!
+		one draw of this frame, sorted by state and the distance of center to
+		the camera. material and transform have to live until the frame is
+		drawn, transform 0 is the identity
+	*/
+	void submit ( u64 stateKey, bool transparent, const core::vector3df &center,
+				scene::IMeshBuffer *buffer, const video::SMaterial *material, const core::matrix4 *transform );
+
+	const SRenderQueueStats & getStats () const { return Stats; }
+
+	//! sorts index by key, least significant byte first. bytes equal in all keys are skipped
+	static void sortKeys ( core::array < u64 > &key, core::array < u32 > &index,
+						core::array < u64 > &keyTemp, core::array < u32 > &indexTemp );
+
+	virtual void OnAnimate ( u32 timeMs );
+	virtual void render ();
+
+	virtual const core::aabbox3d<f32>& getBoundingBox () const { return Box; }
+
+private:
+	struct SDraw
+	{
+		scene::IMeshBuffer *Buffer;
+		const video::SMaterial *Material;
+		const core::matrix4 *Transform;
+	};
+
+	u32 getTextureId ( video::ITexture *texture );
+	void sort ();
+	void draw ( u32 first, u32 last );
+
+	core::array < video::ITexture* > Texture;	// id - 1, 0 is no texture
+	core::array < video::SMaterial > Material;	// id
+
+	core::array < SDraw > Draw;
+	core::array < u64 > Key;
+	core::array < u32 > Order;
+	core::array < u64 > KeyTemp;
+	core::array < u32 > OrderTemp;
+	u32 SolidCount;								// solid draws come first once sorted
+	bool Sorted;
+	bool Registered[2];
+
+	core::vector3df Eye;						// of the first submit in the frame
+	f32 DepthScale;
+	core::aabbox3df Box;
+	SRenderQueueStats Stats;
+	SRenderQueueStats Frame;					// counting
+};
+
+#endif // __QUAKE3_RENDERQUEUE__H_INCLUDED__
@@ -0,0 +1,491 @@
+/*!
+	Shader Scripts.
+	zero copy parser for the quake3 .shader scripts of the mounted archives
+*/
+
+#include "shaderscript.h"
+#include "mappedzip.h"
+#include "inflate.h"
+#include "jobs.h"
+
+using namespace core;
+using namespace io;
+
+bool SStringView::equals_ignore_case ( const c8 *s ) const
+{
+	for ( u32 i = 0; i != Length; ++i )
+	{
+		if ( 0 == s[i] || locale_lower ( Ptr[i] ) != locale_lower ( s[i] ) )
+			return false;
+	}
+	return 0 == s[Length];
+}
+
+// fnv-1a over the lower case name
+static u32 hashName ( const c8 *name, u32 length )
+{
+	u32 h = 2166136261u;
+	for ( u32 i = 0; i != length; ++i )
+		h = ( h ^ (u8) locale_lower ( name[i] ) ) * 16777619u;
+	return h;
+}
+
+static bool sameName ( const SStringView &a, const SStringView &b )
+{
+	if ( a.Length != b.Length )
+		return false;
+	for ( u32 i = 0; i != a.Length; ++i )
+	{
+		if ( locale_lower ( a.Ptr[i] ) != locale_lower ( b.Ptr[i] ) )
+			return false;
+	}
+	return true;
+}
+
+
+CShaderLibrary::CShaderLibrary ()
+: Errors ( 0 )
+{
+}
+
+CShaderLibrary::~CShaderLibrary ()
+{
+	clear ();
+}
+
+void CShaderLibrary::clear ()
+{
+	for ( u32 i = 0; i != Script.size (); ++i )
+	{
+		delete [] Script[i]->Owned;
+		if ( Script[i]->Archive )
+			Script[i]->Archive->drop ();
+		delete Script[i];
+	}
+	Script.clear ();
+	Shader.clear ();
+	Slot.clear ();
+	Errors = 0;
+}
+
+u32 CShaderLibrary::getMemoryUsage () const
+{
+	u32 bytes = Shader.allocated_size () * sizeof ( SShaderDef ) + Slot.allocated_size () * sizeof ( u32 );
+	for ( u32 i = 0; i != Script.size (); ++i )
+	{
+		const SScript *s = Script[i];
+		bytes += sizeof ( SScript ) + ( s->Owned ? s->Size : 0 ) +
+			s->Def.allocated_size () * sizeof ( SShaderDef ) +
+			s->Group.allocated_size () * sizeof ( SShaderGroup ) +
+			s->Variable.allocated_size () * sizeof ( SShaderVariable );
+	}
+	return bytes;
+}
+
+struct SScriptName
+{
+	path Name;
+	u32 Entry;
+
+	bool operator < ( const SScriptName &other ) const { return Name < other.Name; }
+};
+
+/*
+	scripts of each archive sorted by name, archives in mount order.
+	other archive types are read here, the file system is not thread safe
+*/
+void CShaderLibrary::collect ( IFileSystem *fs )
+{
+	for ( u32 a = 0; a != fs->getFileArchiveCount (); ++a )
+	{
+		IFileArchive *archive = fs->getFileArchive ( a );
+		CMappedZipArchive *mapped = dynamic_cast < CMappedZipArchive* > ( archive );
+		const IFileList *list = archive->getFileList ();
+
+		core::array < SScriptName > names;
+		for ( u32 i = 0; i != list->getFileCount (); ++i )
+		{
+			const path &name = list->getFullFileName ( i );
+			if ( list->isDirectory ( i ) || name.find ( "scripts/" ) < 0 || !hasFileExtension ( name, "shader" ) )
+				continue;
+
+			SScriptName n;
+			n.Name = name;
+			n.Entry = i;
+			names.push_back ( n );
+		}
+		names.sort ();
+
+		for ( u32 i = 0; i != names.size (); ++i )
+		{
+			SScript *s = new SScript ();
+			countAllocation ();
+			s->Name = names[i].Name;
+			s->Archive = 0;
+			s->Entry = 0;
+			s->Owned = 0;
+			s->Text = 0;
+			s->Size = 0;
+			s->Error = false;
+
+			const s32 entry = mapped ? mapped->findEntry ( names[i].Name ) : -1;
+			if ( entry >= 0 )
+			{
+				s->Archive = mapped;
+				s->Entry = entry;
+				mapped->grab ();
+			}
+			else
+			{
+				IReadFile *file = archive->createAndOpenFile ( names[i].Entry );
+				if ( file )
+				{
+					s->Size = file->getSize ();
+					s->Owned = new u8 [ s->Size ];
+					countAllocation ();
+					if ( file->read ( s->Owned, s->Size ) != (s32) s->Size )
+						s->Error = true;
+					s->Text = (const c8*) s->Owned;
+					file->drop ();
+				}
+				else
+					s->Error = true;
+			}
+			Script.push_back ( s );
+		}
+	}
+}
+
+// runs on a worker. stored entries are used in place, deflated ones get one buffer
+void CShaderLibrary::load ( SScript *s )
+{
+	if ( s->Archive && !s->Error )
+	{
+		const SMappedZipEntry &e = s->Archive->getEntry ( s->Entry );
+		const u8 *data = s->Archive->getEntryData ( s->Entry );
+		s->Size = e.Size;
+
+		if ( 0 == data )
+			s->Error = true;
+		else
+		if ( 0 == e.Method )
+			s->Text = (const c8*) data;
+		else
+		{
+			s->Owned = new u8 [ e.Size ];
+			countAllocation ();
+			s->Text = (const c8*) s->Owned;
+			if ( e.Method != 8 || !inflateBuffer ( s->Owned, e.Size, data, e.CompressedSize ) )
+				s->Error = true;
+		}
+	}
+
+	if ( !s->Error )
+		parse ( s );
+}
+
+
+/*
+	tokenizer
+*/
+struct SScanner
+{
+	const c8 *P;
+	const c8 *End;
+
+	// skips blanks and comments, true if a line break was passed
+	bool skip ()
+	{
+		bool newLine = false;
+		while ( P < End )
+		{
+			if ( *P == '\n' )
+			{
+				newLine = true;
+				P += 1;
+			}
+			else
+			if ( (u8) *P <= ' ' )
+				P += 1;
+			else
+			if ( P + 1 < End && P[0] == '/' && P[1] == '/' )
+			{
+				while ( P < End && *P != '\n' )
+					P += 1;
+			}
+			else
+			if ( P + 1 < End && P[0] == '/' && P[1] == '*' )
+			{
+				P += 2;
+				while ( P + 1 < End && !( P[0] == '*' && P[1] == '/' ) )
+				{
+					newLine |= *P == '\n';
+					P += 1;
+				}
+				P = core::min_ ( P + 2, End );
+			}
+			else
+				break;
+		}
+		return newLine;
+	}
+
+	SStringView token ()
+	{
+		SStringView v;
+		v.Ptr = P;
+		if ( P < End && ( *P == '{' || *P == '}' ) )
+			P += 1;
+		else
+		{
+			while ( P < End && (u8) *P > ' ' && *P != '{' && *P != '}' &&
+				!( P + 1 < End && P[0] == '/' && P[1] == '/' ) )
+				P += 1;
+		}
+		v.Length = (u32) ( P - v.Ptr );
+		return v;
+	}
+
+	// rest of the line without trailing blanks and comment
+	SStringView line ()
+	{
+		while ( P < End && ( *P == ' ' || *P == '\t' ) )
+			P += 1;
+
+		SStringView v;
+		v.Ptr = P;
+		const c8 *last = P;
+		while ( P < End && *P != '\n' && *P != '\r' && *P != '}' &&
+			!( P + 1 < End && P[0] == '/' && P[1] == '/' ) )
+		{
+			if ( (u8) *P > ' ' )
+				last = P + 1;
+			P += 1;
+		}
+		v.Length = (u32) ( last - v.Ptr );
+		return v;
+	}
+};
+
+/*
+	name { general { stage } { stage } }
+	general keywords may follow stages, they are buffered so every
+	group is one contiguous run of variables
+*/
+void CShaderLibrary::parse ( SScript *s )
+{
+	SScanner scan;
+	scan.P = s->Text;
+	scan.End = s->Text + s->Size;
+
+	core::array < SShaderVariable, CCountingAllocator < SShaderVariable > > general;
+	SShaderDef def;
+	s32 depth = 0;
+	u32 stageGroup = 0;
+
+	for (;;)
+	{
+		scan.skip ();
+		if ( scan.P >= scan.End )
+			break;
+
+		SStringView t = scan.token ();
+
+		if ( 0 == depth )
+		{
+			if ( t.Length == 1 && ( *t.Ptr == '{' || *t.Ptr == '}' ) )
+			{
+				s->Error = true;
+				continue;
+			}
+
+			// shader name, the body has to follow
+			scan.skip ();
+			if ( scan.P >= scan.End || *scan.P != '{' )
+			{
+				s->Error = true;
+				continue;
+			}
+			scan.P += 1;
+
+			def.Name = t;
+			def.Script = 0;
+			def.FirstGroup = s->Group.size ();
+			def.GroupCount = 2;
+
+			SShaderGroup g;
+			g.FirstVariable = s->Variable.size ();
+			g.VariableCount = 1;
+			SShaderVariable name;
+			name.Name = t;
+			name.Content.Ptr = t.Ptr + t.Length;
+			name.Content.Length = 0;
+			s->Variable.push_back ( name );
+			s->Group.push_back ( g );
+
+			// general group, filled when the shader is closed
+			s->Group.push_back ( g );
+			general.set_used ( 0 );
+			depth = 1;
+			continue;
+		}
+
+		if ( *t.Ptr == '{' && t.Length == 1 )
+		{
+			if ( 1 == depth )
+			{
+				SShaderGroup g;
+				g.FirstVariable = s->Variable.size ();
+				g.VariableCount = 0;
+				stageGroup = s->Group.size ();
+				s->Group.push_back ( g );
+				def.GroupCount += 1;
+			}
+			depth += 1;
+			continue;
+		}
+
+		if ( *t.Ptr == '}' && t.Length == 1 )
+		{
+			depth -= 1;
+			if ( 0 == depth )
+			{
+				SShaderGroup &g = s->Group[def.FirstGroup + 1];
+				g.FirstVariable = s->Variable.size ();
+				g.VariableCount = general.size ();
+				for ( u32 i = 0; i != general.size (); ++i )
+					s->Variable.push_back ( general[i] );
+
+				s->Def.push_back ( def );
+			}
+			continue;
+		}
+
+		SShaderVariable v;
+		v.Name = t;
+		v.Content = scan.line ();
+
+		if ( 1 == depth )
+			general.push_back ( v );
+		else
+		{
+			s->Variable.push_back ( v );
+			s->Group[stageGroup].VariableCount += 1;
+		}
+	}
+
+	// unterminated shader at the end of the file
+	if ( depth )
+		s->Error = true;
+}
+
+/*
+	the first definition of a name wins, like the irrlicht shader list
+*/
+void CShaderLibrary::merge ()
+{
+	u32 total = 0;
+	for ( u32 i = 0; i != Script.size (); ++i )
+		total += Script[i]->Def.size ();
+
+	u32 slots = 64;
+	while ( slots < total * 2 )
+		slots <<= 1;
+	Slot.set_used ( slots );
+	memset ( Slot.pointer (), 0, slots * sizeof ( u32 ) );
+	Shader.reallocate ( total );
+
+	const u32 mask = slots - 1;
+	for ( u32 i = 0; i != Script.size (); ++i )
+	{
+		SScript *s = Script[i];
+		Errors += s->Error ? 1 : 0;
+
+		for ( u32 d = 0; d != s->Def.size (); ++d )
+		{
+			SShaderDef def = s->Def[d];
+			def.Script = i;
+
+			u32 slot = hashName ( def.Name.Ptr, def.Name.Length ) & mask;
+			while ( Slot[slot] && !sameName ( Shader[ Slot[slot] - 1 ].Name, def.Name ) )
+				slot = ( slot + 1 ) & mask;
+
+			if ( Slot[slot] )
+				continue;
+
+			Shader.push_back ( def );
+			Slot[slot] = Shader.size ();
+		}
+	}
+}
+
+u32 CShaderLibrary::loadScripts ( IFileSystem *fs, bool parallel )
+{
+	clear ();
+	collect ( fs );
+
+	if ( parallel && Script.size () > 1 )
+	{
+		SScript **script = Script.pointer ();
+		getJobSystem ()->parallelFor ( 0, Script.size (), 1, [script] ( u32 first, u32 last )
+		{
+			for ( u32 i = first; i != last; ++i )
+				CShaderLibrary::load ( script[i] );
+		} );
+	}
+	else
+	{
+		for ( u32 i = 0; i != Script.size (); ++i )
+			load ( Script[i] );
+	}
+
+	merge ();
+	return Shader.size ();
+}
+
+s32 CShaderLibrary::findShader ( const c8 *name ) const
+{
+	if ( Slot.empty () )
+		return -1;
+
+	SStringView v;
+	v.Ptr = name;
+	v.Length = (u32) strlen ( name );
+
+	const u32 mask = Slot.size () - 1;
+	for ( u32 slot = hashName ( v.Ptr, v.Length ) & mask; Slot[slot]; slot = ( slot + 1 ) & mask )
+	{
+		if ( sameName ( Shader[ Slot[slot] - 1 ].Name, v ) )
+			return Slot[slot] - 1;
+	}
+	return -1;
+}
+
+const SShaderVariable * CShaderLibrary::getGroup ( u32 shader, u32 group, u32 &count ) const
+{
+	const SShaderDef &def = Shader[shader];
+	count = 0;
+	if ( group >= def.GroupCount )
+		return 0;
+
+	const SScript *s = Script[def.Script];
+	const SShaderGroup &g = s->Group[def.FirstGroup + group];
+	count = g.VariableCount;
+	return s->Variable.const_pointer () + g.FirstVariable;
+}
+
+SStringView CShaderLibrary::get ( u32 shader, u32 group, const c8 *name ) const
+{
+	u32 count;
+	const SShaderVariable *v = getGroup ( shader, group, count );
+	for ( u32 i = 0; i != count; ++i )
+	{
+		if ( v[i].Name.equals_ignore_case ( name ) )
+			return v[i].Content;
+	}
+
+	SStringView empty;
+	empty.Ptr = "";
+	empty.Length = 0;
+	return empty;
+}
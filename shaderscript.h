@@ -0,0 +1,114 @@
+/*!
+	Shader Scripts.
+	zero copy parser for the quake3 .shader scripts of the mounted archives
+
+	Each script is inflated once into a single buffer ( stored entries of a
+	mapped archive are used in place ) and tokenized into string views,
+	so no token is copied. Scripts are parsed concurrently on the worker
+	pool, the merge keeps the order of the irrlicht loader: scripts in
+	archive order sorted by name, shaders in file order, the first
+	definition of a name wins.
+
+	Groups follow the SVarGroupList layout: group 0 holds the name,
+	group 1 the general keywords, group 2.. the stages.
+	Names are compared without case, the text keeps its case.
+
+	The game still takes its shaders from the level mesh, the quake3 scene
+	nodes need the IShader the dll builds. The library is only run by the
+	benchmark, against the load time loadAllShaders adds to a map.
+*/
+#ifndef __QUAKE3_SHADERSCRIPT__H_INCLUDED__
+#define __QUAKE3_SHADERSCRIPT__H_INCLUDED__
+
+#include <irrlicht.h>
+#include "profile.h"
+
+using namespace irr;
+
+class CMappedZipArchive;
+
+struct SStringView
+{
+	const c8 *Ptr;
+	u32 Length;
+
+	bool equals_ignore_case ( const c8 *s ) const;
+	core::stringc str () const { return core::stringc ( Ptr, Length ); }
+};
+
+struct SShaderVariable
+{
+	SStringView Name;
+	SStringView Content;
+};
+
+struct SShaderGroup
+{
+	u32 FirstVariable;
+	u32 VariableCount;
+};
+
+struct SShaderDef
+{
+	SStringView Name;
+	u32 Script;
+	u32 FirstGroup;
+	u32 GroupCount;
+};
+
+class CShaderLibrary
+{
+public:
+	CShaderLibrary ();
+	~CShaderLibrary ();
+
+	//! parse every scripts/*.shader of the mounted archives. returns the shader count
+	u32 loadScripts ( io::IFileSystem *fs, bool parallel = true );
+	void clear ();
+
+	//! index of a shader or -1
+	s32 findShader ( const c8 *name ) const;
+
+	u32 getShaderCount () const { return Shader.size (); }
+	const SShaderDef & getShader ( u32 index ) const { return Shader[index]; }
+
+	//! variables of a group, 0 if the shader has no such group
+	const SShaderVariable * getGroup ( u32 shader, u32 group, u32 &count ) const;
+
+	//! content of the first variable name in a group, empty view if not defined
+	SStringView get ( u32 shader, u32 group, const c8 *name ) const;
+
+	u32 getScriptCount () const { return Script.size (); }
+	u32 getErrorCount () const { return Errors; }
+
+	//! heap bytes of script buffers and token arrays
+	u32 getMemoryUsage () const;
+
+private:
+	struct SScript
+	{
+		io::path Name;
+		CMappedZipArchive *Archive;		// mapped source, or 0 when read through the file system
+		u32 Entry;
+		u8 *Owned;						// inflated or read text
+		const c8 *Text;
+		u32 Size;
+		bool Error;
+
+		core::array < SShaderDef, CCountingAllocator < SShaderDef > > Def;
+		core::array < SShaderGroup, CCountingAllocator < SShaderGroup > > Group;
+		core::array < SShaderVariable, CCountingAllocator < SShaderVariable > > Variable;
+	};
+
+	void collect ( io::IFileSystem *fs );
+	static void load ( SScript *script );
+	static void parse ( SScript *script );
+	void merge ();
+
+	core::array < SScript*, CCountingAllocator < SScript* > > Script;
+	core::array < SShaderDef, CCountingAllocator < SShaderDef > > Shader;
+	core::array < u32, CCountingAllocator < u32 > > Slot;			// name hash, shader + 1, 0 = empty
+	u32 Errors;
+};
+
+#endif // __QUAKE3_SHADERSCRIPT__H_INCLUDED__
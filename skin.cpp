@@ -0,0 +1,505 @@
+/*!
+	Skin Cache.
+	software skinning of one skinned mesh into poses shared by all instances
+*/
+
+#include "skin.h"
+#include "jobs.h"
+
+#if defined(_M_IX86) || defined(_M_X64) || defined(__SSE2__)
+#define SKIN_SSE2
+#include <emmintrin.h>
+#endif
+
+using namespace core;
+using namespace scene;
+using namespace video;
+
+static const s32 NO_POSE = -1;
+static const s32 REQUESTED = -2;
+
+CSkinCache::CSkinCache ()
+: Mesh ( 0 ), SubFrames ( 1 ), Capacity ( 0 ), JointCount ( 0 ), VertexCount ( 0 ),
+	Tick ( 1 ), Skinned ( 0 ), Hits ( 0 ), Shared ( 0 )
+{
+}
+
+CSkinCache::~CSkinCache ()
+{
+	clear ();
+}
+
+void CSkinCache::clear ()
+{
+	for ( u32 i = 0; i != Pose.size (); ++i )
+	{
+		Pose[i]->Mesh->drop ();
+		delete Pose[i];
+	}
+	Pose.clear ();
+
+	if ( Mesh )
+		Mesh->drop ();
+	Mesh = 0;
+
+	JointCount = 0;
+	VertexCount = 0;
+	Skinned = 0;
+	Hits = 0;
+	Shared = 0;
+	Block.clear ();
+	BufferBlock.clear ();
+	Parent.clear ();
+	Order.clear ();
+	Global.clear ();
+	Slot.clear ();
+	Missing.clear ();
+}
+
+bool CSkinCache::init ( ISkinnedMesh *mesh, u32 subFrames, u32 capacity )
+{
+	clear ();
+
+	if ( 0 == mesh || 0 == mesh->getMeshBufferCount () || mesh->getAllJoints ().size () >= 0xFFFF )
+		return false;
+
+	Mesh = mesh;
+	Mesh->grab ();
+	SubFrames = core::max_ ( subFrames, 1u );
+	Capacity = core::max_ ( capacity, 1u );
+
+	const array < ISkinnedMesh::SJoint* > &joints = mesh->getAllJoints ();
+	const array < SSkinMeshBuffer* > &buffers = mesh->getMeshBuffers ();
+	JointCount = joints.size ();
+
+	array < u32 > first;
+	for ( u32 b = 0; b != buffers.size (); ++b )
+	{
+		first.push_back ( VertexCount );
+		VertexCount += buffers[b]->getVertexCount ();
+	}
+
+	// the strongest weights of every vertex, sorted. the palette entry past the joints is the identity
+	array < f32 > weight;
+	array < u16 > joint;
+	array < f32 > total;
+	weight.set_used ( VertexCount * MAX_INFLUENCE );
+	joint.set_used ( VertexCount * MAX_INFLUENCE );
+	total.set_used ( VertexCount );
+	for ( u32 i = 0; i != weight.size (); ++i )
+	{
+		weight[i] = 0.f;
+		joint[i] = (u16) JointCount;
+	}
+	for ( u32 i = 0; i != VertexCount; ++i )
+		total[i] = 0.f;
+
+	for ( u32 j = 0; j != joints.size (); ++j )
+	{
+		const array < ISkinnedMesh::SWeight > &w = joints[j]->Weights;
+		for ( u32 k = 0; k != w.size (); ++k )
+		{
+			if ( w[k].buffer_id >= buffers.size () || w[k].vertex_id >= buffers [ w[k].buffer_id ]->getVertexCount () )
+				continue;
+
+			const u32 v = first [ w[k].buffer_id ] + w[k].vertex_id;
+			total[v] += w[k].strength;
+
+			f32 s = w[k].strength;
+			u16 n = (u16) j;
+			for ( u32 slot = 0; slot != MAX_INFLUENCE; ++slot )
+			{
+				if ( s > weight [ v * MAX_INFLUENCE + slot ] )
+				{
+					core::swap ( s, weight [ v * MAX_INFLUENCE + slot ] );
+					core::swap ( n, joint [ v * MAX_INFLUENCE + slot ] );
+				}
+			}
+		}
+	}
+
+	// dropped weights go to the kept ones, unweighted vertices stay in the bind pose
+	for ( u32 v = 0; v != VertexCount; ++v )
+	{
+		f32 *w = weight.pointer () + v * MAX_INFLUENCE;
+		const f32 kept = w[0] + w[1] + w[2] + w[3];
+		if ( kept <= 0.f )
+		{
+			w[0] = 1.f;
+			continue;
+		}
+		const f32 scale = total[v] / kept;
+		for ( u32 slot = 0; slot != MAX_INFLUENCE; ++slot )
+			w[slot] *= scale;
+	}
+
+	for ( u32 b = 0; b != buffers.size (); ++b )
+	{
+		BufferBlock.push_back ( Block.size () );
+
+		SSkinMeshBuffer *buffer = buffers[b];
+		const u32 count = buffer->getVertexCount ();
+		for ( u32 i = 0; i < count; i += 4 )
+		{
+			SBlock block;
+			block.Influences = 1;
+			for ( u32 lane = 0; lane != 4; ++lane )
+			{
+				const u32 v = i + lane < count ? i + lane : i;
+				const S3DVertex *vertex = buffer->getVertex ( v );
+				block.Position[0][lane] = vertex->Pos.X;
+				block.Position[1][lane] = vertex->Pos.Y;
+				block.Position[2][lane] = vertex->Pos.Z;
+				block.Normal[0][lane] = vertex->Normal.X;
+				block.Normal[1][lane] = vertex->Normal.Y;
+				block.Normal[2][lane] = vertex->Normal.Z;
+
+				const u32 g = ( first[b] + v ) * MAX_INFLUENCE;
+				for ( u32 slot = 0; slot != MAX_INFLUENCE; ++slot )
+				{
+					block.Weight[slot][lane] = weight [ g + slot ];
+					block.Joint[slot][lane] = joint [ g + slot ];
+					if ( weight [ g + slot ] > 0.f )
+						block.Influences = core::max_ ( block.Influences, slot + 1 );
+				}
+			}
+			Block.push_back ( block );
+		}
+	}
+	BufferBlock.push_back ( Block.size () );
+
+	// joints in tree order, every parent before its children
+	Parent.set_used ( JointCount );
+	for ( u32 j = 0; j != JointCount; ++j )
+		Parent[j] = -1;
+	for ( u32 j = 0; j != JointCount; ++j )
+	{
+		for ( u32 c = 0; c != joints[j]->Children.size (); ++c )
+		{
+			const s32 child = joints.linear_search ( joints[j]->Children[c] );
+			if ( child >= 0 )
+				Parent[child] = j;
+		}
+	}
+	for ( u32 j = 0; j != JointCount; ++j )
+	{
+		if ( Parent[j] < 0 )
+			Order.push_back ( j );
+	}
+	for ( u32 k = 0; k != Order.size (); ++k )
+	{
+		for ( u32 j = 0; j != JointCount; ++j )
+		{
+			if ( Parent[j] == (s32) Order[k] )
+				Order.push_back ( j );
+		}
+	}
+
+	Global.reallocate ( JointCount );
+	for ( u32 j = 0; j != JointCount; ++j )
+		Global.push_back ( matrix4 () );
+
+	const u32 keys = ( core::max_ ( mesh->getFrameCount (), 1u ) - 1 ) * SubFrames + 1;
+	Slot.set_used ( keys );
+	for ( u32 i = 0; i != keys; ++i )
+		Slot[i] = NO_POSE;
+
+	return true;
+}
+
+void CSkinCache::setMaterialTexture ( u32 layer, ITexture *texture )
+{
+	if ( 0 == Mesh || layer >= MATERIAL_MAX_TEXTURES )
+		return;
+
+	for ( u32 b = 0; b != Mesh->getMeshBufferCount (); ++b )
+		Mesh->getMeshBuffer ( b )->getMaterial ().setTexture ( layer, texture );
+	for ( u32 i = 0; i != Pose.size (); ++i )
+	{
+		for ( u32 b = 0; b != Pose[i]->Mesh->getMeshBufferCount (); ++b )
+			Pose[i]->Mesh->getMeshBuffer ( b )->getMaterial ().setTexture ( layer, texture );
+	}
+}
+
+void CSkinCache::setMaterialFlag ( E_MATERIAL_FLAG flag, bool value )
+{
+	if ( 0 == Mesh )
+		return;
+
+	for ( u32 b = 0; b != Mesh->getMeshBufferCount (); ++b )
+		Mesh->getMeshBuffer ( b )->getMaterial ().setFlag ( flag, value );
+	for ( u32 i = 0; i != Pose.size (); ++i )
+	{
+		for ( u32 b = 0; b != Pose[i]->Mesh->getMeshBufferCount (); ++b )
+			Pose[i]->Mesh->getMeshBuffer ( b )->getMaterial ().setFlag ( flag, value );
+	}
+}
+
+u32 CSkinCache::getKey ( f32 frame, u32 step ) const
+{
+	if ( Slot.empty () )
+		return 0;
+
+	step = core::max_ ( step, 1u );
+	const s32 key = core::round32 ( frame * SubFrames / step ) * step;
+	return (u32) core::clamp ( key, 0, (s32) Slot.size () - 1 );
+}
+
+void CSkinCache::request ( u32 key )
+{
+	if ( key >= Slot.size () )
+		return;
+
+	const s32 slot = Slot[key];
+	if ( slot >= 0 )
+	{
+		Pose[slot]->Used = Tick;
+		Shared += 1;
+	}
+	else if ( NO_POSE == slot )
+	{
+		Slot[key] = REQUESTED;
+		Missing.push_back ( key );
+	}
+	else
+	{
+		Shared += 1;
+	}
+}
+
+/*
+	the four lanes of a block, three rows of the joint matrices per slot.
+	a row of four lanes is transposed into one coefficient per register
+*/
+static inline void skinBlock ( const f32 Position[3][4], const f32 Normal[3][4],
+								const f32 Weight[][4], const u16 Joint[][4], u32 influences,
+								const f32 *palette, f32 out[6][4] )
+{
+#ifdef SKIN_SSE2
+	const __m128 px = _mm_loadu_ps ( Position[0] );
+	const __m128 py = _mm_loadu_ps ( Position[1] );
+	const __m128 pz = _mm_loadu_ps ( Position[2] );
+	const __m128 nx = _mm_loadu_ps ( Normal[0] );
+	const __m128 ny = _mm_loadu_ps ( Normal[1] );
+	const __m128 nz = _mm_loadu_ps ( Normal[2] );
+
+	__m128 o[6];
+	for ( u32 r = 0; r != 6; ++r )
+		o[r] = _mm_setzero_ps ();
+
+	for ( u32 s = 0; s != influences; ++s )
+	{
+		const __m128 w = _mm_loadu_ps ( Weight[s] );
+		const f32 *m0 = palette + Joint[s][0] * 12;
+		const f32 *m1 = palette + Joint[s][1] * 12;
+		const f32 *m2 = palette + Joint[s][2] * 12;
+		const f32 *m3 = palette + Joint[s][3] * 12;
+
+		for ( u32 r = 0; r != 3; ++r )
+		{
+			__m128 c0 = _mm_loadu_ps ( m0 + r * 4 );
+			__m128 c1 = _mm_loadu_ps ( m1 + r * 4 );
+			__m128 c2 = _mm_loadu_ps ( m2 + r * 4 );
+			__m128 c3 = _mm_loadu_ps ( m3 + r * 4 );
+			_MM_TRANSPOSE4_PS ( c0, c1, c2, c3 );
+
+			const __m128 p = _mm_add_ps ( _mm_add_ps ( _mm_mul_ps ( c0, px ), _mm_mul_ps ( c1, py ) ),
+										_mm_add_ps ( _mm_mul_ps ( c2, pz ), c3 ) );
+			const __m128 n = _mm_add_ps ( _mm_add_ps ( _mm_mul_ps ( c0, nx ), _mm_mul_ps ( c1, ny ) ),
+										_mm_mul_ps ( c2, nz ) );
+			o[r] = _mm_add_ps ( o[r], _mm_mul_ps ( w, p ) );
+			o[3 + r] = _mm_add_ps ( o[3 + r], _mm_mul_ps ( w, n ) );
+		}
+	}
+
+	for ( u32 r = 0; r != 6; ++r )
+		_mm_storeu_ps ( out[r], o[r] );
+#else
+	for ( u32 r = 0; r != 6; ++r )
+		for ( u32 lane = 0; lane != 4; ++lane )
+			out[r][lane] = 0.f;
+
+	for ( u32 s = 0; s != influences; ++s )
+	{
+		for ( u32 lane = 0; lane != 4; ++lane )
+		{
+			const f32 w = Weight[s][lane];
+			const f32 *m = palette + Joint[s][lane] * 12;
+			for ( u32 r = 0; r != 3; ++r, m += 4 )
+			{
+				out[r][lane] += w * ( m[0] * Position[0][lane] + m[1] * Position[1][lane] + m[2] * Position[2][lane] + m[3] );
+				out[3 + r][lane] += w * ( m[0] * Normal[0][lane] + m[1] * Normal[1][lane] + m[2] * Normal[2][lane] );
+			}
+		}
+	}
+#endif
+}
+
+// runs on a worker, touches only the vertices of its pose
+void CSkinCache::skinPose ( SPose &pose ) const
+{
+	for ( u32 b = 0; b + 1 < BufferBlock.size (); ++b )
+	{
+		SMeshBuffer *buffer = (SMeshBuffer*) pose.Mesh->getMeshBuffer ( b );
+		S3DVertex *vertex = buffer->Vertices.pointer ();
+		const u32 count = buffer->Vertices.size ();
+
+		f32 out[6][4];
+		aabbox3df box;
+		bool empty = true;
+		for ( u32 k = BufferBlock[b]; k != BufferBlock[b + 1]; ++k )
+		{
+			const SBlock &block = Block[k];
+			skinBlock ( block.Position, block.Normal, block.Weight, block.Joint, block.Influences,
+						pose.Palette.const_pointer (), out );
+
+			const u32 v = ( k - BufferBlock[b] ) * 4;
+			const u32 lanes = core::min_ ( 4u, count - v );
+			for ( u32 lane = 0; lane != lanes; ++lane )
+			{
+				S3DVertex &dst = vertex [ v + lane ];
+				dst.Pos.set ( out[0][lane], out[1][lane], out[2][lane] );
+				dst.Normal.set ( out[3][lane], out[4][lane], out[5][lane] );
+				if ( empty )
+					box.reset ( dst.Pos );
+				else
+					box.addInternalPoint ( dst.Pos );
+				empty = false;
+			}
+		}
+		buffer->BoundingBox = box;
+	}
+	pose.Mesh->recalculateBoundingBox ();
+}
+
+void CSkinCache::skin ()
+{
+	Skinned = Missing.size ();
+	Hits = Shared;
+	Shared = 0;
+
+	array < SPose* > work;
+	for ( u32 m = 0; m != Missing.size (); ++m )
+	{
+		const u32 key = Missing[m];
+
+		// the pose unused the longest, a new one while under capacity or all are in use
+		s32 victim = -1;
+		if ( Pose.size () >= Capacity )
+		{
+			for ( u32 i = 0; i != Pose.size (); ++i )
+			{
+				if ( Pose[i]->Used != Tick && ( victim < 0 || Pose[i]->Used < Pose[victim]->Used ) )
+					victim = i;
+			}
+		}
+
+		SPose *pose;
+		if ( victim >= 0 )
+		{
+			pose = Pose[victim];
+			Slot [ pose->Key ] = NO_POSE;
+		}
+		else
+		{
+			pose = new SPose ();
+			pose->Mesh = new SMesh ();
+			for ( u32 b = 0; b != Mesh->getMeshBuffers ().size (); ++b )
+			{
+				SSkinMeshBuffer *src = Mesh->getMeshBuffers ()[b];
+				SMeshBuffer *dst = new SMeshBuffer ();
+				dst->Material = src->Material;
+				dst->Vertices.set_used ( src->getVertexCount () );
+				for ( u32 v = 0; v != src->getVertexCount (); ++v )
+					dst->Vertices[v] = *src->getVertex ( v );
+				dst->Indices.set_used ( src->getIndexCount () );
+				memcpy ( dst->Indices.pointer (), src->getIndices (), src->getIndexCount () * sizeof ( u16 ) );
+				pose->Mesh->addMeshBuffer ( dst );
+				dst->drop ();
+			}
+			pose->Mesh->setHardwareMappingHint ( EHM_STATIC );
+			victim = Pose.size ();
+			Pose.push_back ( pose );
+		}
+
+		pose->Key = key;
+		pose->Used = Tick;
+		Slot[key] = victim;
+
+		/*
+			joints are animated on the shared mesh, so the palettes are taken here.
+			animateMesh only sets the local matrices, the global ones are left to
+			skinMesh, so they are chained down the tree here
+		*/
+		Mesh->animateMesh ( (f32) key / SubFrames, 1.f );
+		const array < ISkinnedMesh::SJoint* > &joints = Mesh->getAllJoints ();
+		for ( u32 k = 0; k != Order.size (); ++k )
+		{
+			const u32 j = Order[k];
+			if ( Parent[j] < 0 )
+				Global[j] = joints[j]->LocalAnimatedMatrix;
+			else
+				Global[j].setbyproduct ( Global [ Parent[j] ], joints[j]->LocalAnimatedMatrix );
+		}
+
+		pose->Palette.set_used ( ( JointCount + 1 ) * 12 );
+		f32 *p = pose->Palette.pointer ();
+		for ( u32 j = 0; j != JointCount + 1; ++j, p += 12 )
+		{
+			matrix4 m;
+			if ( j < JointCount )
+				m.setbyproduct ( Global[j], joints[j]->GlobalInversedMatrix );
+			for ( u32 r = 0; r != 3; ++r )
+			{
+				p [ r * 4 + 0 ] = m [ r ];
+				p [ r * 4 + 1 ] = m [ 4 + r ];
+				p [ r * 4 + 2 ] = m [ 8 + r ];
+				p [ r * 4 + 3 ] = m [ 12 + r ];
+			}
+		}
+		work.push_back ( pose );
+	}
+	Missing.set_used ( 0 );
+
+	const CSkinCache *self = this;
+	SPose **pose = work.pointer ();
+	getJobSystem ()->parallelFor ( 0, work.size (), 1, [self, pose] ( u32 first, u32 last )
+	{
+		for ( u32 i = first; i != last; ++i )
+			self->skinPose ( *pose[i] );
+	} );
+
+	for ( u32 i = 0; i != work.size (); ++i )
+		work[i]->Mesh->setDirty ( EBT_VERTEX );
+
+	Tick += 1;
+}
+
+IMesh * CSkinCache::getPose ( u32 key ) const
+{
+	if ( key >= Slot.size () || Slot[key] < 0 )
+		return 0;
+	return Pose [ Slot[key] ]->Mesh;
+}
+
+const f32 * CSkinCache::getPalette ( u32 key ) const
+{
+	if ( key >= Slot.size () || Slot[key] < 0 )
+		return 0;
+	return Pose [ Slot[key] ]->Palette.const_pointer ();
+}
+
+u32 CSkinCache::getMemoryFootprint () const
+{
+	u32 bytes = Block.allocated_size () * sizeof ( SBlock );
+	for ( u32 i = 0; i != Pose.size (); ++i )
+	{
+		bytes += Pose[i]->Palette.allocated_size () * sizeof ( f32 );
+		for ( u32 b = 0; b != Pose[i]->Mesh->getMeshBufferCount (); ++b )
+		{
+			const IMeshBuffer *buffer = Pose[i]->Mesh->getMeshBuffer ( b );
+			bytes += buffer->getVertexCount () * sizeof ( S3DVertex ) + buffer->getIndexCount () * sizeof ( u16 );
+		}
+	}
+	return bytes;
+}
@@ -0,0 +1,104 @@
+/*!
+	Skin Cache.
+	software skinning of one skinned mesh into poses shared by all instances
+
+	Instances of a mesh play the frames of a few clips, so the skinned
+	vertices are cached per frame instead of per instance. A frame is
+	rounded to a grid of sub frames, all instances on the same grid point
+	draw the same static mesh, which stays in a hardware buffer until the
+	pose is evicted for another one. Vertices are skinned in blocks of
+	four, the positions, normals and up to four joint weights of a block
+	are stored by field so SSE2 transforms the four lanes at once.
+*/
+#ifndef __QUAKE3_SKIN__H_INCLUDED__
+#define __QUAKE3_SKIN__H_INCLUDED__
+
+#include <irrlicht.h>
+
+using namespace irr;
+
+class CSkinCache
+{
+public:
+	CSkinCache ();
+	~CSkinCache ();
+
+	//! copies the bind pose. the mesh must not have been skinned by a scene node
+	bool init ( scene::ISkinnedMesh *mesh, u32 subFrames = 4, u32 capacity = 256 );
+	void clear ();
+
+	//! applied to all poses, like the scene node calls
+	void setMaterialTexture ( u32 layer, video::ITexture *texture );
+	void setMaterialFlag ( video::E_MATERIAL_FLAG flag, bool value );
+
+	//! pose of frame. step > 1 snaps to a coarser grid, more instances share the pose
+	u32 getKey ( f32 frame, u32 step = 1 ) const;
+
+	//! the pose is needed this tick, kept from eviction
+	void request ( u32 key );
+
+	//! skins the requested poses that are not cached, on the worker pool
+	void skin ();
+
+	//! mesh of a key requested before the last skin (), 0 otherwise
+	scene::IMesh * getPose ( u32 key ) const;
+
+	//! joint matrices of a cached pose, three rows of four per joint and the identity last. 0 if not cached
+	const f32 * getPalette ( u32 key ) const;
+	u32 getJointCount () const { return JointCount; }
+
+	u32 getSubFrames () const { return SubFrames; }
+	u32 getPoseCount () const { return Pose.size (); }
+	u32 getVertexCount () const { return VertexCount; }
+
+	//! poses skinned and requests served from the cache in the last skin ()
+	u32 getSkinnedCount () const { return Skinned; }
+	u32 getHitCount () const { return Hits; }
+
+	//! heap bytes of the blocks and the pose vertices
+	u32 getMemoryFootprint () const;
+
+private:
+	enum { MAX_INFLUENCE = 4 };
+
+	//! four vertices by field. padding lanes repeat the first vertex
+	struct SBlock
+	{
+		f32 Position[3][4];
+		f32 Normal[3][4];
+		f32 Weight[MAX_INFLUENCE][4];
+		u16 Joint[MAX_INFLUENCE][4];
+		u32 Influences;			// slots used by any lane
+	};
+
+	struct SPose
+	{
+		scene::SMesh *Mesh;
+		u32 Key;
+		u32 Used;				// tick of the last request
+		core::array < f32 > Palette;	// three rows of four per joint
+	};
+
+	void skinPose ( SPose &pose ) const;
+
+	scene::ISkinnedMesh *Mesh;
+	u32 SubFrames;
+	u32 Capacity;
+	u32 JointCount;
+	u32 VertexCount;
+	u32 Tick;
+	u32 Skinned;
+	u32 Hits;
+	u32 Shared;				// requests served since the last skin ()
+
+	core::array < SBlock > Block;
+	core::array < u32 > BufferBlock;	// blocks of buffer b are BufferBlock[b] .. BufferBlock[b+1]
+	core::array < s32 > Parent;			// per joint, -1 for roots
+	core::array < u32 > Order;			// joints, parents before children
+	core::array < core::matrix4 > Global;	// animated joint to mesh space, scratch of skin ()
+	core::array < s32 > Slot;			// pose of a key, -1 none, -2 requested
+	core::array < u32 > Missing;
+	core::array < SPose* > Pose;
+};
+
+#endif // __QUAKE3_SKIN__H_INCLUDED__
@@ -0,0 +1,398 @@
+/*!
+	Spatial Hash.
+	uniform grid broadphase for moving entities ( enemies, projectiles, items )
+*/
+
+#include "spatialhash.h"
+#include <float.h>
+#include <string.h>
+
+using namespace core;
+
+/*
+	an entity sits in the cell of its center only. queries widen their
+	box by the largest radius, so a big entity is still found next door.
+	a query spanning more cells than this scans the whole sorted list
+*/
+static const s32 MAX_QUERY_CELLS = 4096;
+
+// ray cells are checked with their neighbours, more reach scans the list
+static const s32 MAX_RAY_REACH = 2;
+
+static inline s32 cellOf ( f32 v, f32 inv )
+{
+	return (s32) floorf ( v * inv );
+}
+
+static inline u32 hashCell ( s32 x, s32 y, s32 z )
+{
+	return ( (u32) x * 73856093u ) ^ ( (u32) y * 19349663u ) ^ ( (u32) z * 83492791u );
+}
+
+CSpatialHash::CSpatialHash ( f32 cellSize )
+: CellSize ( cellSize ), NextCellSize ( cellSize ), InvCell ( 1.f / cellSize ), MaxRadius ( 0.f ), Mask ( 0 )
+{
+}
+
+void CSpatialHash::setCellSize ( f32 size )
+{
+	if ( size > 0.f )
+		NextCellSize = size;
+}
+
+u32 CSpatialHash::add ( const vector3df &position, f32 radius )
+{
+	u32 id;
+	if ( Free.size () )
+	{
+		id = Free.getLast ();
+		Free.erase ( Free.size () - 1 );
+	}
+	else
+	{
+		id = X.size ();
+		X.push_back ( 0.f );
+		Y.push_back ( 0.f );
+		Z.push_back ( 0.f );
+		R.push_back ( 0.f );
+	}
+
+	move ( id, position );
+	R[id] = core::max_ ( radius, 0.f );
+	return id;
+}
+
+void CSpatialHash::remove ( u32 id )
+{
+	if ( id >= R.size () || R[id] < 0.f )
+		return;
+
+	R[id] = -1.f;
+	Free.push_back ( id );
+}
+
+void CSpatialHash::clear ()
+{
+	X.clear ();
+	Y.clear ();
+	Z.clear ();
+	R.clear ();
+	Free.clear ();
+
+	Start.clear ();
+	SX.clear ();
+	SY.clear ();
+	SZ.clear ();
+	SR.clear ();
+	SId.clear ();
+	SCell.clear ();
+	MaxRadius = 0.f;
+	Mask = 0;
+}
+
+/*
+	counting sort by bucket: count, prefix sum, scatter.
+	the scatter advances Start[b] to the end of bucket b, shifting it
+	down by one bucket afterwards gives the start again
+*/
+void CSpatialHash::update ()
+{
+	CellSize = NextCellSize;
+	InvCell = 1.f / CellSize;
+
+	const u32 count = X.size ();
+	const u32 live = count - Free.size ();
+
+	u32 table = 64;
+	while ( table < live * 2 )
+		table <<= 1;
+	Mask = table - 1;
+
+	Start.set_used ( table + 1 );
+	memset ( Start.pointer (), 0, ( table + 1 ) * sizeof ( u32 ) );
+
+	MaxRadius = 0.f;
+	for ( u32 i = 0; i != count; ++i )
+	{
+		if ( R[i] < 0.f )
+			continue;
+		const u32 b = hashCell ( cellOf ( X[i], InvCell ), cellOf ( Y[i], InvCell ), cellOf ( Z[i], InvCell ) ) & Mask;
+		Start [ b + 1 ] += 1;
+		MaxRadius = core::max_ ( MaxRadius, R[i] );
+	}
+
+	for ( u32 b = 0; b != table; ++b )
+		Start [ b + 1 ] += Start[b];
+
+	SX.set_used ( live );
+	SY.set_used ( live );
+	SZ.set_used ( live );
+	SR.set_used ( live );
+	SId.set_used ( live );
+	SCell.set_used ( live * 3 );
+
+	for ( u32 i = 0; i != count; ++i )
+	{
+		if ( R[i] < 0.f )
+			continue;
+		const s32 cx = cellOf ( X[i], InvCell );
+		const s32 cy = cellOf ( Y[i], InvCell );
+		const s32 cz = cellOf ( Z[i], InvCell );
+		const u32 s = Start [ hashCell ( cx, cy, cz ) & Mask ]++;
+
+		SX[s] = X[i];
+		SY[s] = Y[i];
+		SZ[s] = Z[i];
+		SR[s] = R[i];
+		SId[s] = i;
+		SCell [ s * 3 + 0 ] = cx;
+		SCell [ s * 3 + 1 ] = cy;
+		SCell [ s * 3 + 2 ] = cz;
+	}
+
+	for ( u32 b = table; b != 0; --b )
+		Start[b] = Start [ b - 1 ];
+	Start[0] = 0;
+}
+
+// cells covering box widened by the largest radius. false if too many
+bool CSpatialHash::cellRange ( const aabbox3df &box, s32 *lo, s32 *hi ) const
+{
+	lo[0] = cellOf ( box.MinEdge.X - MaxRadius, InvCell );
+	lo[1] = cellOf ( box.MinEdge.Y - MaxRadius, InvCell );
+	lo[2] = cellOf ( box.MinEdge.Z - MaxRadius, InvCell );
+	hi[0] = cellOf ( box.MaxEdge.X + MaxRadius, InvCell );
+	hi[1] = cellOf ( box.MaxEdge.Y + MaxRadius, InvCell );
+	hi[2] = cellOf ( box.MaxEdge.Z + MaxRadius, InvCell );
+
+	const f32 cells = ( hi[0] - lo[0] + 1.f ) * ( hi[1] - lo[1] + 1.f ) * ( hi[2] - lo[2] + 1.f );
+	return cells <= MAX_QUERY_CELLS;
+}
+
+/*
+	visits every entity that may touch box once, the cell check skips
+	entities of other cells hashed into the same bucket
+*/
+template < class T >
+static inline void visitCells ( const s32 *lo, const s32 *hi, u32 mask, const u32 *start, const s32 *cell, T &test )
+{
+	for ( s32 z = lo[2]; z <= hi[2]; ++z )
+	for ( s32 y = lo[1]; y <= hi[1]; ++y )
+	for ( s32 x = lo[0]; x <= hi[0]; ++x )
+	{
+		const u32 b = hashCell ( x, y, z ) & mask;
+		for ( u32 i = start[b]; i != start [ b + 1 ]; ++i )
+		{
+			const s32 *c = cell + i * 3;
+			if ( c[0] == x && c[1] == y && c[2] == z )
+				test ( i );
+		}
+	}
+}
+
+struct SRadiusTest
+{
+	const f32 *X, *Y, *Z, *R;
+	const u32 *Id;
+	vector3df Center;
+	f32 Radius;
+	array < u32 > *Out;
+
+	void operator () ( u32 i )
+	{
+		const f32 dx = X[i] - Center.X;
+		const f32 dy = Y[i] - Center.Y;
+		const f32 dz = Z[i] - Center.Z;
+		const f32 reach = Radius + R[i];
+		if ( dx * dx + dy * dy + dz * dz <= reach * reach )
+			Out->push_back ( Id[i] );
+	}
+};
+
+struct SBoxTest
+{
+	const f32 *X, *Y, *Z, *R;
+	const u32 *Id;
+	aabbox3df Box;
+	array < u32 > *Out;
+
+	void operator () ( u32 i )
+	{
+		const f32 r = R[i];
+		if (	X[i] + r >= Box.MinEdge.X && X[i] - r <= Box.MaxEdge.X &&
+				Y[i] + r >= Box.MinEdge.Y && Y[i] - r <= Box.MaxEdge.Y &&
+				Z[i] + r >= Box.MinEdge.Z && Z[i] - r <= Box.MaxEdge.Z )
+			Out->push_back ( Id[i] );
+	}
+};
+
+u32 CSpatialHash::queryRadius ( const vector3df &center, f32 radius, array < u32 > &out ) const
+{
+	const u32 first = out.size ();
+	if ( SId.empty () )
+		return 0;
+
+	SRadiusTest test;
+	test.X = SX.const_pointer ();
+	test.Y = SY.const_pointer ();
+	test.Z = SZ.const_pointer ();
+	test.R = SR.const_pointer ();
+	test.Id = SId.const_pointer ();
+	test.Center = center;
+	test.Radius = radius;
+	test.Out = &out;
+
+	s32 lo[3];
+	s32 hi[3];
+	if ( cellRange ( aabbox3df ( center - vector3df ( radius ), center + vector3df ( radius ) ), lo, hi ) )
+		visitCells ( lo, hi, Mask, Start.const_pointer (), SCell.const_pointer (), test );
+	else
+	{
+		for ( u32 i = 0; i != SId.size (); ++i )
+			test ( i );
+	}
+
+	return out.size () - first;
+}
+
+u32 CSpatialHash::queryBox ( const aabbox3df &box, array < u32 > &out ) const
+{
+	const u32 first = out.size ();
+	if ( SId.empty () )
+		return 0;
+
+	SBoxTest test;
+	test.X = SX.const_pointer ();
+	test.Y = SY.const_pointer ();
+	test.Z = SZ.const_pointer ();
+	test.R = SR.const_pointer ();
+	test.Id = SId.const_pointer ();
+	test.Box = box;
+	test.Out = &out;
+
+	s32 lo[3];
+	s32 hi[3];
+	if ( cellRange ( box, lo, hi ) )
+		visitCells ( lo, hi, Mask, Start.const_pointer (), SCell.const_pointer (), test );
+	else
+	{
+		for ( u32 i = 0; i != SId.size (); ++i )
+			test ( i );
+	}
+
+	return out.size () - first;
+}
+
+// entry t of the segment into sphere i, or a value above best
+static inline f32 raySphere ( const vector3df &start, const vector3df &dir, f32 a,
+							f32 x, f32 y, f32 z, f32 r, f32 best )
+{
+	const vector3df f ( start.X - x, start.Y - y, start.Z - z );
+	const f32 c = f.dotProduct ( f ) - r * r;
+	if ( c <= 0.f )
+		return 0.f;
+
+	const f32 b = f.dotProduct ( dir );
+	if ( b >= 0.f )
+		return best + 1.f;
+
+	const f32 det = b * b - a * c;
+	if ( det < 0.f )
+		return best + 1.f;
+
+	return ( -b - sqrtf ( det ) ) / a;
+}
+
+/*
+	3d dda along the segment. an entity hit at t has its cell within
+	reach of the cell the segment is in at t, so once a cell is entered
+	behind the best hit nothing nearer can follow
+*/
+bool CSpatialHash::raycast ( const line3df &ray, f32 &t, u32 &id, u32 ignore ) const
+{
+	if ( SId.empty () )
+		return false;
+
+	const vector3df start = ray.start;
+	const vector3df dir = ray.end - ray.start;
+	const f32 a = dir.dotProduct ( dir );
+	if ( a <= 0.f )
+		return false;
+
+	f32 best = 1.f;
+	s32 bestSlot = -1;
+
+	const s32 reach = (s32) ceilf ( MaxRadius * InvCell );
+	if ( reach > MAX_RAY_REACH )
+	{
+		for ( u32 i = 0; i != SId.size (); ++i )
+		{
+			if ( SId[i] == ignore )
+				continue;
+			const f32 h = raySphere ( start, dir, a, SX[i], SY[i], SZ[i], SR[i], best );
+			if ( h <= best )
+			{
+				best = h;
+				bestSlot = i;
+			}
+		}
+	}
+	else
+	{
+		s32 c[3] = { cellOf ( start.X, InvCell ), cellOf ( start.Y, InvCell ), cellOf ( start.Z, InvCell ) };
+		s32 step[3];
+		f32 tMax[3];
+		f32 tDelta[3];
+		for ( u32 k = 0; k != 3; ++k )
+		{
+			const f32 s = k == 0 ? start.X : k == 1 ? start.Y : start.Z;
+			const f32 d = k == 0 ? dir.X : k == 1 ? dir.Y : dir.Z;
+			step[k] = d > 0.f ? 1 : d < 0.f ? -1 : 0;
+			tDelta[k] = step[k] ? CellSize / fabsf ( d ) : FLT_MAX;
+			tMax[k] =	step[k] > 0 ? ( ( c[k] + 1 ) * CellSize - s ) / d :
+						step[k] < 0 ? ( c[k] * CellSize - s ) / d : FLT_MAX;
+		}
+
+		f32 enter = 0.f;
+		while ( enter <= best )
+		{
+			for ( s32 z = c[2] - reach; z <= c[2] + reach; ++z )
+			for ( s32 y = c[1] - reach; y <= c[1] + reach; ++y )
+			for ( s32 x = c[0] - reach; x <= c[0] + reach; ++x )
+			{
+				const u32 b = hashCell ( x, y, z ) & Mask;
+				for ( u32 i = Start[b]; i != Start [ b + 1 ]; ++i )
+				{
+					if ( SId[i] == ignore )
+						continue;
+					const f32 h = raySphere ( start, dir, a, SX[i], SY[i], SZ[i], SR[i], best );
+					if ( h <= best )
+					{
+						best = h;
+						bestSlot = i;
+					}
+				}
+			}
+
+			const u32 k = tMax[0] < tMax[1] ? ( tMax[0] < tMax[2] ? 0 : 2 ) : ( tMax[1] < tMax[2] ? 1 : 2 );
+			enter = tMax[k];
+			c[k] += step[k];
+			tMax[k] += tDelta[k];
+		}
+	}
+
+	if ( bestSlot < 0 )
+		return false;
+
+	t = best;
+	id = SId [ bestSlot ];
+	return true;
+}
+
+u32 CSpatialHash::getMemoryFootprint () const
+{
+	return	( X.allocated_size () + Y.allocated_size () + Z.allocated_size () + R.allocated_size () +
+			SX.allocated_size () + SY.allocated_size () + SZ.allocated_size () + SR.allocated_size () ) * sizeof ( f32 ) +
+			( Free.allocated_size () + Start.allocated_size () + SId.allocated_size () ) * sizeof ( u32 ) +
+			SCell.allocated_size () * sizeof ( s32 );
+}
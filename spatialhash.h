@@ -0,0 +1,83 @@
+/*!
+	Spatial Hash.
+	uniform grid broadphase for moving entities ( enemies, projectiles, items )
+
+	Entities are kept by id in structure of arrays. update () sorts them
+	into hashed grid cells with a counting sort, the sorted copy is what
+	the queries read. Between two updates the grid is read only, any
+	number of threads may query while the game moves the entities with
+	move (). Moves become visible with the next update ().
+*/
+#ifndef __QUAKE3_SPATIALHASH__H_INCLUDED__
+#define __QUAKE3_SPATIALHASH__H_INCLUDED__
+
+#include <irrlicht.h>
+
+using namespace irr;
+
+class CSpatialHash
+{
+public:
+	//! a cell should be about twice the radius of a typical entity
+	CSpatialHash ( f32 cellSize = 128.f );
+
+	//! takes effect on the next update
+	void setCellSize ( f32 size );
+	f32 getCellSize () const { return CellSize; }
+
+	//! entity id, stays valid until removed
+	u32 add ( const core::vector3df &position, f32 radius );
+	void remove ( u32 id );
+	void clear ();
+
+	void move ( u32 id, const core::vector3df &position ) { X[id] = position.X; Y[id] = position.Y; Z[id] = position.Z; }
+	void setRadius ( u32 id, f32 radius ) { R[id] = radius; }
+
+	core::vector3df getPosition ( u32 id ) const { return core::vector3df ( X[id], Y[id], Z[id] ); }
+	f32 getRadius ( u32 id ) const { return R[id]; }
+
+	//! sort the entities into the grid, no query may run meanwhile
+	void update ();
+
+	//! ids of the entities whose sphere touches the sphere, appended to out. returns the number found
+	u32 queryRadius ( const core::vector3df &center, f32 radius, core::array < u32 > &out ) const;
+
+	//! ids of the entities whose bounding box overlaps box
+	u32 queryBox ( const core::aabbox3df &box, core::array < u32 > &out ) const;
+
+	//! nearest entity hit by the segment, t in [0,1] along it. ignore skips the shooter
+	bool raycast ( const core::line3df &ray, f32 &t, u32 &id, u32 ignore = 0xFFFFFFFF ) const;
+
+	//! entities in the grid as of the last update
+	u32 getCount () const { return SId.size (); }
+
+	//! heap bytes held by the arrays
+	u32 getMemoryFootprint () const;
+
+private:
+	bool cellRange ( const core::aabbox3df &box, s32 *lo, s32 *hi ) const;
+
+	f32 CellSize;
+	f32 NextCellSize;
+	f32 InvCell;
+	f32 MaxRadius;
+	u32 Mask;
+
+	// by id, radius < 0 marks a free slot
+	core::array < f32 > X;
+	core::array < f32 > Y;
+	core::array < f32 > Z;
+	core::array < f32 > R;
+	core::array < u32 > Free;
+
+	// grid order, bucket b holds Start[b] .. Start[b+1]
+	core::array < u32 > Start;
+	core::array < f32 > SX;
+	core::array < f32 > SY;
+	core::array < f32 > SZ;
+	core::array < f32 > SR;
+	core::array < u32 > SId;
+	core::array < s32 > SCell;		// 3 per entity, tells apart cells sharing a bucket
+};
+
+#endif // __QUAKE3_SPATIALHASH__H_INCLUDED__
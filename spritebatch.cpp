@@ -0,0 +1,511 @@
+/*!
+	Sprite Batch.
+	bullets and impact smoke drawn as camera facing quads from one scenenode
+*/
+
+#include "spritebatch.h"
+#include "occlusion.h"
+#include "random.h"
+
+#if defined(_M_IX86) || defined(_M_X64) || defined(__SSE2__)
+#define SPRITEBATCH_SSE2
+#include <emmintrin.h>
+#endif
+
+using namespace core;
+using namespace scene;
+using namespace video;
+
+static const u32 NO_EMITTER = 0xFFFFFFFF;
+
+// 16 bit indices reach 65536 vertices, four per quad
+static const u32 MAX_QUADS = 16384;
+
+// corners right up, right down, left down, left up: clockwise on screen, front facing
+static const u16 QUAD_INDEX[6] = { 0, 1, 2, 0, 2, 3 };
+
+CSpriteBatchSceneNode::CSpriteBatchSceneNode ( ISceneNode *parent, ISceneManager *mgr, s32 id )
+: ISceneNode ( parent, mgr, id ), BoundsValid ( false ), Occlusion ( 0 ), TimeMs ( 0 ), Drawn ( 0 ), DrawCalls ( 0 )
+{
+#ifdef _DEBUG
+	setDebugName ( "CSpriteBatchSceneNode" );
+#endif
+	Box.reset ( 0.f, 0.f, 0.f );
+
+	// culled here per emitter
+	setAutomaticCulling ( EAC_OFF );
+}
+
+void CSpriteBatchSceneNode::clear ()
+{
+	Material.clear ();
+	Emitter.clear ();
+	Bounds.clear ();
+	BoundsValid = false;
+
+	X.set_used ( 0 );
+	Y.set_used ( 0 );
+	Z.set_used ( 0 );
+	VelocityX.set_used ( 0 );
+	VelocityY.set_used ( 0 );
+	VelocityZ.set_used ( 0 );
+	HalfSize.set_used ( 0 );
+	Color.set_used ( 0 );
+	StartColor.set_used ( 0 );
+	Death.set_used ( 0 );
+	FadeOut.set_used ( 0 );
+	Group.set_used ( 0 );
+	Owner.set_used ( 0 );
+	Drawn = 0;
+}
+
+u32 CSpriteBatchSceneNode::getGroup ( ITexture *texture, E_MATERIAL_TYPE blend )
+{
+	for ( u32 g = 0; g != Material.size (); ++g )
+		if ( Material[g].getTexture ( 0 ) == texture && Material[g].MaterialType == blend )
+			return g;
+
+	SMaterial m;
+	m.Lighting = false;
+	m.ZWriteEnable = false;
+	m.MaterialType = blend;
+	m.setTexture ( 0, texture );
+	Material.push_back ( m );
+	return Material.size () - 1;
+}
+
+void CSpriteBatchSceneNode::push ( u32 group, u32 owner, const vector3df &pos, const vector3df &velocity,
+								f32 halfSize, SColor color, u32 death, u32 fadeOut )
+{
+	X.push_back ( pos.X );
+	Y.push_back ( pos.Y );
+	Z.push_back ( pos.Z );
+	VelocityX.push_back ( velocity.X );
+	VelocityY.push_back ( velocity.Y );
+	VelocityZ.push_back ( velocity.Z );
+	HalfSize.push_back ( halfSize );
+	Color.push_back ( color.color );
+	StartColor.push_back ( color.color );
+	Death.push_back ( death );
+	FadeOut.push_back ( fadeOut );
+	Group.push_back ( group );
+	Owner.push_back ( owner );
+}
+
+void CSpriteBatchSceneNode::addSprite ( ITexture *texture, E_MATERIAL_TYPE blend, f32 size,
+									const vector3df &start, const vector3df &end, u32 now, u32 time )
+{
+	if ( 0 == time )
+		return;
+
+	push ( getGroup ( texture, blend ), NO_EMITTER, start, ( end - start ) / (f32) time,
+		size * 0.5f, SColor ( 255, 255, 255, 255 ), now + time, 0 );
+}
+
+void CSpriteBatchSceneNode::addEmitter ( const SSpriteEmitterDesc &desc, const vector3df &position, f32 reach, u32 now, u32 lifeTime )
+{
+	SEmitter e;
+	e.Desc = desc;
+	e.Position = position;
+	e.Reach = reach;
+	e.Group = getGroup ( desc.Texture, desc.Blend );
+	e.Death = now + lifeTime;
+	e.Time = 0.f;
+	Emitter.push_back ( e );
+	BoundsValid = false;
+}
+
+void CSpriteBatchSceneNode::OnAnimate ( u32 timeMs )
+{
+	const u32 elapsed = TimeMs ? timeMs - TimeMs : 0;
+	TimeMs = timeMs;
+	update ( timeMs, elapsed );
+
+	ISceneNode::OnAnimate ( timeMs );
+}
+
+/*
+	emits like the box emitter of the engine: a particle rate picked per
+	call between min and max, as many particles as the time since the last
+	one covers
+*/
+void CSpriteBatchSceneNode::emit ( u32 emitter, u32 now, u32 elapsed )
+{
+	SEmitter &e = Emitter[emitter];
+	const SSpriteEmitterDesc &d = e.Desc;
+	CRandom &r = getRandom ( RANDOM_PARTICLE );
+
+	e.Time += elapsed;
+	const u32 spread = d.MaxPerSecond - d.MinPerSecond;
+	const f32 perSecond = spread ? d.MinPerSecond + r.frand () * spread : (f32) d.MinPerSecond;
+	const f32 every = 1000.f / core::max_ ( perSecond, 1.f );
+	if ( e.Time <= every )
+		return;
+
+	const u32 amount = core::min_ ( (u32) ( e.Time / every + 0.5f ), d.MaxPerSecond * 2 );
+	e.Time = 0.f;
+
+	for ( u32 i = 0; i != amount; ++i )
+	{
+		const vector3df pos = e.Position + vector3df ( r.frand ( d.Box.MinEdge.X, d.Box.MaxEdge.X ),
+													r.frand ( d.Box.MinEdge.Y, d.Box.MaxEdge.Y ),
+													r.frand ( d.Box.MinEdge.Z, d.Box.MaxEdge.Z ) );
+		vector3df velocity = d.Direction;
+		if ( d.MaxAngle > 0.f )
+		{
+			velocity.rotateXYBy ( r.frand () * d.MaxAngle );
+			velocity.rotateYZBy ( r.frand () * d.MaxAngle );
+			velocity.rotateXZBy ( r.frand () * d.MaxAngle );
+		}
+
+		const u32 life = d.MinLife + r.rand ( d.MaxLife - d.MinLife );
+		const SColor color = d.MinColor.getInterpolated ( d.MaxColor, r.frand () );
+		const f32 size = r.frand ( d.MinSize, d.MaxSize );
+
+		push ( e.Group, emitter, pos, velocity, size * 0.5f, color, now + life, d.FadeOut );
+	}
+}
+
+void CSpriteBatchSceneNode::update ( u32 now, u32 elapsed )
+{
+	// emitters past their life time go, their particles with them
+	Remap.set_used ( Emitter.size () );
+	u32 alive = 0;
+	for ( u32 e = 0; e != Emitter.size (); ++e )
+	{
+		if ( now >= Emitter[e].Death )
+		{
+			Remap[e] = NO_EMITTER;
+			continue;
+		}
+		Remap[e] = alive;
+		if ( alive != e )
+			Emitter[alive] = Emitter[e];
+		alive += 1;
+	}
+	if ( alive != Emitter.size () )
+	{
+		Emitter.erase ( alive, Emitter.size () - alive );
+		BoundsValid = false;
+	}
+
+	// dead sprites are overwritten by the next living one, the colors fade out
+	u32 n = 0;
+	for ( u32 i = 0; i != Death.size (); ++i )
+	{
+		const u32 owner = Owner[i] == NO_EMITTER ? NO_EMITTER : Remap[ Owner[i] ];
+		if ( now >= Death[i] || ( Owner[i] != NO_EMITTER && owner == NO_EMITTER ) )
+			continue;
+
+		X[n] = X[i];
+		Y[n] = Y[i];
+		Z[n] = Z[i];
+		VelocityX[n] = VelocityX[i];
+		VelocityY[n] = VelocityY[i];
+		VelocityZ[n] = VelocityZ[i];
+		HalfSize[n] = HalfSize[i];
+		StartColor[n] = StartColor[i];
+		Death[n] = Death[i];
+		FadeOut[n] = FadeOut[i];
+		Group[n] = Group[i];
+		Owner[n] = owner;
+
+		const u32 left = Death[i] - now;
+		Color[n] = left < FadeOut[i] ?
+			SColor ( StartColor[i] ).getInterpolated ( SColor ( 0, 0, 0, 0 ), (f32) left / FadeOut[i] ).color :
+			StartColor[i];
+		n += 1;
+	}
+
+	X.set_used ( n );
+	Y.set_used ( n );
+	Z.set_used ( n );
+	VelocityX.set_used ( n );
+	VelocityY.set_used ( n );
+	VelocityZ.set_used ( n );
+	HalfSize.set_used ( n );
+	Color.set_used ( n );
+	StartColor.set_used ( n );
+	Death.set_used ( n );
+	FadeOut.set_used ( n );
+	Group.set_used ( n );
+	Owner.set_used ( n );
+
+	// move
+	const f32 dt = (f32) elapsed;
+	f32 *x = X.pointer (), *y = Y.pointer (), *z = Z.pointer ();
+	const f32 *vx = VelocityX.const_pointer (), *vy = VelocityY.const_pointer (), *vz = VelocityZ.const_pointer ();
+	u32 i = 0;
+#ifdef SPRITEBATCH_SSE2
+	const __m128 t = _mm_set1_ps ( dt );
+	for ( ; i + 4 <= n; i += 4 )
+	{
+		_mm_storeu_ps ( x + i, _mm_add_ps ( _mm_loadu_ps ( x + i ), _mm_mul_ps ( _mm_loadu_ps ( vx + i ), t ) ) );
+		_mm_storeu_ps ( y + i, _mm_add_ps ( _mm_loadu_ps ( y + i ), _mm_mul_ps ( _mm_loadu_ps ( vy + i ), t ) ) );
+		_mm_storeu_ps ( z + i, _mm_add_ps ( _mm_loadu_ps ( z + i ), _mm_mul_ps ( _mm_loadu_ps ( vz + i ), t ) ) );
+	}
+#endif
+	for ( ; i != n; ++i )
+	{
+		x[i] += vx[i] * dt;
+		y[i] += vy[i] * dt;
+		z[i] += vz[i] * dt;
+	}
+
+	for ( u32 e = 0; e != Emitter.size (); ++e )
+		emit ( e, now, elapsed );
+}
+
+void CSpriteBatchSceneNode::OnRegisterSceneNode ()
+{
+	Drawn = 0;
+	DrawCalls = 0;
+	if ( IsVisible && Death.size () )
+	{
+		if ( Emitter.size () )
+		{
+			if ( !BoundsValid )
+			{
+				Bounds.clear ();
+				for ( u32 e = 0; e != Emitter.size (); ++e )
+				{
+					const vector3df reach ( Emitter[e].Reach );
+					Bounds.add ( aabbox3df ( Emitter[e].Position - reach, Emitter[e].Position + reach ) );
+				}
+				BoundsValid = true;
+			}
+
+			ICameraSceneNode *camera = SceneManager->getActiveCamera ();
+			const SViewFrustum *frustum = camera ? camera->getViewFrustum () : 0;
+
+			u32 visible = Emitter.size ();
+			if ( frustum )
+				visible = Bounds.cull ( *frustum, Visible );
+			else
+				Bounds.fill ( Visible );
+
+			if ( Occlusion && visible )
+				Occlusion->cull ( Bounds, Visible );
+		}
+
+		gather ();
+		if ( Drawn )
+			SceneManager->registerNodeForRendering ( this, ESNRP_TRANSPARENT );
+	}
+
+	ISceneNode::OnRegisterSceneNode ();
+}
+
+// the sprites of visible emitters and all bullets, counting sorted by group
+void CSpriteBatchSceneNode::gather ()
+{
+	GroupStart.set_used ( Material.size () + 1 );
+	for ( u32 g = 0; g != GroupStart.size (); ++g )
+		GroupStart[g] = 0;
+
+	const u32 n = Death.size ();
+	for ( u32 i = 0; i != n; ++i )
+		if ( Owner[i] == NO_EMITTER || CBoxCuller::isVisible ( Visible, Owner[i] ) )
+			GroupStart[ Group[i] + 1 ] += 1;
+
+	for ( u32 g = 1; g != GroupStart.size (); ++g )
+		GroupStart[g] += GroupStart[g - 1];
+	Drawn = GroupStart.getLast ();
+
+	DrawX.set_used ( Drawn );
+	DrawY.set_used ( Drawn );
+	DrawZ.set_used ( Drawn );
+	DrawSize.set_used ( Drawn );
+	DrawColor.set_used ( Drawn );
+
+	// GroupStart[g] runs to the end of g while filling, then is shifted back
+	for ( u32 i = 0; i != n; ++i )
+	{
+		if ( Owner[i] != NO_EMITTER && !CBoxCuller::isVisible ( Visible, Owner[i] ) )
+			continue;
+
+		const u32 at = GroupStart[ Group[i] ]++;
+		DrawX[at] = X[i];
+		DrawY[at] = Y[i];
+		DrawZ[at] = Z[i];
+		DrawSize[at] = HalfSize[i];
+		DrawColor[at] = Color[i];
+	}
+	for ( u32 g = GroupStart.size () - 1; g != 0; --g )
+		GroupStart[g] = GroupStart[g - 1];
+	GroupStart[0] = 0;
+}
+
+/*
+	right and up of the screen, left handed like the camera: right is
+	up x view with view from the camera to the target
+*/
+void CSpriteBatchSceneNode::getFacing ( const vector3df &position, const vector3df &target, const vector3df &upVector,
+										vector3df &right, vector3df &up, vector3df &normal )
+{
+	vector3df view = target - position;
+	view.normalize ();
+	right = upVector.crossProduct ( view );
+	if ( right.getLengthSQ () == 0.f )
+		right.set ( 0.f, 0.f, 1.f );
+	right.normalize ();
+	up = view.crossProduct ( right );
+	up.normalize ();
+	normal = -view;
+}
+
+bool CSpriteBatchSceneNode::isFrontFacing ( const vector3df &position, const vector3df &target, const vector3df &upVector )
+{
+	vector3df right, up, normal;
+	getFacing ( position, target, upVector, right, up, normal );
+
+	const f32 halfSize = 1.f;
+	const u32 color = 0xFFFFFFFF;
+	S3DVertex v[4];
+	buildQuadsScalar ( &target.X, &target.Y, &target.Z, &halfSize, &color, 1, right, up, normal, v );
+
+	// clockwise after the perspective divide, y up, is the front
+	matrix4 view;
+	view.buildCameraLookAtMatrixLH ( position, target, upVector );
+	for ( u32 t = 0; t != 6; t += 3 )
+	{
+		f32 sx[3], sy[3];
+		for ( u32 k = 0; k != 3; ++k )
+		{
+			vector3df p;
+			view.transformVect ( p, v [ QUAD_INDEX[t + k] ].Pos );
+			if ( p.Z <= 0.f )
+				return false;
+			sx[k] = p.X / p.Z;
+			sy[k] = p.Y / p.Z;
+		}
+		const f32 area = ( sx[1] - sx[0] ) * ( sy[2] - sy[0] ) - ( sy[1] - sy[0] ) * ( sx[2] - sx[0] );
+		if ( area >= 0.f )
+			return false;
+	}
+	return true;
+}
+
+void CSpriteBatchSceneNode::buildQuadsScalar ( const f32 *x, const f32 *y, const f32 *z, const f32 *halfSize, const u32 *color, u32 count,
+											const vector3df &right, const vector3df &up, const vector3df &normal, S3DVertex *out )
+{
+	const vector3df a = right + up;
+	const vector3df b = right - up;
+
+	for ( u32 i = 0; i != count; ++i )
+	{
+		const vector3df p ( x[i], y[i], z[i] );
+		const f32 s = halfSize[i];
+		S3DVertex *v = out + i * 4;
+
+		v[0].Pos = p + a * s;
+		v[1].Pos = p + b * s;
+		v[2].Pos = p - a * s;
+		v[3].Pos = p - b * s;
+
+		v[0].TCoords.set ( 1.f, 0.f );
+		v[1].TCoords.set ( 1.f, 1.f );
+		v[2].TCoords.set ( 0.f, 1.f );
+		v[3].TCoords.set ( 0.f, 0.f );
+
+		for ( u32 k = 0; k != 4; ++k )
+		{
+			v[k].Normal = normal;
+			v[k].Color.color = color[i];
+		}
+	}
+}
+
+void CSpriteBatchSceneNode::buildQuads ( const f32 *x, const f32 *y, const f32 *z, const f32 *halfSize, const u32 *color, u32 count,
+										const vector3df &right, const vector3df &up, const vector3df &normal, S3DVertex *out )
+{
+	u32 i = 0;
+#ifdef SPRITEBATCH_SSE2
+	// four sprites a step, the corners per axis: p + a s, p + b s, p - a s, p - b s
+	const __m128 ax = _mm_set1_ps ( right.X + up.X ), bx = _mm_set1_ps ( right.X - up.X );
+	const __m128 ay = _mm_set1_ps ( right.Y + up.Y ), by = _mm_set1_ps ( right.Y - up.Y );
+	const __m128 az = _mm_set1_ps ( right.Z + up.Z ), bz = _mm_set1_ps ( right.Z - up.Z );
+	static const f32 tu[4] = { 1.f, 1.f, 0.f, 0.f };
+	static const f32 tv[4] = { 0.f, 1.f, 1.f, 0.f };
+
+	for ( ; i + 4 <= count; i += 4 )
+	{
+		const __m128 s = _mm_loadu_ps ( halfSize + i );
+		const __m128 px = _mm_loadu_ps ( x + i ), py = _mm_loadu_ps ( y + i ), pz = _mm_loadu_ps ( z + i );
+		const __m128 sax = _mm_mul_ps ( ax, s ), sbx = _mm_mul_ps ( bx, s );
+		const __m128 say = _mm_mul_ps ( ay, s ), sby = _mm_mul_ps ( by, s );
+		const __m128 saz = _mm_mul_ps ( az, s ), sbz = _mm_mul_ps ( bz, s );
+
+		// corner, lane
+		f32 cx[4][4], cy[4][4], cz[4][4];
+		_mm_storeu_ps ( cx[0], _mm_add_ps ( px, sax ) );
+		_mm_storeu_ps ( cx[1], _mm_add_ps ( px, sbx ) );
+		_mm_storeu_ps ( cx[2], _mm_sub_ps ( px, sax ) );
+		_mm_storeu_ps ( cx[3], _mm_sub_ps ( px, sbx ) );
+		_mm_storeu_ps ( cy[0], _mm_add_ps ( py, say ) );
+		_mm_storeu_ps ( cy[1], _mm_add_ps ( py, sby ) );
+		_mm_storeu_ps ( cy[2], _mm_sub_ps ( py, say ) );
+		_mm_storeu_ps ( cy[3], _mm_sub_ps ( py, sby ) );
+		_mm_storeu_ps ( cz[0], _mm_add_ps ( pz, saz ) );
+		_mm_storeu_ps ( cz[1], _mm_add_ps ( pz, sbz ) );
+		_mm_storeu_ps ( cz[2], _mm_sub_ps ( pz, saz ) );
+		_mm_storeu_ps ( cz[3], _mm_sub_ps ( pz, sbz ) );
+
+		S3DVertex *v = out + i * 4;
+		for ( u32 lane = 0; lane != 4; ++lane )
+		{
+			for ( u32 k = 0; k != 4; ++k, ++v )
+			{
+				v->Pos.set ( cx[k][lane], cy[k][lane], cz[k][lane] );
+				v->Normal = normal;
+				v->Color.color = color[i + lane];
+				v->TCoords.set ( tu[k], tv[k] );
+			}
+		}
+	}
+#endif
+	buildQuadsScalar ( x + i, y + i, z + i, halfSize + i, color + i, count - i, right, up, normal, out + i * 4 );
+}
+
+void CSpriteBatchSceneNode::render ()
+{
+	ICameraSceneNode *camera = SceneManager->getActiveCamera ();
+	if ( 0 == camera || 0 == Drawn )
+		return;
+
+	// one facing for all sprites
+	vector3df right, up, normal;
+	getFacing ( camera->getAbsolutePosition (), camera->getTarget (), camera->getUpVector (), right, up, normal );
+
+	Vertex.set_used ( Drawn * 4 );
+	buildQuads ( DrawX.const_pointer (), DrawY.const_pointer (), DrawZ.const_pointer (), DrawSize.const_pointer (),
+		DrawColor.const_pointer (), Drawn, right, up, normal, Vertex.pointer () );
+
+	const u32 quads = core::min_ ( Drawn, MAX_QUADS );
+	for ( u32 q = Index.size () / 6; q < quads; ++q )
+	{
+		const u16 base = (u16) ( q * 4 );
+		for ( u32 k = 0; k != 6; ++k )
+			Index.push_back ( base + QUAD_INDEX[k] );
+	}
+
+	IVideoDriver *driver = SceneManager->getVideoDriver ();
+	driver->setTransform ( ETS_WORLD, IdentityMatrix );
+
+	for ( u32 g = 0; g != Material.size (); ++g )
+	{
+		const u32 first = GroupStart[g];
+		const u32 last = GroupStart[g + 1];
+		if ( first == last )
+			continue;
+
+		driver->setMaterial ( Material[g] );
+		for ( u32 q = first; q < last; q += MAX_QUADS )
+		{
+			const u32 count = core::min_ ( last - q, MAX_QUADS );
+			driver->drawVertexPrimitiveList ( Vertex.const_pointer () + q * 4, count * 4, Index.const_pointer (), count * 2,
+				EVT_STANDARD, EPT_TRIANGLES, EIT_16BIT );
+			DrawCalls += 1;
+		}
+	}
+}
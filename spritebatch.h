@@ -0,0 +1,158 @@
+/*!
+	Sprite Batch.
+	bullets and impact smoke drawn as camera facing quads from one scenenode
+
+	A bullet was a billboard node with a fly straight and a delete
+	animator, the smoke of an impact two particle system nodes, each one
+	setting its material and drawing on its own. Here sprites are rows in
+	arrays by field: position, velocity, size, color, death. Emitters add
+	particles the way the box emitter and fade out affector of the engine
+	do, bullets are sprites moving from start to end. Each frame the sprites
+	of visible emitters are gathered by texture and blend mode, their quads
+	built four at a time with SSE2 into one growing vertex array, and every
+	group is drawn with one call.
+
+	Emitters are culled by their box against the view frustum and, with an
+	occlusion culler, against the depth of the last frame. Hidden emitters
+	keep emitting, only their particles are not drawn.
+*/
+#ifndef __QUAKE3_SPRITEBATCH__H_INCLUDED__
+#define __QUAKE3_SPRITEBATCH__H_INCLUDED__
+
+#include <irrlicht.h>
+#include "boxcull.h"
+
+using namespace irr;
+
+class COcclusionCuller;
+
+//! particles of an emitter, as the box emitter and fade out affector take them
+struct SSpriteEmitterDesc
+{
+	video::ITexture *Texture;
+	video::E_MATERIAL_TYPE Blend;
+	core::aabbox3df Box;			// around the position
+	core::vector3df Direction;		// units per ms
+	u32 MinPerSecond;
+	u32 MaxPerSecond;
+	video::SColor MinColor;
+	video::SColor MaxColor;
+	u32 MinLife;
+	u32 MaxLife;
+	f32 MaxAngle;					// degrees
+	f32 MinSize;
+	f32 MaxSize;
+	u32 FadeOut;					// ms before death the color fades to black
+};
+
+class CSpriteBatchSceneNode : public scene::ISceneNode
+{
+public:
+	CSpriteBatchSceneNode ( scene::ISceneNode *parent, scene::ISceneManager *mgr, s32 id = -1 );
+
+	//! a sprite flying from start to end in time ms, removed there
+	void addSprite ( video::ITexture *texture, video::E_MATERIAL_TYPE blend, f32 size,
+					const core::vector3df &start, const core::vector3df &end, u32 now, u32 time );
+
+	//! emits until now + lifeTime, its particles die with it. reach is the half extent of the box culled
+	void addEmitter ( const SSpriteEmitterDesc &desc, const core::vector3df &position, f32 reach, u32 now, u32 lifeTime );
+
+	void clear ();
+
+	//! rendered for this frame before the sprites register, 0 for none
+	void setOcclusion ( COcclusionCuller *occlusion ) { Occlusion = occlusion; }
+
+	u32 getSpriteCount () const { return Death.size (); }
+	u32 getEmitterCount () const { return Emitter.size (); }
+
+	//! sprites and draw calls of the last frame
+	u32 getDrawnCount () const { return Drawn; }
+	u32 getDrawCalls () const { return DrawCalls; }
+
+	//! screen right and up seen from position, normal points back at it
+	static void getFacing ( const core::vector3df &position, const core::vector3df &target, const core::vector3df &upVector,
+							core::vector3df &right, core::vector3df &up, core::vector3df &normal );
+
+	//! true if both triangles of a sprite at target turn their front to a camera at position
+	static bool isFrontFacing ( const core::vector3df &position, const core::vector3df &target, const core::vector3df &upVector );
+
+	/*!
+		two triangles per sprite facing along normal, the corners are
+		position +- ( right +- up ) * half size
+	*/
+	static void buildQuads ( const f32 *x, const f32 *y, const f32 *z, const f32 *halfSize, const u32 *color, u32 count,
+							const core::vector3df &right, const core::vector3df &up, const core::vector3df &normal,
+							video::S3DVertex *out );
+
+	//! plain loop, the same vertices
+	static void buildQuadsScalar ( const f32 *x, const f32 *y, const f32 *z, const f32 *halfSize, const u32 *color, u32 count,
+							const core::vector3df &right, const core::vector3df &up, const core::vector3df &normal,
+							video::S3DVertex *out );
+
+	virtual void OnAnimate ( u32 timeMs );
+	virtual void OnRegisterSceneNode ();
+	virtual void render ();
+
+	virtual const core::aabbox3d<f32>& getBoundingBox () const { return Box; }
+	virtual u32 getMaterialCount () const { return Material.size (); }
+	virtual video::SMaterial& getMaterial ( u32 i ) { return Material[i]; }
+
+private:
+	struct SEmitter
+	{
+		SSpriteEmitterDesc Desc;
+		core::vector3df Position;
+		f32 Reach;
+		u32 Group;
+		u32 Death;
+		f32 Time;					// since the last particle
+	};
+
+	u32 getGroup ( video::ITexture *texture, video::E_MATERIAL_TYPE blend );
+	void push ( u32 group, u32 owner, const core::vector3df &pos, const core::vector3df &velocity,
+				f32 halfSize, video::SColor color, u32 death, u32 fadeOut );
+	void emit ( u32 emitter, u32 now, u32 elapsed );
+	void update ( u32 now, u32 elapsed );
+	void gather ();
+
+	core::array < video::SMaterial > Material;	// one per texture and blend mode, the group
+
+	core::array < SEmitter > Emitter;
+	CBoxCuller Bounds;
+	core::array < u32 > Visible;				// bit per emitter
+	core::array < u32 > Remap;					// old emitter index to new, ~0 if dead
+	bool BoundsValid;
+
+	// sprites, structure of arrays
+	core::array < f32 > X;
+	core::array < f32 > Y;
+	core::array < f32 > Z;
+	core::array < f32 > VelocityX;				// units per ms
+	core::array < f32 > VelocityY;
+	core::array < f32 > VelocityZ;
+	core::array < f32 > HalfSize;
+	core::array < u32 > Color;
+	core::array < u32 > StartColor;
+	core::array < u32 > Death;
+	core::array < u32 > FadeOut;
+	core::array < u32 > Group;
+	core::array < u32 > Owner;					// emitter index, ~0 for bullets
+
+	// visible sprites of the frame gathered by group
+	core::array < u32 > GroupStart;				// group count + 1 entries
+	core::array < f32 > DrawX;
+	core::array < f32 > DrawY;
+	core::array < f32 > DrawZ;
+	core::array < f32 > DrawSize;
+	core::array < u32 > DrawColor;
+	core::array < video::S3DVertex > Vertex;
+	core::array < u16 > Index;					// the same two triangles per quad
+
+	COcclusionCuller *Occlusion;
+	core::aabbox3d<f32> Box;
+	u32 TimeMs;
+	u32 Drawn;
+	u32 DrawCalls;
+};
+
+#endif // __QUAKE3_SPRITEBATCH__H_INCLUDED__
@@ -0,0 +1,282 @@
+/*!
+	Parallel Traversal.
+	the subtrees under one group node animated and culled on the workers
+*/
+
+#include "traversal.h"
+#include "jobs.h"
+#include "profile.h"
+
+#include <string.h>
+
+using namespace core;
+using namespace scene;
+using namespace video;
+
+static const u32 CHUNK_ENTRIES = 64;
+
+// OnAnimate of these only updates the node itself
+static bool isLeafType ( ESCENE_NODE_TYPE type )
+{
+	return type == ESNT_Q3SHADER_SCENE_NODE || type == ESNT_MESH || type == ESNT_BILLBOARD ||
+		type == ESNT_TEXT || type == ESNT_CUBE || type == ESNT_SPHERE;
+}
+
+static bool isPlain ( ISceneNode *node )
+{
+	return node->getAnimators ().empty () && node->getChildren ().empty ();
+}
+
+CParallelSceneNode::CParallelSceneNode ( ISceneNode *parent, ISceneManager *mgr, s32 id )
+: ISceneNode ( parent, mgr, id ), ChildCount ( 0 ), Valid ( false ), Stale ( false ), Culled ( 0 )
+{
+#ifdef _DEBUG
+	setDebugName ( "CParallelSceneNode" );
+#endif
+	memset ( &Stats, 0, sizeof ( Stats ) );
+	Box.reset ( 0.f, 0.f, 0.f );
+
+	// a group, the leaves are culled one by one
+	setAutomaticCulling ( EAC_OFF );
+}
+
+CParallelSceneNode::~CParallelSceneNode ()
+{
+	release ();
+}
+
+void CParallelSceneNode::release ()
+{
+	for ( u32 i = 0; i != Entry.size (); ++i )
+	{
+		if ( Entry[i].Kind == ENTRY_LEAF )
+			Entry[i].Node->setAutomaticCulling ( Entry[i].Culling );
+		Entry[i].Node->drop ();
+	}
+	Entry.clear ();
+	Serial.clear ();
+}
+
+void CParallelSceneNode::walk ()
+{
+	release ();
+
+	ChildCount = Children.getSize ();
+	for ( ISceneNodeList::Iterator it = Children.begin (); it != Children.end (); ++it )
+		walk ( *it, -1 );
+
+	GroupVisible.set_used ( Entry.size () );
+	DrawList.clear ();
+	for ( u32 c = 0; c * CHUNK_ENTRIES < Entry.size (); ++c )
+		DrawList.push_back ( array < u32 > () );
+
+	Stats.Groups = 0;
+	Stats.Leaves = 0;
+	Stats.Serial = Serial.size ();
+	for ( u32 i = 0; i != Entry.size (); ++i )
+	{
+		Stats.Groups += Entry[i].Kind == ENTRY_GROUP ? 1 : 0;
+		Stats.Leaves += Entry[i].Kind == ENTRY_LEAF ? 1 : 0;
+	}
+	Stats.Chunks = DrawList.size ();
+	Stats.Walks += 1;
+
+	Valid = true;
+	Stale = false;
+}
+
+void CParallelSceneNode::walk ( ISceneNode *node, s32 parent )
+{
+	SEntry e;
+	e.Node = node;
+	e.Parent = parent;
+	e.ChildCount = 0;
+	e.Culling = node->getAutomaticCulling ();
+
+	if ( node->getType () == ESNT_EMPTY && node->getAnimators ().empty () )
+		e.Kind = ENTRY_GROUP;
+	else if ( isLeafType ( node->getType () ) && isPlain ( node ) )
+		e.Kind = ENTRY_LEAF;
+	else
+		e.Kind = ENTRY_SERIAL;
+
+	node->grab ();
+	Entry.push_back ( e );
+
+	const s32 self = Entry.size () - 1;
+	if ( e.Kind == ENTRY_LEAF )
+		node->setAutomaticCulling ( EAC_OFF );
+	else if ( e.Kind == ENTRY_SERIAL )
+		Serial.push_back ( self );
+	else
+	{
+		const ISceneNodeList &children = node->getChildren ();
+		Entry[self].ChildCount = children.getSize ();
+		for ( ISceneNodeList::ConstIterator it = children.begin (); it != children.end (); ++it )
+			walk ( *it, self );
+	}
+}
+
+bool CParallelSceneNode::changed () const
+{
+	if ( !Valid || Stale || Children.getSize () != ChildCount )
+		return true;
+
+	for ( u32 i = 0; i != Entry.size (); ++i )
+	{
+		const SEntry &e = Entry[i];
+		if ( e.Kind == ENTRY_GROUP && e.Node->getChildren ().getSize () != e.ChildCount )
+			return true;
+	}
+	return false;
+}
+
+// groups come before their children, the parent is done first
+void CParallelSceneNode::updateGroups ()
+{
+	for ( u32 i = 0; i != Entry.size (); ++i )
+	{
+		const SEntry &e = Entry[i];
+		GroupVisible[i] = 0;
+		if ( e.Kind != ENTRY_GROUP || !isParentVisible ( e ) || !e.Node->isVisible () )
+			continue;
+
+		e.Node->updateAbsolutePosition ();
+		GroupVisible[i] = 1;
+	}
+}
+
+void CParallelSceneNode::animateChunk ( u32 chunk, u32 timeMs )
+{
+	const u32 last = core::min_ ( ( chunk + 1 ) * CHUNK_ENTRIES, Entry.size () );
+	for ( u32 i = chunk * CHUNK_ENTRIES; i != last; ++i )
+	{
+		const SEntry &e = Entry[i];
+		if ( e.Kind != ENTRY_LEAF || !isParentVisible ( e ) )
+			continue;
+
+		// changed since the walk, the main thread takes it this frame
+		if ( !isPlain ( e.Node ) || 0 == e.Node->getParent () )
+		{
+			Stale = true;
+			continue;
+		}
+		e.Node->OnAnimate ( timeMs );
+	}
+}
+
+void CParallelSceneNode::OnAnimate ( u32 timeMs )
+{
+	if ( !IsVisible )
+		return;
+
+	updateAbsolutePosition ();
+	if ( changed () )
+		walk ();
+
+	const u64 start = getTimeMicro ();
+	updateGroups ();
+
+	CParallelSceneNode *self = this;
+	getJobSystem ()->parallelFor ( 0, DrawList.size (), 1, [self, timeMs] ( u32 first, u32 last )
+	{
+		for ( u32 c = first; c != last; ++c )
+			self->animateChunk ( c, timeMs );
+	} );
+
+	for ( u32 k = 0; k != Serial.size (); ++k )
+	{
+		const SEntry &e = Entry[ Serial[k] ];
+		if ( isParentVisible ( e ) )
+			e.Node->OnAnimate ( timeMs );
+	}
+
+	// leaves which got animators or children since the walk
+	if ( Stale )
+	{
+		for ( u32 i = 0; i != Entry.size (); ++i )
+		{
+			const SEntry &e = Entry[i];
+			if ( e.Kind == ENTRY_LEAF && isParentVisible ( e ) && e.Node->getParent () && !isPlain ( e.Node ) )
+				e.Node->OnAnimate ( timeMs );
+		}
+	}
+
+	Stats.AnimateMicro = (u32) ( getTimeMicro () - start );
+}
+
+void CParallelSceneNode::cullChunk ( u32 chunk, const SViewFrustum *frustum )
+{
+	array < u32 > &list = DrawList[chunk];
+	list.set_used ( 0 );
+
+	u32 culled = 0;
+	const u32 last = core::min_ ( ( chunk + 1 ) * CHUNK_ENTRIES, Entry.size () );
+	for ( u32 i = chunk * CHUNK_ENTRIES; i != last; ++i )
+	{
+		const SEntry &e = Entry[i];
+		if ( e.Kind == ENTRY_GROUP || !isParentVisible ( e ) || !e.Node->isVisible () )
+			continue;
+
+		if ( e.Kind == ENTRY_SERIAL )
+		{
+			list.push_back ( i );
+			continue;
+		}
+
+		if ( 0 == e.Node->getParent () )
+		{
+			Stale = true;
+			continue;
+		}
+
+		// the transformed box against the planes, as the box tests of the scene manager
+		bool visible = true;
+		if ( frustum && e.Culling != EAC_OFF && isPlain ( e.Node ) )
+		{
+			const aabbox3df box = e.Node->getTransformedBoundingBox ();
+			visible = box.intersectsWithBox ( frustum->getBoundingBox () );
+			for ( u32 p = 0; visible && p != SViewFrustum::VF_PLANE_COUNT; ++p )
+				visible = box.classifyPlaneRelation ( frustum->planes[p] ) != ISREL3D_FRONT;
+		}
+
+		if ( visible )
+			list.push_back ( i );
+		else
+			culled += 1;
+	}
+	Culled += culled;
+}
+
+void CParallelSceneNode::OnRegisterSceneNode ()
+{
+	if ( !IsVisible || !Valid )
+		return;
+
+	const u64 start = getTimeMicro ();
+
+	ICameraSceneNode *camera = SceneManager->getActiveCamera ();
+	const SViewFrustum *frustum = camera ? camera->getViewFrustum () : 0;
+
+	Culled = 0;
+	CParallelSceneNode *self = this;
+	getJobSystem ()->parallelFor ( 0, DrawList.size (), 1, [self, frustum] ( u32 first, u32 last )
+	{
+		for ( u32 c = first; c != last; ++c )
+			self->cullChunk ( c, frustum );
+	} );
+
+	// the lists in chunk order are the tree order
+	u32 registered = 0;
+	for ( u32 c = 0; c != DrawList.size (); ++c )
+	{
+		const array < u32 > &list = DrawList[c];
+		for ( u32 k = 0; k != list.size (); ++k )
+			Entry[ list[k] ].Node->OnRegisterSceneNode ();
+		registered += list.size ();
+	}
+
+	Stats.Culled = Culled;
+	Stats.Registered = registered;
+	Stats.CullMicro = (u32) ( getTimeMicro () - start );
+}
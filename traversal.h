@@ -0,0 +1,107 @@
+/*!
+	Parallel Traversal.
+	the subtrees under one group node animated and culled on the workers
+
+	drawAll walks the scene graph on the main thread: OnAnimate down the
+	tree, then OnRegisterSceneNode, where every node is tested against the
+	frustum as it registers. The item, shader, fog and bullet parents sit
+	under this node instead. Their subtrees are walked once into a flat
+	list in tree order: empty nodes are groups, leaves of node types that
+	only touch themselves in OnAnimate are run on the workers, anything
+	else, custom nodes and nodes with animators, stays on the main thread
+	with its whole subtree.
+
+	The list is split into chunks. In OnAnimate the workers update the
+	transforms of the leaves, the main thread runs the serial entries. In
+	OnRegisterSceneNode every chunk is culled on a worker into a draw list
+	of its own: the leaves inside the frustum and the serial entries. The
+	main thread merges the lists in chunk order, so in tree order, and
+	registers the nodes. It stays the only thread calling the scene
+	manager and the video driver. The leaves are culled here, their own
+	test in the scene manager is turned off while they belong to the node.
+
+	The list is walked again when a group gains or loses children, or a
+	leaf gets children or animators.
+*/
+#ifndef __QUAKE3_TRAVERSAL__H_INCLUDED__
+#define __QUAKE3_TRAVERSAL__H_INCLUDED__
+
+#include <irrlicht.h>
+#include <atomic>
+
+using namespace irr;
+
+//! counters of the last frame
+struct SParallelStats
+{
+	u32 Groups;
+	u32 Leaves;			// animated and culled on the workers
+	u32 Serial;			// subtrees left to the main thread
+	u32 Chunks;
+	u32 Culled;			// leaves outside the frustum
+	u32 Registered;		// leaves and serial entries registered
+	u32 AnimateMicro;
+	u32 CullMicro;		// cull and merge
+	u32 Walks;			// since the node was created
+};
+
+class CParallelSceneNode : public scene::ISceneNode
+{
+public:
+	CParallelSceneNode ( scene::ISceneNode *parent, scene::ISceneManager *mgr, s32 id = -1 );
+
+	//! gives the leaves their culling back
+	virtual ~CParallelSceneNode ();
+
+	//! walk the subtrees again before the next frame
+	void invalidate () { Valid = false; }
+
+	const SParallelStats & getStats () const { return Stats; }
+
+	virtual void OnAnimate ( u32 timeMs );
+	virtual void OnRegisterSceneNode ();
+	virtual void render () {}
+
+	virtual const core::aabbox3d<f32>& getBoundingBox () const { return Box; }
+
+private:
+	enum eEntry
+	{
+		ENTRY_GROUP,
+		ENTRY_LEAF,
+		ENTRY_SERIAL
+	};
+
+	struct SEntry
+	{
+		scene::ISceneNode *Node;
+		s32 Parent;						// group entry, -1 for this node
+		u32 Kind;
+		u32 ChildCount;					// of groups when walked
+		u32 Culling;					// of leaves before they were taken
+	};
+
+	void walk ();
+	void walk ( scene::ISceneNode *node, s32 parent );
+	void release ();
+	bool changed () const;
+	void updateGroups ();
+	bool isParentVisible ( const SEntry &e ) const { return e.Parent < 0 || GroupVisible[e.Parent] != 0; }
+
+	void animateChunk ( u32 chunk, u32 timeMs );
+	void cullChunk ( u32 chunk, const scene::SViewFrustum *frustum );
+
+	core::array < SEntry > Entry;		// tree order
+	core::array < u8 > GroupVisible;	// by entry, set for visible groups
+	core::array < core::array < u32 > > DrawList;	// entries to register, per chunk
+	core::array < u32 > Serial;			// serial entries, in order
+	u32 ChildCount;						// of this node when walked
+	bool Valid;
+	std::atomic < bool > Stale;			// set by a worker, walked next frame
+	std::atomic < u32 > Culled;
+
+	core::aabbox3d<f32> Box;
+	SParallelStats Stats;
+};
+
+#endif // __QUAKE3_TRAVERSAL__H_INCLUDED__
@@ -0,0 +1,99 @@
+/*!
+	Variable Table.
+	hashed lookup of the variables of a quake3 SVarGroup
+*/
+
+#include "vartable.h"
+
+using namespace core;
+using namespace scene;
+using namespace quake3;
+
+CStringPool & getSymbols ()
+{
+	static CStringPool symbols;
+	return symbols;
+}
+
+// symbol ids are dense, a multiplicative hash spreads them
+static inline u32 hashSymbol ( u32 symbol )
+{
+	return symbol * 2654435761u;
+}
+
+void CVarTable::build ( const SVarGroup *group )
+{
+	Group = group;
+	const u32 count = group ? group->Variable.size () : 0;
+
+	Symbol.set_used ( count );
+	Next.set_used ( count );
+
+	u32 slots = 8;
+	while ( slots < count * 2 )
+		slots <<= 1;
+	Slot.set_used ( slots );
+	memset ( Slot.pointer (), 0, slots * sizeof ( u32 ) );
+
+	const u32 mask = slots - 1;
+	CStringPool &symbols = getSymbols ();
+
+	// backwards, so every chain runs in variable order
+	for ( s32 i = (s32) count - 1; i >= 0; --i )
+	{
+		const stringc &name = group->Variable[i].name;
+		const u32 s = symbols.intern ( name.c_str (), name.size () );
+		Symbol[i] = s;
+		Next[i] = -1;
+
+		u32 slot = hashSymbol ( s ) & mask;
+		while ( Slot[slot] && Symbol[ Slot[slot] - 1 ] != s )
+			slot = ( slot + 1 ) & mask;
+
+		if ( Slot[slot] )
+			Next[i] = Slot[slot] - 1;
+		Slot[slot] = i + 1;
+	}
+}
+
+s32 CVarTable::first ( u32 symbol ) const
+{
+	if ( Slot.empty () )
+		return -1;
+
+	const u32 mask = Slot.size () - 1;
+	for ( u32 slot = hashSymbol ( symbol ) & mask; Slot[slot]; slot = ( slot + 1 ) & mask )
+	{
+		if ( Symbol[ Slot[slot] - 1 ] == symbol )
+			return Slot[slot] - 1;
+	}
+	return -1;
+}
+
+const stringc & CVarTable::get ( u32 symbol ) const
+{
+	const s32 i = first ( symbol );
+	return i >= 0 ? Group->Variable[i].content : irrEmptyStringc;
+}
+
+u32 CVarTable::isDefined ( u32 symbol, const c8 *content ) const
+{
+	for ( s32 i = first ( symbol ); i >= 0; i = Next[i] )
+	{
+		if ( 0 == content || strstr ( Group->Variable[i].content.c_str (), content ) )
+			return i + 1;
+	}
+	return 0;
+}
+
+const stringc & CVarTable::get ( const c8 *name ) const
+{
+	const s32 s = getSymbols ().find ( name );
+	return s >= 0 ? get ( (u32) s ) : irrEmptyStringc;
+}
+
+u32 CVarTable::isDefined ( const c8 *name, const c8 *content ) const
+{
+	const s32 s = getSymbols ().find ( name );
+	return s >= 0 ? isDefined ( (u32) s, content ) : 0;
+}
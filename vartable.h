@@ -0,0 +1,58 @@
+/*!
+	Variable Table.
+	hashed lookup of the variables of a quake3 SVarGroup
+
+	SVarGroup::get builds a temporary SVariable for every lookup and
+	searches with strcmp. SVarGroup lives in the irrlicht headers and is
+	filled by the dll, so it stays as it is. A CVarTable is built over a
+	group once: the variable names are interned into the global symbol
+	pool and indexed by symbol id in an open addressing table. The
+	SVarGroup functions are kept as wrappers taking a name.
+
+	The symbol pool is not locked, use it from the main thread.
+*/
+#ifndef __QUAKE3_VARTABLE__H_INCLUDED__
+#define __QUAKE3_VARTABLE__H_INCLUDED__
+
+#include <irrlicht.h>
+#include "intern.h"
+#include "profile.h"
+
+using namespace irr;
+
+//! the global symbol pool for shader and entity variable names
+CStringPool & getSymbols ();
+
+//! symbol id of a name, interned on first use
+inline u32 symbol ( const c8 *name ) { return getSymbols ().intern ( name ); }
+
+class CVarTable
+{
+public:
+	CVarTable () : Group ( 0 ) {}
+	explicit CVarTable ( const scene::quake3::SVarGroup *group ) : Group ( 0 ) { build ( group ); }
+
+	void build ( const scene::quake3::SVarGroup *group );
+
+	//! content of the first variable with this symbol, empty string if not defined
+	const core::stringc & get ( u32 symbol ) const;
+
+	//! like SVarGroup::isDefined. index + 1 of the first variable with symbol containing content, 0 if none
+	u32 isDefined ( u32 symbol, const c8 *content = 0 ) const;
+
+	//! wrappers with the SVarGroup signature. names never interned are not defined
+	const core::stringc & get ( const c8 *name ) const;
+	u32 isDefined ( const c8 *name, const c8 *content = 0 ) const;
+
+	const scene::quake3::SVarGroup * getGroup () const { return Group; }
+
+private:
+	s32 first ( u32 symbol ) const;
+
+	const scene::quake3::SVarGroup *Group;
+	core::array < u32, CCountingAllocator < u32 > > Symbol;	// per variable
+	core::array < s32, CCountingAllocator < s32 > > Next;		// per variable, next one with the same symbol or -1
+	core::array < u32, CCountingAllocator < u32 > > Slot;		// open addressing, variable + 1, 0 = empty
+};
+
+#endif // __QUAKE3_VARTABLE__H_INCLUDED__
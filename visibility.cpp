@@ -0,0 +1,357 @@
+/*!
+	Visibility.
+	bsp leafs, cluster pvs and area portals of a quake3 map
+*/
+
+#include "visibility.h"
+#include "q3bsp.h"
+
+#include <string.h>
+#include <math.h>
+
+using namespace core;
+
+static const f32 PORTAL_EPSILON = 1.f;		// an areaportal brush touches the leafs on both sides
+
+CQ3Visibility::CQ3Visibility ()
+: ClusterCount ( 0 ), ClusterBytes ( 0 ), AreaCount ( 0 ), VisibleLeafs ( 0 ),
+	CameraCluster ( -1 ), CameraArea ( -1 ), Dirty ( true )
+{
+}
+
+void CQ3Visibility::clear ()
+{
+	Node.clear ();
+	Leaf.clear ();
+	LeafSurface.clear ();
+	Vis.clear ();
+	Portal.clear ();
+	AreaVisible.clear ();
+	LeafVisible.clear ();
+	SurfaceVisible.clear ();
+	SurfaceInLeaf.clear ();
+	ClusterCount = 0;
+	ClusterBytes = 0;
+	AreaCount = 0;
+	VisibleLeafs = 0;
+	CameraCluster = -1;
+	CameraArea = -1;
+	Dirty = true;
+}
+
+bool CQ3Visibility::build ( const CQ3Bsp &bsp )
+{
+	clear ();
+
+	u32 planeCount, nodeCount, leafCount, leafSurfaceCount, surfaceCount, visSize;
+	const SQ3BspPlane *plane = bsp.getLump < SQ3BspPlane > ( BSP_PLANES, planeCount );
+	const SQ3BspNode *node = bsp.getLump < SQ3BspNode > ( BSP_NODES, nodeCount );
+	const SQ3BspLeaf *leaf = bsp.getLump < SQ3BspLeaf > ( BSP_LEAFS, leafCount );
+	const s32 *leafSurface = bsp.getLump < s32 > ( BSP_LEAFSURFACES, leafSurfaceCount );
+	bsp.getLump < SQ3BspSurface > ( BSP_SURFACES, surfaceCount );
+	const u8 *vis = bsp.getLump < u8 > ( BSP_VISIBILITY, visSize );
+
+	if ( 0 == nodeCount || 0 == leafCount )
+		return false;
+
+	// the tree, every reference checked once here so the walks need no tests
+	Node.reallocate ( nodeCount );
+	for ( u32 i = 0; i != nodeCount; ++i )
+	{
+		const SQ3BspNode &n = node[i];
+		if ( n.plane < 0 || (u32) n.plane >= planeCount )
+		{
+			clear ();
+			return false;
+		}
+
+		SNode s;
+		s.Plane = plane3df ( q3ToIrr ( plane[n.plane].normal ), -plane[n.plane].dist );
+		for ( u32 k = 0; k != 2; ++k )
+		{
+			const s32 c = n.children[k];
+			if ( c >= 0 ? (u32) c >= nodeCount || (u32) c <= i : (u32) ( -c - 1 ) >= leafCount )
+			{
+				clear ();
+				return false;
+			}
+			s.Child[k] = c;
+		}
+		Node.push_back ( s );
+	}
+
+	LeafSurface.reallocate ( leafSurfaceCount );
+	for ( u32 i = 0; i != leafSurfaceCount; ++i )
+		LeafSurface.push_back ( leafSurface[i] >= 0 && (u32) leafSurface[i] < surfaceCount ? leafSurface[i] : 0 );
+
+	SurfaceInLeaf.set_used ( surfaceCount );
+	if ( surfaceCount )
+		memset ( SurfaceInLeaf.pointer (), 0, surfaceCount );
+
+	Leaf.reallocate ( leafCount );
+	for ( u32 i = 0; i != leafCount; ++i )
+	{
+		const SQ3BspLeaf &l = leaf[i];
+
+		SLeaf s;
+		s.Cluster = l.cluster;
+		s.Area = l.area;
+		s.FirstSurface = 0;
+		s.SurfaceCount = 0;
+		if ( l.firstLeafSurface >= 0 && l.numLeafSurfaces > 0 &&
+			(u32) ( l.firstLeafSurface + l.numLeafSurfaces ) <= leafSurfaceCount )
+		{
+			s.FirstSurface = l.firstLeafSurface;
+			s.SurfaceCount = l.numLeafSurfaces;
+		}
+
+		for ( u32 k = 0; k != s.SurfaceCount; ++k )
+		{
+			const s32 f = leafSurface[s.FirstSurface + k];
+			if ( f >= 0 && (u32) f < surfaceCount )
+				SurfaceInLeaf[f] = 1;
+		}
+
+		if ( s.Area >= 0 )
+			AreaCount = core::max_ ( AreaCount, (u32) s.Area + 1 );
+
+		Leaf.push_back ( s );
+	}
+
+	// pvs rows. a map compiled without vis sees every cluster
+	if ( visSize >= sizeof ( SQ3BspVisibility ) )
+	{
+		const SQ3BspVisibility *header = (const SQ3BspVisibility*) vis;
+		const u32 rows = header->numClusters > 0 ? header->numClusters : 0;
+		const u32 bytes = header->bytesPerCluster > 0 ? header->bytesPerCluster : 0;
+		if ( rows && bytes && bytes * 8 >= rows && rows * bytes <= visSize - sizeof ( SQ3BspVisibility ) )
+		{
+			ClusterCount = rows;
+			ClusterBytes = bytes;
+			Vis.set_used ( rows * bytes );
+			memcpy ( Vis.pointer (), vis + sizeof ( SQ3BspVisibility ), rows * bytes );
+		}
+	}
+
+	if ( 0 == ClusterCount )
+	{
+		for ( u32 i = 0; i != Leaf.size (); ++i )
+			ClusterCount = core::max_ ( ClusterCount, (u32) ( Leaf[i].Cluster + 1 ) );
+	}
+
+	// area portals, the two areas an areaportal brush lies between. q3map writes the 6 axial sides first
+	u32 shaderCount, brushCount, sideCount;
+	const SQ3BspShader *shader = bsp.getLump < SQ3BspShader > ( BSP_SHADERS, shaderCount );
+	const SQ3BspBrush *brush = bsp.getLump < SQ3BspBrush > ( BSP_BRUSHES, brushCount );
+	const SQ3BspBrushSide *side = bsp.getLump < SQ3BspBrushSide > ( BSP_BRUSHSIDES, sideCount );
+
+	array < u32 > touched;
+	for ( u32 i = 0; i != brushCount; ++i )
+	{
+		const SQ3BspBrush &b = brush[i];
+		if ( b.shader < 0 || (u32) b.shader >= shaderCount || 0 == ( shader[b.shader].contentFlags & BSP_CONTENTS_AREAPORTAL ) )
+			continue;
+		if ( b.firstSide < 0 || b.numSides < 6 || (u32) ( b.firstSide + b.numSides ) > sideCount )
+			continue;
+
+		const SQ3BspBrushSide *s = side + b.firstSide;
+		bool axial = true;
+		for ( s32 k = 0; axial && k != 6; ++k )
+			axial = s[k].plane >= 0 && (u32) s[k].plane < planeCount;
+		if ( !axial )
+			continue;
+
+		const f32 mins[3] = { -plane[s[0].plane].dist, -plane[s[2].plane].dist, -plane[s[4].plane].dist };
+		const f32 maxs[3] = { plane[s[1].plane].dist, plane[s[3].plane].dist, plane[s[5].plane].dist };
+		aabbox3df box ( q3ToIrr ( mins ), q3ToIrr ( maxs ) );
+		box.repair ();
+		box.MinEdge -= vector3df ( PORTAL_EPSILON );
+		box.MaxEdge += vector3df ( PORTAL_EPSILON );
+
+		touched.set_used ( 0 );
+		findLeafs ( box, touched );
+
+		SPortal p;
+		p.Area[0] = -1;
+		p.Area[1] = -1;
+		p.Open = true;
+		bool valid = true;
+		for ( u32 k = 0; valid && k != touched.size (); ++k )
+		{
+			const s32 area = Leaf[touched[k]].Area;
+			if ( area < 0 || area == p.Area[0] || area == p.Area[1] )
+				continue;
+			if ( p.Area[0] < 0 )
+				p.Area[0] = area;
+			else if ( p.Area[1] < 0 )
+				p.Area[1] = area;
+			else
+				valid = false;
+		}
+
+		if ( valid && p.Area[1] >= 0 )
+			Portal.push_back ( p );
+	}
+
+	// everything visible until the first update
+	AreaVisible.set_used ( AreaCount );
+	LeafVisible.set_used ( Leaf.size () );
+	SurfaceVisible.set_used ( surfaceCount );
+	if ( AreaCount )
+		memset ( AreaVisible.pointer (), 1, AreaCount );
+	memset ( LeafVisible.pointer (), 1, Leaf.size () );
+	if ( surfaceCount )
+		memset ( SurfaceVisible.pointer (), 1, surfaceCount );
+	VisibleLeafs = Leaf.size ();
+	return true;
+}
+
+s32 CQ3Visibility::findLeaf ( const vector3df &point ) const
+{
+	if ( Node.empty () )
+		return -1;
+
+	s32 n = 0;
+	while ( n >= 0 )
+	{
+		const SNode &node = Node[n];
+		n = node.Child [ node.Plane.getDistanceTo ( point ) >= 0.f ? 0 : 1 ];
+	}
+	return -n - 1;
+}
+
+void CQ3Visibility::findLeafs ( const aabbox3df &box, array < u32 > &leafs ) const
+{
+	if ( Node.empty () )
+		return;
+
+	findLeafs ( 0, box.getCenter (), box.getExtent () * 0.5f, leafs );
+}
+
+void CQ3Visibility::findLeafs ( s32 n, const vector3df &center, const vector3df &extent, array < u32 > &leafs ) const
+{
+	while ( n >= 0 )
+	{
+		const SNode &node = Node[n];
+		const vector3df &normal = node.Plane.Normal;
+		const f32 radius = fabsf ( normal.X ) * extent.X + fabsf ( normal.Y ) * extent.Y + fabsf ( normal.Z ) * extent.Z;
+		const f32 d = node.Plane.getDistanceTo ( center );
+
+		if ( d > radius )
+			n = node.Child[0];
+		else if ( d < -radius )
+			n = node.Child[1];
+		else
+		{
+			// both sides, the front by recursion
+			findLeafs ( node.Child[0], center, extent, leafs );
+			n = node.Child[1];
+		}
+	}
+
+	leafs.push_back ( -n - 1 );
+}
+
+void CQ3Visibility::setPortalOpen ( u32 portal, bool open )
+{
+	if ( portal < Portal.size () && Portal[portal].Open != open )
+	{
+		Portal[portal].Open = open;
+		Dirty = true;
+	}
+}
+
+/*
+	areas reachable from the camera area through open portals
+*/
+void CQ3Visibility::floodAreas ()
+{
+	const u8 all = CameraArea < 0 || Portal.empty () ? 1 : 0;
+	if ( AreaCount )
+		memset ( AreaVisible.pointer (), all, AreaCount );
+	if ( all )
+		return;
+
+	array < s32 > open;
+	AreaVisible[CameraArea] = 1;
+	open.push_back ( CameraArea );
+	while ( !open.empty () )
+	{
+		const s32 area = open.getLast ();
+		open.erase ( open.size () - 1 );
+
+		for ( u32 i = 0; i != Portal.size (); ++i )
+		{
+			const SPortal &p = Portal[i];
+			if ( !p.Open || ( p.Area[0] != area && p.Area[1] != area ) )
+				continue;
+
+			const s32 other = p.Area[0] == area ? p.Area[1] : p.Area[0];
+			if ( 0 == AreaVisible[other] )
+			{
+				AreaVisible[other] = 1;
+				open.push_back ( other );
+			}
+		}
+	}
+}
+
+bool CQ3Visibility::update ( const vector3df &eye )
+{
+	if ( Leaf.empty () )
+		return false;
+
+	const s32 leaf = findLeaf ( eye );
+	const s32 cluster = leaf >= 0 ? Leaf[leaf].Cluster : -1;
+	const s32 area = leaf >= 0 && Leaf[leaf].Area >= 0 && (u32) Leaf[leaf].Area < AreaCount ? Leaf[leaf].Area : -1;
+
+	// the visible set belongs to the cluster, moving inside it changes nothing
+	if ( !Dirty && cluster == CameraCluster && area == CameraArea )
+		return false;
+
+	CameraCluster = cluster;
+	CameraArea = area;
+	Dirty = false;
+
+	floodAreas ();
+
+	// outside the map, in a solid or without a pvs row everything is drawn
+	const u8 *row = 0;
+	const bool all = cluster < 0;
+	if ( !all && ClusterBytes && (u32) cluster < Vis.size () / ClusterBytes )
+		row = Vis.const_pointer () + cluster * ClusterBytes;
+
+	VisibleLeafs = 0;
+	for ( u32 i = 0; i != Leaf.size (); ++i )
+	{
+		const SLeaf &l = Leaf[i];
+		u8 visible = 1;
+		if ( !all )
+		{
+			if ( l.Cluster < 0 )
+				visible = 0;
+			else if ( row && ( (u32) l.Cluster >= ClusterBytes * 8 || 0 == ( row[l.Cluster >> 3] & ( 1 << ( l.Cluster & 7 ) ) ) ) )
+				visible = 0;
+			else if ( l.Area >= 0 && (u32) l.Area < AreaCount && 0 == AreaVisible[l.Area] )
+				visible = 0;
+		}
+
+		LeafVisible[i] = visible;
+		VisibleLeafs += visible;
+	}
+
+	for ( u32 i = 0; i != SurfaceVisible.size (); ++i )
+		SurfaceVisible[i] = SurfaceInLeaf[i] ? 0 : 1;
+
+	for ( u32 i = 0; i != Leaf.size (); ++i )
+	{
+		if ( 0 == LeafVisible[i] )
+			continue;
+
+		const SLeaf &l = Leaf[i];
+		for ( u32 k = 0; k != l.SurfaceCount; ++k )
+			SurfaceVisible [ LeafSurface[l.FirstSurface + k] ] = 1;
+	}
+
+	return true;
+}
@@ -0,0 +1,102 @@
+/*!
+	Visibility.
+	bsp leafs, cluster pvs and area portals of a quake3 map
+
+	The camera point is pushed down the bsp tree to its leaf. The leafs
+	whose cluster is set in the pvs row of the camera cluster and whose
+	area is connected to the camera area through open portals are
+	visible, and with them the surfaces they list. An area portal is an
+	areaportal brush between two areas, quake3 opens and closes it with
+	the door around it. All portals start open, so nothing a door could
+	reveal is ever culled.
+*/
+#ifndef __QUAKE3_VISIBILITY__H_INCLUDED__
+#define __QUAKE3_VISIBILITY__H_INCLUDED__
+
+#include <irrlicht.h>
+
+using namespace irr;
+
+class CQ3Bsp;
+
+class CQ3Visibility
+{
+public:
+	CQ3Visibility ();
+
+	//! false if the bsp has no tree, then everything is visible
+	bool build ( const CQ3Bsp &bsp );
+	void clear ();
+
+	bool isValid () const { return !Leaf.empty (); }
+
+	//! leaf of a point in irrlicht space, -1 without a tree
+	s32 findLeaf ( const core::vector3df &point ) const;
+
+	//! leafs touched by a box in irrlicht space
+	void findLeafs ( const core::aabbox3df &box, core::array < u32 > &leafs ) const;
+
+	//! camera moved. true if the visible set changed
+	bool update ( const core::vector3df &eye );
+
+	bool isLeafVisible ( u32 leaf ) const { return LeafVisible[leaf] != 0; }
+
+	//! surfaces of no leaf ( brush models ) are always visible
+	bool isSurfaceVisible ( u32 surface ) const { return SurfaceVisible[surface] != 0; }
+
+	u32 getLeafCount () const { return Leaf.size (); }
+	u32 getSurfaceCount () const { return SurfaceVisible.size (); }
+	u32 getClusterCount () const { return ClusterCount; }
+	u32 getVisibleLeafCount () const { return VisibleLeafs; }
+
+	//! cluster of the camera leaf, -1 in the void or solid
+	s32 getCameraCluster () const { return CameraCluster; }
+
+	u32 getPortalCount () const { return Portal.size (); }
+	void setPortalOpen ( u32 portal, bool open );
+
+private:
+	struct SNode
+	{
+		core::plane3df Plane;
+		s32 Child[2];		// negative = -( leaf + 1 )
+	};
+
+	struct SLeaf
+	{
+		s32 Cluster;
+		s32 Area;
+		u32 FirstSurface;
+		u32 SurfaceCount;
+	};
+
+	struct SPortal
+	{
+		s32 Area[2];
+		bool Open;
+	};
+
+	void findLeafs ( s32 node, const core::vector3df &center, const core::vector3df &extent,
+					core::array < u32 > &leafs ) const;
+	void floodAreas ();
+
+	core::array < SNode > Node;
+	core::array < SLeaf > Leaf;
+	core::array < u32 > LeafSurface;
+	core::array < u8 > Vis;			// cluster rows of ClusterBytes, empty sees all
+	u32 ClusterCount;
+	u32 ClusterBytes;
+	u32 AreaCount;
+	core::array < SPortal > Portal;
+
+	core::array < u8 > AreaVisible;
+	core::array < u8 > LeafVisible;
+	core::array < u8 > SurfaceVisible;
+	core::array < u8 > SurfaceInLeaf;
+	u32 VisibleLeafs;
+	s32 CameraCluster;
+	s32 CameraArea;
+	bool Dirty;
+};
+
+#endif // __QUAKE3_VISIBILITY__H_INCLUDED__
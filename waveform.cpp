@@ -0,0 +1,152 @@
+/*!
+	Waveform.
+	batch evaluation of quake3 wave functions ( sin, square, triangle.. )
+*/
+
+#include "waveform.h"
+#include "random.h"
+
+#if defined(_M_IX86) || defined(_M_X64) || defined(__SSE2__)
+#define WAVEFORM_SSE2
+#include <emmintrin.h>
+#endif
+
+using namespace core;
+using namespace scene;
+using namespace quake3;
+
+/*
+	sin ( 2 pi x ) for x in [0,1).
+	y = x - 0.5 gives sin ( 2 pi x ) = -sin ( 2 pi y ) with y in [-0.5,0.5),
+	|y| > 0.25 is folded back into [-0.25,0.25] where an odd
+	polynomial of degree 9 is accurate to about 1e-6
+*/
+static const f32 S1 = 6.28318531f;
+static const f32 S3 = -41.3417022f;
+static const f32 S5 = 81.6052492f;
+static const f32 S7 = -76.7058597f;
+static const f32 S9 = 42.0586940f;
+
+f32 waveSin ( f32 x )
+{
+	f32 y = x - 0.5f;
+	const f32 a = fabsf ( y );
+	const f32 s = y < 0.f ? -0.5f : 0.5f;
+	if ( a > 0.25f )
+		y = s - y;
+
+	const f32 y2 = y * y;
+	return -y * ( S1 + y2 * ( S3 + y2 * ( S5 + y2 * ( S7 + y2 * S9 ) ) ) );
+}
+
+// scalar kernel, x in [0,1)
+static inline f32 wave ( eQ3ModifierFunction func, f32 x )
+{
+	switch ( func )
+	{
+		case SINUS:				return waveSin ( x );
+		case COSINUS:			return waveSin ( core::fract ( x + 0.25f ) );
+		case SQUARE:			return 1.f - 2.f * (f32) ( x >= 0.5f );
+		case TRIANGLE:			return 1.f - 4.f * fabsf ( x - 0.5f );
+		case SAWTOOTH:			return x;
+		case SAWTOOTH_INVERSE:	return 1.f - x;
+		default:				return 0.f;
+	}
+}
+
+#ifdef WAVEFORM_SSE2
+
+static inline __m128 floor4 ( __m128 v )
+{
+	// truncate, then step down where truncation rounded up ( negative values )
+	const __m128 t = _mm_cvtepi32_ps ( _mm_cvttps_epi32 ( v ) );
+	return _mm_sub_ps ( t, _mm_and_ps ( _mm_cmpgt_ps ( t, v ), _mm_set1_ps ( 1.f ) ) );
+}
+
+static inline __m128 sin4 ( __m128 x )
+{
+	const __m128 half = _mm_set1_ps ( 0.5f );
+	const __m128 signMask = _mm_set1_ps ( -0.f );
+
+	__m128 y = _mm_sub_ps ( x, half );
+	const __m128 a = _mm_andnot_ps ( signMask, y );
+	const __m128 s = _mm_or_ps ( _mm_and_ps ( y, signMask ), half );
+	const __m128 fold = _mm_cmpgt_ps ( a, _mm_set1_ps ( 0.25f ) );
+	y = _mm_or_ps ( _mm_and_ps ( fold, _mm_sub_ps ( s, y ) ), _mm_andnot_ps ( fold, y ) );
+
+	const __m128 y2 = _mm_mul_ps ( y, y );
+	__m128 p = _mm_add_ps ( _mm_set1_ps ( S7 ), _mm_mul_ps ( y2, _mm_set1_ps ( S9 ) ) );
+	p = _mm_add_ps ( _mm_set1_ps ( S5 ), _mm_mul_ps ( y2, p ) );
+	p = _mm_add_ps ( _mm_set1_ps ( S3 ), _mm_mul_ps ( y2, p ) );
+	p = _mm_add_ps ( _mm_set1_ps ( S1 ), _mm_mul_ps ( y2, p ) );
+	return _mm_xor_ps ( _mm_mul_ps ( y, p ), signMask );
+}
+
+static inline __m128 wave4 ( eQ3ModifierFunction func, __m128 x )
+{
+	const __m128 one = _mm_set1_ps ( 1.f );
+	switch ( func )
+	{
+		case SINUS:
+			return sin4 ( x );
+		case COSINUS:
+		{
+			const __m128 c = _mm_add_ps ( x, _mm_set1_ps ( 0.25f ) );
+			return sin4 ( _mm_sub_ps ( c, floor4 ( c ) ) );
+		}
+		case SQUARE:
+			return _mm_sub_ps ( one, _mm_and_ps ( _mm_cmpge_ps ( x, _mm_set1_ps ( 0.5f ) ), _mm_set1_ps ( 2.f ) ) );
+		case TRIANGLE:
+		{
+			const __m128 d = _mm_andnot_ps ( _mm_set1_ps ( -0.f ), _mm_sub_ps ( x, _mm_set1_ps ( 0.5f ) ) );
+			return _mm_sub_ps ( one, _mm_mul_ps ( d, _mm_set1_ps ( 4.f ) ) );
+		}
+		case SAWTOOTH:
+			return x;
+		case SAWTOOTH_INVERSE:
+			return _mm_sub_ps ( one, x );
+		default:
+			return _mm_setzero_ps ();
+	}
+}
+
+#endif
+
+void evaluateWaveform ( const SModifierFunction &f, f32 dt, const f32 *offset, f32 *out, u32 count )
+{
+	const f32 start = dt + f.phase;
+	u32 i = 0;
+
+	if ( f.func == NOISE )
+	{
+		// a hash of the time instead of the serial Noiser, safe on any thread
+		CRandom noise ( getRandomSeed (), RANDOM_SHADER );
+		noise.setCounter ( IR ( start ) );
+		noise.fill ( out, count, f.base - f.amp, f.base + f.amp );
+		return;
+	}
+
+#ifdef WAVEFORM_SSE2
+	{
+		const __m128 t = _mm_set1_ps ( start );
+		const __m128 frequency = _mm_set1_ps ( f.frequency );
+		const __m128 base = _mm_set1_ps ( f.base );
+		const __m128 amp = _mm_set1_ps ( f.amp );
+
+		for ( ; i + 4 <= count; i += 4 )
+		{
+			__m128 x = offset ? _mm_add_ps ( t, _mm_loadu_ps ( offset + i ) ) : t;
+			x = _mm_mul_ps ( x, frequency );
+			x = _mm_sub_ps ( x, floor4 ( x ) );
+
+			_mm_storeu_ps ( out + i, _mm_add_ps ( base, _mm_mul_ps ( wave4 ( f.func, x ), amp ) ) );
+		}
+	}
+#endif
+
+	for ( ; i != count; ++i )
+	{
+		const f32 x = core::fract ( ( start + ( offset ? offset[i] : 0.f ) ) * f.frequency );
+		out[i] = f.base + wave ( f.func, x ) * f.amp;
+	}
+}
@@ -0,0 +1,27 @@
+/*!
+	Waveform.
+	batch evaluation of quake3 wave functions ( sin, square, triangle.. )
+
+	Same result as SModifierFunction::evaluate for a whole array at once.
+	sin and cos use a polynomial instead of the crt, square, triangle and
+	sawtooth are computed without branches. With SSE2 four values are
+	evaluated per step, the scalar path uses the same kernels.
+*/
+#ifndef __QUAKE3_WAVEFORM__H_INCLUDED__
+#define __QUAKE3_WAVEFORM__H_INCLUDED__
+
+#include <irrlicht.h>
+
+using namespace irr;
+
+/*!
+	out[i] = f.evaluate ( dt + offset[i] ).
+	offset may be 0, it is the per vertex phase of deformVertexes wave
+*/
+void evaluateWaveform ( const scene::quake3::SModifierFunction &f, f32 dt,
+						const f32 *offset, f32 *out, u32 count );
+
+//! sin ( 2 pi x ) with the polynomial of the batch path, for tests
+f32 waveSin ( f32 x );
+
+#endif // __QUAKE3_WAVEFORM__H_INCLUDED__
@@ -0,0 +1,48 @@
+/*!
+	Worker Pool.
+	runs loader jobs ( image decode, cache io ) off the main thread
+*/
+
+#include "worker.h"
+
+CWorkerPool::CWorkerPool ( CJobSystem *jobs )
+: Jobs ( jobs )
+{
+}
+
+CWorkerPool::~CWorkerPool ()
+{
+	wait ();
+}
+
+void CWorkerPool::push ( const tWorkJob &job )
+{
+	Jobs->spawn ( job, &Pending );
+}
+
+void CWorkerPool::wait ()
+{
+	Jobs->wait ( Pending );
+}
+
+u32 CWorkerPool::getThreadCount () const
+{
+	return Jobs->getThreadCount ();
+}
+
+
+static CWorkerPool *Pool = 0;
+
+CWorkerPool * getWorkerPool ()
+{
+	if ( 0 == Pool )
+		Pool = new CWorkerPool ( getJobSystem () );
+	return Pool;
+}
+
+void worker_shutdown ()
+{
+	delete Pool;
+	Pool = 0;
+	jobs_shutdown ();
+}
@@ -0,0 +1,49 @@
+/*!
+	Worker Pool.
+	runs loader jobs ( image decode, cache io ) off the main thread
+
+	Irrlicht itself is not thread safe. Jobs must only touch data
+	that was handed to them and must never call the video driver,
+	the scene manager or the file system.
+
+	The pool is a queue of fire and forget jobs on the job system,
+	wait () covers every job pushed through it.
+*/
+#ifndef __QUAKE3_WORKER__H_INCLUDED__
+#define __QUAKE3_WORKER__H_INCLUDED__
+
+#include <irrlicht.h>
+#include "jobs.h"
+
+using namespace irr;
+
+typedef tJob tWorkJob;
+
+class CWorkerPool
+{
+public:
+	CWorkerPool ( CJobSystem *jobs );
+	~CWorkerPool ();
+
+	//! queue a job, runs on any worker
+	void push ( const tWorkJob &job );
+
+	//! blocks until all queued jobs are done, runs some of them meanwhile
+	void wait ();
+
+	u32 getThreadCount () const;
+
+	CJobSystem * getJobSystem () const { return Jobs; }
+
+private:
+	CJobSystem *Jobs;
+	SJobCounter Pending;
+};
+
+//! the pool shared by the game, created on first use
+CWorkerPool * getWorkerPool ();
+
+//! finish all jobs and join the threads
+void worker_shutdown ();
+
+#endif // __QUAKE3_WORKER__H_INCLUDED__